@@ -22,9 +22,9 @@
 
 #include "average.hxx"
 
+#include <cassert>
 #include <cmath>
-
-namespace ba = boost::accumulators;
+#include <limits>
 
 cdownload::AveragingRegister::AveragingRegister()
 {
@@ -33,7 +33,9 @@ cdownload::AveragingRegister::AveragingRegister()
 
 void cdownload::AveragingRegister::reset()
 {
-	acc_ = acc_type();
+	count_ = 0;
+	mean_ = 0;
+	m2_ = 0;
 	resetFlag_ = false;
 }
 
@@ -42,22 +44,41 @@ void cdownload::AveragingRegister::add(double value)
 	if (resetFlag_) {
 		reset(); // will reset the flag too
 	}
-	acc_(value);
+	++count_;
+	const double delta = value - mean_;
+	mean_ += delta / static_cast<double>(count_);
+	m2_ += delta * (value - mean_);
+}
+
+void cdownload::AveragingRegister::merge(const cdownload::AveragingRegister& other)
+{
+	if (other.resetFlag_ || other.count_ == 0) {
+		return;
+	}
+	if (resetFlag_) {
+		reset();
+	}
+	const counter_type total = count_ + other.count_;
+	const double delta = other.mean_ - mean_;
+	const double otherWeight = static_cast<double>(other.count_) / static_cast<double>(total);
+	mean_ += delta * otherWeight;
+	m2_ += other.m2_ + delta * delta * static_cast<double>(count_) * otherWeight;
+	count_ = total;
 }
 
 cdownload::AveragingRegister::mean_value_type cdownload::AveragingRegister::mean() const
 {
-	return ba::extract::mean(acc_);
+	return count_ ? mean_ : std::numeric_limits<mean_value_type>::quiet_NaN();
 }
 
 cdownload::AveragingRegister::counter_type cdownload::AveragingRegister::count() const
 {
-	return ba::extract::count(acc_);
+	return count_;
 }
 
 cdownload::AveragingRegister::variance_value_type cdownload::AveragingRegister::variance() const
 {
-	return ba::extract::variance(acc_);
+	return count_ ? m2_ / static_cast<double>(count_) : 0.;
 }
 
 cdownload::AveragingRegister::stddev_value_type cdownload::AveragingRegister::stdDev() const
@@ -83,3 +104,39 @@ void cdownload::AveragedVariable::scheduleReset()
 		ar.scheduleReset();
 	}
 }
+
+void cdownload::AveragedVariable::merge(const cdownload::AveragedVariable& other)
+{
+	assert(other.size() == size());
+	for (std::size_t i = 0; i < components_.size(); ++i) {
+		components_[i].merge(other.components_[i]);
+	}
+}
+
+cdownload::AveragedCellsAccumulator::AveragedCellsAccumulator(const std::vector<AveragedVariable>& prototype)
+	: cells_{}
+	, time_{}
+{
+	cells_.reserve(prototype.size());
+	for (const AveragedVariable& av: prototype) {
+		cells_.emplace_back(av.size());
+	}
+}
+
+void cdownload::AveragedCellsAccumulator::add(const std::vector<AveragedVariable>& cells, double cellMidTime)
+{
+	assert(cells.size() == cells_.size());
+	for (std::size_t i = 0; i < cells.size(); ++i) {
+		cells_[i].merge(cells[i]);
+	}
+	time_.add(cellMidTime);
+}
+
+void cdownload::AveragedCellsAccumulator::merge(const cdownload::AveragedCellsAccumulator& other)
+{
+	assert(other.cells_.size() == cells_.size());
+	for (std::size_t i = 0; i < cells_.size(); ++i) {
+		cells_[i].merge(other.cells_[i]);
+	}
+	time_.merge(other.time_);
+}
@@ -26,12 +26,6 @@
 #include <cstddef>
 #include <vector>
 
-#include <boost/accumulators/accumulators.hpp>
-
-#include <boost/accumulators/statistics/count.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <boost/accumulators/statistics/variance.hpp>
-
 namespace cdownload {
 
 	/**
@@ -56,14 +50,21 @@ namespace cdownload {
 		variance_value_type variance() const;
 		stddev_value_type stdDev() const;
 		void scheduleReset();
+
+		/**
+		 * @brief Adds all values accumulated by another register
+		 *
+		 * The result is the same as if the values were added to this register one by one.
+		 * A register with scheduled reset is considered empty.
+		 */
+		void merge(const AveragingRegister& other);
 	private:
+		// running mean and sum of squared deviations (Welford's algorithm), which allows
+		// to combine partial results
 		bool resetFlag_;
-		using acc_type = boost::accumulators::accumulator_set<double,
-			boost::accumulators::features<
-				boost::accumulators::tag::mean,
-				boost::accumulators::tag::variance,
-				boost::accumulators::tag::count>>;
-		acc_type acc_;
+		counter_type count_;
+		mean_value_type mean_;
+		double m2_;
 	};
 
 	/**
@@ -108,9 +109,38 @@ namespace cdownload {
 
 		void reset();
 		void scheduleReset();
+		void merge(const AveragedVariable& other);
 	private:
 		std::vector<AveragingRegister> components_;
 	};
+
+	/**
+	 * @brief Sums up whole averaged cells, e.g. all cells which fall into the same bin
+	 *
+	 */
+	class AveragedCellsAccumulator {
+	public:
+		/**
+		 * @param prototype averaging cells of the data reader, defines the set of variables
+		 */
+		AveragedCellsAccumulator(const std::vector<AveragedVariable>& prototype);
+
+		void add(const std::vector<AveragedVariable>& cells, double cellMidTime);
+		void merge(const AveragedCellsAccumulator& other);
+
+		const std::vector<AveragedVariable>& cells() const {
+			return cells_;
+		}
+
+		//! Middle times of the added cells (CDF EPOCH)
+		const AveragingRegister& time() const {
+			return time_;
+		}
+
+	private:
+		std::vector<AveragedVariable> cells_;
+		AveragingRegister time_;
+	};
 }
 
 #endif // CDOWNLOAD_AVERAGE_HXX
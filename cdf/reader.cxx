@@ -25,6 +25,7 @@
 #include <cdf.h>
 
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <limits>
@@ -56,6 +57,9 @@ cdownload::CDF::File::Impl::~Impl()
 }
 
 namespace {
+	// number of records read ahead for each variable by CDF::Reader
+	const std::size_t RECORDS_BLOCK_SIZE = 1024;
+
 	void CDFStatusHandler(CDFstatus status)
 	{
 		char message[CDF_STATUSTEXT_LEN + 1];
@@ -380,14 +384,18 @@ std::size_t cdownload::CDF::Variable::read(void* dest, std::size_t startIndex, s
 		return 0;
 	}
 	const std::size_t recordsToRead = maxRecordIndex - startIndex + 1;
-	const std::size_t dataStride = this->recordSize();
 #ifdef TRACING_READING
 	BOOST_LOG_TRIVIAL(trace) << "Reading " << name() << "[" << startIndex << ':' << startIndex + recordsToRead << ']';
 #endif
 	assert(startIndex <= startIndex + recordsToRead);
-	for (std::size_t i = 0; i < recordsToRead; ++i) {
-		checkCDFStatus(CDFgetzVarRecordData(file_->cdfId(), static_cast<long>(index_), static_cast<long>(startIndex + i),
-		                                    static_cast<char*>(dest) + i * dataStride));
+	if (recordsToRead == 1) {
+		checkCDFStatus(CDFgetzVarRecordData(file_->cdfId(), static_cast<long>(index_), static_cast<long>(startIndex),
+		                                    dest));
+	} else {
+		// the whole range in a single library call, records are placed contiguously
+		checkCDFStatus(CDFgetzVarRangeRecordsByVarID(file_->cdfId(), static_cast<long>(index_),
+		                                             static_cast<long>(startIndex), static_cast<long>(maxRecordIndex),
+		                                             dest));
 	}
 #endif
 	return recordsToRead;
@@ -572,10 +580,33 @@ cdownload::CDF::Reader::Reader(const cdownload::CDF::File& f, Info&& info, std::
 	: base(variables, [&](const ProductName& name) -> FoundField {return {info.variable(name.name()), static_cast<std::size_t>(-1)};},
 			 [&](std::size_t i, const ProductName& name, const FoundField&){vars[i] = &f.variable(name.name());}, info.timestampVariableName())
 	, variables_(vars)
+	, blocks_(vars.size())
 	, file_{f}
 	, info_{file_}
 	, eof_{false}
 {
+	for (std::size_t i = 0; i < variables_.size(); ++i) {
+		RecordsBlock& block = blocks_[i];
+		block.recordSize = variables_[i]->recordSize();
+		block.data.reset(new char[block.recordSize * RECORDS_BLOCK_SIZE]);
+		block.firstRecord = 0;
+		block.recordsCount = 0;
+	}
+}
+
+bool cdownload::CDF::Reader::readVariableRecord(std::size_t variableIndex, std::size_t recordIndex)
+{
+	RecordsBlock& block = blocks_[variableIndex];
+	if (recordIndex < block.firstRecord || recordIndex >= block.firstRecord + block.recordsCount) {
+		block.firstRecord = recordIndex;
+		block.recordsCount = variables_[variableIndex]->read(block.data.get(), recordIndex, RECORDS_BLOCK_SIZE);
+		if (!block.recordsCount) {
+			return false;
+		}
+	}
+	std::memcpy(buffers_[variableIndex].get(),
+	            block.data.get() + (recordIndex - block.firstRecord) * block.recordSize, block.recordSize);
+	return true;
 }
 
 bool cdownload::CDF::Reader::readRecord(std::size_t index, bool omitTimeStamp)
@@ -585,8 +616,8 @@ bool cdownload::CDF::Reader::readRecord(std::size_t index, bool omitTimeStamp)
 	}
 	std::size_t read = 0;
 	for (std::size_t i = 0; i< variables_.size(); ++i) {
-		if (omitTimeStamp && (timeStampVariableIndex_ != i)) {
-			read += variables_[i]->read(buffers_[i].get(), index, 1);
+		if (!omitTimeStamp || (timeStampVariableIndex_ != i)) {
+			read += readVariableRecord(i, index) ? 1u : 0u;
 		}
 	}
 	if (!read) {
@@ -601,11 +632,23 @@ bool cdownload::CDF::Reader::readTimeStampRecord(std::size_t index)
 		return false;
 	}
 
-	const auto read = variables_[timeStampVariableIndex_]->read(buffers_[timeStampVariableIndex_].get(), index, 1);
+	const bool read = readVariableRecord(timeStampVariableIndex_, index);
 	if (!read) {
 		eof_ = true;
 	}
-	return read != 0;
+	return read;
+}
+
+std::size_t cdownload::CDF::Reader::bufferedRecordsEnd(std::size_t index) const
+{
+	std::size_t res = std::numeric_limits<std::size_t>::max();
+	for (const RecordsBlock& block: blocks_) {
+		if (index < block.firstRecord || index >= block.firstRecord + block.recordsCount) {
+			return index;
+		}
+		res = std::min(res, block.firstRecord + block.recordsCount);
+	}
+	return res;
 }
 
 bool cdownload::CDF::Reader::eof() const
@@ -639,19 +682,17 @@ std::size_t cdownload::CDF::Reader::findTimestamp(double timeStamp, std::size_t
 
 	private:
 		typedef ConstVariableView<double>::const_iterator Iter;
+		// the last record, which is not later than the timestamp, or the first one if all are later
 		Iter find(Iter begin, Iter end)
 		{
+			if (begin == end) {
+				return end;
+			}
 			auto iter = std::upper_bound(begin, end, timeStamp_);
-			if (iter == end) {
+			if (iter != begin) {
 				--iter;
-				if (*iter < timeStamp_) {
-					return iter;
-				} else {
-					return end;
-				}
-			} else {
-				return --iter;
 			}
+			return iter;
 		}
 
 		const Variable* var_;
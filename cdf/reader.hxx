@@ -164,9 +164,32 @@ namespace CDF {
 
 		std::size_t findTimestamp(double timeStamp, std::size_t startIndex) override;
 
+		/**
+		 * @brief End of the records, which follow the given one and are held in memory for every variable
+		 *
+		 * Reading records up to there costs no library calls. Returns index if the record itself is not in memory.
+		 */
+		std::size_t bufferedRecordsEnd(std::size_t index) const;
+
 	private:
+		/**
+		 * @brief A run of consecutive records of a single variable, read from the file at once
+		 *
+		 * Records are served from here into the per-variable buffers, so that sequential reading
+		 * costs one library call per block instead of one per record.
+		 */
+		struct RecordsBlock {
+			std::unique_ptr<char[]> data;
+			std::size_t recordSize;
+			std::size_t firstRecord;
+			std::size_t recordsCount;
+		};
+
 		Reader(const File& f, Info&& info, std::vector<const Variable*>&& vars, const std::vector<ProductName>& variables);
+		bool readVariableRecord(std::size_t variableIndex, std::size_t recordIndex);
+
 		std::vector<const Variable*> variables_;
+		std::vector<RecordsBlock> blocks_;
 		File file_;
 		Info info_;
 		bool eof_;
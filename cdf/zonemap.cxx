@@ -0,0 +1,312 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "./zonemap.hxx"
+
+#include "./reader.hxx"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "../floatcomparison.hxx"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <set>
+
+#include "config.h"
+
+constexpr const std::size_t cdownload::CDF::ZoneMap::RECORDS_PER_BLOCK;
+
+namespace {
+	const char ZONEMAP_MAGIC[] = "CDZM";
+	const std::uint32_t ZONEMAP_VERSION = 1;
+
+	template <class T>
+	void writeValue(std::ostream& os, const T& value)
+	{
+		os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <class T>
+	bool readValue(std::istream& is, T& value)
+	{
+		return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+	}
+
+	template <class T>
+	void writeArray(std::ostream& os, const std::vector<T>& values)
+	{
+		writeValue(os, static_cast<std::uint64_t>(values.size()));
+		os.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+	}
+
+	template <class T>
+	bool readArray(std::istream& is, std::vector<T>& values)
+	{
+		std::uint64_t size;
+		if (!readValue(is, size)) {
+			return false;
+		}
+		values.resize(static_cast<std::size_t>(size));
+		return static_cast<bool>(is.read(reinterpret_cast<char*>(values.data()),
+		                                 static_cast<std::streamsize>(values.size() * sizeof(T))));
+	}
+
+	template <class T>
+	double elementValue(const char* record, std::size_t element)
+	{
+		T value;
+		std::memcpy(&value, record + element * sizeof(T), sizeof(T));
+		return static_cast<double>(value);
+	}
+
+	//! Converts an element of the CDF record to double
+	double elementValue(cdownload::CDF::DataType dt, const char* record, std::size_t element)
+	{
+		using DT = cdownload::CDF::DataType;
+		switch (dt) {
+		case DT::INT1:
+		case DT::BYTE:
+		case DT::CHAR:
+			return elementValue<std::int8_t>(record, element);
+		case DT::INT2:
+			return elementValue<std::int16_t>(record, element);
+		case DT::INT4:
+			return elementValue<std::int32_t>(record, element);
+		case DT::INT8:
+		case DT::TIME_TT2000:
+			return elementValue<std::int64_t>(record, element);
+		case DT::UINT1:
+		case DT::UCHAR:
+			return elementValue<std::uint8_t>(record, element);
+		case DT::UINT2:
+			return elementValue<std::uint16_t>(record, element);
+		case DT::UINT4:
+			return elementValue<std::uint32_t>(record, element);
+		case DT::REAL4:
+		case DT::FLOAT:
+			return elementValue<float>(record, element);
+		case DT::REAL8:
+		case DT::DOUBLE:
+		case DT::EPOCH:
+			return elementValue<double>(record, element);
+		case DT::EPOCH16:
+			// only the first (seconds) part, as the readers do
+			return elementValue<double>(record, element * 2);
+		}
+		throw std::logic_error("Unexpected CDF data type");
+	}
+}
+
+cdownload::CDF::ZoneMap::ZoneMap(const path& fileName, const File& file, const std::vector<std::string>& variables,
+                                 const std::string& timestampVariable)
+	: cdfFileSize_{boost::filesystem::file_size(fileName)}
+	, cdfFileTime_{static_cast<std::int64_t>(boost::filesystem::last_write_time(fileName))}
+	, statsPerBlock_{0}
+{
+	const path mapFileName = zoneMapFileName(fileName);
+	std::set<std::string> requested(variables.begin(), variables.end());
+	if (load(mapFileName)) {
+		bool allPresent = true;
+		for (const std::string& v: requested) {
+			if (std::find(variableNames_.begin(), variableNames_.end(), v) == variableNames_.end()) {
+				allPresent = false;
+				break;
+			}
+		}
+		if (allPresent) {
+			return;
+		}
+		// keep what was stored before, other readers might need those variables
+		requested.insert(variableNames_.begin(), variableNames_.end());
+	}
+
+	BOOST_LOG_TRIVIAL(debug) << "Building zone map for " << fileName;
+	build(file, std::vector<std::string>(requested.begin(), requested.end()), timestampVariable);
+	try {
+		save(mapFileName);
+	} catch (std::exception& ex) {
+		BOOST_LOG_TRIVIAL(warning) << "Could not save zone map " << mapFileName << ": " << ex.what();
+	}
+}
+
+cdownload::path cdownload::CDF::ZoneMap::zoneMapFileName(const path& cdfFileName)
+{
+	return path(cdfFileName.string() + ".zonemap");
+}
+
+const cdownload::CDF::ZoneMap::ElementStats*
+cdownload::CDF::ZoneMap::variable(std::size_t block, const std::string& name) const
+{
+	const auto i = std::find(variableNames_.begin(), variableNames_.end(), name);
+	if (i == variableNames_.end()) {
+		return nullptr;
+	}
+	const std::size_t index = static_cast<std::size_t>(std::distance(variableNames_.begin(), i));
+	return &stats_[block * statsPerBlock_ + statsOffsets_[index]];
+}
+
+void cdownload::CDF::ZoneMap::build(const File& file, const std::vector<std::string>& variables,
+                                    const std::string& timestampVariable)
+{
+	variableNames_ = variables;
+	statsOffsets_.clear();
+	statsPerBlock_ = 0;
+	std::vector<const Variable*> vars;
+	for (const std::string& name: variableNames_) {
+		vars.push_back(&file.variable(name));
+		statsOffsets_.push_back(statsPerBlock_);
+		statsPerBlock_ += vars.back()->elementsCount();
+	}
+
+	const Variable& timestamp = file.variable(timestampVariable);
+	const std::size_t recordsCount = timestamp.recordsCount();
+	const std::size_t blocksCount = (recordsCount + RECORDS_PER_BLOCK - 1) / RECORDS_PER_BLOCK;
+	blocks_.assign(blocksCount, Block());
+	stats_.assign(blocksCount * statsPerBlock_, {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest(), 0, 0});
+
+	std::unique_ptr<char[]> buffer {new char[timestamp.recordSize() * RECORDS_PER_BLOCK]};
+	for (std::size_t b = 0; b < blocksCount; ++b) {
+		Block& block = blocks_[b];
+		block.firstRecord = b * RECORDS_PER_BLOCK;
+		block.recordsCount = timestamp.read(buffer.get(), b * RECORDS_PER_BLOCK, RECORDS_PER_BLOCK);
+		block.minEpoch = std::numeric_limits<double>::max();
+		block.maxEpoch = 0;
+		for (std::size_t r = 0; r < block.recordsCount; ++r) {
+			const double epoch = elementValue(timestamp.datatype(), buffer.get() + r * timestamp.recordSize(), 0);
+			if (epoch > 0) {
+				block.minEpoch = std::min(block.minEpoch, epoch);
+				block.maxEpoch = std::max(block.maxEpoch, epoch);
+			}
+		}
+		if (block.maxEpoch <= 0) {
+			block.minEpoch = 0;
+		}
+	}
+
+	for (std::size_t v = 0; v < vars.size(); ++v) {
+		const Variable& var = *vars[v];
+		const std::size_t recordSize = var.recordSize();
+		const std::size_t elementsCount = var.elementsCount();
+		const double fillValue = var.fillValue();
+		buffer.reset(new char[recordSize * RECORDS_PER_BLOCK]);
+		for (std::size_t b = 0; b < blocksCount; ++b) {
+			const std::size_t recordsRead = var.read(buffer.get(), b * RECORDS_PER_BLOCK, RECORDS_PER_BLOCK);
+			ElementStats* stats = &stats_[b * statsPerBlock_ + statsOffsets_[v]];
+			for (std::size_t r = 0; r < recordsRead; ++r) {
+				const char* record = buffer.get() + r * recordSize;
+				for (std::size_t e = 0; e < elementsCount; ++e) {
+					const double value = elementValue(var.datatype(), record, e);
+					ElementStats& s = stats[e];
+					if (std::isnan(value)) {
+						++s.nanCount;
+						continue;
+					}
+					if (gtest::areFloatsEqual(value, fillValue, 1)) {
+						++s.fillCount;
+					}
+					s.min = std::min(s.min, value);
+					s.max = std::max(s.max, value);
+				}
+			}
+		}
+	}
+}
+
+bool cdownload::CDF::ZoneMap::load(const path& fileName)
+{
+	std::ifstream input(fileName.c_str(), std::ios::binary);
+	if (!input) {
+		return false;
+	}
+	char magic[sizeof(ZONEMAP_MAGIC)];
+	std::uint32_t version;
+	std::uint64_t recordsPerBlock;
+	std::uint64_t fileSize;
+	std::int64_t fileTime;
+	if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, ZONEMAP_MAGIC, sizeof(magic)) != 0 ||
+	    !readValue(input, version) || version != ZONEMAP_VERSION ||
+	    !readValue(input, recordsPerBlock) || recordsPerBlock != RECORDS_PER_BLOCK ||
+	    !readValue(input, fileSize) || fileSize != cdfFileSize_ ||
+	    !readValue(input, fileTime) || fileTime != cdfFileTime_) {
+		return false;
+	}
+
+	std::uint64_t variablesCount;
+	if (!readValue(input, variablesCount)) {
+		return false;
+	}
+	std::vector<std::string> names;
+	for (std::uint64_t i = 0; i < variablesCount; ++i) {
+		std::vector<char> name;
+		if (!readArray(input, name)) {
+			return false;
+		}
+		names.emplace_back(name.begin(), name.end());
+	}
+	std::vector<std::uint64_t> offsets;
+	std::uint64_t statsPerBlock;
+	std::vector<Block> blocks;
+	std::vector<ElementStats> stats;
+	if (!readArray(input, offsets) || offsets.size() != names.size() || !readValue(input, statsPerBlock) ||
+	    !readArray(input, blocks) || !readArray(input, stats) || stats.size() != blocks.size() * statsPerBlock) {
+		return false;
+	}
+	variableNames_ = std::move(names);
+	statsOffsets_ = std::move(offsets);
+	statsPerBlock_ = statsPerBlock;
+	blocks_ = std::move(blocks);
+	stats_ = std::move(stats);
+	return true;
+}
+
+void cdownload::CDF::ZoneMap::save(const path& fileName) const
+{
+	// write into a temporary file first, thus concurrent readers never see a partial map
+	const path tmpFileName = path(fileName.string() + ".part");
+	{
+		std::ofstream output(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+		output.write(ZONEMAP_MAGIC, sizeof(ZONEMAP_MAGIC));
+		writeValue(output, ZONEMAP_VERSION);
+		writeValue(output, static_cast<std::uint64_t>(RECORDS_PER_BLOCK));
+		writeValue(output, cdfFileSize_);
+		writeValue(output, cdfFileTime_);
+		writeValue(output, static_cast<std::uint64_t>(variableNames_.size()));
+		for (const std::string& name: variableNames_) {
+			writeArray(output, std::vector<char>(name.begin(), name.end()));
+		}
+		writeArray(output, statsOffsets_);
+		writeValue(output, statsPerBlock_);
+		writeArray(output, blocks_);
+		writeArray(output, stats_);
+		if (!output) {
+			throw std::runtime_error("write error");
+		}
+	}
+	boost::filesystem::rename(tmpFileName, fileName);
+}
@@ -0,0 +1,104 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_CDF_ZONEMAP_HXX
+#define CDOWNLOAD_CDF_ZONEMAP_HXX
+
+#include "../commonDefinitions.hxx"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cdownload {
+namespace CDF {
+
+	class File;
+
+	/**
+	 * @brief Summary statistics of CDF variables for each block of consecutive records
+	 *
+	 * Allows filters to reject whole blocks without reading their records. The map is stored next to
+	 * the file (with the ".zonemap" suffix) and is rebuilt when the file changes or when variables,
+	 * which are not in the stored map, are requested. Thus it pays off for cached files, which are
+	 * read repeatedly: building the map decodes the variables as reading them does.
+	 */
+	class ZoneMap {
+	public:
+		static constexpr const std::size_t RECORDS_PER_BLOCK = 1024;
+
+		struct ElementStats {
+			double min; //!< over non-NaN values, fill values included
+			double max;
+			std::uint64_t nanCount;
+			std::uint64_t fillCount;
+		};
+
+		struct Block {
+			std::uint64_t firstRecord;
+			std::uint64_t recordsCount;
+			double minEpoch; //!< over records with positive timestamps
+			double maxEpoch;
+		};
+
+		ZoneMap(const path& fileName, const File& file, const std::vector<std::string>& variables,
+		        const std::string& timestampVariable);
+
+		std::size_t blocksCount() const {
+			return blocks_.size();
+		}
+
+		const Block& block(std::size_t index) const {
+			return blocks_[index];
+		}
+
+		static std::size_t blockForRecord(std::size_t record) {
+			return record / RECORDS_PER_BLOCK;
+		}
+
+		/**
+		 * @brief Statistics of the variable elements in the given block
+		 *
+		 * @return pointer to the stats of the first element or nullptr if the variable is not in the map
+		 */
+		const ElementStats* variable(std::size_t block, const std::string& name) const;
+
+		static path zoneMapFileName(const path& cdfFileName);
+
+	private:
+		bool load(const path& fileName);
+		void save(const path& fileName) const;
+		void build(const File& file, const std::vector<std::string>& variables, const std::string& timestampVariable);
+
+		std::uint64_t cdfFileSize_;
+		std::int64_t cdfFileTime_;
+		std::vector<std::string> variableNames_;
+		std::vector<std::uint64_t> statsOffsets_; //!< of each variable within the block stats
+		std::uint64_t statsPerBlock_;
+		std::vector<Block> blocks_;
+		std::vector<ElementStats> stats_;
+	};
+}
+}
+
+#endif // CDOWNLOAD_CDF_ZONEMAP_HXX
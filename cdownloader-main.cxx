@@ -30,6 +30,8 @@
 #include "driver.hxx"
 #include "parameters.hxx"
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/log/core.hpp>
@@ -112,7 +114,28 @@ int main(int ac, char** av)
 	    ("cache-dir", po::value<path>(), "Directory with pre-downloaded CDF files")
 	    ("download-missing", po::value<bool>()->default_value(true)->implicit_value(true),
 	         "Download missing from cache data")
-		("spacecraft", po::value<std::string>()->default_value("C4"), "CLUSTER spacecraft name")
+	    ("max-parallel-downloads", po::value<std::size_t>()->default_value(16),
+	         "Maximal number of simultaneous transfers")
+	    ("prefetch-chunks", po::value<std::size_t>()->default_value(1),
+	         "Number of data chunks to download ahead of reading")
+	    ("prefetch-disk-budget", po::value<std::uint64_t>()->default_value(4096),
+	         "Disk space (MiB) prefetched chunks may occupy")
+	    ("memory-workspace-budget", po::value<std::uint64_t>()->default_value(0),
+	         "RAM (MiB) for downloaded files which are not cached, the rest goes to the work directory")
+	    ("memory-workspace-dir", po::value<path>()->default_value("/dev/shm"),
+	         "Directory in RAM-backed file system (tmpfs) for the memory workspace")
+	    ("async-download", po::value<bool>()->default_value(false)->implicit_value(true),
+	         "Download long ranges missing in the cache via asynchronous CSA requests")
+	    ("async-poll-interval", po::value<unsigned>()->default_value(60),
+	         "Interval (s) between checks whether asynchronous requests are ready")
+	    ("async-max-wait", po::value<unsigned>()->default_value(24),
+	         "Hours an asynchronous request may stay undelivered before it is submitted again, then given up")
+	    ("csa-url", po::value<std::string>()->default_value("https://csa.esac.esa.int/csa/aio"),
+	         "Base URL of the CSA archive interface")
+	    ("omni-url", po::value<std::string>()->default_value("ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/"),
+	         "URL of the directory with high resolution OMNI files")
+		("spacecraft", po::value<std::string>()->default_value("C4"),
+			"CLUSTER spacecraft name or comma-separated list of names to average jointly (e.g. C1,C2,C3,C4)")
 // 	    ("omni-db-file")
 		;
 
@@ -124,6 +147,7 @@ int main(int ac, char** av)
 	    ("cell-size", po::value<cdownload::timeduration>(), "Size of the averaging cell")
 	    ("valid-time-ranges", po::value<path>(), "File with time cells")
 	    ("no-averaging", po::value<bool>()->default_value(false)->implicit_value(true), "Do not average values")
+	    ("cell-intervals", po::value<path>(), "File with time intervals to average over (one output row per interval)")
 	;
 	desc.add(timeOptions);
 
@@ -150,10 +174,42 @@ int main(int ac, char** av)
 		("plasma-sheet", po::value<bool>()->implicit_value(true)->default_value(true), "Use measurements in plasmasheet only")
 		("plasma-sheet-min-r", po::value<double>()->default_value(4.0),
 			"Minimal distance in Earth radius units for plasma-sheet filter")
+		("ephemeris-index", po::value<bool>()->implicit_value(true)->default_value(false),
+			"Skip time ranges where night-side and plasma-sheet distance conditions can not hold by spacecraft ephemeris")
+		("filter", po::value<std::vector<std::string>>()->composing(),
+			"Keep only records satisfying the expression (e.g. \"abs(density__C4_CP_CIS-CODIF_HS_H1_MOMENTS) > 0.1\")")
+		("averaged-filter", po::value<std::vector<std::string>>()->composing(),
+			"Keep only averaged cells whose mean values satisfy the expression")
+		("filter-plugin", po::value<std::vector<std::string>>()->composing(),
+			"Load filter from the shared library")
+		("derived", po::value<std::vector<std::string>>()->composing(),
+			"Define product of the $DERIVED dataset by an expression (e.g. \"C4_R_RE=C4_R__$DERIVED / RE\")")
 	;
 
 	desc.add(optionalFilters);
 
+	po::options_description spatialBinningOptions("Spatial binning");
+	spatialBinningOptions.add_options()
+		("grid-position", po::value<cdownload::ProductName>(),
+			"Position product to bin averaged cells by (e.g. sc_pos_xyz_gse__C4_CP_FGM_SPIN)")
+		("grid-axis", po::value<std::vector<cdownload::GridAxisParameters>>()->composing(),
+			"Grid axis as <x|y|z>:<min>:<max>:<step>, two or three axes are required")
+		("grid-length-unit", po::value<double>()->default_value(cdownload::EARTH_RADIUS),
+			"Length of the grid unit in units of the position product (default is Earth radius in km)")
+	;
+
+	desc.add(spatialBinningOptions);
+
+	po::options_description superposedEpochOptions("Superposed epoch analysis");
+	superposedEpochOptions.add_options()
+		("sea-events", po::value<path>(), "File with event times to superpose averaged cells around")
+		("sea-before", po::value<cdownload::timeduration>()->default_value(cdownload::timeduration(0, 0, 0)),
+			"Window length before each event")
+		("sea-after", po::value<cdownload::timeduration>(), "Window length after each event")
+	;
+
+	desc.add(superposedEpochOptions);
+
 	po::options_description outputOptions("Outputs");
 
 	outputOptions.add_options()
@@ -184,7 +240,33 @@ int main(int ac, char** av)
 	cdownload::Parameters parameters {vm["output-dir"].as<path>(), vm["work-dir"].as<path>(), cacheDir};
 	parameters.setContinueMode(vm["continue"].as<bool>());
 	parameters.setDownloadMissingData(vm["download-missing"].as<bool>());
-	parameters.spacecraftName(vm["spacecraft"].as<std::string>());
+	try {
+		parameters.setMaxParallelDownloads(vm["max-parallel-downloads"].as<std::size_t>());
+		parameters.setPrefetching(vm["prefetch-chunks"].as<std::size_t>(),
+		                          vm["prefetch-disk-budget"].as<std::uint64_t>() << 20);
+		parameters.setMemoryWorkspace(vm["memory-workspace-dir"].as<path>(),
+		                              vm["memory-workspace-budget"].as<std::uint64_t>() << 20);
+		parameters.setAsyncDownload(vm["async-download"].as<bool>(),
+		                            cdownload::timeduration(0, 0, static_cast<int>(vm["async-poll-interval"].as<unsigned>())),
+		                            cdownload::timeduration(static_cast<int>(vm["async-max-wait"].as<unsigned>()), 0, 0));
+		parameters.setCsaUrl(vm["csa-url"].as<std::string>());
+		parameters.setOmniUrl(vm["omni-url"].as<std::string>());
+	} catch (std::exception& ex) {
+		std::cerr << ex.what() << std::endl;
+		return 2;
+	}
+	{
+		std::vector<std::string> spacecraftNames;
+		const std::string spacecraftList = vm["spacecraft"].as<std::string>();
+		boost::algorithm::split(spacecraftNames, spacecraftList, boost::is_any_of(","), boost::token_compress_on);
+		try {
+			parameters.spacecraftNames(spacecraftNames);
+		} catch (std::exception& ex) {
+			std::cerr << ex.what() << std::endl;
+			return 2;
+		}
+	}
+	const bool jointSpacecraft = parameters.spacecraftNames().size() > 1;
 
 	if (!vm.count("list-datasets") && !vm.count("list-products")) {
 		std::vector<cdownload::ProductName> qualityFilterProducts;
@@ -206,7 +288,10 @@ int main(int ac, char** av)
 		}
 
 		for (std::size_t i = 0; i < qualityFilterProducts.size(); ++i) {
-			parameters.addQualityFilter(qualityFilterProducts[i], qualityFilterMinQualities[i]);
+			for (const auto& product: cdownload::expandSpacecraftPlaceholder(qualityFilterProducts[i],
+			                                                                  parameters.spacecraftNames())) {
+				parameters.addQualityFilter(product, qualityFilterMinQualities[i]);
+			}
 		}
 
 		if (vm.count("density-source") != vm.count("min-density-value")) {
@@ -225,8 +310,43 @@ int main(int ac, char** av)
 				vm["min-density-value"].as<double>());
 		}
 
+		if (vm.count("filter")) {
+			for (const std::string& expression: vm["filter"].as<std::vector<std::string>>()) {
+				for (const std::string& expanded: cdownload::expandSpacecraftPlaceholderInExpression(expression,
+				                                                                                  parameters.spacecraftNames())) {
+					parameters.addFilterExpression(expanded);
+				}
+			}
+		}
+
+		if (vm.count("averaged-filter")) {
+			if (vm.count("no-averaging") && vm["no-averaging"].as<bool>()) {
+				std::cerr << "Options 'averaged-filter' and 'no-averaging' are mutually exclusive" << std::endl;
+				return 2;
+			}
+			for (const std::string& expression: vm["averaged-filter"].as<std::vector<std::string>>()) {
+				for (const std::string& expanded: cdownload::expandSpacecraftPlaceholderInExpression(expression,
+				                                                                                  parameters.spacecraftNames())) {
+					parameters.addAveragedFilterExpression(expanded);
+				}
+			}
+		}
+
+		if (vm.count("derived")) {
+			for (const std::string& definition: vm["derived"].as<std::vector<std::string>>()) {
+				parameters.addDerivedDefinition(definition);
+			}
+		}
+
+		if (vm.count("filter-plugin")) {
+			for (const std::string& library: vm["filter-plugin"].as<std::vector<std::string>>()) {
+				parameters.addFilterPlugin(library);
+			}
+		}
+
 		parameters.plasmaSheetFilter(vm["plasma-sheet"].as<bool>());
 		parameters.plasmaSheetMinR(vm["plasma-sheet-min-r"].as<double>());
+		parameters.ephemerisIndex(vm["ephemeris-index"].as<bool>());
 
 		if (vm.count("night-side")) {
 			parameters.onlyNightSide(vm["night-side"].as<bool>());
@@ -245,6 +365,10 @@ int main(int ac, char** av)
 				std::cerr << "Options 'cell-size' and 'no-averaging' are mutually exclusive" << std::endl;
 				return 2;
 			}
+			if (jointSpacecraft) {
+				std::cerr << "Several spacecraft can be processed jointly only in averaging mode" << std::endl;
+				return 2;
+			}
 			parameters.disableAveraging(true);
 		}
 
@@ -252,9 +376,54 @@ int main(int ac, char** av)
 			parameters.writeEpoch(vm["write-epoch-column"].as<bool>());
 		}
 
+		if (vm.count("grid-position")) {
+			if (parameters.disableAveraging()) {
+				std::cerr << "Options 'grid-position' and 'no-averaging' are mutually exclusive" << std::endl;
+				return 2;
+			}
+			if (!vm.count("grid-axis")) {
+				std::cerr << "Grid axes have to be specified for spatial binning" << std::endl;
+				return 2;
+			}
+			try {
+				parameters.spatialGrid({vm["grid-position"].as<cdownload::ProductName>(),
+				                        vm["grid-axis"].as<std::vector<cdownload::GridAxisParameters>>(),
+				                        vm["grid-length-unit"].as<double>()});
+			} catch (std::exception& ex) {
+				std::cerr << ex.what() << std::endl;
+				return 2;
+			}
+		}
+
+		if (vm.count("sea-events")) {
+			if (parameters.disableAveraging() || parameters.spatialBinning()) {
+				std::cerr << "Option 'sea-events' can not be combined with 'no-averaging' or 'grid-position'" << std::endl;
+				return 2;
+			}
+			if (!vm.count("sea-after")) {
+				std::cerr << "Superposed epoch window end ('sea-after') has to be specified" << std::endl;
+				return 2;
+			}
+			parameters.superposedEpochs({vm["sea-events"].as<path>(),
+			                             vm["sea-before"].as<cdownload::timeduration>(),
+			                             vm["sea-after"].as<cdownload::timeduration>()});
+		}
+
+		if (vm.count("cell-intervals")) {
+			if (parameters.disableAveraging() || parameters.spatialBinning() || parameters.superposedEpochAnalysis()
+			    || jointSpacecraft) {
+				std::cerr << "Option 'cell-intervals' can not be combined with 'no-averaging', 'grid-position', 'sea-events', or several spacecraft" << std::endl;
+				return 2;
+			}
+			parameters.cellIntervalsFileName(vm["cell-intervals"].as<path>());
+		}
+
 		try {
 			assureDirectoryExistsAndIsWritable(parameters.outputDir(), "Output");
 			assureDirectoryExistsAndIsWritable(parameters.workDir(), "Working");
+			if (parameters.memoryWorkspaceBudget()) {
+				assureDirectoryExistsAndIsWritable(parameters.memoryWorkspaceDir(), "Memory workspace");
+			}
 		} catch (std::exception& ex) {
 			std::cerr << ex.what() << std::endl;
 			return 2;
@@ -269,7 +438,8 @@ int main(int ac, char** av)
 
 		for (path p: outputDefinitions) {
 			try {
-				parameters.addOuput(cdownload::parseOutputDefinitionFile(p));
+				parameters.addOuput(cdownload::expandSpacecraftPlaceholder(cdownload::parseOutputDefinitionFile(p),
+				                                                           parameters.spacecraftNames()));
 			} catch (std::exception& e) {
 				std::cerr << "Error adding output defined in file " << p << ": " << e.what() << std::endl;
 				return 2;
@@ -279,6 +449,9 @@ int main(int ac, char** av)
 		parameters.setTimeRange(vm["start"].as<cdownload::datetime>(), vm["end"].as<cdownload::datetime>());
 		if (vm.count("cell-size")) {
 			parameters.setTimeInterval(vm["cell-size"].as<cdownload::timeduration>());
+		} else if (vm.count("cell-intervals")) {
+			// here cell size is only the length of the reading step
+			parameters.setTimeInterval(cdownload::timeduration(1, 0, 0, 0.));
 		} else {
 			if (!vm.count("no-averaging") || !vm["no-averaging"].as<bool>()) {
 				std::cerr << "Cell size may not be omitted in averaging mode" << std::endl;
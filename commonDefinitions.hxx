@@ -42,6 +42,9 @@ namespace cdownload {
 	using timeduration = TimeDuration;
 
 	using path = boost::filesystem::path;
+
+	//! Mean Earth radius in km, the unit of the spacecraft positions
+	constexpr const double EARTH_RADIUS = 6371.;
 }
 
 
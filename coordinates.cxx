@@ -0,0 +1,172 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "coordinates.hxx"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+constexpr const double cdownload::CoordinateTransform::STEP_LENGTH;
+
+namespace {
+	const char SYSTEM_DELIMITER = ':';
+	const char* const GSM_PREFIX = "gsm";
+	const char* const SM_PREFIX = "sm";
+
+	constexpr const double J2000_EPOCH = 63113947200000.; //!< 2000-01-01T12:00:00 as CDF epoch, ms
+	constexpr const double MS_PER_DAY = 86400000.;
+	constexpr const double DEG = M_PI / 180.;
+
+	using Vector = std::array<double, 3>;
+
+	double dot(const Vector& a, const Vector& b)
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	Vector cross(const Vector& a, const Vector& b)
+	{
+		return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+	}
+
+	cdownload::CoordinateTransform::Matrix multiply(const cdownload::CoordinateTransform::Matrix& a,
+	                                                 const cdownload::CoordinateTransform::Matrix& b)
+	{
+		cdownload::CoordinateTransform::Matrix res;
+		for (std::size_t i = 0; i < 3; ++i) {
+			for (std::size_t j = 0; j < 3; ++j) {
+				res[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+			}
+		}
+		return res;
+	}
+}
+
+bool cdownload::CoordinateTransform::isTransformedProduct(const ProductName& product)
+{
+	return !product.isPseudoDataset() && product.shortName().find(SYSTEM_DELIMITER) != std::string::npos;
+}
+
+cdownload::CoordinateTransform::System cdownload::CoordinateTransform::system(const ProductName& product)
+{
+	const std::string shortName = product.shortName();
+	const std::string prefix = shortName.substr(0, shortName.find(SYSTEM_DELIMITER));
+	if (prefix == GSM_PREFIX) {
+		return System::GSM;
+	} else if (prefix == SM_PREFIX) {
+		return System::SM;
+	}
+	throw std::runtime_error("Unknown coordinate system '" + prefix + "' in product name '" + product.name() + '\'');
+}
+
+cdownload::ProductName cdownload::CoordinateTransform::sourceProduct(const ProductName& product)
+{
+	const std::string shortName = product.shortName();
+	return ProductName(product.dataset(), shortName.substr(shortName.find(SYSTEM_DELIMITER) + 1));
+}
+
+cdownload::ProductName cdownload::CoordinateTransform::transformedProduct(System system, const ProductName& source)
+{
+	return ProductName(source.dataset(),
+	                   (system == System::GSM ? GSM_PREFIX : SM_PREFIX) + (SYSTEM_DELIMITER + source.shortName()));
+}
+
+cdownload::FieldDesc cdownload::CoordinateTransform::describe(const ProductName& product, const FieldDesc& source)
+{
+	system(product); // validates the prefix
+	if (source.dataType() != FieldDesc::DataType::Real || source.elementCount() != 3) {
+		throw std::runtime_error("Product '" + source.name().name() + "' is not a real 3-vector and can not be transformed");
+	}
+	return FieldDesc(product, std::numeric_limits<double>::quiet_NaN(), FieldDesc::DataType::Real,
+	                 sizeof(double), 3, source.description());
+}
+
+void cdownload::CoordinateTransform::rotations(double epoch, Matrix& gseToGsm, Matrix& gseToSm)
+{
+	// Hapgood, M. A. (1992), Space physics coordinate transformations: A user guide, with the low
+	// precision Sun position of the Astronomical Almanac
+	const double days = (epoch - J2000_EPOCH) / MS_PER_DAY;
+	const double gst = (280.46061837 + 360.98564736629 * days) * DEG;
+	const double meanAnomaly = (357.528 + 0.9856003 * days) * DEG;
+	const double sunLongitude = (280.460 + 0.9856474 * days) * DEG +
+		(1.915 * std::sin(meanAnomaly) + 0.020 * std::sin(2 * meanAnomaly)) * DEG;
+	const double obliquity = (23.439 - 0.0000004 * days) * DEG;
+
+	// GSE axes in GEI
+	const Vector x {std::cos(sunLongitude), std::cos(obliquity) * std::sin(sunLongitude),
+	                std::sin(obliquity) * std::sin(sunLongitude)};
+	const Vector z {0, -std::sin(obliquity), std::cos(obliquity)};
+	const Vector y = cross(z, x);
+
+	// north dipole pole in GEO from IGRF-2000 g10, g11, h11 (nT) and their secular variation
+	const double years = days / 365.25;
+	const double g10 = -29619.4 + 11.4 * years;
+	const double g11 = -1728.2 + 16.7 * years;
+	const double h11 = 5186.1 - 22.5 * years;
+	const double norm = std::sqrt(g10 * g10 + g11 * g11 + h11 * h11);
+	const Vector dipoleGeo {-g11 / norm, -h11 / norm, -g10 / norm};
+	const Vector dipoleGei {std::cos(gst) * dipoleGeo[0] - std::sin(gst) * dipoleGeo[1],
+	                        std::sin(gst) * dipoleGeo[0] + std::cos(gst) * dipoleGeo[1],
+	                        dipoleGeo[2]};
+	const Vector dipole {dot(dipoleGei, x), dot(dipoleGei, y), dot(dipoleGei, z)};
+
+	// GSM: rotation about X, which puts the dipole into the XZ plane
+	const double psi = std::atan2(dipole[1], dipole[2]);
+	gseToGsm = {{
+		{{1, 0, 0}},
+		{{0, std::cos(psi), -std::sin(psi)}},
+		{{0, std::sin(psi), std::cos(psi)}}
+	}};
+
+	// SM: rotation about Y by the dipole tilt
+	const double tilt = std::atan2(dipole[0], std::sqrt(dipole[1] * dipole[1] + dipole[2] * dipole[2]));
+	const Matrix gsmToSm {{
+		{{std::cos(tilt), 0, -std::sin(tilt)}},
+		{{0, 1, 0}},
+		{{std::sin(tilt), 0, std::cos(tilt)}}
+	}};
+	gseToSm = multiply(gsmToSm, gseToGsm);
+}
+
+cdownload::CoordinateTransform::CoordinateTransform(System system)
+	: system_{system}
+	, step_{std::numeric_limits<std::int64_t>::min()}
+	, matrix_()
+{
+}
+
+void cdownload::CoordinateTransform::apply(double epoch, const double* gse, double* res)
+{
+	const std::int64_t step = static_cast<std::int64_t>(std::floor(epoch / STEP_LENGTH));
+	if (step != step_) {
+		Matrix gsm;
+		Matrix sm;
+		rotations((static_cast<double>(step) + 0.5) * STEP_LENGTH, gsm, sm);
+		matrix_ = system_ == System::GSM ? gsm : sm;
+		step_ = step;
+	}
+	for (std::size_t i = 0; i < 3; ++i) {
+		res[i] = matrix_[i][0] * gse[0] + matrix_[i][1] * gse[1] + matrix_[i][2] * gse[2];
+	}
+}
@@ -0,0 +1,79 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_COORDINATES_HXX
+#define CDOWNLOAD_COORDINATES_HXX
+
+#include "field.hxx"
+
+#include <array>
+#include <cstdint>
+
+namespace cdownload {
+
+	/**
+	 * @brief Rotates GSE vectors into GSM or SM coordinates
+	 *
+	 * Transformed products are named by the coordinate system prefix, e.g.
+	 * gsm:B_vec_xyz_gse__C4_CP_FGM_SPIN, and are computed for every record, before averaging.
+	 * The rotation depends on time via the Sun direction and the dipole axis (IGRF dipole terms with
+	 * their secular variation); it is computed once per @ref STEP_LENGTH.
+	 */
+	class CoordinateTransform {
+	public:
+		enum class System {
+			GSM,
+			SM
+		};
+
+		using Matrix = std::array<std::array<double, 3>, 3>;
+
+		static constexpr const double STEP_LENGTH = 60 * 1000.; //!< 1 minute in ms
+
+		static bool isTransformedProduct(const ProductName& product);
+		static System system(const ProductName& product);
+		static ProductName sourceProduct(const ProductName& product);
+		static ProductName transformedProduct(System system, const ProductName& source);
+
+		/**
+		 * @brief Describes transformed product
+		 *
+		 * The source has to be a real 3-vector. The result has double elements, NaN as fill value.
+		 */
+		static FieldDesc describe(const ProductName& product, const FieldDesc& source);
+
+		//! Rotation matrices from GSE to GSM and to SM at the given CDF epoch (ms)
+		static void rotations(double epoch, Matrix& gseToGsm, Matrix& gseToSm);
+
+		explicit CoordinateTransform(System system);
+
+		void apply(double epoch, const double* gse, double* res);
+
+	private:
+		System system_;
+		std::int64_t step_; //!< step of the cached matrix
+		Matrix matrix_;
+	};
+}
+
+#endif // CDOWNLOAD_COORDINATES_HXX
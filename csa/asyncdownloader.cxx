@@ -0,0 +1,228 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "asyncdownloader.hxx"
+
+#include "downloader.hxx"
+#include "unpacker.hxx"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+	const char* const STATE_FILE_NAME = "csa-async-requests.json";
+
+	bool sameRange(const cdownload::datetime& leftStart, const cdownload::datetime& leftEnd,
+	               const cdownload::datetime& rightStart, const cdownload::datetime& rightEnd)
+	{
+		return std::abs((leftStart - rightStart).milliseconds()) < 1. &&
+			std::abs((leftEnd - rightEnd).milliseconds()) < 1.;
+	}
+
+	bool archiveIsNotReady(int statusCode)
+	{
+		return statusCode == 404 || statusCode == 202 || statusCode == 204;
+	}
+}
+
+cdownload::csa::AsyncDownloader::AsyncDownloader(const path& cacheDir, const timeduration& pollInterval,
+                                                 const timeduration& maxWait)
+	: cacheDir_{cacheDir}
+	, stateFileName_{cacheDir / STATE_FILE_NAME}
+	, pollInterval_{pollInterval}
+	, maxWait_{maxWait}
+	, submitter_{new DataDownloader()}
+	, fetcher_{new curl::DownloadManager()}
+{
+	loadState();
+}
+
+cdownload::csa::AsyncDownloader::~AsyncDownloader() = default;
+
+void cdownload::csa::AsyncDownloader::request(const DatasetName& dataset, const datetime& startTime, const datetime& endTime)
+{
+	for (const Request& r: requests_) {
+		if (r.dataset == dataset && sameRange(r.startTime, r.endTime, startTime, endTime)) {
+			return;
+		}
+	}
+	requests_.push_back({dataset, startTime, endTime, std::string(), 0, false});
+}
+
+void cdownload::csa::AsyncDownloader::run()
+{
+	for (Request& r: requests_) {
+		if (r.location.empty()) {
+			submit(r);
+			saveState();
+		}
+	}
+
+	while (!requests_.empty()) {
+		for (auto it = requests_.begin(); it != requests_.end();) {
+			if (fetch(*it)) {
+				it = requests_.erase(it);
+				saveState();
+				continue;
+			}
+			const double waited = std::difftime(std::time(nullptr), it->submitted);
+			if (waited * 1e3 >= maxWait_.milliseconds()) {
+				// the location may have expired, or may belong to another request
+				if (it->resubmitted) {
+					std::ostringstream msg;
+					msg << "Asynchronous request for " << describe(*it) << " was not delivered to "
+					    << it->location << " within " << maxWait_ << " after it was submitted again";
+					throw std::runtime_error(msg.str());
+				}
+				BOOST_LOG_TRIVIAL(warning) << "Asynchronous request for " << describe(*it) << " was not delivered to "
+					<< it->location << " within " << maxWait_ << ", submitting it again";
+				submit(*it);
+				it->resubmitted = true;
+				saveState();
+			}
+			++it;
+		}
+		if (!requests_.empty()) {
+			BOOST_LOG_TRIVIAL(info) << requests_.size() << " asynchronous request(s) are not ready, waiting "
+				<< pollInterval_;
+			std::this_thread::sleep_for(std::chrono::milliseconds(
+				static_cast<std::chrono::milliseconds::rep>(pollInterval_.milliseconds())));
+		}
+	}
+}
+
+void cdownload::csa::AsyncDownloader::submit(Request& request)
+{
+	const std::string url = DataDownloader::asyncRequestUrl(request.dataset, request.startTime, request.endTime);
+	BOOST_LOG_TRIVIAL(info) << "Submitting asynchronous request for '" << request.dataset << "' in ["
+		<< request.startTime << ',' << request.endTime << ']';
+	std::ostringstream reply;
+	submitter_->curl::DownloadManager::beginDownloading(url, reply);
+	submitter_->waitForFinished();
+
+	static const std::regex urlRx(R"((https?|ftp)://[^\s"'<>]+)");
+	std::smatch match;
+	const std::string replyText = reply.str();
+	if (!std::regex_search(replyText, match, urlRx)) {
+		throw std::runtime_error("CSA did not accept asynchronous request for '" + request.dataset +
+			"', the reply is: " + replyText.substr(0, 256));
+	}
+	request.location = match.str();
+	request.submitted = std::time(nullptr);
+	BOOST_LOG_TRIVIAL(debug) << "Archive will be available at " << request.location;
+}
+
+bool cdownload::csa::AsyncDownloader::fetch(const Request& request)
+{
+	StreamingExtractor extractor(cacheDir_, request.dataset);
+	try {
+		fetcher_->beginDownloading(request.location, extractor.input());
+		fetcher_->waitForFinished();
+	} catch (curl::DownloadManager::TransferError& er) {
+		fetcher_->cancelAllRequests(); // removes the failed request
+		if (archiveIsNotReady(er.statusCode())) {
+			return false;
+		}
+		BOOST_LOG_TRIVIAL(error) << "Could not fetch asynchronous request for " << describe(request)
+			<< " from " << request.location;
+		throw;
+	} catch (...) {
+		fetcher_->cancelAllRequests();
+		throw;
+	}
+	const path fileName = extractor.finish();
+	BOOST_LOG_TRIVIAL(info) << "Asynchronous request for " << describe(request) << " delivered " << fileName;
+	return true;
+}
+
+std::string cdownload::csa::AsyncDownloader::describe(const Request& request)
+{
+	std::ostringstream res;
+	res << '\'' << request.dataset << "' in [" << request.startTime << ',' << request.endTime << ']';
+	return res.str();
+}
+
+void cdownload::csa::AsyncDownloader::loadState()
+{
+	std::ifstream input(stateFileName_.c_str());
+	if (!input) {
+		return;
+	}
+	Json::Value state;
+	try {
+		input >> state;
+	} catch (std::exception& ex) {
+		BOOST_LOG_TRIVIAL(warning) << "Ignoring broken state file " << stateFileName_ << ": " << ex.what();
+		return;
+	}
+	// requests saved without the submission time wait from now on
+	const std::time_t now = std::time(nullptr);
+	for (const Json::Value& r: state["requests"]) {
+		requests_.push_back({r["dataset"].asString(), datetime(r["start"].asDouble()), datetime(r["end"].asDouble()),
+		                     r["location"].asString(),
+		                     static_cast<std::time_t>(r.get("submitted", static_cast<double>(now)).asDouble()),
+		                     r["resubmitted"].asBool()});
+	}
+	if (!requests_.empty()) {
+		BOOST_LOG_TRIVIAL(info) << "Resuming " << requests_.size() << " asynchronous request(s) from " << stateFileName_;
+	}
+}
+
+void cdownload::csa::AsyncDownloader::saveState() const
+{
+	Json::Value state;
+	Json::Value& requests = state["requests"] = Json::Value(Json::arrayValue);
+	for (const Request& r: requests_) {
+		Json::Value v;
+		v["dataset"] = r.dataset;
+		v["start"] = r.startTime.milliseconds();
+		v["end"] = r.endTime.milliseconds();
+		v["location"] = r.location;
+		v["submitted"] = static_cast<double>(r.submitted);
+		v["resubmitted"] = r.resubmitted;
+		requests.append(v);
+	}
+
+	// write into a temporary file first, thus an interrupted run never leaves a partial state
+	const path tmpFileName = path(stateFileName_.string() + ".part");
+	{
+		std::ofstream output(tmpFileName.c_str(), std::ios::trunc);
+		output << state;
+		if (!output) {
+			throw std::runtime_error("Could not write asynchronous requests state file " + stateFileName_.string());
+		}
+	}
+	boost::filesystem::rename(tmpFileName, stateFileName_);
+}
@@ -0,0 +1,95 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_CSA_ASYNC_DOWNLOADER_HXX
+#define CDOWNLOAD_CSA_ASYNC_DOWNLOADER_HXX
+
+#include "../commonDefinitions.hxx"
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cdownload {
+namespace curl {
+	class DownloadManager;
+}
+namespace csa {
+
+	class DataDownloader;
+
+	/**
+	 * @brief Downloads long time ranges via asynchronous (offline) CSA requests
+	 *
+	 * Synchronous requests are limited to about 1 GiB, asynchronous ones are not. A request is
+	 * submitted to async-product-action, and the first URL in the server reply is taken as the location
+	 * of the archive. The location is polled until the archive appears (HTTP 404, 202, or 204 mean it
+	 * is not ready yet), and the data file is extracted into the cache directory. A request which is
+	 * not delivered within the maximal wait is submitted once more, and then given up.
+	 *
+	 * Submitted requests are kept in a state file in the cache directory, hence after a restart they
+	 * are polled again instead of being submitted anew.
+	 */
+	class AsyncDownloader {
+	public:
+		AsyncDownloader(const path& cacheDir, const timeduration& pollInterval, const timeduration& maxWait);
+		~AsyncDownloader();
+
+		//! Adds the request, unless the same one is pending since a previous run
+		void request(const DatasetName& dataset, const datetime& startTime, const datetime& endTime);
+
+		//! Submits new requests and waits until all the archives are delivered and extracted
+		void run();
+
+	private:
+		struct Request {
+			DatasetName dataset;
+			datetime startTime;
+			datetime endTime;
+			std::string location; //!< empty until submitted
+			std::time_t submitted; //!< time of the last submission
+			bool resubmitted; //!< whether the request was submitted again after the maximal wait
+		};
+
+		void submit(Request& request);
+		//! @returns false if the archive is not ready yet
+		bool fetch(const Request& request);
+		//! Dataset and time range of the request, for messages
+		static std::string describe(const Request& request);
+
+		void loadState();
+		void saveState() const;
+
+		path cacheDir_;
+		path stateFileName_;
+		timeduration pollInterval_;
+		timeduration maxWait_;
+		std::vector<Request> requests_;
+		std::unique_ptr<DataDownloader> submitter_;
+		std::unique_ptr<curl::DownloadManager> fetcher_;
+	};
+}
+}
+
+#endif // CDOWNLOAD_CSA_ASYNC_DOWNLOADER_HXX
@@ -25,49 +25,272 @@
 #include "downloader.hxx"
 #include "unpacker.hxx"
 #include "../util.hxx"
+#include "../workspace.hxx"
 
-#include <boost/lexical_cast.hpp>
-#include <boost/log/trivial.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
 
-#include <fstream>
+namespace {
+	std::uint64_t unpackedSize(const cdownload::Chunk& chunk)
+	{
+		std::uint64_t res = 0;
+		for (const auto& f: chunk.files) {
+			boost::system::error_code ec;
+			const auto size = boost::filesystem::file_size(f.second.fileName(), ec);
+			if (!ec) {
+				res += size;
+			}
+		}
+		return res;
+	}
 
-cdownload::csa::ChunkDownloader::ChunkDownloader(const path& tmpDir,  const path& unpackedDataDir,
+	constexpr const std::size_t MAX_SYNCHRONOUS_MODE_FILE_SIZE = 1 << 30; // 1 GiB
+	constexpr const std::size_t MAX_CHUNK_TARGET_SIZE = 0.85 * MAX_SYNCHRONOUS_MODE_FILE_SIZE;
+	//! The first chunk is small, thus the first output appears soon
+	constexpr const std::size_t FIRST_CHUNK_TARGET_SIZE = 32 << 20; // 32 MiB
+	constexpr const double MAX_CHUNK_GROWTH = 16.;
+	//! How many times a chunk is downloaded from the beginning, when its transfer can not be resumed
+	constexpr const std::size_t MAX_CHUNK_RESTARTS = 2;
+
+	//! Chunk length of a dataset which was never downloaded before
+	const cdownload::timeduration INITIAL_CHUNK_LENGTH(1, 0, 0);
+	const cdownload::timeduration MIN_CHUNK_LENGTH(0, 1, 0);
+	const cdownload::timeduration MAX_CHUNK_LENGTH(366 * 24, 0, 0);
+
+	//! Chunk boundaries are computed identically, differences below 1 ms are rounding noise
+	bool sameTime(const cdownload::datetime& left, const cdownload::datetime& right)
+	{
+		return std::abs((left - right).milliseconds()) < 1.;
+	}
+
+	//! Aborts the chunk which the prefetching thread downloads, when prefetching is stopped
+	class PrefetchCancelled: public std::runtime_error {
+	public:
+		PrefetchCancelled()
+			: std::runtime_error("Prefetching cancelled")
+		{
+		}
+	};
+}
+
+cdownload::csa::ChunkDownloader::ChunkDownloader(const path& unpackedDataDir,
                                             cdownload::csa::DataDownloader& downloader,
                                             const std::vector<DatasetName>& datasets,
                                             const datetime& startTime, const datetime& endTime)
 	: downloader_(downloader)
 	, datasets_{datasets}
-	, tmpDir_{tmpDir}
 	, unpackedDataDir_{unpackedDataDir}
 	, start_{startTime}
 	, end_{endTime}
 	, currentChunkStart_{startTime}
-	, currentChunkLength_{timeduration(24, 0, 0, 0)}
+	, currentChunkLength_{INITIAL_CHUNK_LENGTH}
 	, eof_{false}
+	, prefetchDepth_{0}
+	, prefetchDiskBudget_{0}
+	, prefetchedBytes_{0}
+	, prefetchStopRequested_{false}
+	, prefetchFinished_{false}
 {
 	BOOST_LOG_TRIVIAL(info) << "Datasets to be downloaded: " << put_list(datasets);
+	for (const auto& ds: datasets_) {
+		models_.emplace_back(ChunkSizeModel::fileName(unpackedDataDir_, ds));
+	}
+	currentChunkLength_ = plannedChunkLength(FIRST_CHUNK_TARGET_SIZE);
+	BOOST_LOG_TRIVIAL(debug) << "Initial chunk length: " << currentChunkLength_;
+}
+
+cdownload::csa::ChunkDownloader::~ChunkDownloader()
+{
+	try {
+		stopPrefetching();
+	} catch (std::exception& ex) {
+		BOOST_LOG_TRIVIAL(error) << "Could not stop prefetching: " << ex.what();
+	}
+}
+
+void cdownload::csa::ChunkDownloader::setPrefetching(std::size_t depth, std::uint64_t diskBudget)
+{
+	stopPrefetching();
+	prefetchDepth_ = depth;
+	prefetchDiskBudget_ = diskBudget;
 }
 
 cdownload::Chunk cdownload::csa::ChunkDownloader::nextChunk()
+{
+	if (!prefetchDepth_) {
+		Chunk res = downloadNextChunk();
+		eof_ = res.empty();
+		return res;
+	}
+
+	if (!prefetchThread_.joinable()) {
+		startPrefetching();
+	}
+
+	std::unique_lock<std::mutex> lock(prefetchMutex_);
+	prefetchCV_.wait(lock, [this]() {return !prefetchedChunks_.empty() || prefetchFinished_;});
+	if (!prefetchedChunks_.empty()) {
+		Chunk res = std::move(prefetchedChunks_.front());
+		prefetchedChunks_.pop_front();
+		prefetchedBytes_ -= std::min(prefetchedBytes_, unpackedSize(res));
+		prefetchCV_.notify_all();
+		return res;
+	}
+	if (prefetchError_) {
+		std::exception_ptr error = prefetchError_;
+		lock.unlock();
+		stopPrefetching();
+		std::rethrow_exception(error);
+	}
+	eof_ = true;
+	return Chunk();
+}
+
+void cdownload::csa::ChunkDownloader::startPrefetching()
+{
+	nextPrefetchStart_ = currentChunkStart_;
+	prefetchThread_ = std::thread(&ChunkDownloader::prefetch, this);
+}
+
+void cdownload::csa::ChunkDownloader::stopPrefetching()
+{
+	if (!prefetchThread_.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(prefetchMutex_);
+		prefetchStopRequested_ = true;
+		prefetchCV_.notify_all();
+	}
+	// interrupts the chunk being downloaded, if any. Only the worker waits for its transfers,
+	// which it does not begin any more, and it does not report their errors
+	try {
+		downloader_.scheduleCancellingAllRequests();
+	} catch (std::exception& ex) {
+		BOOST_LOG_TRIVIAL(warning) << "Could not cancel prefetching transfers: " << ex.what();
+	}
+	prefetchThread_.join();
+
+	// the worker advanced the download position past the chunks not yet served
+	if (!prefetchedChunks_.empty()) {
+		BOOST_LOG_TRIVIAL(debug) << "Discarding " << prefetchedChunks_.size() << " prefetched chunk(s)";
+		currentChunkStart_ = prefetchedChunks_.front().startTime;
+	} else {
+		currentChunkStart_ = nextPrefetchStart_;
+	}
+	prefetchedChunks_.clear(); // removes unpacked files
+	prefetchedBytes_ = 0;
+	prefetchStopRequested_ = false;
+	prefetchFinished_ = false;
+	prefetchError_ = nullptr;
+}
+
+void cdownload::csa::ChunkDownloader::prefetch()
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(prefetchMutex_);
+			prefetchCV_.wait(lock, [this]() {
+				return prefetchStopRequested_ ||
+					(prefetchedChunks_.size() < prefetchDepth_ && prefetchedBytes_ < prefetchDiskBudget_);
+			});
+			if (prefetchStopRequested_) {
+				return;
+			}
+		}
+
+		Chunk chunk;
+		try {
+			chunk = downloadNextChunk();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(prefetchMutex_);
+			if (!prefetchStopRequested_) {
+				prefetchError_ = std::current_exception();
+			}
+			prefetchFinished_ = true;
+			prefetchCV_.notify_all();
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(prefetchMutex_);
+		if (prefetchStopRequested_) {
+			return;
+		}
+		if (chunk.empty()) {
+			prefetchFinished_ = true;
+		} else {
+			BOOST_LOG_TRIVIAL(debug) << "Prefetched chunk [" << chunk.startTime << ',' << chunk.endTime << ']';
+			prefetchedBytes_ += unpackedSize(chunk);
+			prefetchedChunks_.push_back(std::move(chunk));
+			nextPrefetchStart_ = currentChunkStart_;
+		}
+		prefetchCV_.notify_all();
+		if (prefetchFinished_) {
+			return;
+		}
+	}
+}
+
+bool cdownload::csa::ChunkDownloader::continuesPrefetching(const datetime& startTime)
+{
+	if (!prefetchThread_.joinable()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(prefetchMutex_);
+	if (prefetchError_) {
+		return false;
+	}
+	return prefetchedChunks_.empty() ?
+		sameTime(nextPrefetchStart_, startTime) : sameTime(prefetchedChunks_.front().startTime, startTime);
+}
+
+cdownload::timeduration cdownload::csa::ChunkDownloader::plannedChunkLength(std::size_t targetSize) const
+{
+	bool known = false;
+	timeduration res = MAX_CHUNK_LENGTH;
+	for (const auto& model: models_) {
+		if (!model.empty()) {
+			known = true;
+			res = std::min(res, model.chunkLength(targetSize));
+		}
+	}
+	if (!known) {
+		return INITIAL_CHUNK_LENGTH;
+	}
+	return std::max(res, MIN_CHUNK_LENGTH);
+}
+
+cdownload::Chunk cdownload::csa::ChunkDownloader::downloadNextChunk()
 {
 	if (currentChunkStart_ > end_) {
-		eof_ = true;
 		return Chunk();
 	}
 
-	std::size_t maxDownloadedFileSize = 0;
+	std::vector<std::size_t> archiveSizes;
 	Chunk res;
 	bool downloaded = false;
+	std::size_t restarts = 0;
 	if (currentChunkStart_ + currentChunkLength_ > end_) {
 		currentChunkLength_ = end_ - currentChunkStart_;
 	}
 	while (!downloaded) {
 		try {
-			res.files = downloadChunk(currentChunkStart_, currentChunkLength_, maxDownloadedFileSize);
+			res.files = downloadChunk(currentChunkStart_, currentChunkLength_, archiveSizes);
 			downloaded = true;
+		} catch (curl::DownloadManager::ResumeError& er) {
+			// the archive was partially extracted already, the only option is to start from scratch
+			if (restarts++ == MAX_CHUNK_RESTARTS) {
+				throw;
+			}
+			BOOST_LOG_TRIVIAL(warning) << er.what() << ", downloading the chunk again";
 		} catch (curl::DownloadManager::TransferError& er) {
-			// there might be error 413 (Request Entity Too Large), we decrease chunk length then
+			// there might be error 413 (Request Entity Too Large), we decrease chunk length then.
+			// The CSA gateway reports a too large archive by 502
 			if (er.statusCode() == 413 || er.statusCode() == 502) {
 				// So, we have to decrease the chunk length, but, if the chunk is shorter than
 				// 1h already, something wrong is happening, and we are exiting
@@ -75,6 +298,13 @@ cdownload::Chunk cdownload::csa::ChunkDownloader::nextChunk()
 					throw;
 				}
 
+				// only the rejected archive is known to be too large
+				const std::string rejected = DataDownloader::requestedDataset(er.url());
+				for (std::size_t i = 0; i < models_.size(); ++i) {
+					if (datasets_[i] == rejected) {
+						models_[i].addRejection(currentChunkLength_, MAX_SYNCHRONOUS_MODE_FILE_SIZE);
+					}
+				}
 				// the server returned a string with exact requested size and maximal allowed size,
 				// but we just decrease currentChunkLength_ by the factor of 2
 				currentChunkLength_ /= 2;
@@ -88,19 +318,24 @@ cdownload::Chunk cdownload::csa::ChunkDownloader::nextChunk()
 	res.startTime = currentChunkStart_;
 	res.endTime = currentChunkStart_ + currentChunkLength_;
 
+	for (std::size_t i = 0; i < models_.size(); ++i) {
+		models_[i].addSample(archiveSizes[i], currentChunkLength_);
+		try {
+			models_[i].save();
+		} catch (std::exception& ex) {
+			BOOST_LOG_TRIVIAL(warning) << "Could not save chunk size model of '" << datasets_[i] << "': " << ex.what();
+		}
+	}
+
 	if (res.endTime < end_) {
 
 		currentChunkStart_ = res.endTime + timeduration(0, 0, 1, 0); // 1 second
 
-		constexpr const std::size_t MAX_SYNCHRONOUS_MODE_FILE_SIZE = 1 << 30; // 1 GiB
-
-		constexpr const std::size_t MAX_CHUNK_TARGET_SIZE = 0.85 * MAX_SYNCHRONOUS_MODE_FILE_SIZE;
-		int ratio = MAX_CHUNK_TARGET_SIZE / maxDownloadedFileSize;
-		if (ratio == 0) {
-			ratio = 1;
+		// the estimate is rough until several chunks are seen, hence the growth limit
+		timeduration newChunkLength = plannedChunkLength(MAX_CHUNK_TARGET_SIZE);
+		if (newChunkLength > currentChunkLength_ * MAX_CHUNK_GROWTH) {
+			newChunkLength = currentChunkLength_ * MAX_CHUNK_GROWTH;
 		}
-
-		timeduration newChunkLength = currentChunkLength_ * ratio;
 		if (currentChunkStart_ + newChunkLength > end_) {
 			newChunkLength = end_ - currentChunkStart_;
 		}
@@ -116,59 +351,50 @@ cdownload::Chunk cdownload::csa::ChunkDownloader::nextChunk()
 }
 
 std::map<std::string, cdownload::DownloadedChunkFile>
-cdownload::csa::ChunkDownloader::downloadChunk(const datetime& startTime, const timeduration& duration, std::size_t& maxDownloadedFileSize)
+cdownload::csa::ChunkDownloader::downloadChunk(const datetime& startTime, const timeduration& duration,
+                                               std::vector<std::size_t>& archiveSizes)
 {
-	maxDownloadedFileSize = 0;
+	archiveSizes.clear();
 	std::map<DatasetName, DownloadedChunkFile> res;
-	std::size_t maxFileSize = 0;
 	BOOST_LOG_TRIVIAL(debug) << "Downloading datasets for time range ["
 	                         << startTime << ',' << startTime + duration << "]";
 
-	// if several downloads are going in parallel, we need a unique ID for each
-	// to prevent file overwriting. Let's generate one from startTime
-	// as total number of seconds from the start_
-	const std::string chunkId = boost::lexical_cast<std::string>((startTime - start_).seconds());
+	// without a cache directory the files are transient and go to the workspace
+	const bool transient = unpackedDataDir_.empty();
 
-	std::vector<path> outputFileNames;
-	std::vector<std::unique_ptr<std::ofstream>> outputStreams;
+	// archives are extracted while they are being downloaded
+	std::vector<std::unique_ptr<StreamingExtractor>> extractors;
 	try {
 		for (auto ds: datasets_) {
 			BOOST_LOG_TRIVIAL(trace) << "Downloading dataset '" << ds << '\'';
-			auto destFileName = tmpDir_ / (ds + '_' + chunkId + '_' + ".tar.gz");
-			if (boost::filesystem::exists(destFileName)) {
-				BOOST_LOG_TRIVIAL(trace) << "Chunk downloader: destination file " << destFileName << " already exists";
-				boost::filesystem::remove(destFileName);
+			extractors.emplace_back(transient ?
+				new StreamingExtractor(Workspace::instance(), ds) : new StreamingExtractor(unpackedDataDir_, ds));
+			// a stop of prefetching cancels the transfers which are begun before it only
+			std::lock_guard<std::mutex> lock(prefetchMutex_);
+			if (prefetchStopRequested_) {
+				throw PrefetchCancelled();
 			}
-
-			outputFileNames.push_back(destFileName);
-			outputStreams.emplace_back(new std::ofstream(destFileName.c_str()));
-			downloader_.beginDownloading(ds, *outputStreams.back(), startTime, startTime + duration);
+			downloader_.beginDownloading(ds, extractors.back()->input(), startTime, startTime + duration);
 		}
 
 		downloader_.waitForFinished();
+		std::lock_guard<std::mutex> lock(prefetchMutex_);
+		if (prefetchStopRequested_) {
+			throw PrefetchCancelled(); // the transfers are cut
+		}
 	} catch (...) {
 		BOOST_LOG_TRIVIAL(trace) << "Downloading unsuccessful, cancelling all active requests...";
-		downloader_.cancelAllRequests(); // we have to stop all request here, because output streams
+		downloader_.cancelAllRequests(); // we have to stop all request here, because extractors
 		                                 // may not be deleted until that
 		BOOST_LOG_TRIVIAL(trace) << "Requests cancelled";
 		throw;
 	}
-	outputStreams.clear();
-
-	auto itFileNames = outputFileNames.begin();
-	auto itDatasets = datasets_.begin();
-	for (; itFileNames != outputFileNames.end() && itDatasets != datasets_.end(); ++itFileNames, ++itDatasets) {
-		const path& destFileName = *itFileNames;
-		boost::uintmax_t curFileSize = boost::filesystem::file_size(destFileName);
-		if (curFileSize > maxFileSize) {
-			maxFileSize = curFileSize;
-		}
 
-		res[*itDatasets] = DownloadedChunkFile(extractDataFile(destFileName, unpackedDataDir_, *itDatasets), true);
-		boost::filesystem::remove(destFileName);
-// 		res[*itDatasets] = DownloadedChunkFile(destFileName, unpackedDataDir_, *itDatasets);
+	for (std::size_t i = 0; i < extractors.size(); ++i) {
+		const path fileName = extractors[i]->finish();
+		res[datasets_[i]] = DownloadedChunkFile(transient ? Workspace::instance().settle(fileName) : fileName, true);
+		archiveSizes.push_back(static_cast<std::size_t>(extractors[i]->receivedBytes()));
 	}
-	maxDownloadedFileSize = maxFileSize;
 	return res;
 }
 
@@ -179,11 +405,20 @@ bool cdownload::csa::ChunkDownloader::eof() const
 
 void cdownload::csa::ChunkDownloader::setNextChunkStartTime(const datetime& startTime)
 {
+	if (continuesPrefetching(startTime)) {
+		return;
+	}
+	stopPrefetching();
 	currentChunkStart_ = startTime;
 }
 
 void cdownload::csa::ChunkDownloader::setTimeRange(const datetime& startTime, const datetime& endTime)
 {
+	if (sameTime(endTime, end_) && continuesPrefetching(startTime)) {
+		start_ = startTime;
+		return;
+	}
+	stopPrefetching();
 	start_ = startTime;
 	end_ = endTime;
 	if (currentChunkStart_ < start_) {
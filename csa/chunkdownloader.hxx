@@ -25,9 +25,16 @@
 
 #include "../commonDefinitions.hxx"
 #include "../chunkdownloader.hxx"
+#include "chunksizemodel.hxx"
 #include "unpacker.hxx"
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace cdownload {
@@ -39,16 +46,31 @@ namespace csa {
 	 * @brief Downloads data from CSA archive server, managing data chunk size
 	 *
 	 * We adjust chunk size dynamically, to be close enough to the maximal file limit in the
-	 * synchronous mode (1 GiB). To do so we measure size of the downloaded files, and scale
-	 * time interval targeting 0.85 GiB. The server may return HTTP 503 error if we are close enough
-	 * the limit, hence the 0.85 coefficient (see nextChunk() implementation).
+	 * synchronous mode (1 GiB). To do so we learn archive size per hour of every dataset
+	 * (ChunkSizeModel, kept in the cache directory between runs), and choose time interval targeting
+	 * 0.85 GiB. The server may return HTTP 503 error if we are close enough the limit, hence the 0.85
+	 * coefficient. The first chunk targets a much smaller size to produce output soon, and the chunk
+	 * length grows at most 16 times per chunk (see downloadNextChunk() implementation).
 	 *
+	 * With prefetching enabled (see setPrefetching()) a background thread downloads and unpacks
+	 * following chunks while the current one is being read. Prefetched chunks are discarded
+	 * when the caller moves to a time that does not continue the sequence.
 	 */
 	class ChunkDownloader {
 	public:
-		ChunkDownloader(const path& tmpDir, const path& unpackedDataDir, DataDownloader& downloader,
+		ChunkDownloader(const path& unpackedDataDir, DataDownloader& downloader,
 		                const std::vector<DatasetName>& datasets,
 		                const datetime& startTime, const datetime& endTime);
+		~ChunkDownloader();
+
+		/**
+		 * @brief Enables downloading of chunks ahead of their requests
+		 *
+		 * @param depth Maximal number of chunks to keep ready, 0 disables prefetching
+		 * @param diskBudget No new chunk is prefetched while the unpacked files of the
+		 * ready chunks occupy this many bytes or more
+		 */
+		void setPrefetching(std::size_t depth, std::uint64_t diskBudget);
 
 		Chunk nextChunk();
 		bool eof() const;
@@ -57,17 +79,37 @@ namespace csa {
 	private:
 		std::map<std::string, DownloadedChunkFile>
 		downloadChunk(const datetime& startTime, const timeduration& duration,
-		              std::size_t& maxDownloadedFileSize);
+		              std::vector<std::size_t>& archiveSizes);
+		//! Longest chunk length, for which no archive is expected to exceed targetSize
+		timeduration plannedChunkLength(std::size_t targetSize) const;
+		Chunk downloadNextChunk();
+
+		void startPrefetching();
+		void stopPrefetching();
+		void prefetch();
+		//! Whether the next prefetched chunk starts at startTime
+		bool continuesPrefetching(const datetime& startTime);
 
 		DataDownloader& downloader_;
 		std::vector<DatasetName> datasets_;
-		path tmpDir_;
 		path unpackedDataDir_;
 		datetime start_, end_;
 		datetime currentChunkStart_;
 		timeduration currentChunkLength_;
-// 		std::size_t lastMaxDownloadedFileSize_;
+		std::vector<ChunkSizeModel> models_;
 		bool eof_;
+
+		std::size_t prefetchDepth_;
+		std::uint64_t prefetchDiskBudget_;
+		std::thread prefetchThread_;
+		std::mutex prefetchMutex_;
+		std::condition_variable prefetchCV_;
+		std::deque<Chunk> prefetchedChunks_;
+		std::uint64_t prefetchedBytes_;
+		datetime nextPrefetchStart_;
+		bool prefetchStopRequested_;
+		bool prefetchFinished_;
+		std::exception_ptr prefetchError_;
 	};
 }
 }
@@ -0,0 +1,127 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "chunksizemodel.hxx"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+	const char* const MODEL_FILE_SUFFIX = ".chunkrate";
+	const char* const MODEL_FILE_HEADER = "cdownload-chunk-rate-1";
+
+	//! Weight of a new sample in the moving average
+	constexpr const double SMOOTHING_FACTOR = 0.3;
+
+	double hours(const cdownload::timeduration& duration)
+	{
+		return duration.seconds() / 3600.;
+	}
+}
+
+cdownload::csa::ChunkSizeModel::ChunkSizeModel(const path& fileName)
+	: fileName_{fileName}
+	, bytesPerHour_{0.}
+	, samplesCount_{0}
+{
+	if (!fileName_.empty() && load()) {
+		BOOST_LOG_TRIVIAL(debug) << "Loaded chunk size model from " << fileName_
+			<< ": " << bytesPerHour_ << " bytes per hour";
+	}
+}
+
+cdownload::path cdownload::csa::ChunkSizeModel::fileName(const path& cacheDir, const DatasetName& dataset)
+{
+	if (cacheDir.empty()) {
+		return {};
+	}
+	return cacheDir / (dataset + MODEL_FILE_SUFFIX);
+}
+
+void cdownload::csa::ChunkSizeModel::addSample(std::size_t bytes, const timeduration& duration)
+{
+	const double h = hours(duration);
+	if (h <= 0.) {
+		return;
+	}
+	// an empty archive still has a header, hence the rate is never exactly zero
+	const double rate = std::max(static_cast<double>(bytes), 1.) / h;
+	bytesPerHour_ = empty() ? rate : (1. - SMOOTHING_FACTOR) * bytesPerHour_ + SMOOTHING_FACTOR * rate;
+	++samplesCount_;
+}
+
+void cdownload::csa::ChunkSizeModel::addRejection(const timeduration& duration, std::size_t sizeLimit)
+{
+	const double h = hours(duration);
+	if (h <= 0.) {
+		return;
+	}
+	bytesPerHour_ = std::max(bytesPerHour_, static_cast<double>(sizeLimit) / h);
+	++samplesCount_;
+}
+
+cdownload::timeduration cdownload::csa::ChunkSizeModel::chunkLength(std::size_t targetSize) const
+{
+	if (empty()) {
+		throw std::logic_error("Chunk size model has no data");
+	}
+	return timeduration(static_cast<double>(targetSize) / bytesPerHour_ * 3600e3);
+}
+
+bool cdownload::csa::ChunkSizeModel::load()
+{
+	std::ifstream input(fileName_.c_str());
+	std::string header;
+	double bytesPerHour;
+	std::size_t samplesCount;
+	if (!(input >> header >> bytesPerHour >> samplesCount) || header != MODEL_FILE_HEADER ||
+	    !(bytesPerHour > 0.) || bytesPerHour > std::numeric_limits<double>::max()) {
+		return false;
+	}
+	bytesPerHour_ = bytesPerHour;
+	samplesCount_ = samplesCount;
+	return true;
+}
+
+void cdownload::csa::ChunkSizeModel::save() const
+{
+	if (fileName_.empty() || empty()) {
+		return;
+	}
+	// write into a temporary file first, thus concurrent runs never see a partial model
+	const path tmpFileName = path(fileName_.string() + ".part");
+	{
+		std::ofstream output(tmpFileName.c_str(), std::ios::trunc);
+		output.precision(std::numeric_limits<double>::digits10 + 1);
+		output << MODEL_FILE_HEADER << '\n' << bytesPerHour_ << ' ' << samplesCount_ << '\n';
+		if (!output) {
+			throw std::runtime_error("write error");
+		}
+	}
+	boost::filesystem::rename(tmpFileName, fileName_);
+}
@@ -0,0 +1,74 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_CSA_CHUNK_SIZE_MODEL_HXX
+#define CDOWNLOAD_CSA_CHUNK_SIZE_MODEL_HXX
+
+#include "../commonDefinitions.hxx"
+
+#include <cstddef>
+
+namespace cdownload {
+namespace csa {
+
+	/**
+	 * @brief Estimates how many bytes a dataset archive holds per hour of data
+	 *
+	 * The estimate is an exponentially weighted average over downloaded archives. It is stored in
+	 * a small text file in the cache directory, so that the next run starts with a suitable chunk length.
+	 */
+	class ChunkSizeModel {
+	public:
+		//! The model is loaded from and saved to @p fileName, unless the name is empty
+		explicit ChunkSizeModel(const path& fileName = path());
+
+		static path fileName(const path& cacheDir, const DatasetName& dataset);
+
+		bool empty() const {
+			return samplesCount_ == 0;
+		}
+
+		double bytesPerHour() const {
+			return bytesPerHour_;
+		}
+
+		void addSample(std::size_t bytes, const timeduration& duration);
+		//! The server refused to serve @p duration because the archive would exceed @p sizeLimit
+		void addRejection(const timeduration& duration, std::size_t sizeLimit);
+
+		//! Time range length for an archive of @p targetSize bytes
+		timeduration chunkLength(std::size_t targetSize) const;
+
+		void save() const;
+
+	private:
+		bool load();
+
+		path fileName_;
+		double bytesPerHour_;
+		std::size_t samplesCount_;
+	};
+}
+}
+
+#endif // CDOWNLOAD_CSA_CHUNK_SIZE_MODEL_HXX
@@ -22,8 +22,20 @@
 
 #include "dataprovider.hxx"
 
+#include "asyncdownloader.hxx"
 #include "datasource.hxx"
 #include "metadata.hxx"
+#include "../parameters.hxx"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+	//! Shorter gaps in the cache are left to synchronous requests
+	const cdownload::timeduration MIN_ASYNC_RANGE(7 * 24, 0, 0);
+}
 
 std::unique_ptr<cdownload::Metadata> cdownload::csa::DataProvider::metadata() const
 {
@@ -35,3 +47,43 @@ std::unique_ptr<cdownload::DataSource> cdownload::csa::DataProvider::datasource(
 	csa::Metadata meta;
 	return std::unique_ptr<cdownload::DataSource>(new csa::DataSource(dataset, parameters, meta));
 }
+
+void cdownload::csa::DataProvider::prepare(const std::vector<DatasetName>& datasets, const Parameters& parameters,
+                                           const datetime& startTime, const datetime& endTime) const
+{
+	if (!parameters.asyncDownload() || !parameters.downloadMissingData() || datasets.empty()) {
+		return;
+	}
+	if (parameters.cacheDir().empty()) {
+		throw std::runtime_error("Asynchronous downloading requires cache directory");
+	}
+
+	csa::Metadata meta;
+	AsyncDownloader downloader(parameters.cacheDir(), parameters.asyncPollInterval(), parameters.asyncMaxWait());
+	for (const auto& ds: datasets) {
+		const auto dsMeta = meta.dataset(ds);
+		const datetime begin = std::max(startTime, dsMeta.minTime());
+		const datetime end = std::min(endTime, dsMeta.maxTime());
+
+		auto requestGap = [&](const datetime& gapBegin, const datetime& gapEnd) {
+			if (gapEnd - gapBegin >= MIN_ASYNC_RANGE) {
+				downloader.request(ds, gapBegin, gapEnd);
+			}
+		};
+
+		datetime covered = begin;
+		for (const DatasetChunk& cached: DataSource::loadCachedFiles(ds, parameters.cacheDir())) {
+			if (covered >= end) {
+				break;
+			}
+			if (cached.startTime > covered) {
+				requestGap(covered, std::min(cached.startTime, end));
+			}
+			covered = std::max(covered, cached.endTime);
+		}
+		if (covered < end) {
+			requestGap(covered, end);
+		}
+	}
+	downloader.run();
+}
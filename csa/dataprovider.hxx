@@ -33,6 +33,9 @@ class DataProvider: public cdownload::DataProvider {
 public:
 	std::unique_ptr<cdownload::Metadata> metadata() const override;
 	std::unique_ptr<cdownload::DataSource> datasource(const DatasetName& dataset, const Parameters& parameters) const override;
+	//! Downloads long ranges missing in the cache via asynchronous requests, if enabled
+	void prepare(const std::vector<DatasetName>& datasets, const Parameters& parameters,
+	             const datetime& startTime, const datetime& endTime) const override;
 };
 
 }
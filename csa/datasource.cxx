@@ -52,8 +52,9 @@ cdownload::csa::DataSource::DataSource(const DatasetName& dataset, const Paramet
 		minAvailableTime = dsMeta.minTime();
 		maxAvailableTime = dsMeta.maxTime();
 		dataDownloader_.reset(new DataDownloader());
-		downloader_.reset(new ChunkDownloader(parameters.workDir(), cacheDir_, *dataDownloader_,
+		downloader_.reset(new ChunkDownloader(cacheDir_, *dataDownloader_,
 		                                      {dsName_}, minAvailableTime, maxAvailableTime));
+		downloader_->setPrefetching(parameters.prefetchChunks(), parameters.prefetchDiskBudget());
 	} else {
 		// we look for the longest continious range in the cache
 		if (!cachedFiles.size()) {
@@ -87,12 +88,13 @@ cdownload::csa::DataSource::DataSource(const DatasetName& dataset, const Paramet
 cdownload::csa::DataSource::~DataSource() = default;
 
 
-cdownload::DatasetChunk cdownload::csa::DataSource::getNewChunk(const cdownload::datetime& min, const cdownload::datetime& /*max*/)
+cdownload::DatasetChunk cdownload::csa::DataSource::getNewChunk(const cdownload::datetime& min, const cdownload::datetime& max)
 {
 	if (!downloader_) {
 		return {};
 	}
 	downloader_->setNextChunkStartTime(min);
+	downloader_->setTimeRange(min, max);
 	return downloadNextChunk();
 }
 
@@ -150,7 +152,10 @@ cdownload::DatasetChunk cdownload::csa::DataSource::downloadNextChunk()
 		return {};
 	}
 // 	lastServedChunkEndTime_ = downloadedChunk.endTime;
-	downloadedChunk.files[dsName_].release();
+	if (!cacheDir_.empty()) {
+		// stays in the cache, otherwise removed as soon as read
+		downloadedChunk.files[dsName_].release();
+	}
 	return {downloadedChunk.startTime, downloadedChunk.endTime, downloadedChunk.files[dsName_]};
 }
 
@@ -40,6 +40,8 @@ namespace csa {
 	public:
 		DataSource(const DatasetName& dataset, const Parameters& parameters, const Metadata& meta);
 		~DataSource();
+
+		static std::vector<DatasetChunk> loadCachedFiles(const DatasetName& dataset, const path& dir);
 #if 0
 		DataSource(const DataSource& other);
 		DataSource(DataSource&&) = default;
@@ -50,7 +52,6 @@ namespace csa {
 
 		cdownload::DatasetChunk getNewChunk(const cdownload::datetime & min, const cdownload::datetime & max) override;
 
-		std::vector<DatasetChunk> loadCachedFiles(const DatasetName& dataset, const path& dir);
 		DatasetChunk downloadNextChunk();
 
 		DatasetName dsName_;
@@ -27,6 +27,7 @@
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -57,8 +58,25 @@ namespace {
 		std::ostream& os;
 	};
 
-	const std::string DATA_DOWNLOAD_BASE_URL = "https://csa.esac.esa.int/csa/aio/product-action";
-	const std::string METADATA_DOWNLOAD_BASE_URL = "https://csa.esac.esa.int/csa/aio/metadata-action";
+	const std::string DATA_DOWNLOAD_ACTION = "product-action";
+	const std::string ASYNC_DATA_DOWNLOAD_ACTION = "async-product-action";
+	const std::string METADATA_DOWNLOAD_ACTION = "metadata-action";
+
+	std::string& serverUrlStorage()
+	{
+		static std::string url = "https://csa.esac.esa.int/csa/aio";
+		return url;
+	}
+}
+
+const std::string& cdownload::csa::Downloader::serverUrl()
+{
+	return serverUrlStorage();
+}
+
+void cdownload::csa::Downloader::setServerUrl(const std::string& url)
+{
+	serverUrlStorage() = boost::algorithm::trim_right_copy_if(url, [](char c) {return c == '/';});
 }
 
 cdownload::csa::Downloader::Downloader(bool addCookie)
@@ -91,11 +109,33 @@ std::string cdownload::csa::Downloader::encode(const std::string& s) const
 
 void cdownload::csa::DataDownloader::beginDownloading(const std::string& datasetName, std::ostream& output, const datetime& startDate, const datetime& endDate)
 {
-	std::string requestUrl = this->buildRequest(datasetName, startDate, endDate);
-	base::beginDownloading(requestUrl, output);
+	std::string requestUrl = buildRequest(DATA_DOWNLOAD_ACTION, datasetName, startDate, endDate);
+	// the reader which needs the earliest data will starve first
+	base::beginDownloading(requestUrl, output, CompletionCallback(), startDate.milliseconds());
+}
+
+std::string cdownload::csa::DataDownloader::asyncRequestUrl(const std::string& datasetName,
+                                                             const datetime& startDate, const datetime& endDate)
+{
+	return buildRequest(ASYNC_DATA_DOWNLOAD_ACTION, datasetName, startDate, endDate);
+}
+
+std::string cdownload::csa::DataDownloader::requestedDataset(const std::string& url)
+{
+	const std::string parameter = std::string(DATASET_ID_PARAMETER_NAME) + '=';
+	std::size_t pos = url.find('&' + parameter);
+	if (pos == std::string::npos) {
+		pos = url.find('?' + parameter);
+	}
+	if (pos == std::string::npos) {
+		return {};
+	}
+	const std::size_t begin = pos + 1 + parameter.size();
+	return url.substr(begin, url.find('&', begin) - begin);
 }
 
-std::string cdownload::csa::DataDownloader::buildRequest(const std::string& datasetName, const datetime& startDate, const datetime& endDate) const
+std::string cdownload::csa::DataDownloader::buildRequest(const std::string& action, const std::string& datasetName,
+                                                         const datetime& startDate, const datetime& endDate)
 {
 #ifdef STD_CHRONO
 	std::time_t stTime = std::chrono::system_clock::to_time_t(startDate);
@@ -109,7 +149,7 @@ std::string cdownload::csa::DataDownloader::buildRequest(const std::string& data
 #endif
 
 	std::ostringstream res;
-	res << DATA_DOWNLOAD_BASE_URL
+	res << serverUrl() << '/' << action
 	    << "?&RETRIEVALTYPE=PRODUCT"
 	    << "&NON_BROWSER"
 	    << "&DELIVERY_FORMAT=CDF"
@@ -140,7 +180,7 @@ cdownload::csa::MetadataDownloader::MetadataDownloader()
 std::vector<cdownload::DatasetName> cdownload::csa::MetadataDownloader::downloadDatasetsList()
 {
 	// we need just "DATASET.DATASET_ID" records
-	std::string url = METADATA_DOWNLOAD_BASE_URL +
+	std::string url = serverUrl() + '/' + METADATA_DOWNLOAD_ACTION +
 	                  "?RETURN_TYPE=JSON&RESOURCE_CLASS=DATASET&NON_BROWSER&SELECTED_FIELDS=" + DATASET_ID_QUERY_PARAMETER;
 
 #ifdef DEBUG_DOWNLOADING_ACTIONS
@@ -172,7 +212,7 @@ Json::Value cdownload::csa::MetadataDownloader::download(const std::vector<Datas
                                                     const std::vector<std::string>& fields)
 {
 
-	std::string url = METADATA_DOWNLOAD_BASE_URL + "?RETURN_TYPE=JSON&RESOURCE_CLASS=DATASET&NON_BROWSER&SELECTED_FIELDS=" +
+	std::string url = serverUrl() + '/' + METADATA_DOWNLOAD_ACTION + "?RETURN_TYPE=JSON&RESOURCE_CLASS=DATASET&NON_BROWSER&SELECTED_FIELDS=" +
 	                  boost::algorithm::join(fields, ",");
 
 	std::ostringstream queryStream;
@@ -40,6 +40,10 @@ namespace csa {
 
 		std::string encode(const std::string& s) const;
 
+		//! Base URL of the CSA archive interface, https://csa.esac.esa.int/csa/aio by default
+		static const std::string& serverUrl();
+		static void setServerUrl(const std::string& url);
+
 	private:
 		std::string decorateUrl(const std::string & url) const override;
 		bool addCookie_;
@@ -58,9 +62,16 @@ namespace csa {
 		void beginDownloading(const std::string& datasetName, std::ostream& output,
 		              const datetime& startDate, const datetime& endDate);
 
+		//! URL of the asynchronous (offline) request, without the cookie
+		static std::string asyncRequestUrl(const std::string& datasetName,
+		                                   const datetime& startDate, const datetime& endDate);
+
+		//! Dataset requested by the URL, empty if that is not a data request
+		static std::string requestedDataset(const std::string& url);
+
 	private:
-		std::string buildRequest(const std::string& datasetName,
-		                         const datetime& startDate, const datetime& endDate) const;
+		static std::string buildRequest(const std::string& action, const std::string& datasetName,
+		                                const datetime& startDate, const datetime& endDate);
 
 		static const char* DATASET_ID_PARAMETER_NAME;
 	};
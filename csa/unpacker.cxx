@@ -21,57 +21,117 @@
  */
 
 #include "unpacker.hxx"
+#include "../downloader.hxx"
+#include "../workspace.hxx"
 
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <boost/filesystem/operations.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
 #include "config.h"
 
 #include <boost/log/trivial.hpp>
 
 namespace {
-	int
-copy_data(struct archive *ar, struct archive *aw)
-{
-	int r;
-	const void *buff;
-	size_t size;
+	//! Message of the last libarchive error
+	std::string archiveError(struct archive* a, const char* operation)
+	{
+		const char* message = archive_error_string(a);
+		return std::string(operation) + ": " + (message ? message : "unknown error");
+	}
+
+	//! Copies data of the current entry, throws on errors
+	void copyData(struct archive* ar, struct archive* aw)
+	{
+		const void* buff;
+		size_t size;
 #if ARCHIVE_VERSION_NUMBER >= 3000000
-	int64_t offset;
+		int64_t offset;
 #else
-	off_t offset;
+		off_t offset;
 #endif
 
-	for (;;) {
-		r = archive_read_data_block(ar, &buff, &size, &offset);
-		if (r == ARCHIVE_EOF)
-			return (ARCHIVE_OK);
-		if (r != ARCHIVE_OK) {
-			BOOST_LOG_TRIVIAL(warning) << "archive_read_data_block()" << archive_error_string(ar) << std::endl;
-			return (r);
+		for (;;) {
+			const int r = archive_read_data_block(ar, &buff, &size, &offset);
+			if (r == ARCHIVE_EOF) {
+				return;
+			}
+			if (r != ARCHIVE_OK) {
+				throw std::runtime_error(archiveError(ar, "archive_read_data_block()"));
+			}
+			if (archive_write_data_block(aw, buff, size, offset) != ARCHIVE_OK) {
+				throw std::runtime_error(archiveError(aw, "archive_write_data_block()"));
+			}
 		}
-		r = archive_write_data_block(aw, buff, size, offset);
-		if (r != ARCHIVE_OK) {
-			BOOST_LOG_TRIVIAL(warning) << "archive_write_data_block()" << archive_error_string(aw) << std::endl;
-			return (r);
+	}
+
+	//! Path of the extracted file for its name and size
+	using FilePlacement = std::function<cdownload::path (const cdownload::path& fileName, std::uint64_t size)>;
+
+	//! Extracts the first entry, whose name contains datasetId, to the place given by placeFile
+	cdownload::path extractMatchingEntry(struct archive* a, const FilePlacement& placeFile, const std::string& datasetId)
+	{
+		struct archive_entry *entry;
+		struct archive* extracted = archive_write_disk_new();
+
+		cdownload::path res;
+		try {
+			int r;
+			while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+				auto fn = archive_entry_pathname(entry);
+				if (strstr(fn, datasetId.c_str())) {
+					//extract entry
+					cdownload::path cf {fn};
+					const std::uint64_t size = archive_entry_size_is_set(entry) && archive_entry_size(entry) > 0 ?
+						static_cast<std::uint64_t>(archive_entry_size(entry)) : 0;
+					res = placeFile(cf.filename(), size);
+					archive_entry_set_pathname(entry, res.c_str());
+					if (archive_write_header(extracted, entry) != ARCHIVE_OK) {
+						throw std::runtime_error(archiveError(extracted, "archive_write_header()"));
+					}
+					copyData(a, extracted);
+					if (archive_write_finish_entry(extracted) != ARCHIVE_OK) {
+						throw std::runtime_error(archiveError(extracted, "archive_write_finish_entry()"));
+					}
+					break;
+				}
+				if (archive_read_data_skip(a) != ARCHIVE_OK) {
+					throw std::runtime_error(archiveError(a, "archive_read_data_skip()"));
+				}
+			}
+			if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
+				throw std::runtime_error(archiveError(a, "archive_read_next_header()"));
+			}
+		} catch (...) {
+			archive_write_free(extracted);
+			if (!res.empty()) {
+				// the file is incomplete
+				boost::system::error_code ec;
+				boost::filesystem::remove(res, ec);
+			}
+			throw;
+		}
+		if (archive_write_free(extracted) != ARCHIVE_OK) {
+			throw std::runtime_error("Error freeing extracted archive");
 		}
+		return res;
 	}
 }
-}
 
 cdownload::path cdownload::extractDataFile(const boost::filesystem::path& fileName,
                                 const boost::filesystem::path& dirName,
                                 const std::string& datasetId, const std::string& /*fileId*/)
 {
 	struct archive *a;
-	struct archive_entry *entry;
-	struct archive *extracted;
 	int r;
 
 	a = archive_read_new();
-	extracted = archive_write_disk_new();
 
 	archive_read_support_filter_all(a);
 	archive_read_support_format_all(a);
@@ -80,38 +140,18 @@ cdownload::path cdownload::extractDataFile(const boost::filesystem::path& fileNa
 		throw std::runtime_error("Can not read archive file '" + fileName.string() + '\'');
 
 	path res;
-
-	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-		auto fn = archive_entry_pathname(entry);
-		if (strstr(fn, datasetId.c_str())) {
-			//extract entry
-			const char* currentFile = archive_entry_pathname(entry);
-			path cf {currentFile};
-			res = dirName / cf.filename();
-			archive_entry_set_pathname(entry, res.c_str());
-			r = archive_write_header(extracted, entry);
-			if (r != ARCHIVE_OK)
-				BOOST_LOG_TRIVIAL(warning) << "archive_write_header()" <<
-					archive_error_string(extracted) << std::endl;
-			else {
-				copy_data(a, extracted);
-				r = archive_write_finish_entry(extracted);
-				if (r != ARCHIVE_OK)
-					BOOST_LOG_TRIVIAL(error) << "archive_write_finish_entry()" <<
-						archive_error_string(extracted) << std::endl;
-			}
-			break;
-		}
-		archive_read_data_skip(a);  // Note 2
+	try {
+		res = extractMatchingEntry(a, [&dirName](const path& name, std::uint64_t /*size*/) {
+			return dirName / name;
+		}, datasetId);
+	} catch (...) {
+		archive_read_free(a);
+		throw;
 	}
 	r = archive_read_free(a);  // Note 3
 	if (r != ARCHIVE_OK) {
 		throw std::runtime_error("Error freeing source archive");
 	}
-	r = archive_write_free(extracted);
-	if (r != ARCHIVE_OK) {
-		throw std::runtime_error("Error freeing extracted archive");
-	}
 
 	return res;
 }
@@ -123,3 +163,228 @@ cdownload::extractAndAccureDataFile(const path& fileName, const path& dirName, c
 	boost::filesystem::remove(fileName);
 	return res;
 }
+
+// StreamingExtractor
+
+constexpr const std::size_t cdownload::StreamingExtractor::DEFAULT_PIPE_CAPACITY;
+
+namespace {
+	constexpr const std::size_t READ_BLOCK_SIZE = 1 << 16;
+}
+
+/**
+ * @brief Bounded byte queue between a writer (std::ostream) and the extracting thread
+ */
+class cdownload::StreamingExtractor::Pipe: public curl::NonBlockingStreamBuf {
+public:
+	explicit Pipe(std::size_t capacity)
+		: buffer_(capacity)
+		, begin_{0}
+		, size_{0}
+		, writtenBytes_{0}
+		, closed_{false}
+		, abandoned_{false}
+	{
+	}
+
+	//! End of input
+	void close()
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		closed_ = true;
+		readable_.notify_all();
+	}
+
+	//! The reader is not interested in more data, writes are discarded from now on
+	void abandon()
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		abandoned_ = true;
+		size_ = 0;
+		writable_.notify_all();
+	}
+
+	//! Blocks until some data are available, returns 0 at the end of input
+	std::size_t read(char* dest, std::size_t count)
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		readable_.wait(lk, [this]() {return size_ || closed_;});
+		std::size_t res = 0;
+		while (res < count && size_) {
+			const std::size_t chunk = std::min({count - res, size_, buffer_.size() - begin_});
+			std::copy_n(buffer_.begin() + static_cast<std::ptrdiff_t>(begin_), chunk, dest + res);
+			begin_ = (begin_ + chunk) % buffer_.size();
+			size_ -= chunk;
+			res += chunk;
+		}
+		writable_.notify_all();
+		return res;
+	}
+
+	std::size_t tryWrite(const char* data, std::size_t count) override
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		if (abandoned_) {
+			writtenBytes_ += count;
+			return count;
+		}
+		std::size_t res = 0;
+		while (res < count && size_ < buffer_.size()) {
+			res += put(data + res, count - res);
+		}
+		writtenBytes_ += res;
+		return res;
+	}
+
+	std::uint64_t writtenBytes() const
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		return writtenBytes_;
+	}
+
+protected:
+	std::streamsize xsputn(const char* s, std::streamsize count) override
+	{
+		std::size_t left = static_cast<std::size_t>(count);
+		std::unique_lock<std::mutex> lk(mutex_);
+		writtenBytes_ += left;
+		while (left) {
+			writable_.wait(lk, [this]() {return abandoned_ || size_ < buffer_.size();});
+			if (abandoned_) {
+				break;
+			}
+			const std::size_t chunk = put(s, left);
+			s += chunk;
+			left -= chunk;
+		}
+		return count;
+	}
+
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof())) {
+			return traits_type::not_eof(ch);
+		}
+		const char c = traits_type::to_char_type(ch);
+		xsputn(&c, 1);
+		return ch;
+	}
+
+private:
+	//! Copies as much as fits into the contiguous free space, the caller holds the lock
+	std::size_t put(const char* data, std::size_t count)
+	{
+		const std::size_t end = (begin_ + size_) % buffer_.size();
+		const std::size_t chunk = std::min({count, buffer_.size() - size_, buffer_.size() - end});
+		std::copy_n(data, chunk, buffer_.begin() + static_cast<std::ptrdiff_t>(end));
+		size_ += chunk;
+		readable_.notify_all();
+		return chunk;
+	}
+
+	std::vector<char> buffer_;
+	std::size_t begin_;
+	std::size_t size_;
+	std::uint64_t writtenBytes_;
+	bool closed_;
+	bool abandoned_;
+	mutable std::mutex mutex_;
+	std::condition_variable readable_;
+	std::condition_variable writable_;
+};
+
+cdownload::StreamingExtractor::StreamingExtractor(const path& dirName, const std::string& datasetId,
+                                                  std::size_t pipeCapacity)
+	: dirName_{dirName}
+	, workspace_{nullptr}
+	, datasetId_{datasetId}
+	, pipe_{new Pipe(pipeCapacity)}
+	, input_{pipe_.get()}
+	, readBuffer_(READ_BLOCK_SIZE)
+{
+	thread_ = std::thread([this]() {
+		this->extract();
+	});
+}
+
+cdownload::StreamingExtractor::StreamingExtractor(Workspace& workspace, const std::string& datasetId,
+                                                  std::size_t pipeCapacity)
+	: dirName_{}
+	, workspace_{&workspace}
+	, datasetId_{datasetId}
+	, pipe_{new Pipe(pipeCapacity)}
+	, input_{pipe_.get()}
+	, readBuffer_(READ_BLOCK_SIZE)
+{
+	thread_ = std::thread([this]() {
+		this->extract();
+	});
+}
+
+cdownload::StreamingExtractor::~StreamingExtractor()
+{
+	if (thread_.joinable()) {
+		pipe_->close();
+		thread_.join();
+		if (!result_.empty()) {
+			// extraction was not finished by the owner, the file might be incomplete
+			boost::system::error_code ec;
+			boost::filesystem::remove(result_, ec);
+			if (workspace_) {
+				workspace_->release(result_);
+			}
+		}
+	}
+}
+
+std::uint64_t cdownload::StreamingExtractor::receivedBytes() const
+{
+	return pipe_->writtenBytes();
+}
+
+cdownload::path cdownload::StreamingExtractor::finish()
+{
+	pipe_->close();
+	thread_.join();
+	if (!error_.empty()) {
+		throw std::runtime_error("Can not extract data of " + datasetId_ + " from the downloaded archive: " + error_);
+	}
+	if (result_.empty()) {
+		throw std::runtime_error("Downloaded archive does not contain data of " + datasetId_);
+	}
+	return result_;
+}
+
+ssize_t cdownload::StreamingExtractor::readCallback(struct archive* /*a*/, void* clientData, const void** buffer)
+{
+	StreamingExtractor* self = static_cast<StreamingExtractor*>(clientData);
+	*buffer = self->readBuffer_.data();
+	return static_cast<ssize_t>(self->pipe_->read(self->readBuffer_.data(), self->readBuffer_.size()));
+}
+
+void cdownload::StreamingExtractor::extract()
+{
+	path placed;
+	struct archive* a = archive_read_new();
+	archive_read_support_filter_all(a);
+	archive_read_support_format_all(a);
+	try {
+		if (archive_read_open(a, this, nullptr, &StreamingExtractor::readCallback, nullptr) != ARCHIVE_OK) {
+			error_ = archive_error_string(a) ? archive_error_string(a) : "can not open archive";
+		} else {
+			// the workspace learns the file size from the archive entry header
+			result_ = extractMatchingEntry(a, [this, &placed](const path& name, std::uint64_t size) {
+				placed = workspace_ ? workspace_->reserve(name, size) : dirName_ / name;
+				return placed;
+			}, datasetId_);
+		}
+	} catch (std::exception& ex) {
+		error_ = ex.what();
+		if (workspace_ && !placed.empty()) {
+			workspace_->release(placed);
+		}
+	}
+	archive_read_free(a);
+	// the remaining entries are not needed
+	pipe_->abandon();
+}
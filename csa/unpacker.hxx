@@ -25,8 +25,23 @@
 
 #include "../util.hxx"
 
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+struct archive;
+
 namespace cdownload {
 
+	class Workspace;
+
 	//! Unpacks downloaded .tar.gz file, removes everything except the
     //! data file (which is found by datasetId in its name
 	path extractDataFile(const boost::filesystem::path& fileName,
@@ -36,6 +51,59 @@ namespace cdownload {
 	DownloadedChunkFile extractAndAccureDataFile(const boost::filesystem::path& fileName,
 	                     const boost::filesystem::path& dirName,
 	                     const std::string& datasetId, const std::string& fileId = "");
+
+	/**
+	 * @brief Extracts the data file from an archive while it is being downloaded
+	 *
+	 * Bytes written to input() go through a bounded in-memory pipe to libarchive, which runs in
+	 * its own thread, thus the compressed archive is never stored. A writer blocks while the pipe
+	 * is full, except for downloads, which are paused meanwhile (see curl::NonBlockingStreamBuf).
+	 * Once the data file is extracted (or extraction fails), the rest of the input is discarded.
+	 */
+	class StreamingExtractor {
+	public:
+		static constexpr const std::size_t DEFAULT_PIPE_CAPACITY = 16 << 20; // 16 MiB
+
+		StreamingExtractor(const path& dirName, const std::string& datasetId,
+		                   std::size_t pipeCapacity = DEFAULT_PIPE_CAPACITY);
+		//! Extracts into the workspace, which reserves room for the file by the archive entry size
+		StreamingExtractor(Workspace& workspace, const std::string& datasetId,
+		                   std::size_t pipeCapacity = DEFAULT_PIPE_CAPACITY);
+		//! Abandons extraction if finish() was not called
+		~StreamingExtractor();
+
+		StreamingExtractor(const StreamingExtractor&) = delete;
+		StreamingExtractor& operator=(const StreamingExtractor&) = delete;
+
+		std::ostream& input() {
+			return input_;
+		}
+
+		//! Number of bytes written to input() so far
+		std::uint64_t receivedBytes() const;
+
+		/**
+		 * @brief Signals end of input and waits for extraction to complete
+		 *
+		 * @return name of the extracted file
+		 */
+		path finish();
+
+	private:
+		class Pipe;
+		static ssize_t readCallback(struct archive* a, void* clientData, const void** buffer);
+		void extract();
+
+		path dirName_;
+		Workspace* workspace_;
+		std::string datasetId_;
+		std::unique_ptr<Pipe> pipe_;
+		std::ostream input_;
+		std::vector<char> readBuffer_;
+		path result_;
+		std::string error_;
+		std::thread thread_;
+	};
 }
 
 #endif // CDWONLOAD_UPACKER_HXX
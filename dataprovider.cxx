@@ -26,6 +26,11 @@
 
 cdownload::DataProvider::~DataProvider() = default;
 
+void cdownload::DataProvider::prepare(const std::vector<DatasetName>& /*datasets*/, const Parameters& /*parameters*/,
+                                      const datetime& /*startTime*/, const datetime& /*endTime*/) const
+{
+}
+
 cdownload::DataProviderRegistry& cdownload::DataProviderRegistry::instance()
 {
 	static DataProviderRegistry instance;
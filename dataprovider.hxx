@@ -37,6 +37,13 @@ namespace cdownload {
 	public:
 		virtual std::unique_ptr<Metadata> metadata() const = 0;
 		virtual std::unique_ptr<DataSource> datasource(const DatasetName& dataset, const Parameters& parameters) const = 0;
+		/**
+		 * @brief Called once before data sources are created
+		 *
+		 * The provider may fetch data for the time range in bulk here. Does nothing by default.
+		 */
+		virtual void prepare(const std::vector<DatasetName>& datasets, const Parameters& parameters,
+		                     const datetime& startTime, const datetime& endTime) const;
 
 		virtual ~DataProvider();
 	};
@@ -23,11 +23,18 @@
 #include "datareader.hxx"
 
 #include "datasource.hxx"
+#include "derived.hxx"
 #include "cdf/reader.hxx"
 #include "filters/timefilter.hxx"
+#include "floatcomparison.hxx"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <string>
 
 #ifndef NDEBUG
 #include <boost/lexical_cast.hpp>
@@ -37,6 +44,10 @@
 #include "config.h"
 
 constexpr const std::size_t INVALID_INDEX = static_cast<std::size_t>(-1);
+//! Filters are reordered after every that many tested records
+constexpr const std::size_t FILTER_REORDER_PERIOD = 4096;
+//! Duration of every that many filter calls is measured
+constexpr const std::size_t FILTER_TIMING_PERIOD = 64;
 
 cdownload::DataReader::~DataReader() = default;
 
@@ -52,6 +63,7 @@ cdownload::DataReader::DataReader(const datetime& startTime, const datetime& end
 	, readers_{}
 	, filters_{filters}
 	, fields_{fields}
+	, derivedVariables_{nullptr}
 	, state_{ReaderState::OK}
 	, timeFilter_{timeFilter}
 {
@@ -71,7 +83,16 @@ cdownload::DataReader::DataReader(const datetime& startTime, const datetime& end
 	// averaging cells array)
 
 	for (const std::pair<DatasetName, std::vector<ProductName> >& p: productsToRead) {
-		auto datasource = datasources_.at(p.first);
+		auto datasourceIter = datasources_.find(p.first);
+		if (datasourceIter == datasources_.end()) {
+			throw std::runtime_error("No data source for dataset '" + p.first + '\'');
+		}
+		if (!datasourceIter->second) {
+			// the dataset is read by another reader, we keep offsets of the fields anyway
+			bufferPointers_.insert(bufferPointers_.end(), p.second.size(), nullptr);
+			continue;
+		}
+		auto datasource = datasourceIter->second;
 		datasource->setNextChunkStartTime(startTime_);
 		auto chunk = datasource->nextChunk();
 		assert(!chunk.empty());
@@ -79,28 +100,55 @@ cdownload::DataReader::DataReader(const datetime& startTime, const datetime& end
 		CDF::Info info {cdf};
 		std::vector<ProductName> variablesToReadFromDataset; // those we export plus timestamp
 		std::vector<std::size_t> variableIndicies;
+		std::vector<std::size_t> productVariables;
 
 		const auto timestampVarName = info.timestampVariableName();
-		const auto timeStampVarIter = std::find(p.second.begin(), p.second.end(), timestampVarName);
-		bool timestampIsInOutput = timeStampVarIter != p.second.end();
-		std::size_t timeStampVarIndex =
-			timestampIsInOutput ? static_cast<std::size_t>(std::distance(p.second.begin(), timeStampVarIter)) : 0;
-
-		if (!timestampIsInOutput) {
+		if (std::find(p.second.begin(), p.second.end(), timestampVarName) == p.second.end()) {
 			variablesToReadFromDataset.push_back(info.timestampVariableName());
 			variableIndicies.push_back(INVALID_INDEX);
 		}
-		std::transform(p.second.begin(), p.second.end(), std::back_inserter(variablesToReadFromDataset),
-		               [](const ProductName& pr) {return pr.name();});
 
+		std::vector<std::size_t> transformedCellIndicies;
+		std::vector<ProductName> transformedProducts;
 		for (std::size_t i = 0; i < p.second.size(); ++i) {
 			const ProductName& pr = p.second[i];
 			auto keyIterator = std::find(orderedProducts.begin(), orderedProducts.end(), pr);
 			if (keyIterator == orderedProducts.end()) {
 				throw std::logic_error("Error initializing DataReader: can not find product key '" + pr.name() + '\'');
 			}
-			variableIndicies.push_back(static_cast<std::size_t>(std::distance(orderedProducts.begin(), keyIterator)));
+			const std::size_t cellIndex = static_cast<std::size_t>(std::distance(orderedProducts.begin(), keyIterator));
+			if (CoordinateTransform::isTransformedProduct(pr)) {
+				// computed from the source vector after reading
+				transformedCellIndicies.push_back(cellIndex);
+				transformedProducts.push_back(pr);
+				productVariables.push_back(INVALID_INDEX);
+				continue;
+			}
+			productVariables.push_back(variablesToReadFromDataset.size());
+			variablesToReadFromDataset.push_back(pr.name());
+			variableIndicies.push_back(cellIndex);
+		}
+
+		std::vector<TransformedProduct> transforms;
+		for (const ProductName& pr: transformedProducts) {
+			const ProductName source = CoordinateTransform::sourceProduct(pr);
+			auto sourceIter = std::find(variablesToReadFromDataset.begin(), variablesToReadFromDataset.end(), source);
+			if (sourceIter == variablesToReadFromDataset.end()) {
+				variablesToReadFromDataset.push_back(source);
+				variableIndicies.push_back(INVALID_INDEX);
+				sourceIter = std::prev(variablesToReadFromDataset.end());
+			}
+			const FieldDesc& sourceDesc = info.variable(source.name());
+			CoordinateTransform::describe(pr, sourceDesc); // validates the source
+			transforms.push_back({CoordinateTransform(CoordinateTransform::system(pr)),
+				static_cast<std::size_t>(std::distance(variablesToReadFromDataset.begin(), sourceIter)),
+				sourceDesc.dataSize() == sizeof(float), sourceDesc.fillValue(),
+				std::unique_ptr<double[]>(new double[3])});
 		}
+		variableIndicies.insert(variableIndicies.end(), transformedCellIndicies.begin(), transformedCellIndicies.end());
+
+		const std::size_t timeStampVarIndex = static_cast<std::size_t>(std::distance(variablesToReadFromDataset.begin(),
+			std::find(variablesToReadFromDataset.begin(), variablesToReadFromDataset.end(), timestampVarName)));
 
 		std::unique_ptr<CDF::Reader> reader {new CDF::Reader {cdf, variablesToReadFromDataset}};
 		auto indexToStartFrom = reader->findTimestamp(startTime_.milliseconds(), 0);
@@ -108,9 +156,10 @@ cdownload::DataReader::DataReader(const datetime& startTime, const datetime& end
 			BOOST_LOG_TRIVIAL(debug) << "Fast-forward to record " << indexToStartFrom << " for " << p.first;
 		}
 
-		const std::size_t firstVarIndex = timestampIsInOutput ? 0 : 1;
-		for (std::size_t i = firstVarIndex; i < variablesToReadFromDataset.size(); ++i) {
-			bufferPointers_.push_back(reader->bufferForVariable(i));
+		const std::size_t firstBufferIndex = bufferPointers_.size();
+		for (std::size_t i = 0, t = 0; i < productVariables.size(); ++i) {
+			bufferPointers_.push_back(productVariables[i] != INVALID_INDEX ?
+				reader->bufferForVariable(productVariables[i]) : transforms[t++].values.get());
 		}
 
 		std::vector<std::shared_ptr<RawDataFilter>> filtersForDataset;
@@ -134,12 +183,45 @@ cdownload::DataReader::DataReader(const datetime& startTime, const datetime& end
 
 		DataSetReadingContext st (p.first, std::move(reader), variableIndicies,timeStampVarIndex,
 			filtersForDataset, datasource, variablesToReadFromDataset);
+		std::size_t datasetValuesCount = 0;
+		for (const ProductName& pr: p.second) {
+			auto fi = std::find_if(fields_.begin(), fields_.end(), [&pr](const Field& f) {return f.name() == pr;});
+			if (fi != fields_.end()) {
+				datasetValuesCount += fi->elementCount();
+			}
+		}
+		for (FilterStatistics& stat: st.filterStatistics) {
+			// filters without products examine the whole record
+			std::size_t valuesCount = 0;
+			for (const ProductName& pr: filtersForDataset[stat.position]->requiredProducts()) {
+				auto fi = std::find_if(fields_.begin(), fields_.end(), [&pr](const Field& f) {return f.name() == pr;});
+				if (pr.dataset() == p.first && fi != fields_.end()) {
+					valuesCount += fi->elementCount();
+				}
+			}
+			stat.cost = 1 + (valuesCount ? valuesCount : datasetValuesCount);
+		}
 		st.readRecordsCount = indexToStartFrom;
+		st.firstBufferIndex = firstBufferIndex;
+		st.productVariables = std::move(productVariables);
+		st.transforms = std::move(transforms);
+		openZoneMap(st, chunk.file, cdf);
+		st.chunk = chunk;
 
 		readers_[p.first] = std::move(st);
 	}
 }
 
+cdownload::DataReader::DataReader(const datetime& startTime, const datetime& endTime,
+                                  const Filters::TimeFilter* timeFilter)
+	: startTime_{startTime}
+	, endTime_{endTime}
+	, derivedVariables_{nullptr}
+	, state_{ReaderState::OK}
+	, timeFilter_{timeFilter}
+{
+}
+
 bool cdownload::DataReader::fail() const
 {
 	return static_cast<int>(state_) & static_cast<int>(ReaderState::Fail);
@@ -159,6 +241,16 @@ cdownload::DataReader::DataSetReadingContext::DataSetReadingContext()
 	, lastReadTimeStamp(0)
 	, filters()
 	, eof(false)
+	, zoneMapBlock(INVALID_INDEX)
+	, zoneMapBlockRejected(false)
+	, timeRangeIndex(0)
+	, timeFilterCursor(0)
+	, filterStatistics()
+	, batchVerdicts()
+	, filteredRecordsCount(0)
+	, firstBufferIndex(0)
+	, productVariables()
+	, transforms()
 {
 }
 
@@ -180,7 +272,21 @@ cdownload::DataReader::DataSetReadingContext::DataSetReadingContext(const Datase
 	, eof(false)
 	, datasource(adatasource)
 	, variablesToReadFromDataset(variablesToReadFromDatasetParam)
+	, zoneMapBlock(INVALID_INDEX)
+	, zoneMapBlockRejected(false)
+	, timeRangeIndex(0)
+	, timeFilterCursor(0)
+	, filterStatistics()
+	, batchVerdicts()
+	, filteredRecordsCount(0)
+	, firstBufferIndex(0)
+	, productVariables()
+	, transforms()
 {
+	for (std::size_t i = 0; i < filters.size(); ++i) {
+		filterStatistics.push_back({filters[i]->name(), aDataset, 0, 0, 0, 0., 1, i});
+		batchVerdicts.push_back({filters[i]->testsBatches(aDataset), 0, 0, {}});
+	}
 }
 
 bool cdownload::DataReader::advanceDataSource(cdownload::DataReader::DataSetReadingContext& context)
@@ -192,9 +298,236 @@ bool cdownload::DataReader::advanceDataSource(cdownload::DataReader::DataSetRead
 	CDF::File cdfFile(nextChunk.file);
 	context.reader.reset(new CDF::Reader(cdfFile, context.variablesToReadFromDataset));
 	context.readRecordsCount = 0;
+	for (BatchVerdicts& v: context.batchVerdicts) {
+		v.recordsCount = 0;
+	}
+	updateBufferPointers(context);
+	openZoneMap(context, nextChunk.file, cdfFile);
+	// the previous chunk is read completely, its file is removed now unless it is cached
+	context.chunk = nextChunk;
 	return true;
 }
 
+void cdownload::DataReader::updateBufferPointers(DataSetReadingContext& context)
+{
+	for (std::size_t i = 0; i < context.productVariables.size(); ++i) {
+		if (context.productVariables[i] != INVALID_INDEX) {
+			bufferPointers_[context.firstBufferIndex + i] = context.reader->bufferForVariable(context.productVariables[i]);
+		}
+	}
+}
+
+void cdownload::DataReader::applyTransforms(DataSetReadingContext& context, double epoch)
+{
+	for (TransformedProduct& t: context.transforms) {
+		const void* buffer = context.reader->bufferForVariable(t.sourceVariable);
+		double gse[3];
+		bool fill = false;
+		for (std::size_t i = 0; i < 3; ++i) {
+			if (t.sourceIsFloat) {
+				const float value = static_cast<const float*>(buffer)[i];
+				fill |= gtest::areFloatsEqual(value, static_cast<float>(t.sourceFillValue), 1);
+				gse[i] = static_cast<double>(value);
+			} else {
+				gse[i] = static_cast<const double*>(buffer)[i];
+				fill |= gtest::areFloatsEqual(gse[i], t.sourceFillValue, 1);
+			}
+		}
+		if (fill) {
+			std::fill_n(t.values.get(), 3, std::numeric_limits<double>::quiet_NaN());
+		} else {
+			t.transform.apply(epoch, gse, t.values.get());
+		}
+	}
+}
+
+void cdownload::DataReader::openZoneMap(DataSetReadingContext& context, const DownloadedChunkFile& chunkFile,
+                                         const CDF::File& file)
+{
+	context.zoneMap.reset();
+	context.zoneMapBlock = INVALID_INDEX;
+	// transient chunks are read once: building their maps would decode the variables twice,
+	// and a stored map would be an orphan after the chunk is removed
+	if (chunkFile.transient()) {
+		return;
+	}
+	std::vector<std::string> variables;
+	for (const auto& f: context.filters) {
+		if (!f->usesZoneMaps()) {
+			continue;
+		}
+		for (const ProductName& pr: f->requiredProducts()) {
+			if (pr.dataset() == context.datasetName && !CoordinateTransform::isTransformedProduct(pr) &&
+			    std::find(variables.begin(), variables.end(), pr.name()) == variables.end()) {
+				variables.push_back(pr.name());
+			}
+		}
+	}
+	if (variables.empty()) {
+		return;
+	}
+	const std::string& timestampVariable = context.variablesToReadFromDataset[context.timestampVariableIndex].name();
+	context.zoneMap.reset(new CDF::ZoneMap(chunkFile.fileName(), file, variables, timestampVariable));
+}
+
+bool cdownload::DataReader::blockRejected(DataSetReadingContext& context, std::size_t record)
+{
+	const std::size_t block = CDF::ZoneMap::blockForRecord(record);
+	if (block != context.zoneMapBlock) {
+		context.zoneMapBlock = block;
+		context.zoneMapBlockRejected = false;
+		if (block < context.zoneMap->blocksCount() && context.zoneMap->block(block).recordsCount) {
+			for (const auto& f: context.filters) {
+				if (f->rejectsBlock(*context.zoneMap, block)) {
+					context.zoneMapBlockRejected = true;
+					break;
+				}
+			}
+		}
+	}
+	return context.zoneMapBlockRejected;
+}
+
+bool cdownload::DataReader::skipToAllowedTimeRange(DataSetReadingContext& context, std::size_t record, double epoch)
+{
+	if (!context.datasource || !context.datasource->timeRangesRestricted()) {
+		return false;
+	}
+	const std::vector<EpochRange>& ranges = context.datasource->timeRanges();
+	while (context.timeRangeIndex < ranges.size() && ranges[context.timeRangeIndex].end() < epoch) {
+		++context.timeRangeIndex;
+	}
+	if (context.timeRangeIndex < ranges.size() && ranges[context.timeRangeIndex].begin() <= epoch) {
+		return false;
+	}
+	const double nextAllowedEpoch = context.timeRangeIndex < ranges.size() ?
+		ranges[context.timeRangeIndex].begin() : std::numeric_limits<double>::max();
+	// findTimestamp() returns the last record before the range, which we skip too
+	context.readRecordsCount = std::max(context.reader->findTimestamp(nextAllowedEpoch, record), record + 1);
+	return true;
+}
+
+void cdownload::DataReader::setDerivedVariables(const DerivedVariables& derived, const std::vector<void*>& columns)
+{
+	derivedVariables_ = &derived;
+	filterVariables_ = columns;
+}
+
+bool cdownload::DataReader::testFilters(DataSetReadingContext& context)
+{
+	if (derivedVariables_) {
+		derivedVariables_->compute(bufferPointers(), context.datasetName, filterVariables());
+	}
+
+	using clock = std::chrono::steady_clock;
+	const bool timed = context.filteredRecordsCount % FILTER_TIMING_PERIOD == 0;
+	bool passed = true;
+	for (std::size_t i = 0; i < context.filters.size() && passed; ++i) {
+		FilterStatistics& stat = context.filterStatistics[i];
+		const clock::time_point start = timed ? clock::now() : clock::time_point();
+		BatchVerdicts& verdicts = context.batchVerdicts[stat.position];
+		passed = verdicts.used ?
+			testInBatch(context, *context.filters[i], verdicts) :
+			context.filters[i]->test(bufferPointers(), context.datasetName, filterVariables());
+		if (timed) {
+			stat.seconds += std::chrono::duration<double>(clock::now() - start).count();
+			++stat.timedCalls;
+		}
+		++stat.tested;
+		if (passed) {
+			++stat.passed;
+		}
+#ifdef DEBUG_LOG_EVERY_CELL
+		else {
+			BOOST_LOG_TRIVIAL(trace) << "\t Rejected by " << context.filters[i]->name() << " filter";
+		}
+#endif
+	}
+
+	if (++context.filteredRecordsCount % FILTER_REORDER_PERIOD == 0) {
+		reorderFilters(context);
+	}
+	return passed;
+}
+
+bool cdownload::DataReader::testInBatch(DataSetReadingContext& context, const RawDataFilter& filter,
+                                        BatchVerdicts& verdicts)
+{
+	// the record being tested
+	const std::size_t record = context.readRecordsCount - 1;
+	if (record < verdicts.firstRecord || record >= verdicts.firstRecord + verdicts.recordsCount) {
+		const std::size_t end = std::max(context.reader->bufferedRecordsEnd(record), record + 1);
+		batchValues_.clear();
+		for (std::size_t r = record; r < end; ++r) {
+			// the current record is read and transformed already, the rest are in memory
+			if (r != record) {
+				if (!context.reader->readRecord(r, false)) {
+					throw std::runtime_error("Could not read buffered record " + std::to_string(r) +
+					                         " of dataset " + context.datasetName);
+				}
+				applyTransforms(context,
+					*static_cast<const double*>(context.reader->bufferForVariable(context.timestampVariableIndex)));
+			}
+			filter.appendBatchValues(bufferPointers(), context.datasetName, batchValues_);
+		}
+		if (end > record + 1) {
+			context.reader->readRecord(record, false);
+			applyTransforms(context,
+				*static_cast<const double*>(context.reader->bufferForVariable(context.timestampVariableIndex)));
+		}
+		verdicts.firstRecord = record;
+		verdicts.recordsCount = end - record;
+		verdicts.passed.assign((verdicts.recordsCount + 63) / 64, 0);
+		filter.testBatch(batchValues_, context.datasetName, verdicts.recordsCount, verdicts.passed.data());
+	}
+	const std::size_t bit = record - verdicts.firstRecord;
+	return (verdicts.passed[bit / 64] >> (bit % 64)) & 1;
+}
+
+void cdownload::DataReader::reorderFilters(DataSetReadingContext& context)
+{
+	// For independent filters, the expected work is minimal when they go in descending order of
+	// rejection probability per unit of cost. Costs are estimated by the number of the examined values
+	// rather than by the measured durations, so that the order depends on the data only.
+	std::vector<std::size_t> order(context.filters.size());
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	auto rank = [&context](std::size_t i) {
+		const FilterStatistics& stat = context.filterStatistics[i];
+		// filters which were not reached yet are assumed to reject a half of records
+		const double rejectionRate = static_cast<double>(stat.tested - stat.passed + 1) /
+			static_cast<double>(stat.tested + 2);
+		return rejectionRate / static_cast<double>(stat.cost);
+	};
+	std::sort(order.begin(), order.end(), [&context, &rank](std::size_t a, std::size_t b) {
+		const double rankA = rank(a);
+		const double rankB = rank(b);
+		if (rankA > rankB || rankA < rankB) {
+			return rankA > rankB;
+		}
+		return context.filterStatistics[a].position < context.filterStatistics[b].position;
+	});
+
+	std::vector<std::shared_ptr<RawDataFilter> > filters;
+	std::vector<FilterStatistics> statistics;
+	for (std::size_t i: order) {
+		filters.push_back(context.filters[i]);
+		statistics.push_back(context.filterStatistics[i]);
+	}
+	context.filters.swap(filters);
+	context.filterStatistics.swap(statistics);
+}
+
+std::vector<cdownload::DataReader::FilterStatistics> cdownload::DataReader::filterStatistics() const
+{
+	std::vector<FilterStatistics> res;
+	for (const auto& ds: readers_) {
+		res.insert(res.end(), ds.second.filterStatistics.begin(), ds.second.filterStatistics.end());
+	}
+	return res;
+}
+
 void cdownload::DataReader::setStateFlag(cdownload::DataReader::ReaderState flag, bool on)
 {
 	if (on) {
@@ -259,7 +592,23 @@ cdownload::AveragingDataReader::readNextCell(const datetime& cellStart, cdownloa
 		}
 		ds.lastReadTimeStamp = epoch;
 
-		if (timeFilter() && !timeFilter()->test(epoch)) {
+		if (skipToAllowedTimeRange(ds, ds.readRecordsCount - 1, epoch)) {
+			continue;
+		}
+
+		if (ds.zoneMap && blockRejected(ds, ds.readRecordsCount - 1)) {
+			// none of the block records passes the filters, skip the rest of the block at once
+			// if it does not go beyond the output cell
+			const CDF::ZoneMap::Block& block = ds.zoneMap->block(ds.zoneMapBlock);
+			if (block.maxEpoch <= outputCell.end()) {
+				ds.readRecordsCount = static_cast<std::size_t>(block.firstRecord + block.recordsCount);
+				epoch = std::max(epoch, block.maxEpoch);
+				ds.lastReadTimeStamp = epoch;
+			}
+			continue;
+		}
+
+		if (timeFilter() && !timeFilter()->test(epoch, ds.timeFilterCursor)) {
 			continue;
 		}
 
@@ -267,22 +616,12 @@ cdownload::AveragingDataReader::readNextCell(const datetime& cellStart, cdownloa
 		if (!readOk) {
 			return CellReadStatus::ReadError;
 		}
+		applyTransforms(ds, epoch);
 
 		assert(outputCell.contains(epoch));
 
-		bool filtersPassed = true;
 		// the record was read successfully and belongs to the current output cell -> test by filters
-		for (const auto& f: ds.filters) {
-			if (!f->test(bufferPointers(), ds.datasetName, filterVariables())) {
-				filtersPassed = false;
-#ifdef DEBUG_LOG_EVERY_CELL
-				BOOST_LOG_TRIVIAL(trace) << "\t Rejected by " << f->name() << " filter";
-#endif
-				break;
-			}
-		}
-
-		if (!filtersPassed) {
+		if (!testFilters(ds)) {
 			continue;
 		} else {
 			anyRecordSurviedFiltering = true;
@@ -291,7 +630,7 @@ cdownload::AveragingDataReader::readNextCell(const datetime& cellStart, cdownloa
 		// warning: it is important to set lastReadTimeStamp after filtering!
 		// otherwise we might consider filtered out record as valid one on the next cycle step
 
-		copyValuesToAveragingCells(ds);
+		addRecord(ds, epoch);
 	} while (outputCell.end() > epoch); // which means that currentDatasetCell completely falls inside of outputCell
 	return anyRecordSurviedFiltering ? CellReadStatus::OK : CellReadStatus::NoRecordSurviedFiltering;
 
@@ -305,7 +644,13 @@ cdownload::datetime cdownload::AveragingDataReader::cellMidTime() const
 }
 #endif
 
-void cdownload::AveragingDataReader::copyValuesToAveragingCells(const cdownload::DataReader::DataSetReadingContext& ds)
+void cdownload::AveragingDataReader::addRecord(const cdownload::DataReader::DataSetReadingContext& ds, EpochRange::EpochType)
+{
+	copyValuesToAveragingCells(ds, cells_);
+}
+
+void cdownload::AveragingDataReader::copyValuesToAveragingCells(const cdownload::DataReader::DataSetReadingContext& ds,
+	std::vector<AveragedVariable>& cells)
 {
 	// test finished successfully -> append to the averaging cell
 		// TODO: optimize inner loops
@@ -315,7 +660,7 @@ void cdownload::AveragingDataReader::copyValuesToAveragingCells(const cdownload:
 			continue;
 		}
 		Field& f = fields()[cellIndex];
-		AveragedVariable& av = cells_[cellIndex];
+		AveragedVariable& av = cells[cellIndex];
 		switch (f.dataType()) {
 			case FieldDesc::DataType::Real:
 				for (std::size_t i = 0; i < f.elementCount(); ++i) {
@@ -373,6 +718,7 @@ std::pair<bool,cdownload::datetime> cdownload::AveragingDataReader::readNextCell
 #ifdef DEBUG_LOG_EVERY_CELL
 	BOOST_LOG_TRIVIAL(trace) << "Cell " << currentStartTime_ << " +- " << cellLength_ << " read " << anyCellWasReadSuccesfully;
 #endif
+	const datetime cellMidTime = currentStartTime_ + cellLength_ / 2;
 	currentStartTime_ += cellLength_;
 	if (eofInOneOfTheDatasets) {
 		setStateFlag(ReaderState::EoF);
@@ -390,9 +736,263 @@ std::pair<bool,cdownload::datetime> cdownload::AveragingDataReader::readNextCell
 		setStateFlag(ReaderState::EoF, eof);
 	}
 
-	return {anyCellWasReadSuccesfully, currentStartTime_ + cellLength_ / 2};
+	return {anyCellWasReadSuccesfully, cellMidTime};
+}
+
+// IntervalAveragingDataReader
+
+cdownload::IntervalAveragingDataReader::IntervalAveragingDataReader(const datetime& startTime, const datetime& endTime, timeduration sliceLength, const std::vector<EpochRange>& intervals, const std::vector<std::shared_ptr<RawDataFilter> >& filters, std::map<DatasetName, std::shared_ptr<DataSource> >& datasources, const DatasetProductsMap& fieldsToRead, std::vector<AveragedVariable>& cells, const std::vector<Field>& fields, const Filters::TimeFilter* timeFilter)
+	: base(startTime, endTime, sliceLength, filters, datasources, fieldsToRead, cells, fields, timeFilter)
+	, intervals_{intervals}
+	, tree_{intervals}
+	, intervalsByEnd_(intervals.size())
+	, nextIntervalToFinish_{0}
+	, currentInterval_{INVALID_INDEX}
+	, currentSliceStart_{startTime}
+	, dataExhausted_{false}
+{
+	for (std::size_t i = 0; i < intervalsByEnd_.size(); ++i) {
+		intervalsByEnd_[i] = i;
+	}
+	std::stable_sort(intervalsByEnd_.begin(), intervalsByEnd_.end(), [this](std::size_t left, std::size_t right) {
+		return intervals_[left].end() < intervals_[right].end();
+	});
+}
+
+void cdownload::IntervalAveragingDataReader::addRecord(const cdownload::DataReader::DataSetReadingContext& ds, EpochRange::EpochType epoch)
+{
+	tree_.findContaining(epoch, containingIntervals_);
+	for (std::size_t interval: containingIntervals_) {
+		auto it = openIntervals_.find(interval);
+		if (it == openIntervals_.end()) {
+			// a fresh copy of the cells, all of which are empty after scheduleReset()
+			it = openIntervals_.insert(std::make_pair(interval, cells())).first;
+			for (AveragedVariable& cell: it->second) {
+				cell.scheduleReset();
+			}
+		}
+		copyValuesToAveragingCells(ds, it->second);
+	}
+}
+
+void cdownload::IntervalAveragingDataReader::readNextSlice()
+{
+	if (currentSliceStart_ >= endTime()) {
+		dataExhausted_ = true;
+		return;
+	}
+	// unlike the fixed cells, every record counts on its own here, thus a dataset without
+	// data in the slice does not prevent reading the others
+	for (auto& dsp: readers()) {
+		if (base::readNextCell(currentSliceStart_, dsp.second) == CellReadStatus::EoF) {
+			dataExhausted_ = true;
+		}
+	}
+	currentSliceStart_ += cellLength();
+}
+
+std::pair<bool,cdownload::datetime> cdownload::IntervalAveragingDataReader::readNextCell()
+{
+	while (nextIntervalToFinish_ < intervalsByEnd_.size()) {
+		const std::size_t interval = intervalsByEnd_[nextIntervalToFinish_];
+		const EpochRange& range = intervals_[interval];
+		if (!dataExhausted_ && range.end() >= currentSliceStart_.milliseconds()) {
+			readNextSlice();
+			continue;
+		}
+
+		// the data stream has passed the interval end, no more records may come into it
+		++nextIntervalToFinish_;
+		currentInterval_ = interval;
+		auto it = openIntervals_.find(interval);
+		if (it == openIntervals_.end()) {
+			return {false, datetime(range.mid())};
+		}
+		std::swap(cells(), it->second);
+		openIntervals_.erase(it);
+		return {true, datetime(range.mid())};
+	}
+	setStateFlag(ReaderState::EoF);
+	return {false, datetime()};
+}
+
+// JointAveragingDataReader
+
+namespace {
+	//! Number of cells each group reads ahead in its own thread
+	constexpr const std::size_t READ_AHEAD_CELLS = 256;
+}
+
+struct cdownload::JointAveragingDataReader::GroupContext {
+	struct Cell {
+		bool ok;
+		std::vector<AveragedVariable> values; // for the group columns only
+	};
+
+	std::string name;
+	bool required;
+	std::vector<std::shared_ptr<AveragedDataFilter> > filters;
+	std::map<DatasetName, std::shared_ptr<DataSource> > datasources;
+	std::vector<std::size_t> columns;
+	std::vector<AveragedVariable> cells;
+	std::unique_ptr<AveragingDataReader> reader;
+	std::vector<Cell> readAhead;
+
+	void readBatch()
+	{
+		readAhead.clear();
+		while (readAhead.size() < READ_AHEAD_CELLS && !reader->eof() && !reader->fail()) {
+			const bool ok = reader->readNextCell().first;
+			readAhead.push_back({ok, {}});
+			if (ok) {
+				std::vector<AveragedVariable>& values = readAhead.back().values;
+				values.reserve(columns.size());
+				for (std::size_t column: columns) {
+					values.push_back(cells[column]);
+				}
+			}
+		}
+	}
+};
+
+cdownload::JointAveragingDataReader::JointAveragingDataReader(const datetime& startTime, const datetime& endTime, timeduration cellLength, const std::vector<DatasetGroup>& groups, const std::vector<std::shared_ptr<RawDataFilter> >& filters, std::map<DatasetName, std::shared_ptr<DataSource> >& datasources, const DatasetProductsMap& fieldsToRead, std::vector<AveragedVariable>& cells, const std::vector<Field>& fields, std::vector<void*>& filterVariables, const DerivedVariables& derived, const Filters::TimeFilter* timeFilter)
+	: base(startTime, endTime, timeFilter)
+	, currentStartTime_{startTime}
+	, cellLength_{cellLength}
+	, cells_{cells}
+	, filterVariables_{filterVariables}
+	, derived_{derived}
+	, readAheadPosition_{0}
+	, readAheadSize_{0}
+{
+	const std::vector<ProductName> orderedProducts = expandProductsMap(fieldsToRead);
+	for (const DatasetGroup& group: groups) {
+		std::unique_ptr<GroupContext> context {new GroupContext()};
+		context->name = group.name;
+		context->required = group.required;
+		context->filters = group.filters;
+		for (const DatasetName& ds: group.datasets) {
+			auto datasourceIter = datasources.find(ds);
+			if (datasourceIter == datasources.end()) {
+				throw std::runtime_error("No data source for dataset '" + ds + "' of group '" + group.name + '\'');
+			}
+			context->datasources[ds] = datasourceIter->second;
+		}
+		for (std::size_t i = 0; i < orderedProducts.size(); ++i) {
+			if (context->datasources.count(orderedProducts[i].dataset())) {
+				context->columns.push_back(i);
+			}
+		}
+		// datasets of the other groups are read by their own readers
+		for (const DatasetGroup& other: groups) {
+			for (const DatasetName& ds: other.datasets) {
+				context->datasources.insert(std::make_pair(ds, std::shared_ptr<DataSource>()));
+			}
+		}
+		context->cells = cells;
+		context->reader.reset(new AveragingDataReader(startTime, endTime, cellLength, filters,
+			context->datasources, fieldsToRead, context->cells, fields, timeFilter));
+		groups_.push_back(std::move(context));
+	}
+}
+
+cdownload::JointAveragingDataReader::~JointAveragingDataReader() = default;
+
+void cdownload::JointAveragingDataReader::setDerivedVariables(const DerivedVariables& derived,
+                                                              const std::vector<void*>& columns)
+{
+	// a dataset belongs to a single group, hence the group readers update distinct columns
+	for (auto& group: groups_) {
+		group->reader->setDerivedVariables(derived, columns);
+	}
+}
+
+void cdownload::JointAveragingDataReader::readAhead()
+{
+	std::vector<std::future<void>> batches;
+	for (auto& group: groups_) {
+		GroupContext* context = group.get();
+		batches.push_back(std::async(std::launch::async, [context]() {
+			context->readBatch();
+		}));
+	}
+	// get() rethrows exceptions from the reading threads
+	for (auto& batch: batches) {
+		batch.get();
+	}
+
+	readAheadPosition_ = 0;
+	readAheadSize_ = 0;
+	for (const auto& group: groups_) {
+		readAheadSize_ = std::max(readAheadSize_, group->readAhead.size());
+		if (group->reader->fail()) {
+			setStateFlag(ReaderState::Fail);
+		}
+	}
+}
+
+std::pair<bool,cdownload::datetime> cdownload::JointAveragingDataReader::readNextCell()
+{
+	if (readAheadPosition_ == readAheadSize_) {
+		readAhead();
+		if (readAheadSize_ == 0) {
+			setStateFlag(ReaderState::EoF);
+			return {false, datetime()};
+		}
+	}
+
+	std::vector<bool> groupsRead;
+	for (const auto& group: groups_) {
+		groupsRead.push_back(readAheadPosition_ < group->readAhead.size() && group->readAhead[readAheadPosition_].ok);
+		if (groupsRead.back()) {
+			const std::vector<AveragedVariable>& values = group->readAhead[readAheadPosition_].values;
+			for (std::size_t i = 0; i < group->columns.size(); ++i) {
+				cells_[group->columns[i]] = values[i];
+			}
+		}
+	}
+	derived_.compute(cells_, filterVariables_);
+
+	bool requiredGroupsPassed = true;
+	bool anyOptionalGroupPassed = false;
+	for (std::size_t g = 0; g < groups_.size(); ++g) {
+		const auto& group = groups_[g];
+		bool passed = groupsRead[g];
+		if (passed) {
+			for (const auto& filter: group->filters) {
+				if (!filter->test(cells_, filterVariables_)) {
+					passed = false;
+					break;
+				}
+			}
+		}
+		if (!passed) {
+			for (std::size_t column: group->columns) {
+				cells_[column].scheduleReset();
+			}
+		}
+		if (group->required) {
+			requiredGroupsPassed &= passed;
+		} else {
+			anyOptionalGroupPassed |= passed;
+		}
+	}
+
+	++readAheadPosition_;
+	const datetime cellMidTime = currentStartTime_ + cellLength_ / 2;
+	currentStartTime_ += cellLength_;
+	return {requiredGroupsPassed && anyOptionalGroupPassed, cellMidTime};
 }
 
+std::vector<cdownload::DataReader::FilterStatistics> cdownload::JointAveragingDataReader::filterStatistics() const
+{
+	std::vector<FilterStatistics> res;
+	for (const auto& group: groups_) {
+		const std::vector<FilterStatistics> groupStatistics = group->reader->filterStatistics();
+		res.insert(res.end(), groupStatistics.begin(), groupStatistics.end());
+	}
+	return res;
+}
 
 // DirectDataReader
 
@@ -415,7 +1015,15 @@ std::pair<bool,cdownload::datetime> cdownload::DirectDataReader::readNextCell()
 #endif
 
 	while (true) {
+		if (dsContext_->zoneMap && blockRejected(*dsContext_, dsContext_->readRecordsCount)) {
+			const CDF::ZoneMap::Block& block = dsContext_->zoneMap->block(dsContext_->zoneMapBlock);
+			dsContext_->readRecordsCount = static_cast<std::size_t>(block.firstRecord + block.recordsCount);
+			continue;
+		}
 		const bool epochReadOk = dsContext_->reader->readTimeStampRecord(dsContext_->readRecordsCount);
+		if (!epochReadOk && dsContext_->reader->eof() && advanceDataSource(*dsContext_)) {
+			continue;
+		}
 		const double epoch =
 			*static_cast<const double*>(dsContext_->reader->bufferForVariable(dsContext_->timestampVariableIndex)); // EPCH16?
 		if (!epochReadOk || epoch > endTime().milliseconds()) {
@@ -423,7 +1031,11 @@ std::pair<bool,cdownload::datetime> cdownload::DirectDataReader::readNextCell()
 			return {false, datetime()};
 		}
 
-		if (timeFilter() && !timeFilter()->test(epoch)) {
+		if (skipToAllowedTimeRange(*dsContext_, dsContext_->readRecordsCount, epoch)) {
+			continue;
+		}
+
+		if (timeFilter() && !timeFilter()->test(epoch, dsContext_->timeFilterCursor)) {
 			++dsContext_->readRecordsCount;
 			continue;
 		}
@@ -435,20 +1047,10 @@ std::pair<bool,cdownload::datetime> cdownload::DirectDataReader::readNextCell()
 		}
 
 		dsContext_->lastReadTimeStamp = epoch;
+		applyTransforms(*dsContext_, epoch);
 
-		bool filtersPassed = true;
 		// the record was read successfully and belongs to the current output cell -> test by filters
-		for (const auto& f: dsContext_->filters) {
-			if (!f->test(bufferPointers(), dsContext_->datasetName, filterVariables())) {
-				filtersPassed = false;
-#ifdef DEBUG_LOG_EVERY_CELL
-				BOOST_LOG_TRIVIAL(trace) << "\t Rejected by " << f->name() << " filter";
-#endif
-				break;
-			}
-		}
-
-		if (!filtersPassed) {
+		if (!testFilters(*dsContext_)) {
 			continue;
 		}
 
@@ -25,12 +25,18 @@
 
 #include "average.hxx"
 #include "cdf/reader.hxx"
+#include "cdf/zonemap.hxx"
+#include "coordinates.hxx"
+#include "datasource.hxx"
 #include "filter.hxx"
+#include "intervaltree.hxx"
+#include <cstdint>
+#include <map>
 #include <memory>
 
 namespace cdownload {
 
-	class DataSource;
+	class DerivedVariables;
 	class Field;
 	namespace Filters {
 		class TimeFilter;
@@ -59,7 +65,31 @@ namespace cdownload {
 		bool fail() const;
 //      const void* buffer(const ProductName& var) const;
 
+		//! Raw data filter statistics for a dataset, measured while reading
+		struct FilterStatistics {
+			string filter;
+			DatasetName dataset;
+			std::size_t tested;
+			std::size_t passed;
+			std::size_t timedCalls; //!< calls, which duration was measured
+			double seconds; //!< total duration of the timed calls
+			std::size_t cost; //!< number of values the filter examines in a record
+			std::size_t position; //!< position of the filter in the initial order
+		};
+
+		virtual std::vector<FilterStatistics> filterStatistics() const;
+
+		/**
+		 * @brief Computes derived products of every record before the raw filters test it
+		 *
+		 * @param columns buffers of the filter variables, which contain the derived products
+		 */
+		virtual void setDerivedVariables(const DerivedVariables& derived, const std::vector<void*>& columns);
+
 	protected:
+		//! For readers that delegate reading of the datasets to other readers
+		DataReader(const datetime& startTime, const datetime& endTime, const Filters::TimeFilter* timeFilter);
+
 		enum class CellReadStatus {
 			OK,
 			NoRecordSurviedFiltering,
@@ -73,6 +103,23 @@ namespace cdownload {
 			Fail = 2
 		};
 
+		//! Product, computed from a dataset vector by a coordinate transform
+		struct TransformedProduct {
+			CoordinateTransform transform;
+			std::size_t sourceVariable; //!< index in variablesToReadFromDataset
+			bool sourceIsFloat;
+			double sourceFillValue;
+			std::unique_ptr<double[]> values; //!< referenced by bufferPointers
+		};
+
+		//! Results of a filter, which tests records in batches, for the records batched last
+		struct BatchVerdicts {
+			bool used; //!< whether the filter tests records of the dataset in batches
+			std::size_t firstRecord;
+			std::size_t recordsCount;
+			std::vector<std::uint64_t> passed; //!< bitmask, bit i for record firstRecord + i
+		};
+
 		struct DataSetReadingContext {
 			DataSetReadingContext();
 			DataSetReadingContext(const DatasetName& dataset, std::unique_ptr<CDF::Reader>&& reader,
@@ -91,7 +138,19 @@ namespace cdownload {
 			std::vector<std::shared_ptr<RawDataFilter> > filters;
 			bool eof;
 			std::shared_ptr<DataSource> datasource;
+			DatasetChunk chunk; //!< the one being read, keeps a transient file until the next chunk
 			std::vector<ProductName> variablesToReadFromDataset;
+			std::unique_ptr<CDF::ZoneMap> zoneMap; //!< only when some of the filters use it
+			std::size_t zoneMapBlock; //!< last tested block
+			bool zoneMapBlockRejected;
+			std::size_t timeRangeIndex; //!< the current one of the datasource time ranges
+			std::size_t timeFilterCursor;
+			std::vector<FilterStatistics> filterStatistics; //!< in the same order as filters
+			std::vector<BatchVerdicts> batchVerdicts; //!< indexed by FilterStatistics::position
+			std::size_t filteredRecordsCount;
+			std::size_t firstBufferIndex; //!< of the dataset products in bufferPointers
+			std::vector<std::size_t> productVariables; //!< reader variable for each dataset product
+			std::vector<TransformedProduct> transforms;
 		};
 
 		const datetime& startTime() const {
@@ -104,6 +163,31 @@ namespace cdownload {
 
 		bool advanceDataSource(DataSetReadingContext& context);
 
+		//! Computes transformed products from the record, which was just read
+		void applyTransforms(DataSetReadingContext& context, double epoch);
+
+		/**
+		 * @brief Checks by the zone map whether the filters reject every record of the block,
+		 * which contains the given record
+		 */
+		bool blockRejected(DataSetReadingContext& context, std::size_t record);
+
+		/**
+		 * @brief Moves reading position to the next time range of the datasource, if the record,
+		 * which was just read, lies outside of the datasource time ranges
+		 *
+		 * @return true if the record has to be skipped
+		 */
+		bool skipToAllowedTimeRange(DataSetReadingContext& context, std::size_t record, double epoch);
+
+		/**
+		 * @brief Tests the current record by the dataset filters
+		 *
+		 * Filters are reordered periodically by their measured pass rates, such that those, which reject
+		 * most records for the least work, go first.
+		 */
+		bool testFilters(DataSetReadingContext& context);
+
 		const Filters::TimeFilter* timeFilter() const {
 			return timeFilter_;
 		}
@@ -127,6 +211,18 @@ namespace cdownload {
 		void setStateFlag(ReaderState flag, bool on = true);
 
 	private:
+		void openZoneMap(DataSetReadingContext& context, const DownloadedChunkFile& chunkFile, const CDF::File& file);
+		//! Points buffers of the dataset products to the current reader
+		void updateBufferPointers(DataSetReadingContext& context);
+		static void reorderFilters(DataSetReadingContext& context);
+		/**
+		 * @brief Tests the current record by a filter, which tests records in batches
+		 *
+		 * The batch spans records from the current one up to the end of those, which the CDF reader holds
+		 * in memory, and is tested at once when the current record falls outside of the previous batch.
+		 */
+		bool testInBatch(DataSetReadingContext& context, const RawDataFilter& filter, BatchVerdicts& verdicts);
+
 		datetime startTime_;
 		datetime endTime_;
 		std::map<DatasetName, std::shared_ptr<DataSource>> datasources_;
@@ -135,6 +231,8 @@ namespace cdownload {
 		std::vector<const void*> bufferPointers_; // this is for filters, i.e. without time_tags fields
 		std::vector<void*> filterVariables_;
 		std::vector<Field> fields_;
+		const DerivedVariables* derivedVariables_;
+		std::vector<double> batchValues_;
 
 		ReaderState state_;
 // 		datetime lastReadTimeStamp_;
@@ -151,13 +249,112 @@ namespace cdownload {
 		           std::vector<AveragedVariable>& cells,
 		           const std::vector<Field>& fields, const Filters::TimeFilter* timeFilter);
 		std::pair<bool,datetime> readNextCell() override;
-	private:
+	protected:
 		CellReadStatus readNextCell(const datetime& cellStart, DataSetReadingContext& ds);
-		void copyValuesToAveragingCells(const DataSetReadingContext& ds);
+		//! Accumulates the current record, which passed all the filters
+		virtual void addRecord(const DataSetReadingContext& ds, EpochRange::EpochType epoch);
+		void copyValuesToAveragingCells(const DataSetReadingContext& ds, std::vector<AveragedVariable>& cells);
+
+		timeduration cellLength() const {
+			return cellLength_;
+		}
+
+		std::vector<AveragedVariable>& cells() {
+			return cells_;
+		}
+
+	private:
+		datetime currentStartTime_;
+		timeduration cellLength_;
+		std::vector<AveragedVariable>& cells_;
+	};
+
+	/**
+	 * @brief Averages data over arbitrary (possibly overlapping and unsorted) time intervals
+	 *
+	 * Data are streamed once in slices of the cell length; each record is added to every
+	 * interval that contains it. An interval is returned as soon as the data stream passes its end,
+	 * hence intervals come out in the order of their ends.
+	 */
+	class IntervalAveragingDataReader: public AveragingDataReader {
+		using base = AveragingDataReader;
+	public:
+		IntervalAveragingDataReader(const datetime& startTime, const datetime& endTime, timeduration sliceLength,
+		           const std::vector<EpochRange>& intervals,
+		           const std::vector<std::shared_ptr<RawDataFilter> >& filters,
+		           std::map<DatasetName, std::shared_ptr<DataSource>>& datasources,
+		           const DatasetProductsMap& fieldsToRead,
+		           std::vector<AveragedVariable>& cells,
+		           const std::vector<Field>& fields, const Filters::TimeFilter* timeFilter);
+		std::pair<bool,datetime> readNextCell() override;
+
+		//! Index of the interval returned by the last readNextCell() call
+		std::size_t intervalIndex() const {
+			return currentInterval_;
+		}
+
+	private:
+		void addRecord(const DataSetReadingContext& ds, EpochRange::EpochType epoch) override;
+		void readNextSlice();
+
+		std::vector<EpochRange> intervals_;
+		IntervalTree tree_;
+		std::vector<std::size_t> intervalsByEnd_;
+		std::size_t nextIntervalToFinish_;
+		std::size_t currentInterval_;
+		std::map<std::size_t, std::vector<AveragedVariable>> openIntervals_;
+		std::vector<std::size_t> containingIntervals_;
+		datetime currentSliceStart_;
+		bool dataExhausted_;
+	};
+
+	/**
+	 * @brief Datasets averaged together and their own averaged data filters
+	 *
+	 * If a group cell does not pass its filters, the group columns are left empty. Every required group
+	 * has to pass for a cell to be written, and at least one of the others has to as well.
+	 */
+	struct DatasetGroup {
+		std::string name;
+		std::vector<DatasetName> datasets;
+		std::vector<std::shared_ptr<AveragedDataFilter> > filters;
+		bool required;
+	};
+
+	/**
+	 * @brief Averages several dataset groups (e.g. spacecraft) on the same time grid
+	 *
+	 * Each group is read by its own AveragingDataReader; the groups are read concurrently,
+	 * a batch of cells ahead.
+	 */
+	class JointAveragingDataReader: public DataReader {
+		using base = DataReader;
+	public:
+		JointAveragingDataReader(const datetime& startTime, const datetime& endTime, timeduration cellLength,
+		           const std::vector<DatasetGroup>& groups,
+		           const std::vector<std::shared_ptr<RawDataFilter> >& filters,
+		           std::map<DatasetName, std::shared_ptr<DataSource>>& datasources,
+		           const DatasetProductsMap& fieldsToRead,
+		           std::vector<AveragedVariable>& cells,
+		           const std::vector<Field>& fields, std::vector<void*>& filterVariables,
+		           const DerivedVariables& derived, const Filters::TimeFilter* timeFilter);
+		~JointAveragingDataReader();
+		std::pair<bool,datetime> readNextCell() override;
+		std::vector<FilterStatistics> filterStatistics() const override;
+		void setDerivedVariables(const DerivedVariables& derived, const std::vector<void*>& columns) override;
+
+	private:
+		struct GroupContext;
+		void readAhead();
 
+		std::vector<std::unique_ptr<GroupContext> > groups_;
 		datetime currentStartTime_;
 		timeduration cellLength_;
 		std::vector<AveragedVariable>& cells_;
+		std::vector<void*>& filterVariables_;
+		const DerivedVariables& derived_;
+		std::size_t readAheadPosition_;
+		std::size_t readAheadSize_;
 	};
 
 	class DirectDataReader: public DataReader {
@@ -24,13 +24,41 @@
 
 #include <boost/log/trivial.hpp>
 
+#include <algorithm>
+
+namespace {
+	using cdownload::EpochRange;
+
+	//! Both lists have to be normalized
+	std::vector<EpochRange> intersectRanges(const std::vector<EpochRange>& left, const std::vector<EpochRange>& right)
+	{
+		std::vector<EpochRange> res;
+		auto l = left.begin();
+		auto r = right.begin();
+		while (l != left.end() && r != right.end()) {
+			const EpochRange::EpochType begin = std::max(l->begin(), r->begin());
+			const EpochRange::EpochType end = std::min(l->end(), r->end());
+			if (begin <= end) {
+				res.push_back(EpochRange::fromRange(begin, end));
+			}
+			if (l->end() < r->end()) {
+				++l;
+			} else {
+				++r;
+			}
+		}
+		return res;
+	}
+}
+
 bool cdownload::DatasetChunk::empty() const
 {
-	return file.empty();
+	return file.fileName().empty();
 }
 
 cdownload::DataSource::DataSource(const std::string& name, const timeduration& timeGranularity)
 	: eof_{false}
+	, timeRangesRestricted_{false}
 	, timeGranularity_{timeGranularity}
 	, name_{name}
 {
@@ -92,45 +120,55 @@ cdownload::DatasetChunk cdownload::DataSource::nextChunk()
 		setEof();
 		return {};
 	}
-	// step 1: find next cached chunk past lastServedChunkEndTime_
+
+	datetime nextChunkStartTime = lastServedChunkEndTime_ + timeGranularity();
+	datetime maxTime = maxAvailableTime();
+	if (timeRangesRestricted_) {
+		// jump to the first range, which is not over yet
+		auto rangeIter = std::find_if(timeRanges_.begin(), timeRanges_.end(),
+			[&nextChunkStartTime](const EpochRange& r) {
+				return r.end() >= nextChunkStartTime.milliseconds();
+			});
+		if (rangeIter == timeRanges_.end()) {
+			setEof();
+			return {};
+		}
+		if (rangeIter->begin() > nextChunkStartTime.milliseconds()) {
+			nextChunkStartTime = datetime(rangeIter->begin());
+		}
+		maxTime = std::min(maxTime, datetime(rangeIter->end()));
+		if (nextChunkStartTime > maxTime) {
+			setEof();
+			return {};
+		}
+	}
+
+	// step 1: find next cached chunk past nextChunkStartTime
 	// TODO: implement handling of intersecting cached chunks
 	auto nexCachedChunkIter = std::find_if(cachedFiles_.begin(), cachedFiles_.end(),
-		[this](const DatasetChunk& c){
-			return c.endTime > this->lastServedChunkEndTime_ + timeGranularity_;
+		[&nextChunkStartTime](const DatasetChunk& c){
+			return c.endTime >= nextChunkStartTime;
 		});
 
 	// step 2: cache is exhausted, we have to download data if we can
 	DatasetChunk newChunk;
 	if (nexCachedChunkIter == cachedFiles_.end()) {
-		newChunk = getNewChunk(lastServedChunkEndTime_ + timeGranularity(), maxAvailableTime());
+		newChunk = getNewChunk(nextChunkStartTime, maxTime);
 		if (newChunk.empty()) {
 			setEof();
 			return {};
-		} else {
-			return newChunk;
-		}
-#if 0
-		if (!downloader_) {
-			setEof();
-			return {};
-		} else {
-			downloader_->setTimeRange(lastServedChunkEndTime_ + timeGranularity(), maxAvailableTime());
-			return downloadNextChunk();
 		}
-#endif
 	} else {
-		if (lastServedChunkEndTime_ + timeGranularity() < nexCachedChunkIter->startTime) {
+		if (nextChunkStartTime < nexCachedChunkIter->startTime) {
 			// there is a gap in cache, data have to be downloaded
-			newChunk = getNewChunk(lastServedChunkEndTime_ + timeGranularity(),
-												nexCachedChunkIter->startTime - timeGranularity());
+			newChunk = getNewChunk(nextChunkStartTime,
+			                       std::min(maxTime, nexCachedChunkIter->startTime - timeGranularity()));
 
 			if (newChunk.empty()) {
 				throw std::logic_error("Data gap was found when downloading is not permitted");
 			}
-			return newChunk;
 		} else {
-			lastServedChunkEndTime_ = nexCachedChunkIter->endTime;
-			return *nexCachedChunkIter;
+			newChunk = *nexCachedChunkIter;
 		}
 	}
 
@@ -138,6 +176,17 @@ cdownload::DatasetChunk cdownload::DataSource::nextChunk()
 	return newChunk;
 }
 
+void cdownload::DataSource::restrictToTimeRanges(const std::vector<EpochRange>& ranges)
+{
+	if (!timeRangesRestricted_) {
+		timeRanges_ = {EpochRange::fromRange(minAvailableTime().milliseconds(), maxAvailableTime().milliseconds())};
+		timeRangesRestricted_ = true;
+	}
+	timeRanges_ = intersectRanges(timeRanges_, normalizeRanges(ranges));
+	BOOST_LOG_TRIVIAL(debug) << "Datasource for '" << name_ << "' is restricted to " << timeRanges_.size()
+		<< " time ranges";
+}
+
 void cdownload::DataSource::setCache(std::vector<DatasetChunk>&& cache)
 {
 	cachedFiles_ = cache;
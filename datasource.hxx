@@ -24,6 +24,8 @@
 #define CDOWNLOAD_DATASOURCE_HXX
 
 #include "commonDefinitions.hxx"
+#include "epochrange.hxx"
+#include "util.hxx"
 
 #include <memory>
 #include <vector>
@@ -33,7 +35,7 @@ namespace cdownload {
 	struct DatasetChunk {
 		datetime startTime;
 		datetime endTime;
-		path file;
+		DownloadedChunkFile file; //!< transient files are removed when the last copy of the chunk is gone
 
 		bool empty() const;
 	};
@@ -54,6 +56,23 @@ namespace cdownload {
 		bool eof() const;
 		void setNextChunkStartTime(const datetime& startTime);
 
+		/**
+		 * @brief Serves (and downloads) only data within the given time ranges
+		 *
+		 * Chunks outside of the ranges are skipped and new chunks are requested for the ranges only.
+		 * The ranges are intersected with the available time range and with those of the previous calls.
+		 */
+		void restrictToTimeRanges(const std::vector<EpochRange>& ranges);
+
+		bool timeRangesRestricted() const {
+			return timeRangesRestricted_;
+		}
+
+		//! Sorted and disjoint ranges, meaningful only if timeRangesRestricted()
+		const std::vector<EpochRange>& timeRanges() const {
+			return timeRanges_;
+		}
+
 	protected:
 		DataSource(const std::string& name, const timeduration& timeGranularity);
 
@@ -79,6 +98,9 @@ namespace cdownload {
 
 		std::vector<DatasetChunk> cachedFiles_;
 
+		bool timeRangesRestricted_;
+		std::vector<EpochRange> timeRanges_;
+
 		timeduration timeGranularity_;
 		std::string name_;
 	};
@@ -0,0 +1,204 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "derived.hxx"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+cdownload::DatasetName cdownload::DerivedVariables::datasetName()
+{
+	return ProductName::makePseudoDatasetName("DERIVED");
+}
+
+cdownload::ProductName cdownload::DerivedVariables::productName(const string& spacecraft, const string& quantity)
+{
+	return ProductName(datasetName(), spacecraft + '_' + quantity);
+}
+
+std::vector<std::pair<cdownload::string, cdownload::string>>
+cdownload::DerivedVariables::builtinDefinitions(const string& spacecraft)
+{
+	auto data = [&spacecraft](const string& dataset, const string& name) {
+		return ProductName(dataset, spacecraft, name).name();
+	};
+	auto derived = [&spacecraft](const string& quantity) {
+		return productName(spacecraft, quantity).name();
+	};
+
+	const string H1 = "CP_CIS-CODIF_HS_H1_MOMENTS";
+	const string O1 = "CP_CIS-CODIF_HS_O1_MOMENTS";
+	const string B = data("CP_FGM_SPIN", "B_mag");
+	return {
+		{"R", "norm(" + data("CP_FGM_SPIN", "sc_pos_xyz_gse") + ')'},
+		// n k_B T, density and T are taken as they are in CDFs (cm^-3 and MK)
+		{"PlasmaPressure", '(' + data(H1, "density") + " * " + data(H1, "T") + " + " +
+		                   data(O1, "density") + " * " + data(O1, "T") + ") * 1.38064852e-11"},
+		// B^2/2/mu_0, B is in nT
+		{"MagneticPressure", B + " * " + B + " * 1e-18 / (2 * 1.2566370614e-6)"},
+		{"beta", derived("PlasmaPressure") + " / " + derived("MagneticPressure")}
+	};
+}
+
+cdownload::DerivedVariables::DerivedVariables(const std::vector<ProductName>& requested,
+                                              const std::vector<string>& spacecraftNames,
+                                              const std::vector<string>& definitions)
+{
+	std::map<ProductName, string> known;
+	for (const string& spacecraft: spacecraftNames) {
+		for (const auto& d: builtinDefinitions(spacecraft)) {
+			known[productName(spacecraft, d.first)] = d.second;
+		}
+	}
+	for (const string& d: definitions) {
+		const std::size_t delimiter = d.find('=');
+		if (delimiter == 0 || delimiter == string::npos) {
+			throw std::runtime_error("Derived product definition '" + d + "' has to be given as name=expression");
+		}
+		known[ProductName(datasetName(), d.substr(0, delimiter))] = d.substr(delimiter + 1);
+	}
+
+	// depth-first traversal gives dependencies before the dependent quantities
+	std::set<ProductName> planned;
+	std::set<ProductName> visiting;
+	std::function<void (const ProductName&)> addToPlan = [&](const ProductName& product) {
+		if (planned.count(product)) {
+			return;
+		}
+		auto i = known.find(product);
+		if (i == known.end()) {
+			throw std::runtime_error("Unknown derived product '" + product.shortName() + '\'');
+		}
+		if (!visiting.insert(product).second) {
+			throw std::runtime_error("Derived product '" + product.shortName() + "' depends on itself");
+		}
+		const Definition expression = std::make_shared<Filters::Expression>(i->second);
+		std::set<DatasetName> datasets;
+		for (const ProductName& pr: expression->products()) {
+			if (pr.dataset() == datasetName()) {
+				addToPlan(pr);
+				auto dependency = std::find_if(plan_.begin(), plan_.end(), [&pr](const Step& s) {
+					return s.product == pr;
+				});
+				datasets.insert(dependency->dataset);
+			} else if (pr.isPseudoDataset()) {
+				throw std::runtime_error("Derived product '" + product.shortName() +
+				                         "' may not depend on filter variable '" + pr.name() + '\'');
+			} else {
+				datasets.insert(pr.dataset());
+			}
+		}
+		const DatasetName dataset = datasets.size() == 1 ? *datasets.begin() : DatasetName();
+		plan_.push_back({product, expression, dataset, {}, {}, static_cast<std::size_t>(-1)});
+		planned.insert(product);
+	};
+
+	for (const ProductName& product: requested) {
+		if (product.dataset() != datasetName()) {
+			throw std::logic_error("Product '" + product.name() + "' is not a derived one");
+		}
+		addToPlan(product);
+	}
+}
+
+std::vector<cdownload::ProductName> cdownload::DerivedVariables::requiredProducts() const
+{
+	std::vector<ProductName> res;
+	for (const Step& s: plan_) {
+		for (const ProductName& pr: s.expression->products()) {
+			if (!pr.isPseudoDataset() && std::find(res.begin(), res.end(), pr) == res.end()) {
+				res.push_back(pr);
+			}
+		}
+	}
+	return res;
+}
+
+const cdownload::DatasetName& cdownload::DerivedVariables::sourceDataset(const ProductName& product) const
+{
+	for (const Step& s: plan_) {
+		if (s.product == product) {
+			if (s.dataset.empty()) {
+				throw std::runtime_error("Derived product '" + product.shortName() +
+				                         "' combines several datasets, thus it is available for averaged cells only");
+			}
+			return s.dataset;
+		}
+	}
+	throw std::logic_error("Derived product '" + product.shortName() + "' is not computed");
+}
+
+std::vector<cdownload::FieldDesc> cdownload::DerivedVariables::fields() const
+{
+	std::vector<FieldDesc> res;
+	for (const Step& s: plan_) {
+		res.emplace_back(s.product, std::numeric_limits<double>::quiet_NaN(), FieldDesc::DataType::Real,
+		                 sizeof(double), 1);
+	}
+	return res;
+}
+
+void cdownload::DerivedVariables::initialize(const std::vector<Field>& availableProducts,
+                                             const std::vector<Field>& columns)
+{
+	auto find = [](const std::vector<Field>& fields, const ProductName& product) -> const Field* {
+		for (const Field& f: fields) {
+			if (f.name() == product) {
+				return &f;
+			}
+		}
+		throw std::logic_error("Field '" + product.name() + "' is not available for derived products");
+	};
+
+	for (Step& s: plan_) {
+		s.offset = find(columns, s.product)->offset();
+		std::vector<const Field*> arguments;
+		for (const ProductName& pr: s.expression->products()) {
+			arguments.push_back(find(pr.isPseudoDataset() ? columns : availableProducts, pr));
+		}
+		s.recordValue = s.expression->compileValueForRecords(arguments);
+		s.cellValue = s.expression->compileValueForCells(arguments);
+	}
+}
+
+void cdownload::DerivedVariables::compute(const std::vector<AveragedVariable>& cells,
+                                          std::vector<void*>& columns) const
+{
+	for (const Step& s: plan_) {
+		*static_cast<double*>(columns[s.offset]) = s.cellValue(cells, columns);
+	}
+}
+
+void cdownload::DerivedVariables::compute(const std::vector<const void*>& record, const DatasetName& dataset,
+                                          std::vector<void*>& columns) const
+{
+	for (const Step& s: plan_) {
+		if (s.dataset == dataset) {
+			*static_cast<double*>(columns[s.offset]) = s.recordValue(record, columns);
+		}
+	}
+}
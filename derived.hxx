@@ -0,0 +1,106 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_DERIVED_HXX
+#define CDOWNLOAD_DERIVED_HXX
+
+#include "average.hxx"
+#include "field.hxx"
+#include "filters/expression.hxx"
+
+#include <memory>
+#include <vector>
+
+namespace cdownload {
+
+	/**
+	 * @brief Computed columns, which are declared as products of the pseudo-dataset $DERIVED
+	 *
+	 * Every spacecraft has the following built-in quantities, named with the spacecraft prefix (e.g. C4_beta):
+	 *  - R: distance from the Earth center, km
+	 *  - PlasmaPressure: H+ and O+ pressure, Pa
+	 *  - MagneticPressure: Pa
+	 *  - beta: ratio of the plasma and magnetic pressures
+	 *
+	 * A quantity is defined by an arithmetic filter expression (see Filters::Expression), which may refer
+	 * to other derived products. User definitions are given as "name=expression" and replace
+	 * the built-in ones of the same name.
+	 *
+	 * Requested quantities and their dependencies are computed once per record or per averaged cell
+	 * in the dependency order, into columns shared by filters and writers. Cell quantities are
+	 * computed from the cell means. Record quantities are computed from products of a single
+	 * dataset only, before the raw filters test the record.
+	 */
+	class DerivedVariables {
+	public:
+		static DatasetName datasetName();
+		static ProductName productName(const string& spacecraft, const string& quantity);
+
+		DerivedVariables(const std::vector<ProductName>& requested, const std::vector<string>& spacecraftNames,
+		                 const std::vector<string>& definitions = {});
+
+		bool empty() const {
+			return plan_.empty();
+		}
+
+		//! Products, from which the quantities are computed
+		std::vector<ProductName> requiredProducts() const;
+
+		//! The dataset, records of which the product is computed for; throws if it combines several ones
+		const DatasetName& sourceDataset(const ProductName& product) const;
+
+		//! Columns in the computation order, including dependencies of the requested ones
+		std::vector<FieldDesc> fields() const;
+
+		/**
+		 * @brief Resolves positions of the input products and of the columns and compiles the definitions
+		 *
+		 * @param availableProducts data fields (averaging cells or record buffers)
+		 * @param columns buffer fields, which contain fields()
+		 */
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& columns);
+
+		void compute(const std::vector<AveragedVariable>& cells, std::vector<void*>& columns) const;
+		//! Computes the quantities of the record dataset
+		void compute(const std::vector<const void*>& record, const DatasetName& dataset,
+		             std::vector<void*>& columns) const;
+
+	private:
+		using Definition = std::shared_ptr<const Filters::Expression>;
+
+		struct Step {
+			ProductName product;
+			Definition expression;
+			DatasetName dataset; //!< the only dataset of the inputs, empty if there are several
+			Filters::Expression::RecordValue recordValue; //!< compiled by initialize()
+			Filters::Expression::CellValue cellValue; //!< compiled by initialize()
+			std::size_t offset; //!< column offset, resolved by initialize()
+		};
+
+		static std::vector<std::pair<string, string>> builtinDefinitions(const string& spacecraft);
+
+		std::vector<Step> plan_;
+	};
+}
+
+#endif // CDOWNLOAD_DERIVED_HXX
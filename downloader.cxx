@@ -22,13 +22,16 @@
 
 #include "downloader.hxx"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iomanip>
 #include <memory>
-#include <thread>
 #include <ctime>
 #include <type_traits>
 
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/log/trivial.hpp>
 
@@ -36,22 +39,334 @@
 
 #include "config.h"
 
+constexpr const std::size_t cdownload::curl::TransferScheduler::DEFAULT_MAX_CONCURRENT_TRANSFERS;
+constexpr const std::size_t cdownload::curl::TransferScheduler::MAX_RETRIES;
+
 namespace {
-		struct RunningRequestUserData {
-		RunningRequestUserData(std::ostream& s, const cdownload::curl::RunningRequest* r )
-			: os(s)
-			, request(r)
+	//! Upper bound of a single wait in the I/O loop, the loop is woken up on new requests anyway
+	constexpr const int IO_POLL_TIMEOUT_MS = 1000;
+	//! How often transfers, paused because their outputs are full, check the outputs again
+	constexpr const int PAUSED_TRANSFER_POLL_MS = 10;
+
+	//! How many times an interrupted transfer is continued before giving up
+	constexpr const std::size_t MAX_RESUME_ATTEMPTS = 5;
+
+	//! Weight of a new request in the host statistics
+	constexpr const double HOST_STATS_SMOOTHING = 0.2;
+	//! Pause before the first retry, s; it is not shorter than the host latency too
+	constexpr const double MIN_RETRY_DELAY = 1.;
+	constexpr const double MAX_RETRY_DELAY = 60.;
+
+	//! Scheme, host and port of the URL
+	std::string hostOf(const std::string& url)
+	{
+		const std::size_t schemeEnd = url.find("://");
+		const std::size_t hostBegin = schemeEnd == std::string::npos ? 0 : schemeEnd + 3;
+		return url.substr(0, url.find('/', hostBegin));
+	}
+
+	bool isHttp(const std::string& url)
+	{
+		return url.find("http") == 0;
+	}
+
+	/**
+	 * @brief DNS cache, TLS sessions and open connections, shared by all transfers of the process
+	 *
+	 * Thus consecutive requests to the same server (e.g. metadata queries of every dataset) reuse
+	 * kept-alive connections instead of doing DNS lookup, TCP connect and TLS handshake again.
+	 */
+	class SharedConnections {
+	public:
+		static CURLSH* handle()
+		{
+			static SharedConnections instance;
+			return instance.share_;
+		}
+
+	private:
+		SharedConnections()
+			: share_{nullptr}
+		{
+			curl_global_init(CURL_GLOBAL_ALL);
+			share_ = curl_share_init();
+			if (!share_) {
+				return; // transfers work without sharing too
+			}
+			curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &SharedConnections::lock);
+			curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &SharedConnections::unlock);
+			curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+			curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+		}
+
+		~SharedConnections()
+		{
+			if (share_) {
+				curl_share_cleanup(share_);
+			}
+		}
+
+		static void lock(CURL* /*handle*/, curl_lock_data data, curl_lock_access /*access*/, void* userptr)
 		{
+			static_cast<SharedConnections*>(userptr)->mutexes_[static_cast<std::size_t>(data)].lock();
 		}
 
-		std::ostream& os;
-		const cdownload::curl::RunningRequest* request;
+		static void unlock(CURL* /*handle*/, curl_lock_data data, void* userptr)
+		{
+			static_cast<SharedConnections*>(userptr)->mutexes_[static_cast<std::size_t>(data)].unlock();
+		}
+
+		CURLSH* share_;
+		std::array<std::mutex, static_cast<std::size_t>(CURL_LOCK_DATA_LAST)> mutexes_;
 	};
 }
 
-cdownload::curl::DownloadManager::DownloadManager()
+cdownload::curl::TransferScheduler& cdownload::curl::TransferScheduler::instance()
 {
+	static TransferScheduler scheduler;
+	return scheduler;
+}
+
+cdownload::curl::TransferScheduler::TransferScheduler()
+	: multi_{nullptr}
+	, stopIOThread_{false}
+	, maxConcurrentTransfers_{DEFAULT_MAX_CONCURRENT_TRANSFERS}
+	, runningTransfersCount_{0}
+	, submittedCount_{0}
+	, random_{std::random_device()()}
+{
+	// constructed first, hence outlives the scheduler
+	SharedConnections::handle();
 	curl_global_init(CURL_GLOBAL_ALL);
+	multi_ = curl_multi_init();
+	if (!multi_) {
+		throw std::runtime_error("Error initializing CURL");
+	}
+}
+
+cdownload::curl::TransferScheduler::~TransferScheduler()
+{
+	stopIOThread();
+	curl_multi_cleanup(multi_);
+}
+
+std::size_t cdownload::curl::TransferScheduler::maxConcurrentTransfers() const
+{
+	std::unique_lock<std::mutex> lk(mutex_);
+	return maxConcurrentTransfers_;
+}
+
+void cdownload::curl::TransferScheduler::setMaxConcurrentTransfers(std::size_t count)
+{
+	std::unique_lock<std::mutex> lk(mutex_);
+	maxConcurrentTransfers_ = count ? count : 1;
+	curl_multi_wakeup(multi_);
+}
+
+void cdownload::curl::TransferScheduler::submit(cdownload::curl::RunningRequest* request)
+{
+	std::unique_lock<std::mutex> lk(mutex_);
+	pendingRequests_[std::make_pair(request->priority_, submittedCount_++)] = request;
+	startIOThread();
+	curl_multi_wakeup(multi_);
+}
+
+void cdownload::curl::TransferScheduler::wakeup()
+{
+	std::unique_lock<std::mutex> lk(mutex_);
+	curl_multi_wakeup(multi_);
+}
+
+void cdownload::curl::TransferScheduler::startIOThread()
+{
+	if (!ioThread_.joinable()) {
+		stopIOThread_ = false;
+		ioThread_ = std::thread([this]() {
+			this->runIOLoop();
+		});
+	}
+}
+
+void cdownload::curl::TransferScheduler::stopIOThread()
+{
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		stopIOThread_ = true;
+		curl_multi_wakeup(multi_);
+	}
+	if (ioThread_.joinable()) {
+		ioThread_.join();
+	}
+}
+
+void cdownload::curl::TransferScheduler::runIOLoop()
+{
+	while (true) {
+		std::vector<RunningRequest*> requestsToStart;
+		int pollTimeout = IO_POLL_TIMEOUT_MS;
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			if (stopIOThread_) {
+				break;
+			}
+			const auto now = std::chrono::steady_clock::now();
+			// cancelled requests are completed at once and do not count against the limit
+			std::size_t startedCount = runningTransfersCount_;
+			for (auto it = pendingRequests_.begin(); it != pendingRequests_.end();) {
+				RunningRequest* request = it->second;
+				bool start = request->scheduleCancellation_;
+				if (!start && startedCount < maxConcurrentTransfers_) {
+					HostState& h = host(request->host_);
+					if (request->notBefore_ > now) {
+						const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(request->notBefore_ - now);
+						pollTimeout = std::min(pollTimeout, static_cast<int>(wait.count()) + 1);
+					} else if (static_cast<double>(h.running + 1) <= h.window) {
+						start = true;
+						++startedCount;
+						++h.running;
+					}
+				}
+				if (start) {
+					requestsToStart.push_back(request);
+					it = pendingRequests_.erase(it);
+				} else {
+					++it;
+				}
+			}
+		}
+
+		for (RunningRequest* request: requestsToStart) {
+			if (request->scheduleCancellation_) {
+				request->errorMessage_ = "Cancelled";
+				request->manager_->requestCompleted(request);
+				continue;
+			}
+			request->prepare();
+			if (!request->session_) {
+				--host(request->host_).running;
+				request->manager_->requestCompleted(request);
+				continue;
+			}
+#ifdef DEBUG_DOWNLOADING_ACTIONS
+			BOOST_LOG_TRIVIAL(debug) << "Downloading data from url " << request->url();
+#endif
+			curl_multi_add_handle(multi_, request->session_);
+			++runningTransfersCount_;
+		}
+
+		// CURL passes the held data to the write callback again, which pauses the transfer again
+		// if the output is still full
+		std::vector<RunningRequest*> paused;
+		paused.swap(pausedRequests_);
+		for (RunningRequest* request: paused) {
+			curl_easy_pause(request->session_, CURLPAUSE_CONT);
+		}
+
+		int runningHandles = 0;
+		curl_multi_perform(multi_, &runningHandles);
+
+		int messagesLeft = 0;
+		while (CURLMsg* message = curl_multi_info_read(multi_, &messagesLeft)) {
+			if (message->msg != CURLMSG_DONE) {
+				continue;
+			}
+			CURL* session = message->easy_handle;
+			const CURLcode result = message->data.result;
+			char* request = nullptr;
+			curl_easy_getinfo(session, CURLINFO_PRIVATE, &request);
+			curl_multi_remove_handle(multi_, session);
+			--runningTransfersCount_;
+			RunningRequest* runningRequest = static_cast<RunningRequest*>(static_cast<void*>(request));
+			pausedRequests_.erase(std::remove(pausedRequests_.begin(), pausedRequests_.end(), runningRequest),
+			                      pausedRequests_.end());
+			runningRequest->finish(result);
+			--host(runningRequest->host_).running;
+			updateHost(*runningRequest);
+			if (runningRequest->shouldRetry()) {
+				const std::chrono::milliseconds delay = retryDelay(*runningRequest);
+				++runningRequest->retries_;
+				runningRequest->notBefore_ = std::chrono::steady_clock::now() + delay;
+				BOOST_LOG_TRIVIAL(info) << "Request to " << runningRequest->url() << " failed ("
+					<< (runningRequest->errorMessage().empty() ?
+						"status " + std::to_string(runningRequest->statusCode()) : runningRequest->errorMessage())
+					<< "), retrying in " << delay.count() << " ms";
+				std::unique_lock<std::mutex> lk(mutex_);
+				pendingRequests_[std::make_pair(runningRequest->priority_, submittedCount_++)] = runningRequest;
+				continue;
+			}
+			if (runningRequest->shouldResume()) {
+				BOOST_LOG_TRIVIAL(info) << "Transfer from " << runningRequest->url() << " interrupted ("
+					<< runningRequest->errorMessage() << "), resuming from byte " << runningRequest->receivedBytes_;
+				std::unique_lock<std::mutex> lk(mutex_);
+				pendingRequests_[std::make_pair(runningRequest->priority_, submittedCount_++)] = runningRequest;
+				continue;
+			}
+			runningRequest->manager_->requestCompleted(runningRequest);
+		}
+
+		if (!pausedRequests_.empty()) {
+			pollTimeout = std::min(pollTimeout, PAUSED_TRANSFER_POLL_MS);
+		}
+		curl_multi_poll(multi_, nullptr, 0, pollTimeout, nullptr);
+	}
+}
+
+cdownload::curl::TransferScheduler::HostState& cdownload::curl::TransferScheduler::host(const std::string& name)
+{
+	auto it = hosts_.find(name);
+	if (it == hosts_.end()) {
+		HostState state;
+		state.window = static_cast<double>(maxConcurrentTransfers_);
+		it = hosts_.insert(std::make_pair(name, state)).first;
+	}
+	return it->second;
+}
+
+void cdownload::curl::TransferScheduler::updateHost(const cdownload::curl::RunningRequest& request)
+{
+	if (request.scheduleCancellation_) {
+		return;
+	}
+	// the window is bounded by maxConcurrentTransfers_, which other threads change
+	std::unique_lock<std::mutex> lk(mutex_);
+	HostState& h = host(request.host_);
+	const bool failed = request.failedTemporarily();
+	h.errorRate = (1. - HOST_STATS_SMOOTHING) * h.errorRate + HOST_STATS_SMOOTHING * (failed ? 1. : 0.);
+	if (request.latency_ > 0.) {
+		h.latency = h.latency > 0. ?
+			(1. - HOST_STATS_SMOOTHING) * h.latency + HOST_STATS_SMOOTHING * request.latency_ : request.latency_;
+	}
+
+	if (failed) {
+		const auto now = std::chrono::steady_clock::now();
+		// failures of simultaneous requests are a single overload event
+		if (now - h.lastDecrease > std::chrono::duration<double>(std::max(h.latency, MIN_RETRY_DELAY))) {
+			h.window = std::max(1., h.window / 2.);
+			h.lastDecrease = now;
+			BOOST_LOG_TRIVIAL(info) << "Server " << request.host_ << " is overloaded (error rate "
+				<< h.errorRate << ", latency " << h.latency << " s), limiting concurrent transfers to "
+				<< static_cast<std::size_t>(h.window);
+		}
+	} else if (request.completedSuccefully()) {
+		h.window = std::min(static_cast<double>(maxConcurrentTransfers_), h.window + 1. / h.window);
+	}
+}
+
+std::chrono::milliseconds cdownload::curl::TransferScheduler::retryDelay(const cdownload::curl::RunningRequest& request)
+{
+	const double base = std::max(MIN_RETRY_DELAY, host(request.host_).latency);
+	double delay = std::min(MAX_RETRY_DELAY, base * std::pow(2., static_cast<double>(request.retries_)));
+	// randomization spreads retries of simultaneously failed requests
+	std::uniform_real_distribution<double> jitter(0.5, 1.);
+	delay = std::max(delay * jitter(random_), request.retryAfter_);
+	return std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(delay * 1e3));
+}
+
+cdownload::curl::DownloadManager::DownloadManager()
+	: ignoreDownloadingErrors_{false}
+{
 }
 
 cdownload::curl::DownloadManager::~DownloadManager()
@@ -65,59 +380,84 @@ std::string cdownload::curl::DownloadManager::decorateUrl(const std::string& url
 }
 
 cdownload::curl::DownloadManager::RunningRequestWeakPtr
-cdownload::curl::DownloadManager::beginDownloading(const std::string& url, std::ostream& output)
+cdownload::curl::DownloadManager::beginDownloading(const std::string& url, std::ostream& output,
+                                                   CompletionCallback onCompleted, double priority)
 {
 	ignoreDownloadingErrors_ = false;
 	const std::string requestUrl = decorateUrl(url);
-	std::unique_lock<std::mutex> lk(activeRequestsMutex_);
+	std::unique_lock<std::mutex> lk(mutex_);
 	auto i = activeRequests_.find(requestUrl);
 	if (i != activeRequests_.end()) {
 		throw std::logic_error("Url '" + requestUrl + " is downloaded already");
 	}
-	RunningRequestSharedPtr request(new RunningRequest(requestUrl, this));
+	RunningRequestSharedPtr request(new RunningRequest(requestUrl, output, this, priority));
 	activeRequests_[requestUrl] = request;
-	request->beginDownloading(output);
+	if (onCompleted) {
+		callbacks_[request.get()] = onCompleted;
+	}
+	TransferScheduler::instance().submit(request.get());
 	return RunningRequestWeakPtr(request);
 }
 
 void cdownload::curl::DownloadManager::requestCompleted(cdownload::curl::RunningRequest* request)
 {
-	std::unique_lock<std::mutex> lk (completedRequestsMutex_);
+	CompletionCallback callback;
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		auto it = callbacks_.find(request);
+		if (it != callbacks_.end()) {
+			callback.swap(it->second);
+			callbacks_.erase(it);
+		}
+	}
+	request->completed_ = true;
+	if (callback) {
+		callback(*request);
+	}
+	// the request may be destroyed as soon as it is in the completed list
+	std::unique_lock<std::mutex> lk(mutex_);
 	completedRequests_.push_back(request->url());
-// 	request->downloadingThread_.join();
-// 	activeRequests_.erase(request->url());
-	requestsCV_.notify_one();
+	requestsCV_.notify_all();
 }
 
 void cdownload::curl::DownloadManager::cancelAllRequests()
+{
+	scheduleCancellingAllRequests();
+	waitForFinished();
+}
+
+void cdownload::curl::DownloadManager::scheduleCancellingAllRequests()
 {
 	ignoreDownloadingErrors_ = true;
-	for (auto& p: activeRequests_) {
-		p.second->scheduleCancelling();
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		for (auto& p: activeRequests_) {
+			p.second->scheduleCancelling();
+		}
 	}
-	waitForFinished();
+	TransferScheduler::instance().wakeup();
 }
 
 bool cdownload::curl::DownloadManager::removeCompletedRequests()
 {
-	std::unique_lock<std::mutex> lk(completedRequestsMutex_);
 	for (const auto& url: completedRequests_) {
 		auto it = activeRequests_.find(url);
 		if (it != activeRequests_.end()) {
 			RunningRequestSharedPtr rq = it->second;
-			if (rq->downloadingThread_.joinable()) {
-				rq->downloadingThread_.join();
-			}
 			if (!ignoreDownloadingErrors_) {
 				if (rq->completedSuccefully()) {
 					constexpr const long HTTP_CODE_NO_ERROR = 200;
+					constexpr const long HTTP_CODE_PARTIAL_CONTENT = 206; // resumed transfer
 					constexpr const long FTP_CODE_TRANSFER_COMPLETE = 226;
 					const auto protocol = rq->protocol();
-					if (protocol == RunningRequest::Protocol::HTTP && rq->statusCode() != HTTP_CODE_NO_ERROR) {
+					if (protocol == RunningRequest::Protocol::HTTP && rq->statusCode() != HTTP_CODE_NO_ERROR &&
+					    rq->statusCode() != HTTP_CODE_PARTIAL_CONTENT) {
 						throw TransferError(rq->url(), rq->statusCode());
 					} else if (protocol == RunningRequest::Protocol::FTP && rq->statusCode() != FTP_CODE_TRANSFER_COMPLETE) {
 
 					}
+				} else if (rq->resumeRefused()) {
+					throw ResumeError(rq->url(), rq->errorMessage());
 				} else {
 					throw DownloadError(rq->url(), rq->errorMessage());
 				}
@@ -131,23 +471,29 @@ bool cdownload::curl::DownloadManager::removeCompletedRequests()
 
 void cdownload::curl::DownloadManager::waitForFinished()
 {
-	std::unique_lock<std::mutex> lk(activeRequestsMutex_);
+	std::unique_lock<std::mutex> lk(mutex_);
 	requestsCV_.wait(lk, [this](){return this->removeCompletedRequests();});
 }
 
-cdownload::curl::RunningRequest::RunningRequest(const std::string& url, DownloadManager* manager)
+cdownload::curl::RunningRequest::RunningRequest(const std::string& url, std::ostream& output,
+                                                DownloadManager* manager, double priority)
 	: url_(url)
+	, output_(output)
+	, priority_(priority)
+	, nonBlockingOutput_(dynamic_cast<NonBlockingStreamBuf*>(output.rdbuf()))
+	, host_(hostOf(url))
 	, manager_(manager)
 {
 }
 
 cdownload::curl::RunningRequest::~RunningRequest()
 {
+	curl_slist_free_all(headers_);
 }
 
 int cdownload::curl::RunningRequest::statusCode() const
 {
-	return protocolStatusCode_;
+	return static_cast<int>(protocolStatusCode_);
 }
 
 bool cdownload::curl::RunningRequest::completedSuccefully() const
@@ -157,67 +503,200 @@ bool cdownload::curl::RunningRequest::completedSuccefully() const
 
 void cdownload::curl::RunningRequest::waitForFinished()
 {
-	downloadingThread_.join();
+	std::unique_lock<std::mutex> lk(manager_->mutex_);
+	manager_->requestsCV_.wait(lk, [this](){return this->isCompleted();});
 }
 
-void cdownload::curl::RunningRequest::beginDownloading(std::ostream& output)
-{
-	downloadingThread_ = std::thread([this,&output](){
-		this->download(output);
-	});
-}
-
-void cdownload::curl::RunningRequest::download(std::ostream& output)
+void cdownload::curl::RunningRequest::prepare()
 {
 	completedSuccefully_ = false;
+	errorMessage_.clear();
+	protocolStatusCode_ = 0;
+	retryAfter_ = 0.;
+	latency_ = 0.;
+	statusChecked_ = false;
+	discardBody_ = false;
+	writtenAhead_ = 0;
+	++attempts_;
 	session_ = curl_easy_init();
 	if (!session_) {
-		throw std::runtime_error("Error initializing CURL");
+		errorMessage_ = "Error initializing CURL";
+		return;
 	}
 	curl_easy_setopt(session_, CURLOPT_WRITEFUNCTION, &RunningRequest::curlWriteCallback);
 	curl_easy_setopt(session_, CURLOPT_XFERINFOFUNCTION, &RunningRequest::curlProgressCallback);
 
-	RunningRequestUserData userData {output, this};
-
 	curl_easy_setopt(session_, CURLOPT_URL, url_.c_str());
-	curl_easy_setopt(session_, CURLOPT_WRITEDATA, &userData);
-	curl_easy_setopt(session_, CURLOPT_XFERINFODATA, &userData);
-	curl_easy_setopt(session_, CURLOPT_NOPROGRESS, 0);
-#ifdef DEBUG_DOWNLOADING_ACTIONS
-	BOOST_LOG_TRIVIAL(debug) << "Downloading data from url " << url_;
-#endif
-	CURLcode curl_status_code = curl_easy_perform(session_);
-	if (curl_status_code != CURLE_OK) {
+	curl_easy_setopt(session_, CURLOPT_WRITEDATA, this);
+	curl_easy_setopt(session_, CURLOPT_HEADERFUNCTION, &RunningRequest::curlHeaderCallback);
+	curl_easy_setopt(session_, CURLOPT_HEADERDATA, this);
+	curl_easy_setopt(session_, CURLOPT_XFERINFODATA, this);
+	curl_easy_setopt(session_, CURLOPT_PRIVATE, this);
+	curl_easy_setopt(session_, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(session_, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(session_, CURLOPT_TCP_KEEPALIVE, 1L);
+	if (CURLSH* share = SharedConnections::handle()) {
+		curl_easy_setopt(session_, CURLOPT_SHARE, share);
+	}
+
+	resumedFrom_ = receivedBytes_;
+	if (resumedFrom_) {
+		curl_easy_setopt(session_, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(resumedFrom_));
+		// the server sends the whole (changed) resource if the validator does not match, and
+		// CURL reports that as range error
+		curl_slist_free_all(headers_);
+		headers_ = nullptr;
+		if (!validator_.empty()) {
+			headers_ = curl_slist_append(headers_, ("If-Range: " + validator_).c_str());
+			curl_easy_setopt(session_, CURLOPT_HTTPHEADER, headers_);
+		}
+	}
+}
+
+void cdownload::curl::RunningRequest::finish(int curlCode)
+{
+	const CURLcode curl_status_code = static_cast<CURLcode>(curlCode);
+	curlCode_ = curlCode;
+	curl_easy_getinfo(session_, CURLINFO_RESPONSE_CODE, &protocolStatusCode_);
+	// CURL reports an error reply to a ranged request (e.g. 503) as range error too, but that is
+	// a complete reply, which is retried from the same position as any other error status
+	const bool errorStatusReply = isHttp(url_) && protocolStatusCode_ >= 400 &&
+		curl_status_code == CURLE_RANGE_ERROR;
+	if (curl_status_code != CURLE_OK && !errorStatusReply) {
 		errorMessage_ = std::string(curl_easy_strerror(curl_status_code));
+		resumeRefused_ = resumedFrom_ && (curl_status_code == CURLE_RANGE_ERROR ||
+			curl_status_code == CURLE_BAD_DOWNLOAD_RESUME || curl_status_code == CURLE_FTP_COULDNT_USE_REST);
 	} else {
 		completedSuccefully_ = true;
 	}
-	curl_easy_getinfo(session_, CURLINFO_RESPONSE_CODE, &protocolStatusCode_);
+	curl_off_t startTransferTime = 0; // us
+	if (curl_easy_getinfo(session_, CURLINFO_STARTTRANSFER_TIME_T, &startTransferTime) == CURLE_OK) {
+		latency_ = static_cast<double>(startTransferTime) / 1e6;
+	}
 	curl_easy_cleanup(session_);
-	completed_ = true;
-	manager_->requestCompleted(this);
+	session_ = nullptr;
+}
+
+bool cdownload::curl::RunningRequest::shouldResume() const
+{
+	if (completedSuccefully_ || scheduleCancellation_ || resumeRefused_ ||
+	    !receivedBytes_ || attempts_ > MAX_RESUME_ATTEMPTS) {
+		return false;
+	}
+	switch (static_cast<CURLcode>(curlCode_)) {
+	case CURLE_PARTIAL_FILE:
+	case CURLE_RECV_ERROR:
+	case CURLE_SEND_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_OPERATION_TIMEDOUT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool cdownload::curl::RunningRequest::failedTemporarily() const
+{
+	if (!completedSuccefully_) {
+		switch (static_cast<CURLcode>(curlCode_)) {
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_GOT_NOTHING:
+		case CURLE_RECV_ERROR:
+		case CURLE_SEND_ERROR:
+			return !scheduleCancellation_;
+		default:
+			return false;
+		}
+	}
+	if (!isHttp(url_)) {
+		return false;
+	}
+	switch (protocolStatusCode_) {
+	case 429: // Too Many Requests
+	case 503: // Service Unavailable
+	case 504: // Gateway Timeout
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool cdownload::curl::RunningRequest::shouldRetry() const
+{
+	// interrupted transfers with data are resumed instead, while an error reply to a resumed
+	// request leaves the received data intact and is requested again from the same position
+	return !scheduleCancellation_ && !(receivedBytes_ && !completedSuccefully_) &&
+		retries_ < TransferScheduler::MAX_RETRIES && failedTemporarily();
 }
 
 size_t cdownload::curl::RunningRequest::curlWriteCallback(char* ptr, size_t size, size_t nmemb, void* userdata)
 {
-	RunningRequestUserData* cud = static_cast<RunningRequestUserData*>(userdata);
-	if (cud->request->scheduleCancellation_) {
+	RunningRequest* request = static_cast<RunningRequest*>(userdata);
+	if (request->scheduleCancellation_) {
 		return 0; // which will tell CURL to cancel downloading
 	}
-	cud->os.write(ptr, static_cast<std::streamsize>(size * nmemb));
-	if (cud->os) {
+	if (!request->statusChecked_) {
+		request->statusChecked_ = true;
+		constexpr const long HTTP_CODE_FIRST_ERROR = 400;
+		long code = 0;
+		curl_easy_getinfo(request->session_, CURLINFO_RESPONSE_CODE, &code);
+		request->discardBody_ = isHttp(request->url_) && code >= HTTP_CODE_FIRST_ERROR;
+	}
+	if (request->discardBody_) {
+		return size * nmemb;
+	}
+	if (request->nonBlockingOutput_) {
+		const std::size_t count = size * nmemb;
+		const std::size_t skipped = std::min(request->writtenAhead_, count);
+		request->writtenAhead_ -= skipped;
+		const std::size_t written = request->nonBlockingOutput_->tryWrite(ptr + skipped, count - skipped);
+		request->receivedBytes_ += written;
+		if (written < count - skipped) {
+			// CURL holds the whole data and passes them again when the transfer continues
+			request->writtenAhead_ = skipped + written;
+			TransferScheduler::instance().pausedRequests_.push_back(request);
+			return CURL_WRITEFUNC_PAUSE;
+		}
+		return count;
+	}
+	request->output_.write(ptr, static_cast<std::streamsize>(size * nmemb));
+	if (request->output_) {
+		request->receivedBytes_ += size * nmemb;
 		return size * nmemb;
 	} else {
 		return 0;
 	}
 }
 
+size_t cdownload::curl::RunningRequest::curlHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+	RunningRequest* request = static_cast<RunningRequest*>(userdata);
+	const std::string line(buffer, size * nitems);
+	const std::size_t colonPos = line.find(':');
+	if (colonPos != std::string::npos) {
+		const std::string name = boost::algorithm::to_lower_copy(line.substr(0, colonPos));
+		// a strong validator is preferred
+		const std::string value = boost::algorithm::trim_copy(line.substr(colonPos + 1));
+		if (name == "etag" || (name == "last-modified" && request->validator_.empty())) {
+			request->validator_ = value;
+		} else if (name == "retry-after") {
+			// the HTTP-date form is ignored
+			try {
+				request->retryAfter_ = std::min(boost::lexical_cast<double>(value), MAX_RETRY_DELAY);
+			} catch (boost::bad_lexical_cast&) {
+			}
+		}
+	}
+	return size * nitems;
+}
+
 int cdownload::curl::RunningRequest::curlProgressCallback(void* clientp,
 	curl_off_t /*dltotal*/, curl_off_t /*dlnow*/, curl_off_t /*ultotal*/, curl_off_t /*ulnow*/)
 {
 	static_assert(std::is_same<curl_off_t, my_curl_off_t>::value, "");
-	RunningRequestUserData* cud = static_cast<RunningRequestUserData*>(clientp);
-	if (cud->request->scheduleCancellation_) {
+	const RunningRequest* request = static_cast<const RunningRequest*>(clientp);
+	if (request->scheduleCancellation_) {
 		return 1; // which will tell CURL to cancel downloading
 	}
 	return 0;
@@ -241,6 +720,12 @@ cdownload::curl::RunningRequest::Protocol cdownload::curl::RunningRequest::proto
 
 cdownload::curl::DownloadManager::DownloadError::DownloadError(const std::string& url, const std::string& message)
 	: std::runtime_error(message + " : Error occurred while downloading data from URL " + url)
+	, url_{url}
+{
+}
+
+cdownload::curl::DownloadManager::ResumeError::ResumeError(const std::string& url, const std::string& message)
+	: DownloadError(url, message)
 {
 }
 
@@ -28,17 +28,24 @@
 #include <json/value.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <random>
+#include <streambuf>
 #include <string>
 #include <stdexcept>
 #include <thread>
 #include <vector>
 
 
+struct curl_slist;
+
 /** \file downloader.hxx Provides classes for accessing the CSA archive server to download metadata
  * and data files
  */
@@ -47,6 +54,20 @@ namespace cdownload {
 	namespace curl {
 
 	class DownloadManager;
+	class TransferScheduler;
+
+	/**
+	 * @brief Stream buffer, which can be full for a while
+	 *
+	 * Transfers writing to a stream with such a buffer are paused while it is full, instead of
+	 * blocking the I/O thread, which runs all other transfers too.
+	 */
+	class NonBlockingStreamBuf: public std::streambuf {
+	public:
+		//! Writes as much as fits now, does not wait
+		//! @return number of bytes written
+		virtual std::size_t tryWrite(const char* data, std::size_t count) = 0;
+	};
 
 	class RunningRequest {
 	public:
@@ -60,7 +81,6 @@ namespace cdownload {
 
 		~RunningRequest();
 
-		void beginDownloading(std::ostream& output);
 		int statusCode() const;
 		bool completedSuccefully() const;
 
@@ -78,29 +98,133 @@ namespace cdownload {
 		}
 
 		Protocol protocol() const;
-	private:
-		RunningRequest(const std::string& url, DownloadManager* manager);
 
-		void download(std::ostream& output);
+		//! The transfer was interrupted and the server refused to continue it from the interruption point
+		bool resumeRefused() const {
+			return resumeRefused_;
+		}
+	private:
+		RunningRequest(const std::string& url, std::ostream& output, DownloadManager* manager, double priority);
+
+		//! Creates the easy handle, which is then driven by the manager multi handle
+		void prepare();
+		void finish(int curlCode);
+		//! Whether the interrupted transfer shall continue from the last received byte
+		bool shouldResume() const;
+		//! Whether the request failed because the server is overloaded or unreachable
+		bool failedTemporarily() const;
+		//! Whether the request shall be repeated after a pause
+		bool shouldRetry() const;
 
 		static size_t curlWriteCallback(char* ptr, size_t size, size_t nmemb, void* userdata);
+		static size_t curlHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata);
 		typedef long my_curl_off_t;
 		static int curlProgressCallback(void* clientp,
 			my_curl_off_t dltotal, my_curl_off_t dlnow, my_curl_off_t ultotal, my_curl_off_t ulnow);
 
 		typedef void CURL;
 		CURL* session_ = nullptr;
-		bool scheduleCancellation_ = false;
-		bool completed_= false;
+		std::atomic<bool> scheduleCancellation_ {false};
+		std::atomic<bool> completed_ {false};
 		bool completedSuccefully_ = false;
 		std::string errorMessage_;
-		std::thread downloadingThread_;
-		long protocolStatusCode_;
+		long protocolStatusCode_ = 0;
 		std::string url_;
+		std::ostream& output_;
+		double priority_;
+		int curlCode_ = 0;
+		std::size_t attempts_ = 0;
+		std::uint64_t receivedBytes_ = 0;
+		std::uint64_t resumedFrom_ = 0;
+		bool resumeRefused_ = false;
+		std::string validator_; //!< ETag or Last-Modified of the response, for If-Range
+		curl_slist* headers_ = nullptr;
+		NonBlockingStreamBuf* nonBlockingOutput_ = nullptr; //!< buffer of output_, if it is such one
+		std::size_t writtenAhead_ = 0; //!< of the data held by CURL while paused, written already
+		std::string host_;
+		std::size_t retries_ = 0;
+		double retryAfter_ = 0.; //!< Retry-After of the response, s
+		double latency_ = 0.; //!< time to the first byte, s
+		bool statusChecked_ = false;
+		bool discardBody_ = false; //!< error responses are not passed to the output
+		std::chrono::steady_clock::time_point notBefore_;
 		friend class DownloadManager;
+		friend class TransferScheduler;
 		DownloadManager* manager_;
 	};
 
+	/**
+	 * @brief Runs transfers of all download managers of the process
+	 *
+	 * Transfers are driven by a single I/O thread via a curl multi handle. At most
+	 * maxConcurrentTransfers() transfers run at once, the rest wait in a queue shared by all managers,
+	 * where requests with lower priority value start first.
+	 *
+	 * Every host gets own concurrency window, which grows by one per window of successful
+	 * requests and halves when the server reports overload (HTTP 429, 503, 504) or can not be
+	 * reached. Requests failed that way are repeated after a jittered exponential pause, at most
+	 * MAX_RETRIES times. HTTP 502 is not retried: the CSA gateway replies so when the requested
+	 * archive is too large, and the caller has to request less data instead.
+	 */
+	class TransferScheduler {
+	public:
+		static constexpr const std::size_t DEFAULT_MAX_CONCURRENT_TRANSFERS = 16;
+		static constexpr const std::size_t MAX_RETRIES = 4;
+
+		static TransferScheduler& instance();
+		~TransferScheduler();
+
+		std::size_t maxConcurrentTransfers() const;
+		void setMaxConcurrentTransfers(std::size_t count);
+
+	private:
+		TransferScheduler();
+
+		friend class DownloadManager;
+		friend class RunningRequest;
+		void submit(RunningRequest* request);
+		//! Makes the I/O thread to look at pending and cancelled requests
+		void wakeup();
+
+		void startIOThread();
+		void stopIOThread();
+		void runIOLoop();
+
+		struct HostState {
+			double window;           //!< concurrency limit
+			std::size_t running = 0;
+			double errorRate = 0.;   //!< moving average of the failed fraction
+			double latency = 0.;     //!< moving average of time to the first byte, s
+			std::chrono::steady_clock::time_point lastDecrease;
+		};
+
+		HostState& host(const std::string& name);
+		//! AIMD update of the host window
+		void updateHost(const RunningRequest& request);
+		std::chrono::milliseconds retryDelay(const RunningRequest& request);
+
+		typedef void CURLM;
+		CURLM* multi_;
+		std::thread ioThread_;
+		bool stopIOThread_;
+		std::size_t maxConcurrentTransfers_;
+		std::size_t runningTransfersCount_; //!< added to the multi handle
+		std::uint64_t submittedCount_;
+		//! ordered by priority, then by submission order
+		std::map<std::pair<double, std::uint64_t>, RunningRequest*> pendingRequests_;
+		std::map<std::string, HostState> hosts_; //!< accessed from the I/O thread only
+		std::vector<RunningRequest*> pausedRequests_; //!< accessed from the I/O thread only
+		std::mt19937 random_;
+		mutable std::mutex mutex_;
+	};
+
+	/**
+	 * @brief Runs transfers concurrently
+	 *
+	 * Transfers are passed to the TransferScheduler, the manager tracks their completion.
+	 * A transfer interrupted by a network error is continued from the last received byte
+	 * (HTTP range request or FTP REST), the output stream does not see the interruption.
+	 */
 	class DownloadManager {
 	public:
 		DownloadManager();
@@ -108,11 +232,26 @@ namespace cdownload {
 
 		using RunningRequestSharedPtr = std::shared_ptr<RunningRequest>;
 		using RunningRequestWeakPtr = std::weak_ptr<RunningRequest>;
+		//! Called from the I/O thread when a request completes (successfully or not), must not throw
+		using CompletionCallback = std::function<void (const RunningRequest& request)>;
 
 
 		class DownloadError: public std::runtime_error {
 		public:
 			DownloadError(const std::string& url, const std::string& message);
+
+			const std::string& url() const {
+				return url_;
+			}
+
+		private:
+			std::string url_;
+		};
+
+		//! The server does not support continuation of an interrupted transfer
+		class ResumeError: public DownloadError {
+		public:
+			ResumeError(const std::string& url, const std::string& message);
 		};
 
 		class TransferError: public DownloadError {
@@ -128,19 +267,31 @@ namespace cdownload {
 			int statusCode_;
 		};
 
-		RunningRequestWeakPtr beginDownloading(const std::string& url, std::ostream& output);
+		/**
+		 * @param priority Requests with lower value start first. Data requests use the start time
+		 * of the requested range (milliseconds), thus the reader which needs the earliest data
+		 * is served first; 0 is for requests somebody waits for right now (e.g. metadata).
+		 */
+		RunningRequestWeakPtr beginDownloading(const std::string& url, std::ostream& output,
+		                                       CompletionCallback onCompleted = CompletionCallback(),
+		                                       double priority = 0.);
 		void cancelAllRequests();
+		//! Same without waiting, errors of the cancelled requests are ignored by waitForFinished()
+		void scheduleCancellingAllRequests();
 		void waitForFinished();
+
 	private:
 
 		friend class RunningRequest;
+		friend class TransferScheduler;
 		void requestCompleted(RunningRequest* request);
 		bool removeCompletedRequests();
 		virtual std::string decorateUrl(const std::string& url) const;
 
+		std::map<const RunningRequest*, CompletionCallback> callbacks_;
+
 		std::map<std::string, RunningRequestSharedPtr> activeRequests_;
-		std::mutex activeRequestsMutex_;
-		std::mutex completedRequestsMutex_;
+		std::mutex mutex_;
 		std::condition_variable requestsCV_;
 		std::atomic<bool> ignoreDownloadingErrors_;
 		std::vector<std::string> completedRequests_;
@@ -24,17 +24,26 @@
 
 #include "average.hxx"
 #include "cdf/reader.hxx"
+#include "coordinates.hxx"
 #include "datareader.hxx"
 #include "dataprovider.hxx"
+#include "derived.hxx"
+#include "downloader.hxx"
+#include "ephemerisindex.hxx"
 #include "field.hxx"
 #include "fieldbuffer.hxx"
 #include "parameters.hxx"
+#include "spatialgrid.hxx"
+#include "superposedepochs.hxx"
+#include "workspace.hxx"
 
 #include "filters/baddata.hxx"
 #include "filters/blankdata.hxx"
 #include "filters/density.hxx"
+#include "filters/expression.hxx"
 #include "filters/nightside.hxx"
 #include "filters/plasmasheet.hxx"
+#include "filters/plugin.hxx"
 #include "filters/quality.hxx"
 #include "filters/timefilter.hxx"
 
@@ -47,13 +56,17 @@
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <set>
 
 #include "config.h"
 
 #include "csa/dataprovider.hxx"
+#include "csa/downloader.hxx"
 #include "omni/dataprovider.hxx"
+#include "omni/omnidb.hxx"
 
 namespace {
 
@@ -98,6 +111,7 @@ namespace {
 	std::vector<cdownload::Output> expandOutputs(const std::vector<cdownload::Output>& outputs,
 	                                             const std::map<cdownload::DatasetName, cdownload::CDF::Info>& availableProducts)
 	{
+		using cdownload::CoordinateTransform;
 		using cdownload::ProductName;
 		using cdownload::Output;
 
@@ -115,9 +129,21 @@ namespace {
 					if (i == availableProducts.end()) {
 						throw std::runtime_error("Dataset '" + ds + "' is not present in the downloaded files");
 					}
+					std::vector<ProductName> products;
+					std::vector<ProductName> transformedProducts;
+					for (const ProductName& pr: output.productsForDataset(ds)) {
+						(CoordinateTransform::isTransformedProduct(pr) ? transformedProducts : products).push_back(pr);
+					}
 					std::vector<cdownload::ProductName> expandedProducts =
-						cdownload::expandWildcardsCaseSensitive(
-							output.productsForDataset(ds), i->second.variableNames());
+						cdownload::expandWildcardsCaseSensitive(products, i->second.variableNames());
+					// wildcards of transformed products are expanded over their sources
+					for (const ProductName& pr: transformedProducts) {
+						for (const ProductName& source: cdownload::expandWildcardsCaseSensitive(
+							{CoordinateTransform::sourceProduct(pr)}, i->second.variableNames())) {
+							expandedProducts.push_back(
+								CoordinateTransform::transformedProduct(CoordinateTransform::system(pr), source));
+						}
+					}
 					expandedProductsMap[ds] = expandedProducts;
 				}
 			}
@@ -125,11 +151,38 @@ namespace {
 		}
 		return res;
 	}
+
+	cdownload::FieldDesc describeProduct(const cdownload::CDF::Info& info, const cdownload::ProductName& product)
+	{
+		using cdownload::CoordinateTransform;
+		if (CoordinateTransform::isTransformedProduct(product)) {
+			return CoordinateTransform::describe(product,
+				info.variable(CoordinateTransform::sourceProduct(product).name()));
+		}
+		return info.variable(product.name());
+	}
+
+	void logFilterStatistics(const cdownload::DataReader& reader)
+	{
+		for (const auto& stat: reader.filterStatistics()) {
+			if (!stat.tested) {
+				continue;
+			}
+			BOOST_LOG_TRIVIAL(info) << "Filter " << stat.filter << " on " << stat.dataset << ": passed "
+				<< stat.passed << " of " << stat.tested << " records ("
+				<< 100. * static_cast<double>(stat.passed) / static_cast<double>(stat.tested) << "%), "
+				<< (stat.timedCalls ? 1e9 * stat.seconds / static_cast<double>(stat.timedCalls) : 0.)
+				<< " ns per call";
+		}
+	}
 }
 
 cdownload::Driver::Driver(const cdownload::Parameters& params)
 	: params_{params}
 {
+	curl::TransferScheduler::instance().setMaxConcurrentTransfers(params_.maxParallelDownloads());
+	csa::Downloader::setServerUrl(params_.csaUrl());
+	omni::OmniTableDesc::setHroDirectoryUrl(params_.omniUrl());
 }
 
 void cdownload::Driver::doTask()
@@ -142,9 +195,40 @@ void cdownload::Driver::doTask()
 	std::copy(rawFilters.begin(), rawFilters.end(), std::back_inserter(allFilters));
 	std::copy(averageDataFilters.begin(), averageDataFilters.end(), std::back_inserter(allFilters));
 
-	path tmpDirName = params_.workDir() / boost::filesystem::unique_path();
-	boost::filesystem::create_directories(tmpDirName);
-	BOOST_LOG_TRIVIAL(info) << "Working in " << tmpDirName;
+	std::vector<ProductName> requestedDerivedProducts;
+	for (const Output& output: params_.outputs()) {
+		const std::vector<ProductName> products =
+			output.productsForDatasetOrDefault(DerivedVariables::datasetName(), {});
+		if (!products.empty() && (params_.spatialBinning() || params_.superposedEpochAnalysis())) {
+			// bins aggregate the data cells only
+			throw std::runtime_error("Output '" + output.name() + "' requests derived products, which can not be "
+			                         "written with spatial binning or superposed epoch analysis");
+		}
+		std::copy(products.begin(), products.end(), std::back_inserter(requestedDerivedProducts));
+	}
+	for (const auto& filter: allFilters) {
+		const std::vector<ProductName> products = filter->derivedProducts();
+		std::copy(products.begin(), products.end(), std::back_inserter(requestedDerivedProducts));
+	}
+	DerivedVariables derived(requestedDerivedProducts, params_.spacecraftNames(), params_.derivedDefinitions());
+	bool rawFiltersUseDerived = false;
+	for (const auto& filter: rawFilters) {
+		rawFiltersUseDerived |= !filter->derivedProducts().empty();
+		if (auto expressionFilter = std::dynamic_pointer_cast<Filters::RawExpressionFilter>(filter)) {
+			expressionFilter->resolveDerivedProducts(derived);
+		}
+	}
+	// derived products inputs are read as the auxiliary ones
+	std::vector<ProductName> auxiliary = auxiliaryProducts();
+	for (const ProductName& pr: derived.requiredProducts()) {
+		if (std::find(auxiliary.begin(), auxiliary.end(), pr) == auxiliary.end()) {
+			auxiliary.push_back(pr);
+		}
+	}
+
+	Workspace::instance().setDirectories(params_.workDir(), params_.memoryWorkspaceDir(),
+	                                     params_.memoryWorkspaceBudget());
+	BOOST_LOG_TRIVIAL(info) << "Working in " << Workspace::instance().diskDirectory();
 
 	// dumping and saving parameters
 	BOOST_LOG_TRIVIAL(debug) << "Parameters: " << std::endl << params_;
@@ -164,7 +248,12 @@ void cdownload::Driver::doTask()
 	datetime availableStartDateTime = makeDateTime(1999, 1, 1);
 	datetime availableEndDateTime = datetime::utcNow();
 
-	std::vector<DatasetName> requiredDatasets = collectRequiredDatasets(params_.outputs(), allFilters);
+	if ((params_.spatialBinning() || params_.superposedEpochAnalysis() || !params_.cellIntervalsFileName().empty())
+	    && params_.continueDownloading()) {
+		throw std::runtime_error("Spatial binning, superposed epoch analysis, and cell intervals can not continue previous downloads");
+	}
+
+	std::vector<DatasetName> requiredDatasets = collectRequiredDatasets(params_.outputs(), allFilters, auxiliary);
 
 	for (const auto& ds: requiredDatasets) {
 		if (ProductName::isPseudoDataset(ds)) {
@@ -184,6 +273,38 @@ void cdownload::Driver::doTask()
 	BOOST_LOG_TRIVIAL(info) << "Found available time range: ["
 	                        << availableStartDateTime << ',' << availableEndDateTime << ']';
 
+	std::vector<datetime> events;
+	std::vector<EpochRange> eventWindows;
+	if (params_.superposedEpochAnalysis()) {
+		events = SuperposedEpochs::loadEvents(params_.superposedEpochs().eventsFileName);
+		// there is no need to download and read data outside of the event windows
+		const EpochRange windows = SuperposedEpochs::timeRange(events, params_.superposedEpochs().before,
+		                                                       params_.superposedEpochs().after);
+		eventWindows = SuperposedEpochs::windows(events, params_.superposedEpochs().before,
+		                                         params_.superposedEpochs().after);
+		BOOST_LOG_TRIVIAL(info) << "Loaded " << events.size() << " events in " << eventWindows.size()
+			<< " disjoint windows";
+		availableStartDateTime = std::max(availableStartDateTime, datetime(windows.begin()));
+		availableEndDateTime = std::min(availableEndDateTime, datetime(windows.end()));
+	}
+
+	std::vector<EpochRange> cellIntervals;
+	if (!params_.cellIntervalsFileName().empty()) {
+		cellIntervals = Filters::TimeFilter::readRanges(params_.cellIntervalsFileName());
+		if (cellIntervals.empty()) {
+			throw std::runtime_error("Cell intervals list is empty");
+		}
+		BOOST_LOG_TRIVIAL(info) << "Loaded " << cellIntervals.size() << " cell intervals";
+		EpochRange::EpochType firstBegin = cellIntervals.front().begin();
+		EpochRange::EpochType lastEnd = cellIntervals.front().end();
+		for (const EpochRange& interval: cellIntervals) {
+			firstBegin = std::min(firstBegin, interval.begin());
+			lastEnd = std::max(lastEnd, interval.end());
+		}
+		availableStartDateTime = std::max(availableStartDateTime, datetime(firstBegin));
+		availableEndDateTime = std::min(availableEndDateTime, datetime(lastEnd));
+	}
+
 	const datetime actualStartDateTime = std::max(params_.startDate(), availableStartDateTime);
 	const datetime actualEndtDateTime = std::min(params_.endDate(), availableEndDateTime);
 
@@ -193,17 +314,57 @@ void cdownload::Driver::doTask()
 
 //  datetime currentChunkStartTime = availableStartDateTime;
 
+	std::vector<EpochRange> orbitRanges;
+	const bool pruneByOrbit = params_.ephemerisIndex() &&
+		findOrbitCandidateRanges(actualStartDateTime, actualEndtDateTime, cellIntervals.empty(), orbitRanges);
+	if (pruneByOrbit && orbitRanges.empty()) {
+		throw std::runtime_error("Spacecraft orbit does not satisfy the filter conditions in the requested time range");
+	}
+
+	{
+		std::map<const DataProvider*, std::vector<DatasetName>> providerDatasets;
+		for (const auto& ds: requiredDatasets) {
+			if (!ProductName::isPseudoDataset(ds)) {
+				providerDatasets[&dataProvider(ds)].push_back(ds);
+			}
+		}
+		for (const auto& p: providerDatasets) {
+			p.first->prepare(p.second, params_, actualStartDateTime, actualEndtDateTime);
+		}
+	}
+
+	std::unique_ptr<Filters::TimeFilter> timeFilter;
+	if (!params_.timeRangesFileName().empty()) {
+		timeFilter.reset(new Filters::TimeFilter(params_.timeRangesFileName()));
+	}
+
 	// have to get first chunks separately in order to detect dataset products
 	std::map<DatasetName, std::shared_ptr<DataSource> > datasources;
 	std::map<DatasetName, DatasetChunk> chunks;
 	for (const auto& ds: requiredDatasets) {
 		datasources[ds] = std::shared_ptr<DataSource>(dataProvider(ds).datasource(ds, params_));
+		if (pruneByOrbit) {
+			datasources[ds]->restrictToTimeRanges(orbitRanges);
+		}
+		if (timeFilter) {
+			// only the valid ranges are downloaded and read
+			datasources[ds]->restrictToTimeRanges(timeFilter->ranges());
+		}
+		if (!eventWindows.empty()) {
+			datasources[ds]->restrictToTimeRanges(eventWindows);
+		}
 		chunks[ds] = datasources[ds]->nextChunk();
+		if (chunks[ds].empty()) {
+			throw std::runtime_error("No data for dataset '" + ds + "' in the requested time ranges");
+		}
 	}
 
 	std::map<cdownload::DatasetName, CDF::Info> availableProducts;
 	std::vector<ProductName> orderedCDFKeys;
 	extractInfo(chunks, availableProducts, orderedCDFKeys);
+	// readers request the first chunks again, and transient files of these would be removed
+	// under them otherwise
+	chunks.clear();
 
 	BOOST_LOG_TRIVIAL(debug) << "Collected CDF variables: " << put_list(orderedCDFKeys);
 
@@ -212,7 +373,8 @@ void cdownload::Driver::doTask()
 	productsToRead_.clear();
 	datasetsToLoad_.clear();
 
-	ProductsToRead fieldsToRead = collectAllProductsToRead(availableProducts, expandedOutputs, allFilters);
+	ProductsToRead fieldsToRead = collectAllProductsToRead(availableProducts, expandedOutputs, allFilters,
+	                                                       auxiliary);
 	BOOST_LOG_TRIVIAL(trace) << "Fields to read (write): " << put_list(fieldsToRead.productsToWrite);
 	BOOST_LOG_TRIVIAL(trace) << "Fields to read (filter): " << put_list(fieldsToRead.productsForFiltersOnly);
 	BOOST_LOG_TRIVIAL(trace) << "Filter variables: ";
@@ -224,6 +386,9 @@ void cdownload::Driver::doTask()
 	for (const auto& fp: fieldsToRead.filterFields) {
 		std::copy(fp.second.begin(), fp.second.end(), std::back_inserter(allFilterFields));
 	}
+	// derived products share the buffer with filter variables, which makes them visible to filters
+	const std::vector<FieldDesc> derivedFields = derived.fields();
+	std::copy(derivedFields.begin(), derivedFields.end(), std::back_inserter(allFilterFields));
 
 	FieldBuffer filterVariablesBuffer(allFilterFields);
 
@@ -255,7 +420,7 @@ void cdownload::Driver::doTask()
 	DatasetProductsMap productsToRead = parseProductsList(productsToRead_);
 	for (const auto& dsp: productsToRead) {
 		for (const auto& pr: dsp.second) {
-			const FieldDesc& f = availableProducts[pr.dataset()].variable(pr.name());
+			const FieldDesc f = describeProduct(availableProducts[pr.dataset()], pr);
 			fields.emplace_back(f, totalSize);
 			averagingCells.emplace_back(f.elementCount());
 			totalSize++;//d? += f.elementCount();
@@ -280,11 +445,48 @@ void cdownload::Driver::doTask()
 		}
 	}
 
+	// bin descriptions for the spatial grid and superposed epoch outputs. Filter variables
+	// describe single cells and thus are not written in these modes
+	const bool aggregateCells = params_.spatialBinning() || params_.superposedEpochAnalysis();
+	// filter variables of different spacecraft share names, thus only the derived products, which are named
+	// with the spacecraft, are written for joint runs
+	const bool jointSpacecraft = params_.spacecraftNames().size() > 1;
+	std::vector<FieldDesc> binColumns;
+	if (params_.spatialBinning()) {
+		const char componentNames[] = {'X', 'Y', 'Z'};
+		for (const auto& axis: params_.spatialGrid().axes) {
+			binColumns.emplace_back(ProductName(ProductName::makePseudoDatasetName("GRID"),
+			                                    std::string(1, componentNames[axis.component])),
+			                        std::numeric_limits<double>::quiet_NaN(), FieldDesc::DataType::Real,
+			                        sizeof(double), 1);
+		}
+	} else if (params_.superposedEpochAnalysis()) {
+		for (const char* name: {"Offset", "Events"}) {
+			binColumns.emplace_back(ProductName(ProductName::makePseudoDatasetName("SEA"), name),
+			                        std::numeric_limits<double>::quiet_NaN(), FieldDesc::DataType::Real,
+			                        sizeof(double), 1);
+		}
+	}
+	FieldBuffer binColumnsBuffer(binColumns);
+
 	BOOST_LOG_TRIVIAL(debug) << "Creating writers";
 
+	const std::vector<Field> filterVariableFields = filterVariablesBuffer.fields();
+	std::vector<Field> derivedColumns;
+	std::copy_if(filterVariableFields.begin(), filterVariableFields.end(),
+	             std::back_inserter(derivedColumns), [](const Field& f) {
+		return f.name().dataset() == DerivedVariables::datasetName();
+	});
+
 	std::vector<std::unique_ptr<Writer> > writers;
 	for (const Output& o: params_.outputs()) {
-		writers.push_back(createWriterForOutput(o, fields, filterVariablesBuffer.fields()));
+		if (aggregateCells) {
+			writers.push_back(createWriterForOutput(o, fields, {}, binColumnsBuffer.fields()));
+		} else if (jointSpacecraft) {
+			writers.push_back(createWriterForOutput(o, fields, derivedColumns));
+		} else {
+			writers.push_back(createWriterForOutput(o, fields, filterVariablesBuffer.fields()));
+		}
 	}
 
 	if (!params_.allowBlanks()) {
@@ -292,6 +494,7 @@ void cdownload::Driver::doTask()
 	}
 
 	initializeFilters(fields, filterVariablesBuffer.fields(), rawFilters, averageDataFilters);
+	derived.initialize(fields, filterVariablesBuffer.fields());
 
 	std::size_t cellNo = 0;
 
@@ -344,15 +547,13 @@ void cdownload::Driver::doTask()
 		}
 	}
 
-	std::unique_ptr<Filters::TimeFilter> timeFilter;
-	if (!params_.timeRangesFileName().empty()) {
-		timeFilter.reset(new Filters::TimeFilter(params_.timeRangesFileName()));
-	}
-
-
 	if (params_.disableAveraging()) {
 		DirectDataReader reader(actualStartDateTime, actualEndtDateTime,
 		                                  rawFilters, datasources, productsToRead, fields, timeFilter.get());
+		if (!derived.empty()) {
+			// computed before the filters test the record, and written along with it
+			reader.setDerivedVariables(derived, filterVariables);
+		}
 		std::vector<DirectDataWriter*> dWriters;
 		for (const std::unique_ptr<Writer>& writer: writers) {
 			dWriters.push_back(dynamic_cast<DirectDataWriter*>(writer.get()));
@@ -383,17 +584,68 @@ void cdownload::Driver::doTask()
 				}
 			}
 		}
+		logFilterStatistics(reader);
 	} else {
-		AveragingDataReader reader(actualStartDateTime, actualEndtDateTime, params_.timeInterval(),
-		                           rawFilters, datasources, productsToRead, averagingCells, fields, timeFilter.get());
+		// record values of derived products for the raw filters, cells get their own ones. Joint readers
+		// read ahead concurrently with the cells processing, hence the separate buffer
+		FieldBuffer recordDerivedBuffer(rawFiltersUseDerived ? allFilterFields : std::vector<FieldDesc>());
+		std::unique_ptr<DataReader> reader;
+		IntervalAveragingDataReader* intervalReader = nullptr;
+		if (jointSpacecraft) {
+			std::vector<DatasetGroup> groups = makeSpacecraftGroups(productsToRead, averageDataFilters);
+			for (const DatasetGroup& group: groups) {
+				BOOST_LOG_TRIVIAL(debug) << "Dataset group " << group.name << ": " << put_list(group.datasets);
+			}
+			reader.reset(new JointAveragingDataReader(actualStartDateTime, actualEndtDateTime, params_.timeInterval(),
+			                           groups, rawFilters, datasources, productsToRead, averagingCells, fields,
+			                           filterVariables, derived, timeFilter.get()));
+		} else if (!cellIntervals.empty()) {
+			intervalReader = new IntervalAveragingDataReader(actualStartDateTime, actualEndtDateTime,
+			                           params_.timeInterval(), cellIntervals,
+			                           rawFilters, datasources, productsToRead, averagingCells, fields, timeFilter.get());
+			reader.reset(intervalReader);
+		} else {
+			reader.reset(new AveragingDataReader(actualStartDateTime, actualEndtDateTime, params_.timeInterval(),
+			                           rawFilters, datasources, productsToRead, averagingCells, fields, timeFilter.get()));
+		}
+		if (rawFiltersUseDerived) {
+			reader->setDerivedVariables(derived, recordDerivedBuffer.writeBuffers());
+		}
 		std::vector<AveragedDataWriter*> aWriters;
 		for (const std::unique_ptr<Writer>& writer: writers) {
 			aWriters.push_back(dynamic_cast<AveragedDataWriter*>(writer.get()));
 		}
 
-		for (; !reader.eof() && !reader.fail(); ++cellNo) {
-			auto readResult = reader.readNextCell();
+		std::unique_ptr<SpatialGrid> grid;
+		std::size_t positionIndex = 0;
+		if (params_.spatialBinning()) {
+			grid.reset(new SpatialGrid(params_.spatialGrid().axes, params_.spatialGrid().lengthUnit, averagingCells));
+			const ProductName& positionProduct = params_.spatialGrid().positionProduct;
+			auto fi = std::find_if(fields.begin(), fields.end(), [&positionProduct](const Field& f) {
+				return f.name() == positionProduct;
+			});
+			assert(fi != fields.end());
+			positionIndex = static_cast<std::size_t>(std::distance(fields.begin(), fi));
+		}
+
+		std::unique_ptr<SuperposedEpochs> superposedEpochs;
+		if (params_.superposedEpochAnalysis()) {
+			superposedEpochs.reset(new SuperposedEpochs(events, params_.superposedEpochs().before,
+			                                            params_.superposedEpochs().after, params_.timeInterval(),
+			                                            averagingCells));
+		}
+
+		for (; !reader->eof() && !reader->fail(); ++cellNo) {
+			auto readResult = reader->readNextCell();
+			if (intervalReader) {
+				// output rows are numbered by the intervals order in the file
+				cellNo = intervalReader->intervalIndex();
+			}
 			if (readResult.first) {
+				if (!jointSpacecraft) {
+					// joint reader computes them for the group filters
+					derived.compute(averagingCells, filterVariables);
+				}
 				bool cellPassedFiltering = true;
 				for (const auto& filter: averageDataFilters) {
 					if (!filter->test(averagingCells, filterVariables)) {
@@ -404,7 +656,14 @@ void cdownload::Driver::doTask()
 						break;
 					}
 				}
-				if (cellPassedFiltering) {
+				if (cellPassedFiltering && grid) {
+					const std::size_t bin = grid->binIndex(averagingCells[positionIndex]);
+					if (bin != SpatialGrid::INVALID_BIN) {
+						grid->add(bin, averagingCells, readResult.second);
+					}
+				} else if (cellPassedFiltering && superposedEpochs) {
+					superposedEpochs->add(readResult.second, averagingCells);
+				} else if (cellPassedFiltering) {
 #ifdef DEBUG_LOG_EVERY_CELL
 					BOOST_LOG_TRIVIAL(trace) << "Writing Cell " << readResult.second;
 #endif
@@ -414,12 +673,45 @@ void cdownload::Driver::doTask()
 				}
 			}
 		}
+		logFilterStatistics(*reader);
+
+		std::vector<void*> binColumnsValues = binColumnsBuffer.writeBuffers();
+		const std::vector<const void*> binColumnsForWriters = binColumnsBuffer.readBuffers();
+		if (grid) {
+			BOOST_LOG_TRIVIAL(info) << "Writing spatial grid";
+			for (const auto& bin: *grid) {
+				const std::vector<double> center = grid->binCenter(bin.first);
+				for (std::size_t i = 0; i < center.size(); ++i) {
+					*static_cast<double*>(binColumnsValues[i]) = center[i];
+				}
+				for (AveragedDataWriter* writer: aWriters) {
+					writer->write(bin.first, datetime(bin.second.time().mean()), {bin.second.cells()},
+					              {binColumnsForWriters});
+				}
+			}
+		}
+
+		if (superposedEpochs) {
+			BOOST_LOG_TRIVIAL(info) << "Writing superposed epochs";
+			for (std::size_t i = 0; i < superposedEpochs->binsCount(); ++i) {
+				const SuperposedEpochs::Bin& bin = superposedEpochs->bin(i);
+				if (!bin.time().count()) {
+					continue;
+				}
+				*static_cast<double*>(binColumnsValues[0]) = superposedEpochs->binOffset(i).seconds();
+				*static_cast<double*>(binColumnsValues[1]) = static_cast<double>(bin.time().count());
+				for (AveragedDataWriter* writer: aWriters) {
+					writer->write(i, datetime(bin.time().mean()), {bin.cells()}, {binColumnsForWriters});
+				}
+			}
+		}
 	}
 }
 
 std::unique_ptr<cdownload::Writer>
 cdownload::Driver::createWriterForOutput(const cdownload::Output& output,
-                     const std::vector<Field>& dataFields, const std::vector<Field>& filterVariables) const
+                     const std::vector<Field>& dataFields, const std::vector<Field>& filterVariables,
+                     const std::vector<Field>& extraColumns) const
 {
 
 // 	fieldsForWriters[o.name()], params_.writeEpoch()
@@ -436,6 +728,8 @@ cdownload::Driver::createWriterForOutput(const cdownload::Output& output,
 					 return contains(output.productsForDatasetOrDefault(f.name().dataset(), {}), f.name());
 				 });
 
+	std::copy(extraColumns.begin(), extraColumns.end(), std::back_inserter(filterVariableForWriter));
+
 	std::unique_ptr<cdownload::Writer> res;
 	switch (output.format()) {
 	case Output::Format::ASCII: {
@@ -490,31 +784,142 @@ void cdownload::Driver::createFilters(std::vector<std::shared_ptr<RawDataFilter>
 	// better to be the first one to simplify debugging
 	rawDataFilters.emplace_back(new Filters::BadDataFilter());
 
-	if (params_.onlyNightSide()) {
-		rawDataFilters.emplace_back(new Filters::NightSide(params_.spacecraftName()));
-	}
+	for (const string& spacecraft: params_.spacecraftNames()) {
+		if (params_.onlyNightSide()) {
+			rawDataFilters.emplace_back(new Filters::NightSide(spacecraft));
+		}
 
-	if (params_.plasmaSheetFilter()) {
-		rawDataFilters.emplace_back(new Filters::PlasmaSheetModeFilter(params_.spacecraftName()));
+		if (params_.plasmaSheetFilter()) {
+			rawDataFilters.emplace_back(new Filters::PlasmaSheetModeFilter(spacecraft));
+		}
 	}
 
 	for (const auto& qfp: params_.qualityFilters()) {
 		rawDataFilters.emplace_back(new Filters::QualityFilter(qfp.product, qfp.minQuality));
 	}
 
+	for (const string& expression: params_.filterExpressions()) {
+		rawDataFilters.emplace_back(new Filters::RawExpressionFilter(expression));
+	}
+
+
+	if (!params_.disableAveraging()) {
+		for (const string& spacecraft: params_.spacecraftNames()) {
+			for (const auto& dfp: params_.densityyFilters()) {
+				const ProductName product = ProductName(dfp.source == DensitySource::CODIF ? "CP_CIS-CODIF_HS_H1_MOMENTS" : "CP_CIS-HIA_ONBOARD_MOMENTS",
+				                                        spacecraft, "density");
+				averagedDataFilters.emplace_back(new Filters::H1DensityFilter(product, dfp.minDensity));
+			}
+
+			if (isPlasmaSheetFilterNeeded) {
+				averagedDataFilters.emplace_back(new Filters::PlasmaSheet(params_.plasmaSheetMinR(), spacecraft));
+				averagedDataFilters.back()->enable(isPlasmaSheetFilterActive);
+			}
+		}
+
+		for (const string& expression: params_.averagedFilterExpressions()) {
+			averagedDataFilters.emplace_back(new Filters::AveragedExpressionFilter(expression));
+		}
+	}
+
+	for (const path& library: params_.filterPlugins()) {
+		std::shared_ptr<Filters::FilterPlugin> plugin = std::make_shared<Filters::FilterPlugin>(library);
+		if (!plugin->averaged()) {
+			rawDataFilters.emplace_back(new Filters::RawPluginFilter(plugin));
+		} else if (!params_.disableAveraging()) {
+			averagedDataFilters.emplace_back(new Filters::AveragedPluginFilter(plugin));
+		} else {
+			throw std::runtime_error("Filter plugin " + plugin->name() + " tests averaged data, but averaging is disabled");
+		}
+	}
+}
+
+bool cdownload::Driver::findOrbitCandidateRanges(const datetime& begin, const datetime& end, bool cellsAreRegular,
+                                                 std::vector<EpochRange>& ranges) const
+{
+	EphemerisIndex::Conditions conditions {params_.onlyNightSide(), 0.};
+	// the plasma sheet filter tests cell mean position, which is never farther than the farthest record.
+	// Cells of arbitrary length may reach far from the ranges, thus we do not use it for them
+	if (params_.plasmaSheetFilter() && !params_.disableAveraging() && cellsAreRegular) {
+		conditions.minR = params_.plasmaSheetMinR() * EARTH_RADIUS;
+	}
+	if (!conditions.nightSide && conditions.minR <= 0) {
+		BOOST_LOG_TRIVIAL(info) << "Ephemeris index is not used: no geometric filters are active";
+		return false;
+	}
 
+	// positions are sampled every minute, and records outside of the candidate steps still count
+	// for the averaging cells, which reach into them
+	timeduration margin = timeduration(0, 1, 0);
 	if (!params_.disableAveraging()) {
-		for (const auto& dfp: params_.densityyFilters()) {
-			const ProductName product = ProductName(dfp.source == DensitySource::CODIF ? "CP_CIS-CODIF_HS_H1_MOMENTS" : "CP_CIS-HIA_ONBOARD_MOMENTS",
-			                                        params_.spacecraftName(), "density");
-			averagedDataFilters.emplace_back(new Filters::H1DensityFilter(product, dfp.minDensity));
+		margin += params_.timeInterval();
+	}
+
+	const path directory = params_.cacheDir().empty() ? params_.workDir() : params_.cacheDir();
+	ranges.clear();
+	for (const string& spacecraft: params_.spacecraftNames()) {
+		const DatasetName positionsDataset = EphemerisIndex::positionProduct(spacecraft).dataset();
+		std::unique_ptr<DataSource> positions = dataProvider(positionsDataset).datasource(positionsDataset, params_);
+		EphemerisIndex index(spacecraft, directory);
+		index.update(begin, end, *positions);
+		// a joint row may come from any of the spacecraft
+		std::vector<EpochRange> spacecraftRanges = index.candidateRanges(begin, end, conditions, margin);
+		double totalLength = 0;
+		for (const EpochRange& r: spacecraftRanges) {
+			totalLength += r.width();
+		}
+		BOOST_LOG_TRIVIAL(info) << "Ephemeris index for " << spacecraft << ": " << spacecraftRanges.size()
+			<< " candidate time ranges, " << 100. * totalLength / (end - begin).milliseconds() << "% of the time range";
+		ranges.insert(ranges.end(), spacecraftRanges.begin(), spacecraftRanges.end());
+	}
+	return true;
+}
+
+std::vector<cdownload::DatasetGroup>
+cdownload::Driver::makeSpacecraftGroups(const DatasetProductsMap& productsToRead,
+                                        std::vector<std::shared_ptr<AveragedDataFilter> >& averagedDataFilters) const
+{
+	// datasets of a spacecraft start with its name, e.g. C1_CP_FGM_SPIN, the others (OMNI) are shared
+	const string sharedGroupName = "shared";
+	std::map<string, DatasetGroup> groups;
+	auto groupNameForDataset = [this, &sharedGroupName](const DatasetName& ds) {
+		for (const string& spacecraft: params_.spacecraftNames()) {
+			if (ds.compare(0, spacecraft.size() + 1, spacecraft + '_') == 0) {
+				return spacecraft;
+			}
 		}
+		return sharedGroupName;
+	};
+
+	for (const auto& dsp: productsToRead) {
+		const string groupName = groupNameForDataset(dsp.first);
+		DatasetGroup& group = groups[groupName];
+		group.name = groupName;
+		group.required = groupName == sharedGroupName;
+		group.datasets.push_back(dsp.first);
+	}
 
-		if (isPlasmaSheetFilterNeeded) {
-			averagedDataFilters.emplace_back(new Filters::PlasmaSheet(params_.plasmaSheetMinR(), params_.spacecraftName()));
-			averagedDataFilters.back()->enable(isPlasmaSheetFilterActive);
+	// a filter goes to the group its products belong to, filters spanning several groups are
+	// applied to the joint cells
+	std::vector<std::shared_ptr<AveragedDataFilter> > jointFilters;
+	for (const auto& filter: averagedDataFilters) {
+		std::set<string> filterGroups;
+		for (const ProductName& pr: filter->requiredProducts()) {
+			filterGroups.insert(groupNameForDataset(pr.dataset()));
+		}
+		if (filterGroups.size() == 1 && groups.count(*filterGroups.begin())) {
+			groups[*filterGroups.begin()].filters.push_back(filter);
+		} else {
+			jointFilters.push_back(filter);
 		}
 	}
+	averagedDataFilters = jointFilters;
+
+	std::vector<DatasetGroup> res;
+	for (const auto& gp: groups) {
+		res.push_back(gp.second);
+	}
+	return res;
 }
 
 void cdownload::Driver::addBlankDataFilters(const std::vector<Field>& fields,
@@ -549,7 +954,8 @@ void cdownload::Driver::initializeFilters(const std::vector<Field>& fields,
 cdownload::Driver::ProductsToRead
 cdownload::Driver::collectAllProductsToRead(const std::map<cdownload::DatasetName, CDF::Info>& available,
                                             const std::vector<Output>& outputs,
-                                            const std::vector<std::shared_ptr<Filter> >& filters)
+                                            const std::vector<std::shared_ptr<Filter> >& filters,
+                                            const std::vector<ProductName>& auxiliaryProducts)
 {
 	std::vector<ProductName> requestedFilterVariables;
 	ProductsToRead res;
@@ -559,6 +965,9 @@ cdownload::Driver::collectAllProductsToRead(const std::map<cdownload::DatasetNam
 		}
 
 		for (const auto& dsPrPair: o.products()) {
+			if (dsPrPair.first == DerivedVariables::datasetName()) {
+				continue;
+			}
 			// store filter variables for later
 			if (ProductName::isPseudoDataset(dsPrPair.first)) {
 				std::copy(dsPrPair.second.begin(), dsPrPair.second.end(), std::back_inserter(requestedFilterVariables));
@@ -571,9 +980,11 @@ cdownload::Driver::collectAllProductsToRead(const std::map<cdownload::DatasetNam
 			std::vector<ProductName> dsVariables = i->second.variableNames();
 //          const CDF::Info& info = i->second;
 			for (const auto& pr: dsPrPair.second) {
-				if (std::find(dsVariables.begin(), dsVariables.end(), pr) == dsVariables.end()) {
+				const ProductName& variable =
+					CoordinateTransform::isTransformedProduct(pr) ? CoordinateTransform::sourceProduct(pr) : pr;
+				if (std::find(dsVariables.begin(), dsVariables.end(), variable) == dsVariables.end()) {
 					throw std::runtime_error("Dataset '" + dsPrPair.first
-					                         + "' does not contain product '" + pr.name() + '\'');
+					                         + "' does not contain product '" + variable.name() + '\'');
 				}
 				res.productsToWrite.push_back(pr);
 			}
@@ -597,13 +1008,16 @@ cdownload::Driver::collectAllProductsToRead(const std::map<cdownload::DatasetNam
 	for (const auto& filter: filters) {
 		res.filterVariables[filter.get()] = {};
 		const auto filterName = filter->name();
-		if (filterNames.count(filterName)) {
-			throw std::runtime_error("Two filters with the same name ('" + filterName + "') are not allowed");
-		}
-		filterNames.insert(filterName);
 
 		auto iv = variablesPerFilter.find(filterName);
 		if (iv != variablesPerFilter.end()) {
+			// variables are referred by the filter name
+			if (filterNames.count(filterName)) {
+				throw std::runtime_error("Variables of several filters with the same name ('" + filterName +
+				                         "') are not allowed");
+			}
+			filterNames.insert(filterName);
+
 			res.filterFields[filter.get()] = filter->variables();
 			const auto& filterVariables = res.filterFields[filter.get()];
 			std::set<std::string> shortNamedFilterVariables;
@@ -633,11 +1047,19 @@ cdownload::Driver::collectAllProductsToRead(const std::map<cdownload::DatasetNam
 		throw std::runtime_error("Not all filter variables have been found");
 	}
 
+	for (const ProductName& pr: auxiliaryProducts) {
+		if (std::find(res.productsToWrite.begin(), res.productsToWrite.end(), pr) == res.productsToWrite.end() &&
+			std::find(res.productsForFiltersOnly.begin(), res.productsForFiltersOnly.end(), pr) == res.productsForFiltersOnly.end()) {
+			res.productsForFiltersOnly.push_back(pr);
+		}
+	}
+
 	return res;
 }
 
 std::vector<cdownload::DatasetName>
-cdownload::Driver::collectRequiredDatasets(const std::vector<Output>& outputs, const std::vector<std::shared_ptr<Filter> >& filters)
+cdownload::Driver::collectRequiredDatasets(const std::vector<Output>& outputs, const std::vector<std::shared_ptr<Filter> >& filters,
+                                           const std::vector<ProductName>& auxiliaryProducts)
 {
 	std::set<DatasetName> res;
 	for (const Output& o: outputs) {
@@ -654,11 +1076,24 @@ cdownload::Driver::collectRequiredDatasets(const std::vector<Output>& outputs, c
 		}
 	}
 
+	for (const ProductName& pr: auxiliaryProducts) {
+		res.insert(pr.dataset());
+	}
+
 	std::vector<DatasetName> resVector;
 	std::copy(res.begin(), res.end(), std::back_inserter(resVector));
 	return resVector;
 }
 
+std::vector<cdownload::ProductName> cdownload::Driver::auxiliaryProducts() const
+{
+	std::vector<ProductName> res;
+	if (params_.spatialBinning()) {
+		res.push_back(params_.spatialGrid().positionProduct);
+	}
+	return res;
+}
+
 void cdownload::Driver::listDatasets()
 {
 	std::cerr << "Available datasets:" << std::endl << std::flush;
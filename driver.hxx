@@ -20,6 +20,7 @@
 #ifndef CDOWNLOAD_DRIVER_H
 #define CDOWNLOAD_DRIVER_H
 
+#include "epochrange.hxx"
 #include "parameters.hxx"
 #include "csa/unpacker.hxx"
 
@@ -44,6 +45,8 @@ namespace csa {
 	class AveragedDataFilter;
 	class RawDataFilter;
 
+	struct DatasetGroup;
+
 	/**
 	 * @brief Main class for data downloader which drives interaction between downloader,
 	 * data reader, filters and output writers
@@ -61,6 +64,25 @@ namespace csa {
 		void createFilters(std::vector<std::shared_ptr<RawDataFilter> >& rawDataFilters,
 		                   std::vector<std::shared_ptr<AveragedDataFilter> >& averagedDataFilters);
 
+		/**
+		 * @brief Splits datasets into per-spacecraft groups for joint averaging
+		 *
+		 * Averaged data filters, which belong to a single group, are moved from @p averagedDataFilters
+		 * into that group.
+		 */
+		std::vector<DatasetGroup> makeSpacecraftGroups(const DatasetProductsMap& productsToRead,
+		                                               std::vector<std::shared_ptr<AveragedDataFilter> >& averagedDataFilters) const;
+
+		/**
+		 * @brief Finds time ranges, where the geometric filters (night side, plasma sheet distance)
+		 * may pass, using the coarse ephemeris index of every spacecraft
+		 *
+		 * @param cellsAreRegular averaging cells are of the fixed length
+		 * @return false if none of the geometric filters is active
+		 */
+		bool findOrbitCandidateRanges(const datetime& begin, const datetime& end, bool cellsAreRegular,
+		                              std::vector<EpochRange>& ranges) const;
+
 		void addBlankDataFilters(const std::vector<Field>& fields, std::vector<std::shared_ptr<RawDataFilter> >& rawDataFilters);
 
 		void initializeFilters(const std::vector<Field>& fields, const std::vector<Field>& filterVariables,
@@ -75,15 +97,23 @@ namespace csa {
 			std::map<const Filter*, std::vector<FieldDesc>> filterFields;
 		};
 
+		//! @param auxiliaryProducts products, which are neither written nor used by filters, but
+		//! have to be read anyway (e.g. position for spatial binning)
 		static ProductsToRead collectAllProductsToRead(const std::map<cdownload::DatasetName, CDF::Info>& available,
 		                                               const std::vector<Output>& outputs,
-		                                               const std::vector<std::shared_ptr<Filter> >& filters);
+		                                               const std::vector<std::shared_ptr<Filter> >& filters,
+		                                               const std::vector<ProductName>& auxiliaryProducts);
 
 		static std::vector<DatasetName> collectRequiredDatasets(const std::vector<Output>& outputs,
-		                                                         const std::vector<std::shared_ptr<Filter> >& filters);
+		                                                         const std::vector<std::shared_ptr<Filter> >& filters,
+		                                                         const std::vector<ProductName>& auxiliaryProducts);
+
+		std::vector<ProductName> auxiliaryProducts() const;
 
+		//! @param extraColumns raw fields, which are written into every output
 		std::unique_ptr<Writer> createWriterForOutput(const Output& output,
-		                                      const std::vector<Field>& dataFields, const std::vector<Field>& filterVariables) const;
+		                                      const std::vector<Field>& dataFields, const std::vector<Field>& filterVariables,
+		                                      const std::vector<Field>& extraColumns = {}) const;
 
 		Parameters params_;
 		std::vector<DatasetName> datasetsToLoad_;
@@ -0,0 +1,257 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "ephemerisindex.hxx"
+
+#include "cdf/reader.hxx"
+#include "datasource.hxx"
+#include "field.hxx"
+#include "floatcomparison.hxx"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "config.h"
+
+constexpr const double cdownload::EphemerisIndex::STEP_LENGTH;
+
+namespace {
+	const char INDEX_MAGIC[] = "CDEI";
+	const std::uint32_t INDEX_VERSION = 1;
+
+	template <class T>
+	void writeValue(std::ostream& os, const T& value)
+	{
+		os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <class T>
+	bool readValue(std::istream& is, T& value)
+	{
+		return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+	}
+
+	cdownload::EphemerisIndex::Step emptyStep()
+	{
+		return {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), 0.f, 0};
+	}
+}
+
+cdownload::EphemerisIndex::EphemerisIndex(const string& spacecraft, const path& directory)
+	: spacecraft_{spacecraft}
+	, fileName_{indexFileName(spacecraft, directory)}
+	, firstStep_{0}
+{
+	if (!load()) {
+		steps_.clear();
+	}
+}
+
+cdownload::ProductName cdownload::EphemerisIndex::positionProduct(const string& spacecraft)
+{
+	return {"CP_AUX_POSGSE_1M", spacecraft, "sc_r_xyz_gse"};
+}
+
+cdownload::path cdownload::EphemerisIndex::indexFileName(const string& spacecraft, const path& directory)
+{
+	return directory / (spacecraft + "_ephemeris.idx");
+}
+
+std::int64_t cdownload::EphemerisIndex::stepForEpoch(double epoch)
+{
+	return static_cast<std::int64_t>(std::floor(epoch / STEP_LENGTH));
+}
+
+void cdownload::EphemerisIndex::update(const datetime& begin, const datetime& end, DataSource& positions)
+{
+	const std::int64_t firstStep = stepForEpoch(begin.milliseconds());
+	const std::int64_t endStep = stepForEpoch(end.milliseconds()) + 1;
+	bool changed = false;
+	if (steps_.empty()) {
+		firstStep_ = firstStep;
+		readPositions(firstStep, endStep, positions, steps_);
+		changed = true;
+	} else {
+		if (firstStep < firstStep_) {
+			std::vector<Step> steps;
+			readPositions(firstStep, firstStep_, positions, steps);
+			steps.insert(steps.end(), steps_.begin(), steps_.end());
+			steps_.swap(steps);
+			firstStep_ = firstStep;
+			changed = true;
+		}
+		const std::int64_t indexEndStep = firstStep_ + static_cast<std::int64_t>(steps_.size());
+		if (endStep > indexEndStep) {
+			readPositions(indexEndStep, endStep, positions, steps_);
+			changed = true;
+		}
+	}
+
+	if (changed) {
+		try {
+			save();
+		} catch (std::exception& ex) {
+			BOOST_LOG_TRIVIAL(warning) << "Could not save ephemeris index " << fileName_ << ": " << ex.what();
+		}
+	}
+}
+
+void cdownload::EphemerisIndex::readPositions(std::int64_t firstStep, std::int64_t endStep, DataSource& positions,
+                                              std::vector<Step>& steps) const
+{
+	const std::size_t firstIndex = steps.size();
+	steps.resize(firstIndex + static_cast<std::size_t>(endStep - firstStep), emptyStep());
+
+	const double from = static_cast<double>(firstStep) * STEP_LENGTH;
+	const double to = static_cast<double>(endStep) * STEP_LENGTH;
+	if (to <= positions.minAvailableTime().milliseconds() || from >= positions.maxAvailableTime().milliseconds()) {
+		return;
+	}
+	BOOST_LOG_TRIVIAL(info) << "Building ephemeris index for " << spacecraft_ << " in ["
+		<< datetime(from) << ',' << datetime(to) << ']';
+
+	const ProductName product = positionProduct(spacecraft_);
+	positions.setNextChunkStartTime(std::max(datetime(from), positions.minAvailableTime()));
+	for (DatasetChunk chunk = positions.nextChunk(); !chunk.empty() && chunk.startTime.milliseconds() < to;
+	     chunk = positions.nextChunk()) {
+		CDF::File file {chunk.file};
+		CDF::Info info {file};
+		CDF::Reader reader {file, {info.timestampVariableName(), product}};
+		const Field position {info.variable(product.name()), 1};
+		const std::vector<const void*> line {reader.bufferForVariable(0), reader.bufferForVariable(1)};
+		for (std::size_t record = reader.findTimestamp(from, 0); reader.readRecord(record, false); ++record) {
+			const double epoch = *static_cast<const double*>(line[0]);
+			if (epoch < from) {
+				continue;
+			}
+			if (epoch >= to) {
+				break;
+			}
+			const double x = position.getReal(line, 0);
+			const double y = position.getReal(line, 1);
+			const double z = position.getReal(line, 2);
+			if (std::isnan(x) || std::isnan(y) || std::isnan(z) ||
+			    gtest::areFloatsEqual(x, position.fillValue(), 1)) {
+				continue;
+			}
+			const float r = static_cast<float>(std::sqrt(x * x + y * y + z * z));
+			Step& step = steps[firstIndex + static_cast<std::size_t>(stepForEpoch(epoch) - firstStep)];
+			step.minX = std::min(step.minX, static_cast<float>(x));
+			step.minR = std::min(step.minR, r);
+			step.maxR = std::max(step.maxR, r);
+			++step.samplesCount;
+		}
+	}
+}
+
+bool cdownload::EphemerisIndex::stepPasses(std::int64_t step, const Conditions& conditions) const
+{
+	if (step < firstStep_ || step >= firstStep_ + static_cast<std::int64_t>(steps_.size())) {
+		return true;
+	}
+	const Step& s = steps_[static_cast<std::size_t>(step - firstStep_)];
+	if (!s.samplesCount) {
+		return true;
+	}
+	if (conditions.nightSide && s.minX > 0) {
+		return false;
+	}
+	if (conditions.minR > 0 && s.maxR < conditions.minR) {
+		return false;
+	}
+	return true;
+}
+
+std::vector<cdownload::EpochRange>
+cdownload::EphemerisIndex::candidateRanges(const datetime& begin, const datetime& end,
+                                           const Conditions& conditions, const timeduration& margin) const
+{
+	std::vector<EpochRange> res;
+	const std::int64_t lastStep = stepForEpoch(end.milliseconds());
+	for (std::int64_t step = stepForEpoch(begin.milliseconds()); step <= lastStep; ++step) {
+		if (!stepPasses(step, conditions)) {
+			continue;
+		}
+		const double rangeBegin =
+			std::max(static_cast<double>(step) * STEP_LENGTH - margin.milliseconds(), begin.milliseconds());
+		const double rangeEnd =
+			std::min(static_cast<double>(step + 1) * STEP_LENGTH + margin.milliseconds(), end.milliseconds());
+		if (!res.empty() && rangeBegin <= res.back().end()) {
+			res.back() = EpochRange::fromRange(res.back().begin(), rangeEnd);
+		} else {
+			res.push_back(EpochRange::fromRange(rangeBegin, rangeEnd));
+		}
+	}
+	return res;
+}
+
+bool cdownload::EphemerisIndex::load()
+{
+	std::ifstream input(fileName_.c_str(), std::ios::binary);
+	if (!input) {
+		return false;
+	}
+	char magic[sizeof(INDEX_MAGIC)];
+	std::uint32_t version;
+	double stepLength;
+	std::int64_t firstStep;
+	std::uint64_t stepsCount;
+	if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 ||
+	    !readValue(input, version) || version != INDEX_VERSION ||
+	    !readValue(input, stepLength) || !gtest::areFloatsEqual(stepLength, STEP_LENGTH, 1) ||
+	    !readValue(input, firstStep) || !readValue(input, stepsCount)) {
+		return false;
+	}
+	std::vector<Step> steps(static_cast<std::size_t>(stepsCount));
+	if (!input.read(reinterpret_cast<char*>(steps.data()), static_cast<std::streamsize>(steps.size() * sizeof(Step)))) {
+		return false;
+	}
+	firstStep_ = firstStep;
+	steps_ = std::move(steps);
+	return true;
+}
+
+void cdownload::EphemerisIndex::save() const
+{
+	// write into a temporary file first, thus concurrent runs never see a partial index
+	const path tmpFileName = path(fileName_.string() + ".part");
+	{
+		std::ofstream output(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+		output.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		writeValue(output, INDEX_VERSION);
+		writeValue(output, STEP_LENGTH);
+		writeValue(output, firstStep_);
+		writeValue(output, static_cast<std::uint64_t>(steps_.size()));
+		output.write(reinterpret_cast<const char*>(steps_.data()), static_cast<std::streamsize>(steps_.size() * sizeof(Step)));
+		if (!output) {
+			throw std::runtime_error("write error");
+		}
+	}
+	boost::filesystem::rename(tmpFileName, fileName_);
+}
@@ -0,0 +1,102 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_EPHEMERISINDEX_HXX
+#define CDOWNLOAD_EPHEMERISINDEX_HXX
+
+#include "commonDefinitions.hxx"
+#include "epochrange.hxx"
+#include "util.hxx"
+
+#include <cstdint>
+#include <vector>
+
+namespace cdownload {
+
+	class DataSource;
+
+	/**
+	 * @brief Coarse spacecraft position index
+	 *
+	 * For every step of @ref STEP_LENGTH keeps the extent of the spacecraft position, collected from
+	 * a low-cadence auxiliary dataset. The index allows to find time ranges, where geometric
+	 * filter conditions can hold, before downloading and reading the science data. It is stored in
+	 * the given directory and extended when a time range outside of it is requested.
+	 */
+	class EphemerisIndex {
+	public:
+		static constexpr const double STEP_LENGTH = 15 * 60 * 1000.; //!< 15 minutes in ms
+
+		struct Step {
+			float minX; //!< GSE, km
+			float minR; //!< km
+			float maxR;
+			std::uint32_t samplesCount; //!< 0 means there were no position records
+		};
+
+		//! Conditions, which may reject records or cells
+		struct Conditions {
+			bool nightSide; //!< X < 0
+			double minR; //!< km, non-positive value disables the condition
+		};
+
+		EphemerisIndex(const string& spacecraft, const path& directory);
+
+		//! Position product, from which the index is built
+		static ProductName positionProduct(const string& spacecraft);
+
+		static path indexFileName(const string& spacecraft, const path& directory);
+
+		/**
+		 * @brief Makes sure the index covers the given time range
+		 *
+		 * Missing positions are read from the datasource of the @ref positionProduct() dataset,
+		 * the extended index is saved then.
+		 */
+		void update(const datetime& begin, const datetime& end, DataSource& positions);
+
+		/**
+		 * @brief Time ranges within [begin, end], where the conditions can hold
+		 *
+		 * Steps without position data and those outside of the index are considered to pass.
+		 * @param margin every range is extended by it at both sides
+		 */
+		std::vector<EpochRange> candidateRanges(const datetime& begin, const datetime& end,
+		                                        const Conditions& conditions, const timeduration& margin) const;
+
+	private:
+		static std::int64_t stepForEpoch(double epoch);
+		bool stepPasses(std::int64_t step, const Conditions& conditions) const;
+		void readPositions(std::int64_t firstStep, std::int64_t endStep, DataSource& positions,
+		                   std::vector<Step>& steps) const;
+		bool load();
+		void save() const;
+
+		string spacecraft_;
+		path fileName_;
+		std::int64_t firstStep_; //!< number of the first step since the epoch origin
+		std::vector<Step> steps_;
+	};
+}
+
+#endif // CDOWNLOAD_EPHEMERISINDEX_HXX
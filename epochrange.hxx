@@ -23,7 +23,9 @@
 #ifndef CDOWNLOAD_EPOCHRANGE_HXX
 #define CDOWNLOAD_EPOCHRANGE_HXX
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
 
 namespace cdownload {
 	class EpochRange {
@@ -68,6 +70,23 @@ namespace cdownload {
 		EpochType midEpoch_;
 		EpochType halfWidth_;
 	};
+
+	//! Sorts the ranges and merges overlapping ones, thus the range ends are sorted too
+	inline std::vector<EpochRange> normalizeRanges(std::vector<EpochRange> ranges)
+	{
+		std::sort(ranges.begin(), ranges.end(), [](const EpochRange& left, const EpochRange& right) {
+			return left.begin() < right.begin();
+		});
+		std::vector<EpochRange> res;
+		for (const EpochRange& r: ranges) {
+			if (!res.empty() && r.begin() <= res.back().end()) {
+				res.back() = EpochRange::fromRange(res.back().begin(), std::max(res.back().end(), r.end()));
+			} else {
+				res.push_back(r);
+			}
+		}
+		return res;
+	}
 }
 
 #endif // CDOWNLOAD_EPOCHRANGE_HXX
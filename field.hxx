@@ -212,6 +212,21 @@ namespace cdownload {
 			throw std::logic_error("DataType is not real");
 		}
 
+		//! Value of any numeric type, converted to double
+		double getDouble(const std::vector<const void*>& line, std::size_t index = 0) const
+		{
+			switch (dataType()) {
+			case DataType::Real:
+				return getReal(line, index);
+			case DataType::SignedInt:
+				return static_cast<double>(getLong(line, index));
+			case DataType::UnsignedInt:
+				return static_cast<double>(getULong(line, index));
+			default:
+				throw std::runtime_error("Product '" + name().name() + "' is not numeric");
+			}
+		}
+
 	private:
 		std::size_t offset_;
 	};
@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <limits>
+#include <stdexcept>
 
 const cdownload::DatasetName cdownload::Filter::FAKE_FILTER_DATASET = "FILTER";
 
@@ -56,6 +57,11 @@ std::vector<cdownload::FieldDesc> cdownload::Filter::variables() const
 	return res;
 }
 
+std::vector<cdownload::ProductName> cdownload::Filter::derivedProducts() const
+{
+	return {};
+}
+
 std::vector<cdownload::ProductName> cdownload::Filter::requiredProducts() const {
 	std::vector<ProductName> res;
 	std::transform(requiredFields_.begin(), requiredFields_.end(), std::back_inserter(res),
@@ -155,6 +161,33 @@ cdownload::RawDataFilter::RawDataFilter(const std::string& name, std::size_t max
 {
 }
 
+bool cdownload::RawDataFilter::usesZoneMaps() const
+{
+	return false;
+}
+
+bool cdownload::RawDataFilter::rejectsBlock(const CDF::ZoneMap& /*zoneMap*/, std::size_t /*block*/) const
+{
+	return false;
+}
+
+bool cdownload::RawDataFilter::testsBatches(const DatasetName& /*ds*/) const
+{
+	return false;
+}
+
+void cdownload::RawDataFilter::appendBatchValues(const std::vector<const void*>& /*line*/, const DatasetName& /*ds*/,
+                                                 std::vector<double>& /*values*/) const
+{
+	throw std::logic_error("Filter '" + name() + "' does not test batches");
+}
+
+void cdownload::RawDataFilter::testBatch(const std::vector<double>& /*values*/, const DatasetName& /*ds*/,
+                                         std::size_t /*count*/, std::uint64_t* /*passed*/) const
+{
+	throw std::logic_error("Filter '" + name() + "' does not test batches");
+}
+
 cdownload::AveragedDataFilter::AveragedDataFilter(const std::string& name, std::size_t maxFieldsCount, std::size_t maxVariablesCount)
 	: Filter(name, maxFieldsCount, maxVariablesCount)
 {
@@ -27,10 +27,15 @@
 #include "average.hxx"
 
 #include <cassert>
+#include <cstdint>
 #include <vector>
 
 namespace cdownload {
 
+	namespace CDF {
+		class ZoneMap;
+	}
+
 	/**
 	 * @brief Basic data filer interface.
 	 *
@@ -53,6 +58,9 @@ namespace cdownload {
 		static ProductName composeProductName(const std::string& shortName, const std::string& filterName);
 		virtual std::vector<FieldDesc> variables() const;
 
+		//! Products of the $DERIVED pseudo-dataset, which the filter finds among the filter variables
+		virtual std::vector<ProductName> derivedProducts() const;
+
 		static bool productBelongsToFilter(const ProductName& pr, const string& filterName);
 
 		bool enabled() const {
@@ -100,6 +108,36 @@ namespace cdownload {
 	class RawDataFilter: public Filter {
 	public:
 		virtual bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const = 0;
+
+		//! @returns true if the filter can reject blocks of records by their summary statistics
+		virtual bool usesZoneMaps() const;
+
+		/**
+		 * @brief Tests a block of records using its summary statistics only
+		 *
+		 * @returns true if none of the block records can pass the filter, false if some might
+		 */
+		virtual bool rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const;
+
+		/**
+		 * @brief Whether the filter tests records of the dataset in batches instead of test()
+		 *
+		 * Readers then collect values of the records, which the CDF reader holds in memory, by
+		 * appendBatchValues() and test them at once by testBatch().
+		 */
+		virtual bool testsBatches(const DatasetName& ds) const;
+
+		//! Appends values of the record of dataset ds, which testBatch() needs, to the batch
+		virtual void appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+		                               std::vector<double>& values) const;
+
+		/**
+		 * @brief Tests count records, values of which were appended to the batch
+		 *
+		 * @param passed bitmask of at least (count + 63) / 64 words, bit i is set if record i passes
+		 */
+		virtual void testBatch(const std::vector<double>& values, const DatasetName& ds, std::size_t count,
+		                       std::uint64_t* passed) const;
 	protected:
 		RawDataFilter(const std::string& name, std::size_t maxFieldsCount = 0, std::size_t maxVariablesCount = 0);
 	};
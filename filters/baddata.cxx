@@ -1,5 +1,6 @@
 #include "baddata.hxx"
 
+#include <algorithm>
 #include <cmath>
 
 // #define TRACING_BADDATA_FILTER
@@ -8,11 +9,51 @@
 #include <boost/log/trivial.hpp>
 #endif
 
+namespace {
+	//! No early exit, so that the loop is vectorized
+	template <class T>
+	bool containsNaN(const T* values, std::size_t count)
+	{
+		bool res = false;
+		for (std::size_t i = 0; i < count; ++i) {
+			res |= std::isnan(values[i]);
+		}
+		return res;
+	}
+}
+
 cdownload::Filters::BadDataFilter::BadDataFilter()
 	: base("BadData")
 {
 }
 
+void cdownload::Filters::BadDataFilter::initialize(const std::vector<Field>& availableProducts,
+                                                   const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	columns_.clear();
+	for (const Field& f: availableProducts) {
+		if (f.dataType() != Field::DataType::Real) {
+			continue;
+		}
+#ifdef TRACING_BADDATA_FILTER
+		BOOST_LOG_TRIVIAL(trace) << "Testing var " << f.name() << " at offset " << f.offset();
+#endif
+		DatasetColumns& columns = columns_[f.name().dataset()];
+		columns.elementCount += f.elementCount();
+		switch (f.dataSize()) {
+		case 4:
+			columns.floats.push_back({f.offset(), f.elementCount()});
+			break;
+		case 8:
+			columns.doubles.push_back({f.offset(), f.elementCount()});
+			break;
+		default:
+			throw std::logic_error("Unexpected real data size");
+		}
+	}
+}
+
 bool cdownload::Filters::BadDataFilter::test(const std::vector<const void*>& line, const DatasetName& ds,
                                              std::vector<void*>& /*variables*/) const
 {
@@ -20,19 +61,49 @@ bool cdownload::Filters::BadDataFilter::test(const std::vector<const void*>& lin
 		return true;
 	}
 
-	for (const Field& f: availableProducts()) {
-		if (f.name().dataset() == ds) {
-#ifdef TRACING_BADDATA_FILTER
-			BOOST_LOG_TRIVIAL(trace) << "Testing var " << f.name() << " at offset " << f.offset();
-#endif
-			if (f.dataType() == Field::DataType::Real) {
-				for (std::size_t i = 0; i < f.elementCount(); ++i) {
-					if (std::isnan(f.getReal(line, i))) {
-						return false;
-					}
-				}
-			}
+	auto i = columns_.find(ds);
+	if (i == columns_.end()) {
+		return true;
+	}
+	for (const Column& c: i->second.floats) {
+		if (containsNaN(static_cast<const float*>(line[c.offset]), c.elementCount)) {
+			return false;
+		}
+	}
+	for (const Column& c: i->second.doubles) {
+		if (containsNaN(static_cast<const double*>(line[c.offset]), c.elementCount)) {
+			return false;
 		}
 	}
 	return true;
 }
+
+bool cdownload::Filters::BadDataFilter::testsBatches(const DatasetName& ds) const
+{
+	return enabled() && columns_.count(ds) != 0;
+}
+
+void cdownload::Filters::BadDataFilter::appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+                                                          std::vector<double>& values) const
+{
+	// floats are widened to doubles, NaNs stay NaNs
+	const DatasetColumns& columns = columns_.at(ds);
+	for (const Column& c: columns.floats) {
+		const float* v = static_cast<const float*>(line[c.offset]);
+		values.insert(values.end(), v, v + c.elementCount);
+	}
+	for (const Column& c: columns.doubles) {
+		const double* v = static_cast<const double*>(line[c.offset]);
+		values.insert(values.end(), v, v + c.elementCount);
+	}
+}
+
+void cdownload::Filters::BadDataFilter::testBatch(const std::vector<double>& values, const DatasetName& ds,
+                                                  std::size_t count, std::uint64_t* passed) const
+{
+	const std::size_t stride = columns_.at(ds).elementCount;
+	std::fill_n(passed, (count + 63) / 64, 0);
+	for (std::size_t i = 0; i < count; ++i) {
+		passed[i / 64] |= static_cast<std::uint64_t>(!containsNaN(values.data() + i * stride, stride)) << (i % 64);
+	}
+}
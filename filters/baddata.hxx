@@ -3,14 +3,38 @@
 
 #include "../filter.hxx"
 
+#include <map>
+
 namespace cdownload {
 namespace Filters {
+	//! Rejects records with NaN in any element of real products
 	class BadDataFilter: public RawDataFilter {
 		using base = RawDataFilter;
 	public:
 		BadDataFilter();
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
 	private:
 		bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const override;
+		bool testsBatches(const DatasetName& ds) const override;
+		void appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+		                       std::vector<double>& values) const override;
+		void testBatch(const std::vector<double>& values, const DatasetName& ds, std::size_t count,
+		               std::uint64_t* passed) const override;
+
+		struct Column {
+			std::size_t offset;
+			std::size_t elementCount;
+		};
+
+		//! Real columns of a dataset, by element type
+		struct DatasetColumns {
+			std::vector<Column> floats;
+			std::vector<Column> doubles;
+			std::size_t elementCount = 0; //!< of all the columns, i.e. batch values per record
+		};
+
+		std::map<DatasetName, DatasetColumns> columns_;
 	};
 }
 }
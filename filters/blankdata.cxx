@@ -22,44 +22,363 @@
 
 #include "./blankdata.hxx"
 
-#include "../floatcomparison.hxx"
+#include "../cdf/zonemap.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace {
+	//! No early exit, so that the loop is vectorized
+	template <class T>
+	bool containsValue(const void* values, std::size_t count, std::uint64_t valueBits)
+	{
+		T value;
+		std::memcpy(&value, &valueBits, sizeof(T));
+		const T* v = static_cast<const T*>(values);
+		bool res = false;
+		for (std::size_t i = 0; i < count; ++i) {
+			res |= v[i] == value;
+		}
+		return res;
+	}
+
+	//! Converts sign-magnitude bits of a real to biased ones, which are ordered as the reals are
+	template <class Bits>
+	Bits biased(Bits b)
+	{
+		constexpr const Bits signBit = static_cast<Bits>(1) << (8 * sizeof(Bits) - 1);
+		return (b & signBit) ? static_cast<Bits>(~b + 1) : static_cast<Bits>(b | signBit);
+	}
+
+	/**
+	 * @brief Same for reals, which are compared within 1 ULP
+	 *
+	 * Values are compared as sign-magnitude integers, converted to biased ones, like gtest::areFloatsEqual()
+	 * does, but without branches.
+	 */
+	template <class Bits>
+	bool containsReal(const void* values, std::size_t count, std::uint64_t valueBits)
+	{
+		const Bits value = biased(static_cast<Bits>(valueBits));
+		const Bits* v = static_cast<const Bits*>(values);
+		bool res = false;
+		for (std::size_t i = 0; i < count; ++i) {
+			const Bits b = biased(v[i]);
+			res |= (b >= value ? b - value : value - b) <= 1;
+		}
+		return res;
+	}
+
+	//! Same for floats, which batches hold widened to doubles
+	bool containsWidenedFloat(const double* values, std::size_t count, std::uint64_t valueBits)
+	{
+		const std::uint32_t value = biased(static_cast<std::uint32_t>(valueBits));
+		bool res = false;
+		for (std::size_t i = 0; i < count; ++i) {
+			const float f = static_cast<float>(values[i]);
+			std::uint32_t b;
+			std::memcpy(&b, &f, sizeof(b));
+			b = biased(b);
+			res |= (b >= value ? b - value : value - b) <= 1;
+		}
+		return res;
+	}
+
+	//! Same for integers, which batches hold converted to doubles exactly
+	bool containsWidenedValue(const double* values, std::size_t count, double value)
+	{
+		bool res = false;
+		for (std::size_t i = 0; i < count; ++i) {
+			res |= !(values[i] < value) && !(values[i] > value);
+		}
+		return res;
+	}
+
+	template <class T>
+	T convertFillValue(double value, std::false_type /*unsigned*/)
+	{
+		return static_cast<T>(value);
+	}
+
+	//! Negative fill values of unsigned variables wrap around, which a direct conversion does not guarantee
+	template <class T>
+	T convertFillValue(double value, std::true_type /*unsigned*/)
+	{
+		using Signed = typename std::make_signed<T>::type;
+		return value < 0 ? static_cast<T>(static_cast<Signed>(value)) : static_cast<T>(value);
+	}
+
+	template <class T>
+	std::uint64_t toBits(double value)
+	{
+		const T v = convertFillValue<T>(value, std::is_unsigned<T>());
+		std::uint64_t res = 0;
+		std::memcpy(&res, &v, sizeof(T));
+		return res;
+	}
+
+	template <class T>
+	double toBatchValue(double value)
+	{
+		return static_cast<double>(convertFillValue<T>(value, std::is_unsigned<T>()));
+	}
+
+	template <class T>
+	void appendWidened(const void* values, std::size_t count, std::vector<double>& batch)
+	{
+		const T* v = static_cast<const T*>(values);
+		for (std::size_t i = 0; i < count; ++i) {
+			batch.push_back(static_cast<double>(v[i]));
+		}
+	}
+}
 
 cdownload::Filters::BlankDataFilter::BlankDataFilter(const std::map<ProductName, double>& blanks)
 	: base("Blank", blanks.size())
+	, blanks_{blanks}
 {
 	for (const auto& pb: blanks) {
-		const Field& f = addField(pb.first.name());
-		fields_.emplace_back(f, pb.second);
+		addField(pb.first.name());
+	}
+}
+
+void cdownload::Filters::BlankDataFilter::initialize(const std::vector<Field>& availableProducts,
+                                                     const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	columns_.clear();
+	for (const auto& pb: blanks_) {
+		const Field& f = field(pb.first.name());
+		Column c {ColumnType::Double, f.offset(), f.elementCount(), 0, 0.};
+		switch (f.dataType()) {
+		case FieldDesc::DataType::SignedInt:
+			switch (f.dataSize()) {
+			case 1:
+				c.type = ColumnType::Int8;
+				c.fill = toBits<std::int8_t>(pb.second);
+				c.batchFill = toBatchValue<std::int8_t>(pb.second);
+				break;
+			case 2:
+				c.type = ColumnType::Int16;
+				c.fill = toBits<std::int16_t>(pb.second);
+				c.batchFill = toBatchValue<std::int16_t>(pb.second);
+				break;
+			case 4:
+				c.type = ColumnType::Int32;
+				c.fill = toBits<std::int32_t>(pb.second);
+				c.batchFill = toBatchValue<std::int32_t>(pb.second);
+				break;
+			case 8:
+				c.type = ColumnType::Int64;
+				c.fill = toBits<std::int64_t>(pb.second);
+				break;
+			default:
+				throw std::logic_error("Unexpected int data size");
+			}
+			break;
+		case FieldDesc::DataType::UnsignedInt:
+			switch (f.dataSize()) {
+			case 1:
+				c.type = ColumnType::UInt8;
+				c.fill = toBits<std::uint8_t>(pb.second);
+				c.batchFill = toBatchValue<std::uint8_t>(pb.second);
+				break;
+			case 2:
+				c.type = ColumnType::UInt16;
+				c.fill = toBits<std::uint16_t>(pb.second);
+				c.batchFill = toBatchValue<std::uint16_t>(pb.second);
+				break;
+			case 4:
+				c.type = ColumnType::UInt32;
+				c.fill = toBits<std::uint32_t>(pb.second);
+				c.batchFill = toBatchValue<std::uint32_t>(pb.second);
+				break;
+			case 8:
+				c.type = ColumnType::UInt64;
+				c.fill = toBits<std::uint64_t>(pb.second);
+				break;
+			default:
+				throw std::logic_error("Unexpected uint data size");
+			}
+			break;
+		case FieldDesc::DataType::Real:
+			switch (f.dataSize()) {
+			case 4:
+				c.type = ColumnType::Float;
+				c.fill = toBits<float>(pb.second);
+				break;
+			case 8:
+				c.type = ColumnType::Double;
+				c.fill = toBits<double>(pb.second);
+				break;
+			default:
+				throw std::logic_error("Unexpected real data size");
+			}
+			break;
+		default:
+			continue;
+		}
+		columns_[f.name().dataset()].push_back(c);
+	}
+
+	batchStrides_.clear();
+	for (const auto& dc: columns_) {
+		std::size_t stride = 0;
+		for (const Column& c: dc.second) {
+			if (c.type == ColumnType::Int64 || c.type == ColumnType::UInt64) {
+				stride = 0;
+				break;
+			}
+			stride += c.elementCount;
+		}
+		if (stride) {
+			batchStrides_[dc.first] = stride;
+		}
 	}
 }
 
-bool cdownload::Filters::BlankDataFilter::test(const std::vector<const void *>& line, const DatasetName& /*ds*/,
+bool cdownload::Filters::BlankDataFilter::test(const std::vector<const void *>& line, const DatasetName& ds,
                                                std::vector<void*>& /*variables*/) const
 {
 	if (!enabled()) {
 		return true;
 	}
 
-	for (const auto& p: fields_) {
-		switch (p.first.dataType()) {
-			case FieldDesc::DataType::UnsignedInt:
-				if (p.first.getULong(line, 0) == static_cast<unsigned long>(p.second)) {
-					return false;
-				}
-				break;
-			case FieldDesc::DataType::SignedInt:
-				if (p.first.getLong(line, 0) == static_cast<long>(p.second)) {
-					return false;
-				}
+	auto i = columns_.find(ds);
+	if (i == columns_.end()) {
+		return true;
+	}
+	for (const Column& c: i->second) {
+		const void* values = line[c.offset];
+		bool blank = false;
+		switch (c.type) {
+		case ColumnType::Int8:
+			blank = containsValue<std::int8_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::Int16:
+			blank = containsValue<std::int16_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::Int32:
+			blank = containsValue<std::int32_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::Int64:
+			blank = containsValue<std::int64_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::UInt8:
+			blank = containsValue<std::uint8_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::UInt16:
+			blank = containsValue<std::uint16_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::UInt32:
+			blank = containsValue<std::uint32_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::UInt64:
+			blank = containsValue<std::uint64_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::Float:
+			blank = containsReal<std::uint32_t>(values, c.elementCount, c.fill);
+			break;
+		case ColumnType::Double:
+			blank = containsReal<std::uint64_t>(values, c.elementCount, c.fill);
+			break;
+		}
+		if (blank) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool cdownload::Filters::BlankDataFilter::usesZoneMaps() const
+{
+	return true;
+}
+
+bool cdownload::Filters::BlankDataFilter::rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const
+{
+	if (!enabled()) {
+		return false;
+	}
+	const std::uint64_t recordsCount = zoneMap.block(block).recordsCount;
+	for (const auto& pb: blanks_) {
+		// zone maps count blanks of the first element, which is enough to reject a whole block
+		const CDF::ZoneMap::ElementStats* stats = zoneMap.variable(block, pb.first.name());
+		if (stats && recordsCount && stats->fillCount == recordsCount) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool cdownload::Filters::BlankDataFilter::testsBatches(const DatasetName& ds) const
+{
+	return enabled() && batchStrides_.count(ds) != 0;
+}
+
+void cdownload::Filters::BlankDataFilter::appendBatchValues(const std::vector<const void*>& line,
+                                                            const DatasetName& ds, std::vector<double>& values) const
+{
+	for (const Column& c: columns_.at(ds)) {
+		const void* v = line[c.offset];
+		switch (c.type) {
+		case ColumnType::Int8:
+			appendWidened<std::int8_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::Int16:
+			appendWidened<std::int16_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::Int32:
+			appendWidened<std::int32_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::UInt8:
+			appendWidened<std::uint8_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::UInt16:
+			appendWidened<std::uint16_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::UInt32:
+			appendWidened<std::uint32_t>(v, c.elementCount, values);
+			break;
+		case ColumnType::Float:
+			appendWidened<float>(v, c.elementCount, values);
+			break;
+		case ColumnType::Double:
+			appendWidened<double>(v, c.elementCount, values);
+			break;
+		case ColumnType::Int64:
+		case ColumnType::UInt64:
+			throw std::logic_error("64-bit integer products are not tested in batches");
+		}
+	}
+}
+
+void cdownload::Filters::BlankDataFilter::testBatch(const std::vector<double>& values, const DatasetName& ds,
+                                                    std::size_t count, std::uint64_t* passed) const
+{
+	const std::vector<Column>& columns = columns_.at(ds);
+	const std::size_t stride = batchStrides_.at(ds);
+	std::fill_n(passed, (count + 63) / 64, 0);
+	for (std::size_t i = 0; i < count; ++i) {
+		const double* v = values.data() + i * stride;
+		bool blank = false;
+		for (const Column& c: columns) {
+			switch (c.type) {
+			case ColumnType::Float:
+				blank |= containsWidenedFloat(v, c.elementCount, c.fill);
 				break;
-			case FieldDesc::DataType::Real:
-				if (gtest::areFloatsEqual(p.first.getReal(line, 0), p.second, 1)) {
-					return false;
-				}
+			case ColumnType::Double:
+				blank |= containsReal<std::uint64_t>(v, c.elementCount, c.fill);
 				break;
 			default:
+				blank |= containsWidenedValue(v, c.elementCount, c.batchFill);
 				break;
+			}
+			v += c.elementCount;
 		}
+		passed[i / 64] |= static_cast<std::uint64_t>(!blank) << (i % 64);
 	}
-	return true;
 }
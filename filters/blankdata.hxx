@@ -25,19 +25,63 @@
 
 #include "../filter.hxx"
 
+#include <cstdint>
 #include <map>
 
 namespace cdownload {
 namespace Filters {
 
+	/**
+	 * @brief Rejects records with the fill value in any element of the given products
+	 *
+	 * A record is tested against the products of its own dataset only. The line holds the last read
+	 * records of the other datasets too, but those are not synchronized with the tested record, and
+	 * are tested when their own datasets are read.
+	 *
+	 * Records are tested in batches, unless the dataset has 64-bit integer products, values of which
+	 * doubles do not hold exactly.
+	 */
 	class BlankDataFilter: public RawDataFilter {
 		using base = RawDataFilter;
 	public:
 		BlankDataFilter(const std::map<ProductName, double>& blanks);
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
 	private:
 		bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const override;
+		bool testsBatches(const DatasetName& ds) const override;
+		void appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+		                       std::vector<double>& values) const override;
+		void testBatch(const std::vector<double>& values, const DatasetName& ds, std::size_t count,
+		               std::uint64_t* passed) const override;
+		bool usesZoneMaps() const override;
+		bool rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const override;
+
+		//! Element type of a column
+		enum class ColumnType {
+			Int8,
+			Int16,
+			Int32,
+			Int64,
+			UInt8,
+			UInt16,
+			UInt32,
+			UInt64,
+			Float,
+			Double
+		};
+
+		struct Column {
+			ColumnType type;
+			std::size_t offset;
+			std::size_t elementCount;
+			std::uint64_t fill; //!< fill value converted to the column type, bitwise
+			double batchFill; //!< same, converted to double as batches hold it
+		};
 
-		std::vector<std::pair<const Field&, double>> fields_;
+		std::map<ProductName, double> blanks_;
+		std::map<DatasetName, std::vector<Column>> columns_;
+		std::map<DatasetName, std::size_t> batchStrides_; //!< batch values per record of the batched datasets
 	};
 }
 }
@@ -0,0 +1,1003 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "./expression.hxx"
+
+#include "../derived.hxx"
+#include "../floatcomparison.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	constexpr const std::size_t WHOLE_PRODUCT = static_cast<std::size_t>(-1);
+	constexpr const std::size_t FLOAT_COMPARISON_ULPS = 4;
+}
+
+struct cdownload::Filters::Expression::Node {
+	enum class Kind {
+		Number,
+		Product,
+		Call,
+		Unary,
+		Binary
+	};
+
+	Node(Kind aKind, const string& anOp = string())
+		: kind{aKind}
+		, op{anOp}
+		, value{0}
+		, product{0}
+		, element{WHOLE_PRODUCT}
+	{
+	}
+
+	Kind kind;
+	string op; //!< operator or function name
+	double value;
+	std::size_t product; //!< index in products_
+	std::size_t element;
+	std::vector<std::unique_ptr<Node>> args;
+};
+
+namespace {
+	using cdownload::Field;
+	using cdownload::FieldDesc;
+	using cdownload::string;
+	using Node = cdownload::Filters::Expression::Node;
+
+	//! Data of a record or a cell together with the filter variables
+	template <class Data>
+	struct Line {
+		const Data& data;
+		const std::vector<void*>& variables;
+	};
+
+	using RecordLine = Line<std::vector<const void*>>;
+	using CellLine = Line<std::vector<cdownload::AveragedVariable>>;
+
+	template <class Line>
+	struct Compiled {
+		std::function<double (const Line&)> number;
+		std::function<bool (const Line&)> condition; //!< set for boolean subexpressions instead of number
+	};
+
+	template <class Line>
+	struct LineAccess;
+
+	template <class T>
+	std::function<double (const RecordLine&)> recordElement(std::size_t offset, std::size_t element)
+	{
+		return [offset, element](const RecordLine& line) {
+			return static_cast<double>(static_cast<const T*>(line.data[offset])[element]);
+		};
+	}
+
+	template <>
+	struct LineAccess<RecordLine> {
+		static std::function<double (const RecordLine&)> element(const Field& f, std::size_t element)
+		{
+			const std::size_t offset = f.offset();
+			switch (f.dataType()) {
+			case FieldDesc::DataType::Real:
+				switch (f.dataSize()) {
+				case 4:
+					return recordElement<float>(offset, element);
+				case 8:
+					return recordElement<double>(offset, element);
+				}
+				break;
+			case FieldDesc::DataType::SignedInt:
+				switch (f.dataSize()) {
+				case 1:
+					return recordElement<std::int8_t>(offset, element);
+				case 2:
+					return recordElement<std::int16_t>(offset, element);
+				case 4:
+					return recordElement<std::int32_t>(offset, element);
+				case 8:
+					return recordElement<std::int64_t>(offset, element);
+				}
+				break;
+			case FieldDesc::DataType::UnsignedInt:
+				switch (f.dataSize()) {
+				case 1:
+					return recordElement<std::uint8_t>(offset, element);
+				case 2:
+					return recordElement<std::uint16_t>(offset, element);
+				case 4:
+					return recordElement<std::uint32_t>(offset, element);
+				case 8:
+					return recordElement<std::uint64_t>(offset, element);
+				}
+				break;
+			default:
+				break;
+			}
+			throw std::runtime_error("Product '" + f.name().name() + "' is not numeric");
+		}
+	};
+
+	template <>
+	struct LineAccess<CellLine> {
+		static std::function<double (const CellLine&)> element(const Field& f, std::size_t element)
+		{
+			const std::size_t offset = f.offset();
+			return [offset, element](const CellLine& line) {
+				return line.data[offset][element].mean();
+			};
+		}
+	};
+
+	template <class Line>
+	std::function<double (const Line&)> variableElement(const Field& f, std::size_t element)
+	{
+		if (f.dataType() != FieldDesc::DataType::Real || f.dataSize() != sizeof(double)) {
+			throw std::runtime_error("Variable '" + f.name().name() + "' is not of type double");
+		}
+		const std::size_t offset = f.offset();
+		return [offset, element](const Line& line) {
+			return static_cast<const double*>(line.variables[offset])[element];
+		};
+	}
+
+	template <class Line>
+	class Compiler {
+	public:
+		Compiler(const string& text, const std::vector<const Field*>& fields)
+			: text_{text}
+			, fields_{fields}
+		{
+		}
+
+		Compiled<Line> compile(const Node& node) const
+		{
+			switch (node.kind) {
+			case Node::Kind::Number: {
+				const double value = node.value;
+				return {[value](const Line&) {return value;}, {}};
+			}
+			case Node::Kind::Product:
+				return {productElement(node, node.element == WHOLE_PRODUCT ? 0 : node.element,
+				                       node.element == WHOLE_PRODUCT), {}};
+			case Node::Kind::Call:
+				return {compileCall(node), {}};
+			case Node::Kind::Unary:
+				return compileUnary(node);
+			case Node::Kind::Binary:
+				return compileBinary(node);
+			}
+			throw std::logic_error("Unexpected expression node");
+		}
+
+	private:
+		using Number = std::function<double (const Line&)>;
+		using Condition = std::function<bool (const Line&)>;
+
+		[[noreturn]] void error(const string& message) const
+		{
+			throw std::runtime_error("Filter expression '" + text_ + "': " + message);
+		}
+
+		Number number(const Node& node) const
+		{
+			Compiled<Line> res = compile(node);
+			if (!res.number) {
+				error("number is expected, but a condition is given");
+			}
+			return res.number;
+		}
+
+		Condition condition(const Node& node) const
+		{
+			Compiled<Line> res = compile(node);
+			if (!res.condition) {
+				error("condition is expected, but a number is given");
+			}
+			return res.condition;
+		}
+
+		Number productElement(const Node& node, std::size_t element, bool mustBeScalar) const
+		{
+			const Field& f = *fields_[node.product];
+			if (mustBeScalar && f.elementCount() != 1) {
+				error("product '" + f.name().name() + "' has " + std::to_string(f.elementCount()) +
+				      " elements, an index or norm() is required");
+			}
+			if (element >= f.elementCount()) {
+				error("index " + std::to_string(element) + " is out of range for '" + f.name().name() + '\'');
+			}
+			try {
+				return f.name().isPseudoDataset() ?
+					variableElement<Line>(f, element) : LineAccess<Line>::element(f, element);
+			} catch (std::runtime_error& ex) {
+				error(ex.what());
+			}
+		}
+
+		Number compileCall(const Node& node) const
+		{
+			const Node& arg = *node.args.front();
+			if (node.op == "norm") {
+				if (arg.kind != Node::Kind::Product || arg.element != WHOLE_PRODUCT) {
+					error("norm() accepts a product name only");
+				}
+				std::vector<Number> components;
+				for (std::size_t i = 0; i < fields_[arg.product]->elementCount(); ++i) {
+					components.push_back(productElement(arg, i, false));
+				}
+				return [components](const Line& line) {
+					double sum = 0;
+					for (const auto& c: components) {
+						const double v = c(line);
+						sum += v * v;
+					}
+					return std::sqrt(sum);
+				};
+			}
+			const Number value = number(arg);
+			if (node.op == "abs") {
+				return [value](const Line& line) {return std::abs(value(line));};
+			}
+			if (node.op == "sqrt") {
+				return [value](const Line& line) {return std::sqrt(value(line));};
+			}
+			error("unknown function '" + node.op + '\'');
+		}
+
+		Compiled<Line> compileUnary(const Node& node) const
+		{
+			if (node.op == "!") {
+				const Condition c = condition(*node.args.front());
+				return {{}, [c](const Line& line) {return !c(line);}};
+			}
+			const Number value = number(*node.args.front());
+			return {[value](const Line& line) {return -value(line);}, {}};
+		}
+
+		Compiled<Line> compileBinary(const Node& node) const
+		{
+			const string& op = node.op;
+			if (op == "&&" || op == "||") {
+				const Condition left = condition(*node.args[0]);
+				const Condition right = condition(*node.args[1]);
+				if (op == "&&") {
+					return {{}, [left, right](const Line& line) {return left(line) && right(line);}};
+				}
+				return {{}, [left, right](const Line& line) {return left(line) || right(line);}};
+			}
+
+			const Number left = number(*node.args[0]);
+			const Number right = number(*node.args[1]);
+			if (op == "+") {
+				return {[left, right](const Line& line) {return left(line) + right(line);}, {}};
+			} else if (op == "-") {
+				return {[left, right](const Line& line) {return left(line) - right(line);}, {}};
+			} else if (op == "*") {
+				return {[left, right](const Line& line) {return left(line) * right(line);}, {}};
+			} else if (op == "/") {
+				return {[left, right](const Line& line) {return left(line) / right(line);}, {}};
+			} else if (op == "<") {
+				return {{}, [left, right](const Line& line) {return left(line) < right(line);}};
+			} else if (op == "<=") {
+				return {{}, [left, right](const Line& line) {return left(line) <= right(line);}};
+			} else if (op == ">") {
+				return {{}, [left, right](const Line& line) {return left(line) > right(line);}};
+			} else if (op == ">=") {
+				return {{}, [left, right](const Line& line) {return left(line) >= right(line);}};
+			} else if (op == "==") {
+				return {{}, [left, right](const Line& line) {
+					return gtest::areFloatsEqual(left(line), right(line), FLOAT_COMPARISON_ULPS);
+				}};
+			} else if (op == "!=") {
+				return {{}, [left, right](const Line& line) {
+					return !gtest::areFloatsEqual(left(line), right(line), FLOAT_COMPARISON_ULPS);
+				}};
+			}
+			error("unknown operator '" + op + '\'');
+		}
+
+		const string& text_;
+		const std::vector<const Field*>& fields_;
+	};
+
+	//! Values of a batch of records, row by row
+	struct Batch {
+		const double* values;
+		std::size_t columns;
+		std::size_t count;
+	};
+
+	using BatchNumber = std::function<void (const Batch& batch, double* res)>;
+	using BatchCondition = std::function<void (const Batch& batch, std::uint8_t* res)>;
+
+	struct CompiledBatch {
+		BatchNumber number;
+		BatchCondition condition; //!< set for boolean subexpressions instead of number
+	};
+
+	template <class Op>
+	BatchNumber batchArithmetic(const BatchNumber& left, const BatchNumber& right, Op op)
+	{
+		return [left, right, op](const Batch& batch, double* res) {
+			std::vector<double> r(batch.count);
+			left(batch, res);
+			right(batch, r.data());
+			for (std::size_t i = 0; i < batch.count; ++i) {
+				res[i] = op(res[i], r[i]);
+			}
+		};
+	}
+
+	template <class Op>
+	BatchCondition batchComparison(const BatchNumber& left, const BatchNumber& right, Op op)
+	{
+		return [left, right, op](const Batch& batch, std::uint8_t* res) {
+			std::vector<double> l(batch.count);
+			std::vector<double> r(batch.count);
+			left(batch, l.data());
+			right(batch, r.data());
+			for (std::size_t i = 0; i < batch.count; ++i) {
+				res[i] = op(l[i], r[i]);
+			}
+		};
+	}
+
+	template <class Op>
+	BatchNumber batchFunction(const BatchNumber& value, Op op)
+	{
+		return [value, op](const Batch& batch, double* res) {
+			value(batch, res);
+			for (std::size_t i = 0; i < batch.count; ++i) {
+				res[i] = op(res[i]);
+			}
+		};
+	}
+
+	//! Compiles expressions into closures, which process a column of the batch at once
+	class BatchCompiler {
+	public:
+		BatchCompiler(const string& text, const std::vector<const Field*>& fields,
+		              std::vector<cdownload::Filters::Expression::ProductElement>& columns)
+			: text_{text}
+			, fields_{fields}
+			, columns_(columns)
+		{
+		}
+
+		CompiledBatch compile(const Node& node) const
+		{
+			switch (node.kind) {
+			case Node::Kind::Number: {
+				const double value = node.value;
+				return {[value](const Batch& batch, double* res) {std::fill_n(res, batch.count, value);}, {}};
+			}
+			case Node::Kind::Product:
+				return {productElement(node, node.element == WHOLE_PRODUCT ? 0 : node.element), {}};
+			case Node::Kind::Call:
+				return {compileCall(node), {}};
+			case Node::Kind::Unary:
+				return compileUnary(node);
+			case Node::Kind::Binary:
+				return compileBinary(node);
+			}
+			throw std::logic_error("Unexpected expression node");
+		}
+
+	private:
+		[[noreturn]] void error(const string& message) const
+		{
+			throw std::runtime_error("Filter expression '" + text_ + "': " + message);
+		}
+
+		BatchNumber number(const Node& node) const
+		{
+			CompiledBatch res = compile(node);
+			if (!res.number) {
+				error("number is expected, but a condition is given");
+			}
+			return res.number;
+		}
+
+		BatchCondition condition(const Node& node) const
+		{
+			CompiledBatch res = compile(node);
+			if (!res.condition) {
+				error("condition is expected, but a number is given");
+			}
+			return res.condition;
+		}
+
+		//! The record compiler checked element counts and types already
+		BatchNumber productElement(const Node& node, std::size_t element) const
+		{
+			if (fields_[node.product]->name().isPseudoDataset()) {
+				error("products of pseudo-datasets can not be evaluated for batches of records");
+			}
+			const auto key = std::make_pair(node.product, element);
+			auto i = std::find(columns_.begin(), columns_.end(), key);
+			const std::size_t column = static_cast<std::size_t>(std::distance(columns_.begin(), i));
+			if (i == columns_.end()) {
+				columns_.push_back(key);
+			}
+			return [column](const Batch& batch, double* res) {
+				const double* value = batch.values + column;
+				for (std::size_t i = 0; i < batch.count; ++i, value += batch.columns) {
+					res[i] = *value;
+				}
+			};
+		}
+
+		BatchNumber compileCall(const Node& node) const
+		{
+			const Node& arg = *node.args.front();
+			if (node.op == "norm") {
+				std::vector<BatchNumber> components;
+				for (std::size_t i = 0; i < fields_[arg.product]->elementCount(); ++i) {
+					components.push_back(productElement(arg, i));
+				}
+				return [components](const Batch& batch, double* res) {
+					std::fill_n(res, batch.count, 0.);
+					std::vector<double> c(batch.count);
+					for (const auto& component: components) {
+						component(batch, c.data());
+						for (std::size_t i = 0; i < batch.count; ++i) {
+							res[i] += c[i] * c[i];
+						}
+					}
+					for (std::size_t i = 0; i < batch.count; ++i) {
+						res[i] = std::sqrt(res[i]);
+					}
+				};
+			}
+			const BatchNumber value = number(arg);
+			if (node.op == "abs") {
+				return batchFunction(value, [](double v) {return std::abs(v);});
+			}
+			if (node.op == "sqrt") {
+				return batchFunction(value, [](double v) {return std::sqrt(v);});
+			}
+			error("unknown function '" + node.op + '\'');
+		}
+
+		CompiledBatch compileUnary(const Node& node) const
+		{
+			if (node.op == "!") {
+				const BatchCondition c = condition(*node.args.front());
+				return {{}, [c](const Batch& batch, std::uint8_t* res) {
+					c(batch, res);
+					for (std::size_t i = 0; i < batch.count; ++i) {
+						res[i] = !res[i];
+					}
+				}};
+			}
+			return {batchFunction(number(*node.args.front()), [](double v) {return -v;}), {}};
+		}
+
+		CompiledBatch compileBinary(const Node& node) const
+		{
+			const string& op = node.op;
+			if (op == "&&" || op == "||") {
+				// both sides are evaluated for the whole batch, they have no side effects
+				const BatchCondition left = condition(*node.args[0]);
+				const BatchCondition right = condition(*node.args[1]);
+				const bool conjunction = op == "&&";
+				return {{}, [left, right, conjunction](const Batch& batch, std::uint8_t* res) {
+					std::vector<std::uint8_t> r(batch.count);
+					left(batch, res);
+					right(batch, r.data());
+					for (std::size_t i = 0; i < batch.count; ++i) {
+						res[i] = conjunction ? (res[i] & r[i]) : (res[i] | r[i]);
+					}
+				}};
+			}
+
+			const BatchNumber left = number(*node.args[0]);
+			const BatchNumber right = number(*node.args[1]);
+			if (op == "+") {
+				return {batchArithmetic(left, right, [](double l, double r) {return l + r;}), {}};
+			} else if (op == "-") {
+				return {batchArithmetic(left, right, [](double l, double r) {return l - r;}), {}};
+			} else if (op == "*") {
+				return {batchArithmetic(left, right, [](double l, double r) {return l * r;}), {}};
+			} else if (op == "/") {
+				return {batchArithmetic(left, right, [](double l, double r) {return l / r;}), {}};
+			} else if (op == "<") {
+				return {{}, batchComparison(left, right, [](double l, double r) {return l < r;})};
+			} else if (op == "<=") {
+				return {{}, batchComparison(left, right, [](double l, double r) {return l <= r;})};
+			} else if (op == ">") {
+				return {{}, batchComparison(left, right, [](double l, double r) {return l > r;})};
+			} else if (op == ">=") {
+				return {{}, batchComparison(left, right, [](double l, double r) {return l >= r;})};
+			} else if (op == "==") {
+				return {{}, batchComparison(left, right, [](double l, double r) {
+					return gtest::areFloatsEqual(l, r, FLOAT_COMPARISON_ULPS);
+				})};
+			} else if (op == "!=") {
+				return {{}, batchComparison(left, right, [](double l, double r) {
+					return !gtest::areFloatsEqual(l, r, FLOAT_COMPARISON_ULPS);
+				})};
+			}
+			error("unknown operator '" + op + '\'');
+		}
+
+		const string& text_;
+		const std::vector<const Field*>& fields_;
+		std::vector<cdownload::Filters::Expression::ProductElement>& columns_;
+	};
+
+	//! Fields of the expression products, those of pseudo-datasets are taken from the filter variables
+	template <class FieldLookup>
+	std::vector<const Field*> expressionFields(const cdownload::Filters::Expression& expression,
+	                                           const std::vector<Field>& filterVariables, FieldLookup product)
+	{
+		std::vector<const Field*> res;
+		for (const cdownload::ProductName& pr: expression.products()) {
+			if (!pr.isPseudoDataset()) {
+				res.push_back(&product(pr));
+				continue;
+			}
+			auto fi = std::find_if(filterVariables.begin(), filterVariables.end(), [&pr](const Field& f) {
+				return f.name() == pr;
+			});
+			if (fi == filterVariables.end()) {
+				throw std::runtime_error("Filter expression '" + expression.text() + "': variable '" + pr.name() +
+				                         "' is not available");
+			}
+			res.push_back(&*fi);
+		}
+		return res;
+	}
+
+	std::vector<cdownload::ProductName> derivedProductsOf(const cdownload::Filters::Expression& expression)
+	{
+		std::vector<cdownload::ProductName> res;
+		std::copy_if(expression.products().begin(), expression.products().end(), std::back_inserter(res),
+		             [](const cdownload::ProductName& pr) {
+			return pr.dataset() == cdownload::DerivedVariables::datasetName();
+		});
+		return res;
+	}
+
+	bool isIdentifierStart(char c)
+	{
+		return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+	}
+
+	bool isIdentifierChar(char c)
+	{
+		return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+	}
+}
+
+cdownload::Filters::Expression::Expression(const string& text)
+	: text_{text}
+	, position_{0}
+{
+	root_ = parseOr();
+	skipSpaces();
+	if (position_ != text_.size()) {
+		error("unexpected '" + text_.substr(position_) + '\'');
+	}
+}
+
+cdownload::Filters::Expression::~Expression() = default;
+
+void cdownload::Filters::Expression::error(const string& message) const
+{
+	throw std::runtime_error("Filter expression '" + text_ + "': " + message);
+}
+
+void cdownload::Filters::Expression::skipSpaces()
+{
+	while (position_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[position_]))) {
+		++position_;
+	}
+}
+
+bool cdownload::Filters::Expression::skipToken(const char* token)
+{
+	skipSpaces();
+	const std::size_t length = std::strlen(token);
+	if (text_.compare(position_, length, token) != 0) {
+		return false;
+	}
+	// do not take '<' from '<=' and so on
+	if (length == 1 && position_ + 1 < text_.size() && text_[position_ + 1] == '=' && std::strchr("<>!=", token[0])) {
+		return false;
+	}
+	position_ += length;
+	return true;
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseOr()
+{
+	std::unique_ptr<Node> res = parseAnd();
+	while (skipToken("||")) {
+		std::unique_ptr<Node> node {new Node(Node::Kind::Binary, "||")};
+		node->args.push_back(std::move(res));
+		node->args.push_back(parseAnd());
+		res = std::move(node);
+	}
+	return res;
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseAnd()
+{
+	std::unique_ptr<Node> res = parseComparison();
+	while (skipToken("&&")) {
+		std::unique_ptr<Node> node {new Node(Node::Kind::Binary, "&&")};
+		node->args.push_back(std::move(res));
+		node->args.push_back(parseComparison());
+		res = std::move(node);
+	}
+	return res;
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseComparison()
+{
+	std::unique_ptr<Node> res = parseSum();
+	for (const char* op: {"<=", ">=", "==", "!=", "<", ">"}) {
+		if (skipToken(op)) {
+			std::unique_ptr<Node> node {new Node(Node::Kind::Binary, op)};
+			node->args.push_back(std::move(res));
+			node->args.push_back(parseSum());
+			return node;
+		}
+	}
+	return res;
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseSum()
+{
+	std::unique_ptr<Node> res = parseTerm();
+	while (true) {
+		const char* op = skipToken("+") ? "+" : skipToken("-") ? "-" : nullptr;
+		if (!op) {
+			return res;
+		}
+		std::unique_ptr<Node> node {new Node(Node::Kind::Binary, op)};
+		node->args.push_back(std::move(res));
+		node->args.push_back(parseTerm());
+		res = std::move(node);
+	}
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseTerm()
+{
+	std::unique_ptr<Node> res = parseUnary();
+	while (true) {
+		const char* op = skipToken("*") ? "*" : skipToken("/") ? "/" : nullptr;
+		if (!op) {
+			return res;
+		}
+		std::unique_ptr<Node> node {new Node(Node::Kind::Binary, op)};
+		node->args.push_back(std::move(res));
+		node->args.push_back(parseUnary());
+		res = std::move(node);
+	}
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parseUnary()
+{
+	const char* op = skipToken("-") ? "-" : skipToken("!") ? "!" : nullptr;
+	if (!op) {
+		return parsePrimary();
+	}
+	std::unique_ptr<Node> node {new Node(Node::Kind::Unary, op)};
+	node->args.push_back(parseUnary());
+	return node;
+}
+
+std::unique_ptr<cdownload::Filters::Expression::Node> cdownload::Filters::Expression::parsePrimary()
+{
+	skipSpaces();
+	if (position_ == text_.size()) {
+		error("unexpected end");
+	}
+
+	if (skipToken("(")) {
+		std::unique_ptr<Node> res = parseOr();
+		if (!skipToken(")")) {
+			error("')' is expected at position " + std::to_string(position_));
+		}
+		return res;
+	}
+
+	const char* begin = text_.c_str() + position_;
+	if (std::isdigit(static_cast<unsigned char>(*begin)) || *begin == '.') {
+		char* end = nullptr;
+		std::unique_ptr<Node> res {new Node(Node::Kind::Number)};
+		res->value = std::strtod(begin, &end);
+		position_ += static_cast<std::size_t>(end - begin);
+		return res;
+	}
+
+	if (!isIdentifierStart(*begin)) {
+		error("unexpected '" + text_.substr(position_) + '\'');
+	}
+	const std::size_t identifierBegin = position_;
+	while (position_ < text_.size() && (isIdentifierChar(text_[position_]) ||
+	       // pseudo-dataset names start with '$', e.g. C4_beta__$DERIVED
+	       (text_[position_] == '$' && position_ >= identifierBegin + 2 &&
+	        text_.compare(position_ - 2, 2, "__") == 0))) {
+		++position_;
+		// dataset names contain '-', e.g. C4_CP_CIS-CODIF_HS_H1_MOMENTS
+		if (position_ + 1 < text_.size() && text_[position_] == '-' &&
+		    std::isalpha(static_cast<unsigned char>(text_[position_ + 1])) &&
+		    text_.find("__", identifierBegin) < position_) {
+			++position_;
+		}
+	}
+	const string identifier = text_.substr(identifierBegin, position_ - identifierBegin);
+
+	if (skipToken("(")) {
+		std::unique_ptr<Node> res {new Node(Node::Kind::Call, identifier)};
+		if (identifier != "norm" && identifier != "abs" && identifier != "sqrt") {
+			error("unknown function '" + identifier + '\'');
+		}
+		res->args.push_back(parseSum());
+		if (!skipToken(")")) {
+			error("')' is expected at position " + std::to_string(position_));
+		}
+		return res;
+	}
+
+	if (identifier == "RE") {
+		std::unique_ptr<Node> res {new Node(Node::Kind::Number)};
+		res->value = cdownload::EARTH_RADIUS;
+		return res;
+	}
+
+	if (identifier.find("__") == string::npos) {
+		error("unknown name '" + identifier + "', products have to be given with dataset names");
+	}
+	std::unique_ptr<Node> res {new Node(Node::Kind::Product)};
+	const ProductName product {identifier};
+	auto i = std::find(products_.begin(), products_.end(), product);
+	res->product = static_cast<std::size_t>(std::distance(products_.begin(), i));
+	if (i == products_.end()) {
+		products_.push_back(product);
+	}
+
+	if (skipToken("[")) {
+		skipSpaces();
+		const char* indexBegin = text_.c_str() + position_;
+		char* indexEnd = nullptr;
+		const unsigned long index = std::strtoul(indexBegin, &indexEnd, 10);
+		if (indexEnd == indexBegin) {
+			error("element index is expected at position " + std::to_string(position_));
+		}
+		position_ += static_cast<std::size_t>(indexEnd - indexBegin);
+		res->element = index;
+		if (!skipToken("]")) {
+			error("']' is expected at position " + std::to_string(position_));
+		}
+	}
+	return res;
+}
+
+cdownload::Filters::Expression::RecordEvaluator
+cdownload::Filters::Expression::compileForRecords(const std::vector<const Field*>& fields) const
+{
+	const Compiler<RecordLine> compiler {text_, fields};
+	const std::function<bool (const RecordLine&)> condition = compiler.compile(*root_).condition;
+	if (!condition) {
+		error("the expression has to be a condition");
+	}
+	return [condition](const std::vector<const void*>& line, const std::vector<void*>& variables) {
+		return condition(RecordLine{line, variables});
+	};
+}
+
+cdownload::Filters::Expression::CellEvaluator
+cdownload::Filters::Expression::compileForCells(const std::vector<const Field*>& fields) const
+{
+	const Compiler<CellLine> compiler {text_, fields};
+	const std::function<bool (const CellLine&)> condition = compiler.compile(*root_).condition;
+	if (!condition) {
+		error("the expression has to be a condition");
+	}
+	return [condition](const std::vector<AveragedVariable>& line, const std::vector<void*>& variables) {
+		return condition(CellLine{line, variables});
+	};
+}
+
+cdownload::Filters::Expression::RecordValue
+cdownload::Filters::Expression::compileValueForRecords(const std::vector<const Field*>& fields) const
+{
+	const Compiler<RecordLine> compiler {text_, fields};
+	const std::function<double (const RecordLine&)> number = compiler.compile(*root_).number;
+	if (!number) {
+		error("the expression has to be a number");
+	}
+	return [number](const std::vector<const void*>& line, const std::vector<void*>& variables) {
+		return number(RecordLine{line, variables});
+	};
+}
+
+cdownload::Filters::Expression::CellValue
+cdownload::Filters::Expression::compileValueForCells(const std::vector<const Field*>& fields) const
+{
+	const Compiler<CellLine> compiler {text_, fields};
+	const std::function<double (const CellLine&)> number = compiler.compile(*root_).number;
+	if (!number) {
+		error("the expression has to be a number");
+	}
+	return [number](const std::vector<AveragedVariable>& line, const std::vector<void*>& variables) {
+		return number(CellLine{line, variables});
+	};
+}
+
+cdownload::Filters::Expression::BatchEvaluator
+cdownload::Filters::Expression::compileForBatches(const std::vector<const Field*>& fields,
+                                                  std::vector<ProductElement>& columns) const
+{
+	columns.clear();
+	const BatchCompiler compiler {text_, fields, columns};
+	const BatchCondition condition = compiler.compile(*root_).condition;
+	if (!condition) {
+		error("the expression has to be a condition");
+	}
+	const std::size_t columnsCount = columns.size();
+	return [condition, columnsCount](const double* values, std::size_t count, std::uint64_t* passed) {
+		std::vector<std::uint8_t> res(count);
+		condition(Batch{values, columnsCount, count}, res.data());
+		std::fill_n(passed, (count + 63) / 64, 0);
+		for (std::size_t i = 0; i < count; ++i) {
+			passed[i / 64] |= static_cast<std::uint64_t>(res[i] != 0) << (i % 64);
+		}
+	};
+}
+
+// RawExpressionFilter
+
+cdownload::Filters::RawExpressionFilter::RawExpressionFilter(const string& expression)
+	: RawExpressionFilter(std::unique_ptr<Expression>(new Expression(expression)))
+{
+}
+
+cdownload::Filters::RawExpressionFilter::RawExpressionFilter(std::unique_ptr<Expression>&& expression)
+	: base("Expression", expression->products().size())
+	, expression_{std::move(expression)}
+{
+	for (const ProductName& pr: expression_->products()) {
+		if (!pr.isPseudoDataset()) {
+			addField(pr);
+			assignDataset(pr.dataset());
+		}
+	}
+}
+
+void cdownload::Filters::RawExpressionFilter::assignDataset(const DatasetName& dataset)
+{
+	if (!dataset_.empty() && dataset != dataset_) {
+		throw std::runtime_error("Filter expression '" + expression_->text() +
+		                         "' refers to several datasets, which is possible for averaged data only");
+	}
+	dataset_ = dataset;
+}
+
+void cdownload::Filters::RawExpressionFilter::initialize(const std::vector<Field>& availableProducts,
+                                                         const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	const std::vector<const Field*> fields = expressionFields(*expression_, filterVariables,
+		[this](const ProductName& pr) -> const Field& {return field(pr.name());});
+	evaluator_ = expression_->compileForRecords(fields);
+	batchEvaluator_ = Expression::BatchEvaluator();
+	batchColumns_.clear();
+	// derived products are computed for the current record only
+	if (derivedProducts().empty()) {
+		std::vector<Expression::ProductElement> columns;
+		batchEvaluator_ = expression_->compileForBatches(fields, columns);
+		for (const Expression::ProductElement& c: columns) {
+			batchColumns_.emplace_back(fields[c.first], c.second);
+		}
+	}
+}
+
+std::vector<cdownload::ProductName> cdownload::Filters::RawExpressionFilter::derivedProducts() const
+{
+	return derivedProductsOf(*expression_);
+}
+
+void cdownload::Filters::RawExpressionFilter::resolveDerivedProducts(const DerivedVariables& derived)
+{
+	for (const ProductName& pr: derivedProducts()) {
+		assignDataset(derived.sourceDataset(pr));
+	}
+}
+
+bool cdownload::Filters::RawExpressionFilter::test(const std::vector<const void*>& line, const DatasetName& ds,
+                                                   std::vector<void*>& variables) const
+{
+	if (!enabled() || ds != dataset_) {
+		return true;
+	}
+	return evaluator_(line, variables);
+}
+
+bool cdownload::Filters::RawExpressionFilter::testsBatches(const DatasetName& ds) const
+{
+	return enabled() && ds == dataset_ && batchEvaluator_;
+}
+
+void cdownload::Filters::RawExpressionFilter::appendBatchValues(const std::vector<const void*>& line,
+                                                                const DatasetName& /*ds*/, std::vector<double>& values) const
+{
+	for (const auto& c: batchColumns_) {
+		values.push_back(c.first->getDouble(line, c.second));
+	}
+}
+
+void cdownload::Filters::RawExpressionFilter::testBatch(const std::vector<double>& values, const DatasetName& /*ds*/,
+                                                        std::size_t count, std::uint64_t* passed) const
+{
+	batchEvaluator_(values.data(), count, passed);
+}
+
+// AveragedExpressionFilter
+
+cdownload::Filters::AveragedExpressionFilter::AveragedExpressionFilter(const string& expression)
+	: AveragedExpressionFilter(std::unique_ptr<Expression>(new Expression(expression)))
+{
+}
+
+cdownload::Filters::AveragedExpressionFilter::AveragedExpressionFilter(std::unique_ptr<Expression>&& expression)
+	: base("Expression", expression->products().size())
+	, expression_{std::move(expression)}
+{
+	for (const ProductName& pr: expression_->products()) {
+		if (!pr.isPseudoDataset()) {
+			addField(pr);
+		}
+	}
+}
+
+void cdownload::Filters::AveragedExpressionFilter::initialize(const std::vector<Field>& availableProducts,
+                                                              const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	evaluator_ = expression_->compileForCells(expressionFields(*expression_, filterVariables,
+		[this](const ProductName& pr) -> const Field& {return field(pr.name());}));
+}
+
+std::vector<cdownload::ProductName> cdownload::Filters::AveragedExpressionFilter::derivedProducts() const
+{
+	return derivedProductsOf(*expression_);
+}
+
+bool cdownload::Filters::AveragedExpressionFilter::test(const std::vector<AveragedVariable>& line,
+                                                        std::vector<void*>& variables) const
+{
+	if (!enabled()) {
+		return true;
+	}
+	return evaluator_(line, variables);
+}
@@ -0,0 +1,186 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_FILTER_EXPRESSION_HXX
+#define CDOWNLOAD_FILTER_EXPRESSION_HXX
+
+#include "../filter.hxx"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace cdownload {
+
+	class DerivedVariables;
+
+namespace Filters {
+
+	/**
+	 * @brief Filter condition, given as an expression over products
+	 *
+	 * Grammar, from the lowest precedence:
+	 *
+	 *     or         := and ('||' and)*
+	 *     and        := comparison ('&&' comparison)*
+	 *     comparison := sum (('<' | '<=' | '>' | '>=' | '==' | '!=') sum)?
+	 *     sum        := term (('+' | '-') term)*
+	 *     term       := unary (('*' | '/') unary)*
+	 *     unary      := ('-' | '!') unary | primary
+	 *     primary    := number | 'RE' | product ('[' index ']')? | function '(' product-or-sum ')' | '(' or ')'
+	 *
+	 * Functions are abs(), sqrt() and norm() (euclidean norm of a vector product). 'RE' is the Earth radius
+	 * in km. Products are referred by full names, e.g. density__C4_CP_CIS-CODIF_HS_H1_MOMENTS; a dataset name
+	 * may contain '-', hence subtraction right after a product name has to be separated by a space.
+	 * Products of pseudo-datasets (e.g. C4_beta__$DERIVED) are read from the filter variables.
+	 *
+	 * The expression is parsed once and compiled into a tree of closures, when the product types and
+	 * buffer offsets are known. For batches of records every closure processes a whole column of values.
+	 */
+	class Expression {
+	public:
+		explicit Expression(const string& text);
+		~Expression();
+
+		const string& text() const {
+			return text_;
+		}
+
+		//! Products in order of their first appearance
+		const std::vector<ProductName>& products() const {
+			return products_;
+		}
+
+		using RecordEvaluator = std::function<bool (const std::vector<const void*>& line,
+		                                            const std::vector<void*>& variables)>;
+		using CellEvaluator = std::function<bool (const std::vector<AveragedVariable>& line,
+		                                          const std::vector<void*>& variables)>;
+		using RecordValue = std::function<double (const std::vector<const void*>& line,
+		                                          const std::vector<void*>& variables)>;
+		using CellValue = std::function<double (const std::vector<AveragedVariable>& line,
+		                                        const std::vector<void*>& variables)>;
+
+		/**
+		 * @brief Type checks and compiles the expression for raw records or for averaged cells
+		 *
+		 * @param fields products() descriptions with offsets, in the same order; fields of the pseudo-dataset
+		 * products are filter variables of type double
+		 * @return evaluator, which returns true if the condition holds
+		 */
+		RecordEvaluator compileForRecords(const std::vector<const Field*>& fields) const;
+		CellEvaluator compileForCells(const std::vector<const Field*>& fields) const;
+
+		//! Same for an arithmetic expression, the compiled function returns its value
+		RecordValue compileValueForRecords(const std::vector<const Field*>& fields) const;
+		CellValue compileValueForCells(const std::vector<const Field*>& fields) const;
+
+		//! Product element as (index in products(), element index)
+		using ProductElement = std::pair<std::size_t, std::size_t>;
+		//! Tests count records, given by rows of values, sets bit i of passed if record i passes
+		using BatchEvaluator = std::function<void (const double* values, std::size_t count, std::uint64_t* passed)>;
+
+		/**
+		 * @brief Compiles the condition for batches of records
+		 *
+		 * Products of pseudo-datasets are not supported, as they are computed for the current record only.
+		 * @param columns receives product elements, values of which make a row of the batch
+		 */
+		BatchEvaluator compileForBatches(const std::vector<const Field*>& fields,
+		                                 std::vector<ProductElement>& columns) const;
+
+		struct Node;
+
+	private:
+		std::unique_ptr<Node> parseOr();
+		std::unique_ptr<Node> parseAnd();
+		std::unique_ptr<Node> parseComparison();
+		std::unique_ptr<Node> parseSum();
+		std::unique_ptr<Node> parseTerm();
+		std::unique_ptr<Node> parseUnary();
+		std::unique_ptr<Node> parsePrimary();
+		bool skipToken(const char* token);
+		void skipSpaces();
+		[[noreturn]] void error(const string& message) const;
+
+		string text_;
+		std::size_t position_; //!< parsing position
+		std::vector<ProductName> products_;
+		std::unique_ptr<Node> root_;
+	};
+
+	/**
+	 * @brief Tests records of a single dataset by an expression
+	 *
+	 * Derived products count as products of the dataset they are computed from.
+	 */
+	class RawExpressionFilter: public RawDataFilter {
+		using base = RawDataFilter;
+	public:
+		explicit RawExpressionFilter(const string& expression);
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
+		std::vector<ProductName> derivedProducts() const override;
+
+		//! Assigns the filter to the source dataset of its derived products
+		void resolveDerivedProducts(const DerivedVariables& derived);
+
+		//! Expressions without derived products are evaluated for batches of records
+		bool testsBatches(const DatasetName& ds) const override;
+		void appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+		                       std::vector<double>& values) const override;
+		void testBatch(const std::vector<double>& values, const DatasetName& ds, std::size_t count,
+		               std::uint64_t* passed) const override;
+
+	private:
+		explicit RawExpressionFilter(std::unique_ptr<Expression>&& expression);
+		void assignDataset(const DatasetName& dataset);
+		bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const override;
+
+		std::unique_ptr<Expression> expression_;
+		DatasetName dataset_;
+		Expression::RecordEvaluator evaluator_;
+		Expression::BatchEvaluator batchEvaluator_;
+		std::vector<std::pair<const Field*, std::size_t>> batchColumns_; //!< field and element
+	};
+
+	//! Tests averaged cells by an expression, products are replaced by their cell means
+	class AveragedExpressionFilter: public AveragedDataFilter {
+		using base = AveragedDataFilter;
+	public:
+		explicit AveragedExpressionFilter(const string& expression);
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
+		std::vector<ProductName> derivedProducts() const override;
+
+	private:
+		explicit AveragedExpressionFilter(std::unique_ptr<Expression>&& expression);
+		bool test(const std::vector<AveragedVariable>& line, std::vector<void*>& variables) const override;
+
+		std::unique_ptr<Expression> expression_;
+		Expression::CellEvaluator evaluator_;
+	};
+}
+}
+
+#endif // CDOWNLOAD_FILTER_EXPRESSION_HXX
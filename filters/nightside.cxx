@@ -22,6 +22,8 @@
 
 #include "./nightside.hxx"
 
+#include "../cdf/zonemap.hxx"
+
 cdownload::Filters::NightSide::NightSide(const std::string& spacecraftName)
 	: base("NightSide", 1)
 	, sc_pos_xyz_gse_(addField({"CP_FGM_SPIN", spacecraftName, "sc_pos_xyz_gse"}))
@@ -41,3 +43,18 @@ bool cdownload::Filters::NightSide::test(const std::vector<const void *>& line,
 
 	return true;
 }
+
+bool cdownload::Filters::NightSide::usesZoneMaps() const
+{
+	return true;
+}
+
+bool cdownload::Filters::NightSide::rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const
+{
+	if (!enabled()) {
+		return false;
+	}
+	// the whole block is on the day side
+	const CDF::ZoneMap::ElementStats* x = zoneMap.variable(block, sc_pos_xyz_gse_.name().name());
+	return x && x->nanCount == 0 && x->min > 0;
+}
@@ -33,6 +33,8 @@ namespace Filters {
 		NightSide(const std::string& spacecraftName);
 	private:
 		bool test(const std::vector<const void*> & line, const DatasetName & ds, std::vector<void*>& variables) const override;
+		bool usesZoneMaps() const override;
+		bool rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const override;
 		const Field& sc_pos_xyz_gse_;
 	};
 }
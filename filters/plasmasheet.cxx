@@ -55,7 +55,9 @@
 
 #include "plasmasheet.hxx"
 
-#include <cmath>
+#include "../derived.hxx"
+
+#include <algorithm>
 
 cdownload::Filters::PlasmaSheetModeFilter::PlasmaSheetModeFilter(const string& spacecraftName)
 	: base("PlasmaSheetMode", 1)
@@ -80,14 +82,13 @@ bool cdownload::Filters::PlasmaSheetModeFilter::test(const std::vector<const voi
 }
 
 cdownload::Filters::PlasmaSheet::PlasmaSheet(double minR, const string& spacecraftName)
-	: base(filterName(), 7, 3)
+	: base(filterName(), 6, 3)
 	, minR_{minR}
-	, H1density_(addField({"CP_CIS-CODIF_HS_H1_MOMENTS", spacecraftName, "density"}))
-	, H1T_(addField({"CP_CIS-CODIF_HS_H1_MOMENTS", spacecraftName, "T"}))
-	, O1density_(addField({"CP_CIS-CODIF_HS_O1_MOMENTS", spacecraftName, "density"}))
-	, O1T_(addField({"CP_CIS-CODIF_HS_O1_MOMENTS", spacecraftName, "T"}))
-	, BMag_(addField({"CP_FGM_SPIN", spacecraftName, "B_mag"}))
-	, sc_pos_xyz_gse_(addField({"CP_FGM_SPIN", spacecraftName, "sc_pos_xyz_gse"}))
+	, spacecraftName_{spacecraftName}
+	, R_{0}
+	, beta_{0}
+	, plasmaPressure_{0}
+	, magneticPressure_{0}
 	, reportBeta_{addVariable(FieldDesc(composeProductName("beta"), -1., FieldDesc::DataType::Real, sizeof(double), 1), &reportBetaIndex_)}
 	, reportPlasmaPressure_{addVariable(
 		FieldDesc(composeProductName("PlasmaPressure"), -1., FieldDesc::DataType::Real, sizeof(double), 1),
@@ -96,6 +97,14 @@ cdownload::Filters::PlasmaSheet::PlasmaSheet(double minR, const string& spacecra
 		FieldDesc(composeProductName("MagneticPressure"), -1., FieldDesc::DataType::Real, sizeof(double), 1),
 		&reportMagneticPressureIndex_)}
 {
+	// the derived products are computed from these, which also assign the filter to the spacecraft
+	// in joint runs
+	addField({"CP_CIS-CODIF_HS_H1_MOMENTS", spacecraftName, "density"});
+	addField({"CP_CIS-CODIF_HS_H1_MOMENTS", spacecraftName, "T"});
+	addField({"CP_CIS-CODIF_HS_O1_MOMENTS", spacecraftName, "density"});
+	addField({"CP_CIS-CODIF_HS_O1_MOMENTS", spacecraftName, "T"});
+	addField({"CP_FGM_SPIN", spacecraftName, "B_mag"});
+	addField({"CP_FGM_SPIN", spacecraftName, "sc_pos_xyz_gse"});
 }
 
 cdownload::string cdownload::Filters::PlasmaSheet::filterName()
@@ -103,61 +112,60 @@ cdownload::string cdownload::Filters::PlasmaSheet::filterName()
 	return "PlasmaSheet";
 }
 
-namespace {
-	template <class T>
-	inline constexpr T sqr(T v)
-	{
-		return v * v;
-	}
-
-	// returns pressure in SI, takes density and T directly as they are in CDFs
-	double gasPressure(double density, double T)
-	{
-		constexpr const double k_B = 1.38064852e-23; // Boltzmann constant
-		return density * 1e6 * k_B * T * 1e6;
-	}
+std::vector<cdownload::ProductName> cdownload::Filters::PlasmaSheet::derivedProducts() const
+{
+	return {
+		DerivedVariables::productName(spacecraftName_, "R"),
+		DerivedVariables::productName(spacecraftName_, "beta"),
+		DerivedVariables::productName(spacecraftName_, "PlasmaPressure"),
+		DerivedVariables::productName(spacecraftName_, "MagneticPressure")
+	};
+}
 
-	// return pressure in SI, takes B directory from CDF
-	double magneticPressure(double B)
-	{
-		// P = B^2/2/mu_0 (SI)
-		constexpr const double mu_0 = 1.2566370614e-6;
-		return sqr(B)*1e-18/2/mu_0;
+void cdownload::Filters::PlasmaSheet::initialize(const std::vector<Field>& availableProducts,
+                                                 const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	const std::vector<ProductName> derived = derivedProducts();
+	std::size_t* offsets[] = {&R_, &beta_, &plasmaPressure_, &magneticPressure_};
+	for (std::size_t i = 0; i < derived.size(); ++i) {
+		auto fi = std::find_if(filterVariables.begin(), filterVariables.end(), [&derived, i](const Field& f) {
+			return f.name() == derived[i];
+		});
+		if (fi == filterVariables.end()) {
+			throw std::logic_error("Derived product '" + derived[i].shortName() + "' is not computed");
+		}
+		*offsets[i] = fi->offset();
 	}
 }
 
-bool cdownload::Filters::PlasmaSheet::test(const std::vector<AveragedVariable>& line, std::vector<void*>& variables) const
+bool cdownload::Filters::PlasmaSheet::test(const std::vector<AveragedVariable>& /*line*/,
+                                           std::vector<void*>& variables) const
 {
-	// check for R > 4 R_E
-	const AveragedVariable& pos = sc_pos_xyz_gse_.data(line);
-	constexpr const double RE = 6371;
+	auto value = [&variables](std::size_t offset) {
+		return *static_cast<const double*>(variables[offset]);
+	};
 
-	if (enabled() && std::sqrt(sqr(pos[0].mean()) + sqr(pos[1].mean()) + sqr(pos[2].mean())) < minR_ * RE) {
+	// check for R > 4 R_E
+	if (enabled() && value(R_) < minR_ * EARTH_RADIUS) {
 		return false;
 	}
 
 	// 0.2 <plasma beta< 10
 	// beta is defined as ratio between plasma pressure and magnetic pressure
 	// for plasma pressure we sum H1 pressure and O1 pressure
-
-	const double totalPlasma =
-		gasPressure(H1density_.data(line)[0].mean(), H1T_.data(line)[0].mean()) +
-		gasPressure(O1density_.data(line)[0].mean(), O1T_.data(line)[0].mean());
-
-	const double magnetic = magneticPressure(BMag_.data(line)[0].mean());
-
-	const double beta = totalPlasma / magnetic;
+	const double beta = value(beta_);
 
 	if (isVariableEnabled(reportBetaIndex_)) {
 		*(reportBeta_.data<double>(variables)) = beta;
 	}
 
 	if (isVariableEnabled(reportPlasmaPressureIndex_)) {
-		*(reportPlasmaPressure_.data<double>(variables)) = totalPlasma;
+		*(reportPlasmaPressure_.data<double>(variables)) = value(plasmaPressure_);
 	}
 
 	if (isVariableEnabled(reportMagneticPressureIndex_)) {
-		*(reportMagneticPressure_.data<double>(variables)) = magnetic;
+		*(reportMagneticPressure_.data<double>(variables)) = value(magneticPressure_);
 	}
 
 	if (enabled() && (beta < 0.2 || beta > 10)) {
@@ -165,4 +173,3 @@ bool cdownload::Filters::PlasmaSheet::test(const std::vector<AveragedVariable>&
 	}
 	return true;
 }
-
@@ -40,22 +40,26 @@ namespace Filters {
 		const Field& cis_mode_;
 	};
 
+	//! Tests distance and plasma beta, which are taken from the derived products
 	class PlasmaSheet : public AveragedDataFilter {
 		using base = AveragedDataFilter;
 	public:
 		PlasmaSheet(double minR, const string& spacecraftName);
 
 		static string filterName();
+
+		std::vector<ProductName> derivedProducts() const override;
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
 	private:
 		bool test(const std::vector<AveragedVariable>& line, std::vector<void*>& variables) const override;
 
 		double minR_;
-		const Field& H1density_;
-		const Field& H1T_;
-		const Field& O1density_;
-		const Field& O1T_;
-		const Field& BMag_;
-		const Field& sc_pos_xyz_gse_;
+		string spacecraftName_;
+		// offsets of the derived products in filter variables
+		std::size_t R_;
+		std::size_t beta_;
+		std::size_t plasmaPressure_;
+		std::size_t magneticPressure_;
 		// variables for export
 		const Field& reportBeta_;
 		const Field& reportPlasmaPressure_;
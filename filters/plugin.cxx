@@ -0,0 +1,208 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "./plugin.hxx"
+
+#include <dlfcn.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <stdexcept>
+
+namespace {
+	std::vector<std::size_t> elementCounts(const std::vector<const cdownload::Field*>& fields)
+	{
+		std::vector<std::size_t> res;
+		for (const cdownload::Field* f: fields) {
+			res.push_back(f->elementCount());
+		}
+		return res;
+	}
+}
+
+cdownload::Filters::FilterPlugin::FilterPlugin(const path& library)
+	: library_{library}
+	, handle_{dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL)}
+	, plugin_{nullptr}
+	, valuesPerLine_{0}
+{
+	if (!handle_) {
+		throw std::runtime_error("Can not load filter plugin " + library.string() + ": " + dlerror());
+	}
+	void* entry = dlsym(handle_, CDOWNLOAD_FILTER_PLUGIN_ENTRY);
+	if (entry) {
+		plugin_ = reinterpret_cast<cdownload_filter_plugin_entry>(entry)();
+	}
+	if (!plugin_ || plugin_->api_version != CDOWNLOAD_FILTER_PLUGIN_API_VERSION || !plugin_->name ||
+	    !plugin_->test || (plugin_->kind != CDOWNLOAD_FILTER_RAW && plugin_->kind != CDOWNLOAD_FILTER_AVERAGED)) {
+		dlclose(handle_);
+		throw std::runtime_error("Library " + library.string() + " is not a compatible filter plugin");
+	}
+	for (const char* const* pr = plugin_->products; pr && *pr; ++pr) {
+		products_.emplace_back(*pr);
+	}
+	BOOST_LOG_TRIVIAL(debug) << "Loaded filter plugin " << name() << " from " << library_;
+}
+
+cdownload::Filters::FilterPlugin::~FilterPlugin()
+{
+	dlclose(handle_);
+}
+
+cdownload::string cdownload::Filters::FilterPlugin::name() const
+{
+	return plugin_->name;
+}
+
+bool cdownload::Filters::FilterPlugin::averaged() const
+{
+	return plugin_->kind == CDOWNLOAD_FILTER_AVERAGED;
+}
+
+void cdownload::Filters::FilterPlugin::setElementCounts(const std::vector<std::size_t>& elementCounts)
+{
+	elementCounts_ = elementCounts;
+	offsets_.clear();
+	valuesPerLine_ = 0;
+	for (std::size_t count: elementCounts_) {
+		offsets_.push_back(valuesPerLine_);
+		valuesPerLine_ += count;
+	}
+}
+
+void cdownload::Filters::FilterPlugin::test(const double* values, std::size_t count, std::uint64_t* passed) const
+{
+	static thread_local std::vector<cdownload_column> columns;
+	columns.clear();
+	for (std::size_t i = 0; i < offsets_.size(); ++i) {
+		columns.push_back({values + offsets_[i], elementCounts_[i], valuesPerLine_});
+	}
+	plugin_->test(columns.data(), count, passed);
+}
+
+// RawPluginFilter
+
+cdownload::Filters::RawPluginFilter::RawPluginFilter(std::shared_ptr<FilterPlugin> plugin)
+	: base(plugin->name(), plugin->products().size())
+	, plugin_{plugin}
+{
+	if (plugin_->products().empty()) {
+		throw std::runtime_error("Filter plugin " + plugin_->name() + " does not require any product");
+	}
+	for (const ProductName& pr: plugin_->products()) {
+		addField(pr);
+		if (!dataset_.empty() && pr.dataset() != dataset_) {
+			throw std::runtime_error("Filter plugin " + plugin_->name() +
+			                         " refers to several datasets, which is possible for averaged data only");
+		}
+		dataset_ = pr.dataset();
+	}
+}
+
+void cdownload::Filters::RawPluginFilter::initialize(const std::vector<Field>& availableProducts,
+                                                     const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	fields_.clear();
+	for (const ProductName& pr: plugin_->products()) {
+		fields_.push_back(&field(pr.name()));
+	}
+	plugin_->setElementCounts(elementCounts(fields_));
+}
+
+bool cdownload::Filters::RawPluginFilter::test(const std::vector<const void*>& line, const DatasetName& ds,
+                                               std::vector<void*>& /*variables*/) const
+{
+	if (!enabled() || ds != dataset_) {
+		return true;
+	}
+	// readers test records of the dataset in batches, this is for the single ones
+	static thread_local std::vector<double> values;
+	values.clear();
+	appendBatchValues(line, ds, values);
+	std::uint64_t passed = 0;
+	testBatch(values, ds, 1, &passed);
+	return passed & 1;
+}
+
+bool cdownload::Filters::RawPluginFilter::testsBatches(const DatasetName& ds) const
+{
+	return enabled() && ds == dataset_;
+}
+
+void cdownload::Filters::RawPluginFilter::appendBatchValues(const std::vector<const void*>& line,
+                                                            const DatasetName& /*ds*/, std::vector<double>& values) const
+{
+	for (const Field* f: fields_) {
+		for (std::size_t i = 0; i < f->elementCount(); ++i) {
+			values.push_back(f->getDouble(line, i));
+		}
+	}
+}
+
+void cdownload::Filters::RawPluginFilter::testBatch(const std::vector<double>& values, const DatasetName& /*ds*/,
+                                                    std::size_t count, std::uint64_t* passed) const
+{
+	plugin_->test(values.data(), count, passed);
+}
+
+// AveragedPluginFilter
+
+cdownload::Filters::AveragedPluginFilter::AveragedPluginFilter(std::shared_ptr<FilterPlugin> plugin)
+	: base(plugin->name(), plugin->products().size())
+	, plugin_{plugin}
+{
+	for (const ProductName& pr: plugin_->products()) {
+		addField(pr);
+	}
+}
+
+void cdownload::Filters::AveragedPluginFilter::initialize(const std::vector<Field>& availableProducts,
+                                                          const std::vector<Field>& filterVariables)
+{
+	base::initialize(availableProducts, filterVariables);
+	fields_.clear();
+	for (const ProductName& pr: plugin_->products()) {
+		fields_.push_back(&field(pr.name()));
+	}
+	plugin_->setElementCounts(elementCounts(fields_));
+}
+
+bool cdownload::Filters::AveragedPluginFilter::test(const std::vector<AveragedVariable>& line,
+                                                    std::vector<void*>& /*variables*/) const
+{
+	if (!enabled()) {
+		return true;
+	}
+	static thread_local std::vector<double> values;
+	values.clear();
+	for (const Field* f: fields_) {
+		const AveragedVariable& cell = f->data(line);
+		for (std::size_t i = 0; i < f->elementCount(); ++i) {
+			values.push_back(cell[i].mean());
+		}
+	}
+	std::uint64_t passed = 0;
+	plugin_->test(values.data(), 1, &passed);
+	return passed & 1;
+}
@@ -0,0 +1,119 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_FILTER_PLUGIN_HXX
+#define CDOWNLOAD_FILTER_PLUGIN_HXX
+
+#include "../filter.hxx"
+#include "./pluginapi.h"
+
+#include <cstdint>
+#include <memory>
+
+namespace cdownload {
+namespace Filters {
+
+	/**
+	 * @brief Filter plugin library, loaded at runtime
+	 *
+	 * See pluginapi.h for the interface a library has to implement.
+	 */
+	class FilterPlugin {
+	public:
+		explicit FilterPlugin(const path& library);
+		~FilterPlugin();
+
+		FilterPlugin(const FilterPlugin&) = delete;
+		FilterPlugin& operator=(const FilterPlugin&) = delete;
+
+		string name() const;
+		bool averaged() const;
+		const std::vector<ProductName>& products() const {
+			return products_;
+		}
+
+		//! Sets numbers of elements of products(), i.e. the layout of the lines to test
+		void setElementCounts(const std::vector<std::size_t>& elementCounts);
+
+		std::size_t valuesPerLine() const {
+			return valuesPerLine_;
+		}
+
+		/**
+		 * @brief Tests a batch of lines
+		 *
+		 * @param values count lines of valuesPerLine() values, products in the same order as products()
+		 * @param passed bitmask of at least (count + 63) / 64 words
+		 */
+		void test(const double* values, std::size_t count, std::uint64_t* passed) const;
+
+	private:
+		path library_;
+		void* handle_;
+		const cdownload_filter_plugin* plugin_;
+		std::vector<ProductName> products_;
+		std::vector<std::size_t> elementCounts_;
+		std::vector<std::size_t> offsets_;
+		std::size_t valuesPerLine_;
+	};
+
+	//! Tests records of a single dataset by a plugin
+	class RawPluginFilter: public RawDataFilter {
+		using base = RawDataFilter;
+	public:
+		explicit RawPluginFilter(std::shared_ptr<FilterPlugin> plugin);
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
+
+		bool testsBatches(const DatasetName& ds) const override;
+		void appendBatchValues(const std::vector<const void*>& line, const DatasetName& ds,
+		                       std::vector<double>& values) const override;
+		void testBatch(const std::vector<double>& values, const DatasetName& ds, std::size_t count,
+		               std::uint64_t* passed) const override;
+
+	private:
+		bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const override;
+
+		std::shared_ptr<FilterPlugin> plugin_;
+		DatasetName dataset_;
+		std::vector<const Field*> fields_;
+	};
+
+	//! Tests averaged cells by a plugin, products are replaced by their cell means
+	class AveragedPluginFilter: public AveragedDataFilter {
+		using base = AveragedDataFilter;
+	public:
+		explicit AveragedPluginFilter(std::shared_ptr<FilterPlugin> plugin);
+
+		void initialize(const std::vector<Field>& availableProducts, const std::vector<Field>& filterVariables) override;
+
+	private:
+		bool test(const std::vector<AveragedVariable>& line, std::vector<void*>& variables) const override;
+
+		std::shared_ptr<FilterPlugin> plugin_;
+		std::vector<const Field*> fields_;
+	};
+}
+}
+
+#endif // CDOWNLOAD_FILTER_PLUGIN_HXX
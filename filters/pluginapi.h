@@ -0,0 +1,79 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Interface of runtime-loadable filter plugins (--filter-plugin). This is a C header, thus plugins
+ * may be written in C or in any language with a C ABI.
+ *
+ * A plugin is a shared library exporting
+ *
+ *     const struct cdownload_filter_plugin* cdownload_filter_plugin(void);
+ *
+ * The returned description has to stay valid until the library is unloaded.
+ */
+
+#ifndef CDOWNLOAD_FILTER_PLUGIN_API_H
+#define CDOWNLOAD_FILTER_PLUGIN_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CDOWNLOAD_FILTER_PLUGIN_API_VERSION 1
+#define CDOWNLOAD_FILTER_PLUGIN_ENTRY "cdownload_filter_plugin"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum cdownload_filter_kind {
+	CDOWNLOAD_FILTER_RAW = 0,     /* tests records of a single dataset */
+	CDOWNLOAD_FILTER_AVERAGED = 1 /* tests averaged cells, values are the cell means */
+};
+
+/* Values of a product for a batch of lines: element e of line i is values[i * stride + e] */
+struct cdownload_column {
+	const double* values;
+	size_t elements;
+	size_t stride;
+};
+
+struct cdownload_filter_plugin {
+	unsigned api_version; /* CDOWNLOAD_FILTER_PLUGIN_API_VERSION */
+	const char* name;
+	enum cdownload_filter_kind kind;
+	/* NULL-terminated list of full product names, e.g. "density__C4_CP_CIS-CODIF_HS_H1_MOMENTS" */
+	const char* const* products;
+	/*
+	 * Tests count lines, columns come in the order of products. Sets bit (i % 64) of passed[i / 64]
+	 * if line i passes and clears it otherwise. May be called concurrently from several threads.
+	 */
+	void (*test)(const struct cdownload_column* columns, size_t count, uint64_t* passed);
+};
+
+typedef const struct cdownload_filter_plugin* (*cdownload_filter_plugin_entry)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CDOWNLOAD_FILTER_PLUGIN_API_H */
@@ -22,6 +22,8 @@
 
 #include "./quality.hxx"
 
+#include "../cdf/zonemap.hxx"
+
 cdownload::Filters::QualityFilter::QualityFilter(const cdownload::ProductName& product, int minRequiredQuality)
 	: base("Quality", 1)
 	, field_(addField(product.name()))
@@ -43,3 +45,18 @@ bool cdownload::Filters::QualityFilter::test(const std::vector<const void *>& li
 
 	return true;
 }
+
+bool cdownload::Filters::QualityFilter::usesZoneMaps() const
+{
+	return true;
+}
+
+bool cdownload::Filters::QualityFilter::rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const
+{
+	if (!enabled()) {
+		return false;
+	}
+	const CDF::ZoneMap::ElementStats* stats = zoneMap.variable(block, field_.name().name());
+	// the block maximum is lowest() if there are no valid values
+	return stats && stats->nanCount == 0 && stats->max < minQuality_;
+}
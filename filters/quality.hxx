@@ -35,6 +35,8 @@ namespace Filters {
 
 	private:
 		bool test(const std::vector<const void*>& line, const DatasetName& ds, std::vector<void*>& variables) const override;
+		bool usesZoneMaps() const override;
+		bool rejectsBlock(const CDF::ZoneMap& zoneMap, std::size_t block) const override;
 		const Field& field_;
 		const int minQuality_;
 	};
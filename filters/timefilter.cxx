@@ -33,33 +33,25 @@
 #include <sstream>
 #include <vector>
 
-namespace {
-	struct RangeComparisonByBegin {
-		bool operator()(const cdownload::EpochRange& left, const cdownload::EpochRange& right) const
-		{
-			return left.begin() < right.begin();
-		}
-	};
-}
-
 cdownload::Filters::TimeFilter::TimeFilter(const path& fileName)
 	: ranges_{loadRanges(fileName)}
 {
 }
 
-bool cdownload::Filters::TimeFilter::test(EpochRange::EpochType epoch) const
+bool cdownload::Filters::TimeFilter::test(EpochRange::EpochType epoch, std::size_t& cursor) const
 {
-	auto it = std::upper_bound(ranges_.begin(), ranges_.end(), epoch,
-	                           [](EpochRange::EpochType epoch, const EpochRange& range) {
-		return epoch < range.end();
-	});
-
-	if (it != ranges_.end()) {
-		if (it->contains(epoch) || (it != ranges_.begin() && (it - 1)->contains(epoch))) {
-			return true;
-		}
+	// the cursor points to the first range, which does not end before the last tested epoch
+	if (cursor > ranges_.size() || (cursor > 0 && ranges_[cursor - 1].end() >= epoch)) {
+		cursor = static_cast<std::size_t>(std::distance(ranges_.begin(),
+			std::lower_bound(ranges_.begin(), ranges_.end(), epoch,
+			                 [](const EpochRange& range, EpochRange::EpochType epoch) {
+				return range.end() < epoch;
+			})));
 	}
-	return false;
+	while (cursor < ranges_.size() && ranges_[cursor].end() < epoch) {
+		++cursor;
+	}
+	return cursor < ranges_.size() && ranges_[cursor].begin() <= epoch;
 }
 
 namespace {
@@ -78,6 +70,11 @@ namespace {
 }
 
 std::vector<cdownload::EpochRange> cdownload::Filters::TimeFilter::loadRanges(const path& fileName)
+{
+	return normalizeRanges(readRanges(fileName));
+}
+
+std::vector<cdownload::EpochRange> cdownload::Filters::TimeFilter::readRanges(const path& fileName)
 {
 	std::ifstream inp(fileName.c_str());
 	string line;
@@ -97,7 +94,5 @@ std::vector<cdownload::EpochRange> cdownload::Filters::TimeFilter::loadRanges(co
 		}
 		res.push_back(parseRange(line));
 	}
-
-	std::sort(res.begin(), res.end(), RangeComparisonByBegin());
 	return res;
 }
@@ -33,7 +33,28 @@ namespace Filters {
 	class TimeFilter {
 	public:
 		TimeFilter(const path& fileName);
-		bool test(EpochRange::EpochType epoch) const;
+
+		/**
+		 * @brief Tests whether the epoch falls into one of the ranges
+		 *
+		 * @param cursor position in the ranges list, owned by the caller and initially 0. Epochs tested with
+		 * the same cursor should come in non-decreasing order, otherwise the cursor is looked up again.
+		 */
+		bool test(EpochRange::EpochType epoch, std::size_t& cursor) const;
+
+		//! Sorted and disjoint ranges
+		const std::vector<EpochRange>& ranges() const {
+			return ranges_;
+		}
+
+		/**
+		 * @brief Reads time ranges file
+		 *
+		 * The file contains a header line, followed by a single range per line, e.g.
+		 * [2008-12-21T08:06:32Z;2008-12-23T05:21:32Z]
+		 * @return ranges in the file order
+		 */
+		static std::vector<EpochRange> readRanges(const path& fileName);
 	private:
 		static std::vector<EpochRange> loadRanges(const path& fileName);
 		std::vector<EpochRange> ranges_;
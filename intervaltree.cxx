@@ -0,0 +1,79 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "intervaltree.hxx"
+
+#include <algorithm>
+#include <limits>
+
+#include "config.h"
+
+cdownload::IntervalTree::IntervalTree(const std::vector<EpochRange>& intervals)
+{
+	nodes_.reserve(intervals.size());
+	for (std::size_t i = 0; i < intervals.size(); ++i) {
+		nodes_.push_back({intervals[i].begin(), intervals[i].end(), intervals[i].end(), i});
+	}
+	std::sort(nodes_.begin(), nodes_.end(), [](const Node& left, const Node& right) {
+		return left.begin < right.begin;
+	});
+	buildMaxEnd(0, nodes_.size());
+}
+
+cdownload::EpochRange::EpochType cdownload::IntervalTree::buildMaxEnd(std::size_t first, std::size_t last)
+{
+	if (first >= last) {
+		return std::numeric_limits<EpochRange::EpochType>::lowest();
+	}
+	const std::size_t mid = first + (last - first) / 2;
+	Node& node = nodes_[mid];
+	node.maxEnd = std::max(node.end, std::max(buildMaxEnd(first, mid), buildMaxEnd(mid + 1, last)));
+	return node.maxEnd;
+}
+
+void cdownload::IntervalTree::findContaining(EpochRange::EpochType point, std::vector<std::size_t>& result) const
+{
+	result.clear();
+	find(0, nodes_.size(), point, result);
+}
+
+void cdownload::IntervalTree::find(std::size_t first, std::size_t last, EpochRange::EpochType point,
+                                   std::vector<std::size_t>& result) const
+{
+	while (first < last) {
+		const std::size_t mid = first + (last - first) / 2;
+		const Node& node = nodes_[mid];
+		if (node.maxEnd < point) {
+			return;
+		}
+		find(first, mid, point, result);
+		if (node.begin > point) {
+			// all the intervals to the right begin even later
+			return;
+		}
+		if (node.end >= point) {
+			result.push_back(node.index);
+		}
+		first = mid + 1;
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_INTERVALTREE_HXX
+#define CDOWNLOAD_INTERVALTREE_HXX
+
+#include "epochrange.hxx"
+
+#include <vector>
+
+namespace cdownload {
+
+	/**
+	 * @brief Static interval tree for stabbing queries
+	 *
+	 * Intervals are sorted by their beginning and stored in an array that represents an implicitly
+	 * balanced binary tree. Each node keeps the maximal end of its subtree, allowing to skip subtrees
+	 * that end before the query point. Intervals may overlap and be given in any order.
+	 */
+	class IntervalTree {
+	public:
+		explicit IntervalTree(const std::vector<EpochRange>& intervals);
+
+		/**
+		 * @brief Finds all intervals that contain the given point (ends inclusive)
+		 *
+		 * @param result Receives indicies of the found intervals in the array given to the constructor
+		 */
+		void findContaining(EpochRange::EpochType point, std::vector<std::size_t>& result) const;
+
+		std::size_t size() const {
+			return nodes_.size();
+		}
+
+	private:
+		struct Node {
+			EpochRange::EpochType begin;
+			EpochRange::EpochType end;
+			EpochRange::EpochType maxEnd;
+			std::size_t index;
+		};
+
+		EpochRange::EpochType buildMaxEnd(std::size_t first, std::size_t last);
+		void find(std::size_t first, std::size_t last, EpochRange::EpochType point,
+		          std::vector<std::size_t>& result) const;
+
+		std::vector<Node> nodes_;
+	};
+}
+
+#endif // CDOWNLOAD_INTERVALTREE_HXX
@@ -23,6 +23,7 @@
 #include "datasource.hxx"
 
 #include "../parameters.hxx"
+#include "../workspace.hxx"
 #include "downloader.hxx"
 #include "omnidb.hxx"
 
@@ -30,14 +31,19 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/log/trivial.hpp>
 
+#include <cstdint>
 #include <fstream>
 #include <regex>
 
+namespace {
+	//! A year of 1-minute records takes about 175 MB
+	constexpr const std::uint64_t HRO_FILE_SIZE_ESTIMATE = 180 << 20;
+}
+
 cdownload::omni::DataSource::DataSource(const cdownload::Parameters& parameters)
 	: base{"OMNI", cdownload::timeduration(0,1,0)} // 1 minute
 	, cacheDir_{parameters.cacheDir()}
 	, downloader_{new Downloader()}
-	, tempDir_{parameters.workDir()}
 {
 	std::vector<DatasetChunk> cacheFiles =
 		parameters.cacheDir().empty() ? std::vector<DatasetChunk>() : loadCachedFiles(parameters.cacheDir());
@@ -90,11 +96,22 @@ cdownload::DatasetChunk cdownload::omni::DataSource::getNewChunk(const cdownload
 {
 	unsigned short int year = static_cast<unsigned short>(min.breakdown().year);
 
-	path fn = cacheDir_ / OmniTableDesc::fileNameForHRODbFile(year);
-	{
+	// without a cache directory the file is transient and removed as soon as read
+	const bool transient = cacheDir_.empty();
+	const std::string name = OmniTableDesc::fileNameForHRODbFile(year);
+	path fn = transient ? Workspace::instance().reserve(name, HRO_FILE_SIZE_ESTIMATE) : cacheDir_ / name;
+	try {
 		std::ofstream tempFile{fn.string()};
 		downloader_->beginDownloading(year, tempFile);
 		downloader_->waitForFinished();
+	} catch (...) {
+		if (transient) {
+			Workspace::instance().release(fn);
+		}
+		throw;
+	}
+	if (transient) {
+		fn = Workspace::instance().settle(fn);
 	}
-	return {makeDateTime(year, 1, 1, 0, 0, 0), makeDateTime(year, 12, 31, 23, 59, 59), fn};
+	return {makeDateTime(year, 1, 1, 0, 0, 0), makeDateTime(year, 12, 31, 23, 59, 59), DownloadedChunkFile(fn, transient)};
 }
@@ -51,7 +51,6 @@ namespace omni {
 		datetime lastServedChunkEndTime_;
 
 		DatasetChunk lastServedChunk_;
-		path tempDir_;
 	};
 }
 }
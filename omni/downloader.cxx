@@ -27,6 +27,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/log/trivial.hpp>
 
 #include <regex>
@@ -35,7 +36,7 @@
 std::pair<unsigned short, unsigned short> cdownload::omni::Downloader::availableYearRange()
 {
 	std::stringstream dirList;
-	base::beginDownloading(OmniTableDesc::HRODirectoryUrl, dirList);
+	base::beginDownloading(OmniTableDesc::hroDirectoryUrl(), dirList);
 	base::waitForFinished();
 
 	unsigned short minYear = 9999, maxYear = 0;
@@ -51,6 +52,8 @@ std::pair<unsigned short, unsigned short> cdownload::omni::Downloader::available
 	std::string line;
 	while(dirList) {
 		std::getline(dirList, line);
+		// FTP listings end lines with CR LF
+		boost::algorithm::trim_right(line);
 		boost::algorithm::split(parts, line, boost::is_any_of(" \t"), boost::token_compress_on);
 		std::smatch match;
 		if (std::regex_match(parts.back(), match, fileNameRx)) {
@@ -26,9 +26,27 @@
 
 #include <sstream>
 
-const std::string cdownload::omni::OmniTableDesc::HRODirectoryUrl{"ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/"};
 const cdownload::DatasetName cdownload::omni::OmniTableDesc::HRODatasetName{"HRO"};
 
+namespace {
+	std::string& hroDirectoryUrlStorage()
+	{
+		static std::string url = "ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/";
+		return url;
+	}
+}
+
+const std::string& cdownload::omni::OmniTableDesc::hroDirectoryUrl()
+{
+	return hroDirectoryUrlStorage();
+}
+
+void cdownload::omni::OmniTableDesc::setHroDirectoryUrl(const std::string& url)
+{
+	// file names are appended directly, and FTP servers list a directory only with the slash
+	hroDirectoryUrlStorage() = (url.empty() || url.back() != '/') ? url + '/' : url;
+}
+
 cdownload::omni::OmniTableDesc::OmniTableDesc()
 	: fields_{highResOmniFields()}
 {
@@ -52,7 +70,7 @@ cdownload::string cdownload::omni::OmniTableDesc::urlForHRODbFile(unsigned int y
 	// ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/omni_min1981.asc
 	// ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/omni_5min1981.asc
 
-	return HRODirectoryUrl + fileNameForHRODbFile(year, perMinuteFile);
+	return hroDirectoryUrl() + fileNameForHRODbFile(year, perMinuteFile);
 }
 
 cdownload::ProductName cdownload::omni::OmniTableDesc::makeOmniHROName(const cdownload::string& fieldName)
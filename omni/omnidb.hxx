@@ -42,7 +42,9 @@ namespace omni {
 
 		static ProductName makeOmniHROName(const string& fieldName);
 
-		static const std::string HRODirectoryUrl;
+		//! Directory holding the high resolution OMNI files, with a trailing slash
+		static const std::string& hroDirectoryUrl();
+		static void setHroDirectoryUrl(const std::string& url);
 
 		static const DatasetName HRODatasetName;
 	private:
@@ -26,12 +26,15 @@
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim_all.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/log/trivial.hpp>
 
 
 #include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <locale>
 #include <string>
 #include <sstream>
 #include <set>
@@ -87,7 +90,10 @@ cdownload::Parameters::Parameters(const path& outputDir, const path& workDir, co
 	, workDir_{workDir}
 	, cacheDir_{cacheDir}
 	, downloadMissingData_{true}
-	, allowBlanks_{false} {
+	, allowBlanks_{false}
+	, spacecraftNames_{"C4"}
+	, spatialGrid_{ProductName(), {}, 1.}
+	, superposedEpochs_{path(), timeduration(), timeduration()} {
 }
 
 void cdownload::Parameters::setExpansionDictFile(const path& fileName) {
@@ -115,6 +121,62 @@ void cdownload::Parameters::setDownloadMissingData(bool download)
 	downloadMissingData_ = download;
 }
 
+void cdownload::Parameters::setMaxParallelDownloads(std::size_t count)
+{
+	if (!count) {
+		throw std::runtime_error("Number of parallel downloads has to be positive");
+	}
+	maxParallelDownloads_ = count;
+}
+
+void cdownload::Parameters::setPrefetching(std::size_t chunks, std::uint64_t diskBudget)
+{
+	if (chunks && !diskBudget) {
+		throw std::runtime_error("Prefetching requires a positive disk budget");
+	}
+	prefetchChunks_ = chunks;
+	prefetchDiskBudget_ = diskBudget;
+}
+
+void cdownload::Parameters::setMemoryWorkspace(const path& dir, std::uint64_t budget)
+{
+	if (budget && dir.empty()) {
+		throw std::runtime_error("Memory workspace requires a directory");
+	}
+	memoryWorkspaceDir_ = dir;
+	memoryWorkspaceBudget_ = budget;
+}
+
+void cdownload::Parameters::setAsyncDownload(bool enable, const timeduration& pollInterval,
+                                             const timeduration& maxWait)
+{
+	if (enable && pollInterval <= timeduration()) {
+		throw std::runtime_error("Poll interval of asynchronous requests has to be positive");
+	}
+	if (enable && maxWait <= timeduration()) {
+		throw std::runtime_error("Maximal wait for asynchronous requests has to be positive");
+	}
+	asyncDownload_ = enable;
+	asyncPollInterval_ = pollInterval;
+	asyncMaxWait_ = maxWait;
+}
+
+void cdownload::Parameters::setCsaUrl(const std::string& url)
+{
+	if (url.empty()) {
+		throw std::runtime_error("CSA URL can not be empty");
+	}
+	csaUrl_ = url;
+}
+
+void cdownload::Parameters::setOmniUrl(const std::string& url)
+{
+	if (url.empty()) {
+		throw std::runtime_error("OMNI URL can not be empty");
+	}
+	omniUrl_ = url;
+}
+
 namespace {
 	[[noreturn]]
 	void signalParsingError(const cdownload::path& fileName, std::size_t lineNo, const std::string& errorMessage)
@@ -307,6 +369,50 @@ cdownload::Output cdownload::parseOutputDefinitionFile(const path& filePath)
 	return Output(name, parseFormatString(formatString), products);
 }
 
+namespace {
+	const std::string SPACECRAFT_PLACEHOLDER = "C*_";
+}
+
+std::vector<cdownload::ProductName>
+cdownload::expandSpacecraftPlaceholder(const ProductName& product, const std::vector<std::string>& spacecraftNames)
+{
+	if (product.dataset().compare(0, SPACECRAFT_PLACEHOLDER.size(), SPACECRAFT_PLACEHOLDER) != 0) {
+		return {product};
+	}
+	const DatasetName dataset = product.dataset().substr(SPACECRAFT_PLACEHOLDER.size());
+	std::vector<ProductName> res;
+	for (const std::string& spacecraft: spacecraftNames) {
+		res.emplace_back(dataset, spacecraft, product.shortName());
+	}
+	return res;
+}
+
+cdownload::Output cdownload::expandSpacecraftPlaceholder(const Output& output,
+                                                         const std::vector<std::string>& spacecraftNames)
+{
+	std::vector<ProductName> products;
+	for (const ProductName& pr: expandProductsMap(output.products())) {
+		const std::vector<ProductName> expanded = expandSpacecraftPlaceholder(pr, spacecraftNames);
+		std::copy(expanded.begin(), expanded.end(), std::back_inserter(products));
+	}
+	return Output(output.name(), output.format(), products);
+}
+
+std::vector<std::string>
+cdownload::expandSpacecraftPlaceholderInExpression(const std::string& expression,
+                                                  const std::vector<std::string>& spacecraftNames)
+{
+	const std::string placeholder = "__" + SPACECRAFT_PLACEHOLDER;
+	if (expression.find(placeholder) == std::string::npos) {
+		return {expression};
+	}
+	std::vector<std::string> res;
+	for (const std::string& spacecraft: spacecraftNames) {
+		res.push_back(boost::algorithm::replace_all_copy(expression, placeholder, "__" + spacecraft + '_'));
+	}
+	return res;
+}
+
 std::vector<std::string> cdownload::Parameters::allDatasetNames() const
 {
 	std::set<string> names;
@@ -331,6 +437,26 @@ void cdownload::Parameters::addDensityFilter(cdownload::DensitySource source, do
 	densityFilters_.push_back({source, minDensity});
 }
 
+void cdownload::Parameters::addFilterExpression(const string& expression)
+{
+	filterExpressions_.push_back(expression);
+}
+
+void cdownload::Parameters::addAveragedFilterExpression(const string& expression)
+{
+	averagedFilterExpressions_.push_back(expression);
+}
+
+void cdownload::Parameters::addDerivedDefinition(const string& definition)
+{
+	derivedDefinitions_.push_back(definition);
+}
+
+void cdownload::Parameters::addFilterPlugin(const path& library)
+{
+	filterPlugins_.push_back(library);
+}
+
 void cdownload::Parameters::onlyNightSide(bool v)
 {
 	onlyNightSide_ = v;
@@ -366,9 +492,49 @@ void cdownload::Parameters::plasmaSheetMinR(double v)
 	plasmaSheetMinR_ = v;
 }
 
-void cdownload::Parameters::spacecraftName(const string& name)
+void cdownload::Parameters::ephemerisIndex(bool v)
+{
+	ephemerisIndex_ = v;
+}
+
+void cdownload::Parameters::spacecraftNames(const std::vector<string>& names)
 {
-	spacecraftName_ = name;
+	if (names.empty()) {
+		throw std::runtime_error("At least one spacecraft has to be given");
+	}
+	if (std::set<string>(names.begin(), names.end()).size() != names.size()) {
+		throw std::runtime_error("Spacecraft names have to be unique");
+	}
+	spacecraftNames_ = names;
+}
+
+void cdownload::Parameters::spatialGrid(const SpatialGridParameters& v)
+{
+	if (!v.positionProduct.empty()) {
+		if (v.axes.size() < 2 || v.axes.size() > 3) {
+			throw std::runtime_error("Spatial grid has to have 2 or 3 axes");
+		}
+		std::set<std::size_t> components;
+		for (const auto& axis: v.axes) {
+			if (!components.insert(axis.component).second) {
+				throw std::runtime_error("Spatial grid axes have to use different position components");
+			}
+		}
+		if (v.lengthUnit <= 0) {
+			throw std::runtime_error("Spatial grid length unit has to be positive");
+		}
+	}
+	spatialGrid_ = v;
+}
+
+void cdownload::Parameters::superposedEpochs(const SuperposedEpochParameters& v)
+{
+	superposedEpochs_ = v;
+}
+
+void cdownload::Parameters::cellIntervalsFileName(const path& v)
+{
+	cellIntervalsFileName_ = v;
 }
 
 namespace {
@@ -391,17 +557,38 @@ std::ostream& cdownload::operator<<(std::ostream& os, const cdownload::Parameter
 		<< "Interval: " << p.timeInterval() << std::endl
 		<< "Cache dir: " << p.cacheDir() <<
 			" (download missing: " << std::boolalpha << p.downloadMissingData() << ")" << std::endl
+		<< "Parallel downloads: " << p.maxParallelDownloads() << std::endl
+		<< "Prefetch: " << p.prefetchChunks() << " chunk(s), at most "
+			<< (p.prefetchDiskBudget() >> 20) << " MiB" << std::endl
+		<< "Memory workspace: " << p.memoryWorkspaceDir() << ", at most "
+			<< (p.memoryWorkspaceBudget() >> 20) << " MiB" << std::endl
+		<< "CSA URL: " << p.csaUrl() << std::endl
+		<< "OMNI URL: " << p.omniUrl() << std::endl
+		<< "Async download: " << std::boolalpha << p.asyncDownload()
+			<< " (poll interval: " << p.asyncPollInterval() << ", max. wait: " << p.asyncMaxWait() << ")" << std::endl
 		<< "Options:" << std::endl
 			<< '\t' << "night-side" << ": " << p.onlyNightSide() << std::endl
 			<< '\t' << "allow-blanks" << ": " << p.allowBlanks() << std::endl
 			<< '\t' << "plasma-sheet" << ": " << p.plasmaSheetFilter() << std::endl
 			<< '\t' << "plasma-sheet-min-r" << ": " << p.plasmaSheetMinR() << std::endl
+			<< '\t' << "ephemeris-index" << ": " << p.ephemerisIndex() << std::endl
 			<< '\t' << "valid-time-ranges" << ": " << p.timeRangesFileName() << std::endl
 			<< '\t' << "no-averaging" << ": " << p.disableAveraging() << std::endl
 			<< '\t' << "write-epoch-column" << ": " << p.writeEpoch() << std::endl
 			<< '\t' << "quality filters" << ": " << put_list(p.qualityFilters()) << std::endl
 			<< '\t' << "density filters" << ": " << put_list(p.densityyFilters()) << std::endl
-			<< '\t' << "spacecraft" << ": " << p.spacecraftName() << std::endl
+			<< '\t' << "filter" << ": " << put_list(p.filterExpressions()) << std::endl
+			<< '\t' << "averaged-filter" << ": " << put_list(p.averagedFilterExpressions()) << std::endl
+			<< '\t' << "derived" << ": " << put_list(p.derivedDefinitions()) << std::endl
+			<< '\t' << "filter-plugin" << ": " << put_list(p.filterPlugins()) << std::endl
+			<< '\t' << "spacecraft" << ": " << put_list(p.spacecraftNames()) << std::endl
+			<< '\t' << "grid-position" << ": " << p.spatialGrid().positionProduct << std::endl
+			<< '\t' << "grid-axis" << ": " << put_list(p.spatialGrid().axes) << std::endl
+			<< '\t' << "grid-length-unit" << ": " << p.spatialGrid().lengthUnit << std::endl
+			<< '\t' << "sea-events" << ": " << p.superposedEpochs().eventsFileName << std::endl
+			<< '\t' << "sea-before" << ": " << p.superposedEpochs().before << std::endl
+			<< '\t' << "sea-after" << ": " << p.superposedEpochs().after << std::endl
+			<< '\t' << "cell-intervals" << ": " << p.cellIntervalsFileName() << std::endl
 
 		<< "Outputs:" << std::endl;
 		for (const Output& o: p.outputs()) {
@@ -441,3 +628,38 @@ std::ostream& cdownload::operator<<(std::ostream& os, cdownload::DensitySource d
 	}
 	return os;
 }
+
+namespace {
+	const char GRID_AXIS_COMPONENT_NAMES[] = {'x', 'y', 'z'};
+}
+
+std::ostream& cdownload::operator<<(std::ostream& os, const cdownload::GridAxisParameters& p)
+{
+	os << GRID_AXIS_COMPONENT_NAMES[p.component] << ':' << p.min << ':' << p.max << ':' << p.step;
+	return os;
+}
+
+std::istream& cdownload::operator>>(std::istream& is, cdownload::GridAxisParameters& p)
+{
+	// format: <component>:<min>:<max>:<step>, e.g. x:-20:10:0.5
+	std::string str;
+	is >> str;
+	std::vector<std::string> parts;
+	boost::algorithm::split(parts, str, boost::is_any_of(":"));
+	if (parts.size() != 4 || parts[0].size() != 1) {
+		throw std::runtime_error("Grid axis '" + str + "' does not follow '<x|y|z>:<min>:<max>:<step>' format");
+	}
+	const char* component = std::find(std::begin(GRID_AXIS_COMPONENT_NAMES), std::end(GRID_AXIS_COMPONENT_NAMES),
+	                                  std::tolower(parts[0][0], std::locale::classic()));
+	if (component == std::end(GRID_AXIS_COMPONENT_NAMES)) {
+		throw std::runtime_error("Unknown grid axis component '" + parts[0] + '\'');
+	}
+	p.component = static_cast<std::size_t>(std::distance(std::begin(GRID_AXIS_COMPONENT_NAMES), component));
+	p.min = boost::lexical_cast<double>(parts[1]);
+	p.max = boost::lexical_cast<double>(parts[2]);
+	p.step = boost::lexical_cast<double>(parts[3]);
+	if (!(p.max > p.min) || !(p.step > 0)) {
+		throw std::runtime_error("Grid axis '" + str + "' has to have max > min and positive step");
+	}
+	return is;
+}
@@ -25,6 +25,7 @@
 
 #include "util.hxx"
 
+#include <cstdint>
 #include <iosfwd>
 #include <map>
 
@@ -76,6 +77,19 @@ namespace cdownload {
 
 	Output parseOutputDefinitionFile(const path& filePath);
 
+	/**
+	 * @brief Replaces spacecraft placeholder "C*" in dataset names by each of the given spacecraft
+	 *
+	 * E.g. B_mag__C*_CP_FGM_SPIN for C1 and C3 becomes B_mag__C1_CP_FGM_SPIN and B_mag__C3_CP_FGM_SPIN.
+	 * Products without the placeholder are returned as is.
+	 */
+	std::vector<ProductName> expandSpacecraftPlaceholder(const ProductName& product,
+	                                                     const std::vector<std::string>& spacecraftNames);
+	Output expandSpacecraftPlaceholder(const Output& output, const std::vector<std::string>& spacecraftNames);
+	//! Same for product names in a filter expression, the result contains an expression per spacecraft
+	std::vector<std::string> expandSpacecraftPlaceholderInExpression(const std::string& expression,
+	                                                                 const std::vector<std::string>& spacecraftNames);
+
 	struct QualityFilterParameters {
 		ProductName product;
 		int minQuality;
@@ -90,6 +104,37 @@ namespace cdownload {
 		DensitySource source;
 		double minDensity;
 	};
+
+	//! Bins along one component of the position vector
+	struct GridAxisParameters {
+		std::size_t component; //!< 0, 1, or 2 for X, Y, and Z
+		double min;
+		double max;
+		double step;
+	};
+
+	/**
+	 * @brief Describes a grid to bin averaged values by spacecraft position
+	 *
+	 * Bounds and steps of the axes are given in units of lengthUnit, which itself is expressed
+	 * in units of the position product.
+	 */
+	struct SpatialGridParameters {
+		ProductName positionProduct;
+		std::vector<GridAxisParameters> axes;
+		double lengthUnit;
+	};
+
+	/**
+	 * @brief Superposed epoch analysis settings: an event list file and the window around each event
+	 *
+	 * Resolution of the window is the averaging cell size.
+	 */
+	struct SuperposedEpochParameters {
+		path eventsFileName;
+		timeduration before;
+		timeduration after;
+	};
 	/**
 	 * @brief Encapsulates all settings related to outputs
 	 *
@@ -105,6 +150,12 @@ namespace cdownload {
 		void setExpansionDictFile(const path& fileName);
 		void setContinueMode(bool continueDownloading);
 		void setDownloadMissingData(bool download);
+		void setMaxParallelDownloads(std::size_t count);
+		void setPrefetching(std::size_t chunks, std::uint64_t diskBudget);
+		void setMemoryWorkspace(const path& dir, std::uint64_t budget);
+		void setAsyncDownload(bool enable, const timeduration& pollInterval, const timeduration& maxWait);
+		void setCsaUrl(const std::string& url);
+		void setOmniUrl(const std::string& url);
 
 		const datetime& startDate() const
 		{
@@ -161,6 +212,54 @@ namespace cdownload {
 			return downloadMissingData_;
 		}
 
+		//! Maximal number of simultaneous transfers of the process
+		std::size_t maxParallelDownloads() const {
+			return maxParallelDownloads_;
+		}
+
+		//! Number of chunks to download ahead of the reader
+		std::size_t prefetchChunks() const {
+			return prefetchChunks_;
+		}
+
+		//! Disk space (bytes) prefetched chunks may occupy
+		std::uint64_t prefetchDiskBudget() const {
+			return prefetchDiskBudget_;
+		}
+
+		//! Directory in RAM-backed file system for downloaded files, which are not cached
+		const path& memoryWorkspaceDir() const {
+			return memoryWorkspaceDir_;
+		}
+
+		//! RAM (bytes) such files may occupy, 0 means they are stored in the work directory
+		std::uint64_t memoryWorkspaceBudget() const {
+			return memoryWorkspaceBudget_;
+		}
+
+		//! Whether long ranges missing in the cache are downloaded via asynchronous CSA requests
+		bool asyncDownload() const {
+			return asyncDownload_;
+		}
+
+		const timeduration& asyncPollInterval() const {
+			return asyncPollInterval_;
+		}
+
+		//! How long an asynchronous request may stay undelivered before it is submitted again or given up
+		const timeduration& asyncMaxWait() const {
+			return asyncMaxWait_;
+		}
+
+		//! Base URL of the CSA archive interface
+		const std::string& csaUrl() const {
+			return csaUrl_;
+		}
+
+		const std::string& omniUrl() const {
+			return omniUrl_;
+		}
+
 		// optional filters
 		const std::vector<QualityFilterParameters>& qualityFilters() const {
 			return qualityFilters_;
@@ -172,6 +271,30 @@ namespace cdownload {
 		}
 		void addDensityFilter(DensitySource source, double minDensity);
 
+		//! Expressions to test raw records with
+		const std::vector<string>& filterExpressions() const {
+			return filterExpressions_;
+		}
+		void addFilterExpression(const string& expression);
+
+		//! Expressions to test averaged cells with
+		const std::vector<string>& averagedFilterExpressions() const {
+			return averagedFilterExpressions_;
+		}
+		void addAveragedFilterExpression(const string& expression);
+
+		//! User definitions of derived products as "name=expression"
+		const std::vector<string>& derivedDefinitions() const {
+			return derivedDefinitions_;
+		}
+		void addDerivedDefinition(const string& definition);
+
+		//! Filter plugin libraries
+		const std::vector<path>& filterPlugins() const {
+			return filterPlugins_;
+		}
+		void addFilterPlugin(const path& library);
+
 		bool onlyNightSide() const {
 			return onlyNightSide_;
 		}
@@ -210,10 +333,43 @@ namespace cdownload {
 		}
 		void plasmaSheetMinR(double v);
 
-		const string& spacecraftName() const {
-			return spacecraftName_;
+		//! Time ranges are pruned by the coarse spacecraft position before downloading
+		bool ephemerisIndex() const {
+			return ephemerisIndex_;
+		}
+		void ephemerisIndex(bool v);
+
+		//! Several spacecraft are averaged jointly on the same time grid
+		const std::vector<string>& spacecraftNames() const {
+			return spacecraftNames_;
+		}
+		void spacecraftNames(const std::vector<string>& names);
+
+		//! @returns true if averaged cells are collected into a spatial grid
+		bool spatialBinning() const {
+			return !spatialGrid_.positionProduct.empty();
+		}
+
+		const SpatialGridParameters& spatialGrid() const {
+			return spatialGrid_;
+		}
+		void spatialGrid(const SpatialGridParameters& v);
+
+		//! @returns true if averaged cells are superposed by offsets from events
+		bool superposedEpochAnalysis() const {
+			return !superposedEpochs_.eventsFileName.empty();
+		}
+
+		const SuperposedEpochParameters& superposedEpochs() const {
+			return superposedEpochs_;
+		}
+		void superposedEpochs(const SuperposedEpochParameters& v);
+
+		//! File with the intervals to average over instead of the regular cells
+		const path& cellIntervalsFileName() const {
+			return cellIntervalsFileName_;
 		}
-		void spacecraftName(const string& name);
+		void cellIntervalsFileName(const path& v);
 	private:
 		datetime startDate_;
 		datetime endDate_;
@@ -225,8 +381,22 @@ namespace cdownload {
 		bool continue_ = false;
 		path cacheDir_;
 		bool downloadMissingData_ = true;
+		std::size_t maxParallelDownloads_ = 16;
+		std::size_t prefetchChunks_ = 0;
+		std::uint64_t prefetchDiskBudget_ = std::uint64_t(4) << 30; // 4 GiB
+		path memoryWorkspaceDir_ = "/dev/shm";
+		std::uint64_t memoryWorkspaceBudget_ = 0;
+		bool asyncDownload_ = false;
+		timeduration asyncPollInterval_ = timeduration(0, 1, 0);
+		timeduration asyncMaxWait_ = timeduration(24, 0, 0);
+		std::string csaUrl_ = "https://csa.esac.esa.int/csa/aio";
+		std::string omniUrl_ = "ftp://spdf.gsfc.nasa.gov/pub/data/omni/high_res_omni/";
 		std::vector<QualityFilterParameters> qualityFilters_;
 		std::vector<DensityFilterParameters> densityFilters_;
+		std::vector<string> filterExpressions_;
+		std::vector<string> averagedFilterExpressions_;
+		std::vector<string> derivedDefinitions_;
+		std::vector<path> filterPlugins_;
 		bool onlyNightSide_ = false;
 		path timeRangesFileName_;
 		bool allowBlanks_ = false;
@@ -234,7 +404,11 @@ namespace cdownload {
 		bool writeEpoch_ = false;
 		bool plasmaSheetFilter_ = true;
 		double plasmaSheetMinR_;
-		string spacecraftName_;
+		bool ephemerisIndex_ = false;
+		std::vector<string> spacecraftNames_;
+		SpatialGridParameters spatialGrid_;
+		SuperposedEpochParameters superposedEpochs_;
+		path cellIntervalsFileName_;
 	};
 
 	std::ostream& operator<<(std::ostream& os, const Parameters& p);
@@ -242,6 +416,8 @@ namespace cdownload {
 	std::ostream& operator<<(std::ostream& os, const QualityFilterParameters& p);
 	std::ostream& operator<<(std::ostream& os, const DensityFilterParameters& p);
 	std::ostream& operator<<(std::ostream& os, DensitySource ds);
+	std::ostream& operator<<(std::ostream& os, const GridAxisParameters& p);
+	std::istream& operator>>(std::istream& is, GridAxisParameters& p);
 }
 
 #endif // CDOWNLOAD_PARAMETERS_H
@@ -0,0 +1,103 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "spatialgrid.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+constexpr const std::size_t cdownload::SpatialGrid::INVALID_BIN;
+
+cdownload::SpatialGrid::SpatialGrid(const std::vector<GridAxisParameters>& axes, double lengthUnit,
+                                    const std::vector<AveragedVariable>& prototype)
+	: axes_{axes}
+	, binsPerAxis_{}
+	, lengthUnit_{lengthUnit}
+	, prototype_{prototype}
+	, bins_{}
+{
+	for (const GridAxisParameters& axis: axes_) {
+		binsPerAxis_.push_back(static_cast<std::size_t>(std::ceil((axis.max - axis.min) / axis.step)));
+	}
+}
+
+std::size_t cdownload::SpatialGrid::binIndex(const AveragedVariable& position) const
+{
+	std::size_t index = 0;
+	for (std::size_t i = 0; i < axes_.size(); ++i) {
+		const GridAxisParameters& axis = axes_[i];
+		if (axis.component >= position.size()) {
+			throw std::runtime_error("Position product has too few components for the spatial grid");
+		}
+		const double coordinate = position[axis.component].mean() / lengthUnit_;
+		// NaN fails both comparisons
+		if (!(coordinate >= axis.min && coordinate < axis.max)) {
+			return INVALID_BIN;
+		}
+		const std::size_t binOnAxis = std::min(static_cast<std::size_t>((coordinate - axis.min) / axis.step),
+		                                       binsPerAxis_[i] - 1);
+		index = index * binsPerAxis_[i] + binOnAxis;
+	}
+	return index;
+}
+
+void cdownload::SpatialGrid::add(std::size_t binIndex, const std::vector<AveragedVariable>& cells,
+                                 const datetime& cellMidTime)
+{
+	assert(binIndex != INVALID_BIN);
+	assert(cells.size() == prototype_.size());
+	auto i = bins_.find(binIndex);
+	if (i == bins_.end()) {
+		i = bins_.emplace(binIndex, Bin(prototype_)).first;
+	}
+	i->second.add(cells, cellMidTime.milliseconds());
+}
+
+void cdownload::SpatialGrid::merge(const cdownload::SpatialGrid& other)
+{
+	if (other.binsPerAxis_ != binsPerAxis_ || other.prototype_.size() != prototype_.size()) {
+		throw std::logic_error("Only spatial grids of the same geometry can be merged");
+	}
+	for (const auto& ob: other.bins_) {
+		auto i = bins_.find(ob.first);
+		if (i == bins_.end()) {
+			bins_.emplace(ob.first, ob.second);
+			continue;
+		}
+		i->second.merge(ob.second);
+	}
+}
+
+std::vector<double> cdownload::SpatialGrid::binCenter(std::size_t binIndex) const
+{
+	std::vector<double> res(axes_.size());
+	for (std::size_t i = axes_.size(); i > 0; --i) {
+		const GridAxisParameters& axis = axes_[i - 1];
+		const std::size_t binOnAxis = binIndex % binsPerAxis_[i - 1];
+		binIndex /= binsPerAxis_[i - 1];
+		res[i - 1] = axis.min + (static_cast<double>(binOnAxis) + 0.5) * axis.step;
+	}
+	return res;
+}
@@ -0,0 +1,92 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_SPATIALGRID_HXX
+#define CDOWNLOAD_SPATIALGRID_HXX
+
+#include "average.hxx"
+#include "parameters.hxx"
+
+#include <map>
+#include <vector>
+
+namespace cdownload {
+
+	/**
+	 * @brief Collects averaged cells into bins of a regular 2D or 3D spatial grid
+	 *
+	 * Only bins which received data are allocated. Grids with the same geometry can be merged,
+	 * which allows to fill them independently for parts of the data.
+	 */
+	class SpatialGrid {
+	public:
+		using Bin = AveragedCellsAccumulator;
+		using const_iterator = std::map<std::size_t, Bin>::const_iterator;
+
+		static constexpr const std::size_t INVALID_BIN = static_cast<std::size_t>(-1);
+
+		/**
+		 * @param prototype averaging cells of the data reader, defines the set of variables
+		 * of each bin
+		 */
+		SpatialGrid(const std::vector<GridAxisParameters>& axes, double lengthUnit,
+		            const std::vector<AveragedVariable>& prototype);
+
+		/**
+		 * @brief Finds bin for the given position
+		 *
+		 * @param position averaged position vector, in units of the position product
+		 * @return bin index or @ref INVALID_BIN if the position is outside of the grid
+		 */
+		std::size_t binIndex(const AveragedVariable& position) const;
+
+		//! Adds all the values accumulated in the cells to the bin
+		void add(std::size_t binIndex, const std::vector<AveragedVariable>& cells, const datetime& cellMidTime);
+
+		void merge(const SpatialGrid& other);
+
+		//! @returns coordinates of the bin center, in grid length units, one per axis
+		std::vector<double> binCenter(std::size_t binIndex) const;
+
+		const std::vector<GridAxisParameters>& axes() const {
+			return axes_;
+		}
+
+		const_iterator begin() const {
+			return bins_.begin();
+		}
+
+		const_iterator end() const {
+			return bins_.end();
+		}
+
+	private:
+		std::vector<GridAxisParameters> axes_;
+		std::vector<std::size_t> binsPerAxis_;
+		double lengthUnit_;
+		std::vector<AveragedVariable> prototype_;
+		std::map<std::size_t, Bin> bins_;
+	};
+}
+
+#endif // CDOWNLOAD_SPATIALGRID_HXX
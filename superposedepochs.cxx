@@ -0,0 +1,138 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "superposedepochs.hxx"
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+cdownload::SuperposedEpochs::SuperposedEpochs(const std::vector<datetime>& events, const timeduration& before,
+                                              const timeduration& after, const timeduration& resolution,
+                                              const std::vector<AveragedVariable>& prototype)
+	: events_{}
+	, before_{before.milliseconds()}
+	, after_{after.milliseconds()}
+	, resolution_{resolution.milliseconds()}
+	, firstActiveEvent_{0}
+	, lastActiveEvent_{0}
+	, bins_{}
+{
+	if (events.empty()) {
+		throw std::runtime_error("Event list for superposed epoch analysis is empty");
+	}
+	if (!(resolution_ > 0) || !(before_ + after_ > 0)) {
+		throw std::runtime_error("Superposed epoch window and resolution have to be positive");
+	}
+	std::transform(events.begin(), events.end(), std::back_inserter(events_),
+	               [](const datetime& dt) {return dt.milliseconds();});
+	std::sort(events_.begin(), events_.end());
+
+	const std::size_t binsCount = static_cast<std::size_t>(std::ceil((before_ + after_) / resolution_));
+	bins_.assign(binsCount, Bin(prototype));
+}
+
+void cdownload::SuperposedEpochs::add(const datetime& cellMidTime, const std::vector<AveragedVariable>& cells)
+{
+	const double t = cellMidTime.milliseconds();
+	while (lastActiveEvent_ < events_.size() && events_[lastActiveEvent_] - before_ <= t) {
+		++lastActiveEvent_;
+	}
+	while (firstActiveEvent_ < lastActiveEvent_ && events_[firstActiveEvent_] + after_ <= t) {
+		++firstActiveEvent_;
+	}
+
+	for (std::size_t i = firstActiveEvent_; i < lastActiveEvent_; ++i) {
+		const std::size_t binIndex = static_cast<std::size_t>((t - events_[i] + before_) / resolution_);
+		if (binIndex < bins_.size()) {
+			bins_[binIndex].add(cells, t);
+		}
+	}
+}
+
+cdownload::timeduration cdownload::SuperposedEpochs::binOffset(std::size_t index) const
+{
+	return {(static_cast<double>(index) + 0.5) * resolution_ - before_};
+}
+
+cdownload::EpochRange cdownload::SuperposedEpochs::timeRange(const std::vector<datetime>& events,
+                                                             const timeduration& before, const timeduration& after)
+{
+	if (events.empty()) {
+		throw std::runtime_error("Event list for superposed epoch analysis is empty");
+	}
+	const auto eventsRange = std::minmax_element(events.begin(), events.end());
+	return EpochRange::fromRange(std::max(eventsRange.first->milliseconds() - before.milliseconds(), 0.),
+	                             eventsRange.second->milliseconds() + after.milliseconds());
+}
+
+std::vector<cdownload::EpochRange> cdownload::SuperposedEpochs::windows(const std::vector<datetime>& events,
+                                                                      const timeduration& before,
+                                                                      const timeduration& after)
+{
+	std::vector<EpochRange> res;
+	res.reserve(events.size());
+	for (const datetime& event: events) {
+		res.push_back(EpochRange::fromRange(std::max(event.milliseconds() - before.milliseconds(), 0.),
+		                                    event.milliseconds() + after.milliseconds()));
+	}
+	return normalizeRanges(res);
+}
+
+std::vector<cdownload::datetime> cdownload::SuperposedEpochs::loadEvents(const path& fileName)
+{
+	std::ifstream inp(fileName.c_str());
+	if (!inp) {
+		throw std::runtime_error("Can not open event list file '" + fileName.string() + '\'');
+	}
+	string line;
+	std::getline(inp, line); // read header
+
+	std::vector<datetime> res;
+	std::size_t lineNumber = 1;
+	while (std::getline(inp, line)) {
+		++lineNumber;
+		if (boost::algorithm::trim_copy(line).empty()) {
+			continue;
+		}
+		std::istringstream is(line);
+		datetime event;
+		bool parsed = false;
+		try {
+			is >> event;
+			parsed = !is.fail();
+		} catch (std::runtime_error&) {
+		}
+		if (!parsed) {
+			throw std::runtime_error("Can not parse event time at line " + std::to_string(lineNumber) +
+			                         " of '" + fileName.string() + '\'');
+		}
+		res.push_back(event);
+	}
+	return res;
+}
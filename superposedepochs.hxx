@@ -0,0 +1,92 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_SUPERPOSEDEPOCHS_HXX
+#define CDOWNLOAD_SUPERPOSEDEPOCHS_HXX
+
+#include "average.hxx"
+#include "commonDefinitions.hxx"
+#include "epochrange.hxx"
+
+#include <vector>
+
+namespace cdownload {
+
+	/**
+	 * @brief Accumulates averaged cells by their time offset from events (superposed epoch analysis)
+	 *
+	 * Each event defines a window [event - before, event + after), divided into bins of the
+	 * given resolution. A cell is added to the bin of every event window it falls into. Events are
+	 * kept sorted and cells have to come in time order, then the events whose windows contain
+	 * the current cell are tracked by a pair of cursors, which only move forward.
+	 */
+	class SuperposedEpochs {
+	public:
+		using Bin = AveragedCellsAccumulator;
+
+		SuperposedEpochs(const std::vector<datetime>& events, const timeduration& before,
+		                 const timeduration& after, const timeduration& resolution,
+		                 const std::vector<AveragedVariable>& prototype);
+
+		/**
+		 * @brief Reads event list file
+		 *
+		 * The file contains a header line, followed by a single date-time per line,
+		 * e.g. 2008-12-21T08:06:32Z. Blank lines are skipped.
+		 */
+		static std::vector<datetime> loadEvents(const path& fileName);
+
+		//! Cells have to be added in non-decreasing order of their times
+		void add(const datetime& cellMidTime, const std::vector<AveragedVariable>& cells);
+
+		std::size_t binsCount() const {
+			return bins_.size();
+		}
+
+		const Bin& bin(std::size_t index) const {
+			return bins_[index];
+		}
+
+		//! Offset of the bin center from the event
+		timeduration binOffset(std::size_t index) const;
+
+		//! Time range from the beginning of the first event window to the end of the last one
+		static EpochRange timeRange(const std::vector<datetime>& events, const timeduration& before,
+		                            const timeduration& after);
+
+		//! Event windows, overlapping ones merged, sorted
+		static std::vector<EpochRange> windows(const std::vector<datetime>& events, const timeduration& before,
+		                                       const timeduration& after);
+
+	private:
+		std::vector<double> events_; // sorted, CDF EPOCH
+		double before_;
+		double after_;
+		double resolution_;
+		std::size_t firstActiveEvent_; // first event whose window does not end before the last cell
+		std::size_t lastActiveEvent_; // past the last event whose window started before the last cell
+		std::vector<Bin> bins_;
+	};
+}
+
+#endif // CDOWNLOAD_SUPERPOSEDEPOCHS_HXX
@@ -0,0 +1,76 @@
+#include "../csa/chunkdownloader.hxx"
+#include "../csa/downloader.hxx"
+#include "../csa/metadata.hxx"
+#include "../downloader.hxx"
+
+#include <chrono>
+#include <iostream>
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+using namespace cdownload;
+namespace logging = boost::log;
+
+// Downloads a time range of a dataset chunk by chunk and reports the throughput.
+// Meant to be run against tests/mock_server.py, which makes the numbers reproducible:
+// chunk-download-benchmark http://127.0.0.1:8700/csa/aio C4_CP_FGM_SPIN 30 4 2
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <csa url> [dataset] [days] [parallel downloads] [prefetch chunks]" << std::endl;
+		return 2;
+	}
+
+	logging::core::get()->set_filter
+	(
+		logging::trivial::severity >= logging::trivial::info
+	);
+
+	const std::string dataset = argc > 2 ? argv[2] : "C4_CP_FGM_SPIN";
+	const double days = argc > 3 ? boost::lexical_cast<double>(argv[3]) : 30.;
+	const std::size_t parallel = argc > 4 ? boost::lexical_cast<std::size_t>(argv[4]) : 4;
+	const std::size_t prefetch = argc > 5 ? boost::lexical_cast<std::size_t>(argv[5]) : 0;
+
+	csa::Downloader::setServerUrl(argv[1]);
+	curl::TransferScheduler::instance().setMaxConcurrentTransfers(parallel);
+
+	csa::Metadata meta;
+	const datetime startTime = meta.dataset(dataset).minTime();
+	const datetime endTime = startTime + timeduration(days * 24 * 3600 * 1000);
+
+	// a clean cache directory, so that the chunk size model starts from scratch too
+	path cacheDir = "/tmp/test-chunk-download-benchmark";
+	boost::filesystem::remove_all(cacheDir);
+	boost::filesystem::create_directories(cacheDir);
+
+	csa::DataDownloader downloader;
+	const auto started = std::chrono::steady_clock::now();
+	std::size_t chunks = 0;
+	std::uintmax_t bytes = 0;
+	{
+		csa::ChunkDownloader chunkDownloader {cacheDir, downloader, {dataset}, startTime, endTime};
+		chunkDownloader.setPrefetching(prefetch, std::uint64_t(4) << 30);
+		while (!chunkDownloader.eof()) {
+			Chunk chunk = chunkDownloader.nextChunk();
+			// the last call returns an empty chunk
+			if (chunk.files.empty()) {
+				continue;
+			}
+			for (const auto& f: chunk.files) {
+				bytes += boost::filesystem::file_size(f.second.fileName());
+			}
+			++chunks;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	std::cout << "Chunks: " << chunks << std::endl
+	          << "Unpacked MiB: " << static_cast<double>(bytes) / (1 << 20) << std::endl
+	          << "Seconds: " << seconds << std::endl
+	          << "MiB/s: " << static_cast<double>(bytes) / (1 << 20) / seconds << std::endl;
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include "../coordinates.hxx"
+#include "../csatime.hxx"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace {
+	using cdownload::CoordinateTransform;
+
+	const double TOLERANCE = 1e-3; // about 0.05 deg for unit vectors
+
+	bool check(const std::string& testName, const double* value, const double* expected)
+	{
+		bool ok = true;
+		for (std::size_t i = 0; i < 3; ++i) {
+			ok &= std::abs(value[i] - expected[i]) < TOLERANCE;
+		}
+		std::cout << "Test: " << testName << (ok ? " passed" : " FAILED")
+			<< " result: (" << value[0] << ", " << value[1] << ", " << value[2] << ')'
+			<< " expected: (" << expected[0] << ", " << expected[1] << ", " << expected[2] << ')' << std::endl;
+		return ok;
+	}
+
+	const double GSE[] = {1, 2, 3};
+
+	void toGsm(const cdownload::datetime& time, double* gsm)
+	{
+		CoordinateTransform::Matrix gseToGsm;
+		CoordinateTransform::Matrix gseToSm;
+		CoordinateTransform::rotations(time.milliseconds(), gseToGsm, gseToSm);
+		for (std::size_t i = 0; i < 3; ++i) {
+			gsm[i] = gseToGsm[i][0] * GSE[0] + gseToGsm[i][1] * GSE[1] + gseToGsm[i][2] * GSE[2];
+		}
+	}
+
+	bool testGsm(const std::string& testName, const cdownload::datetime& time, const double* expected)
+	{
+		double gsm[3];
+		toGsm(time, gsm);
+		return check(testName, gsm, expected);
+	}
+
+	//! Dipole tilt is the angle between the SM and GSM Z axes, positive if the north pole is tilted towards the Sun
+	bool testTilt(const std::string& testName, const cdownload::datetime& time, double expectedDegrees)
+	{
+		CoordinateTransform::Matrix gseToGsm;
+		CoordinateTransform::Matrix gseToSm;
+		CoordinateTransform::rotations(time.milliseconds(), gseToGsm, gseToSm);
+		// SM Z axis in GSE is the third row of the rotation matrix
+		const double tilt = std::asin(gseToSm[2][0]) * 180. / M_PI;
+		const bool ok = std::abs(tilt - expectedDegrees) < 0.1;
+		std::cout << "Test: " << testName << (ok ? " passed" : " FAILED")
+			<< " tilt: " << tilt << " expected: " << expectedDegrees << std::endl;
+		return ok;
+	}
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+	using cdownload::makeDateTime;
+
+	// reference values are computed with the transformations of Hapgood (1992) with IGRF-2000 dipole terms
+	const double equinox[] = {1, 0.017441, 3.605509};
+	const double solstice[] = {1, 1.986134, 3.009198};
+	bool ok = true;
+	ok &= testGsm("GSE to GSM 2004-03-20T22:00", makeDateTime(2004, 3, 20, 22), equinox);
+	ok &= testGsm("GSE to GSM 2004-06-21T17:00", makeDateTime(2004, 6, 21, 17), solstice);
+	ok &= testTilt("dipole tilt 2004-06-21T17:00", makeDateTime(2004, 6, 21, 17), 33.68);
+	ok &= testTilt("dipole tilt 2004-12-21T05:00", makeDateTime(2004, 12, 21, 5), -33.65);
+
+	// the rotation is cached for a step, it is the one of the step middle
+	CoordinateTransform transform(CoordinateTransform::System::GSM);
+	double cached[3];
+	double middle[3];
+	transform.apply(makeDateTime(2004, 3, 20, 22, 0, 10).milliseconds(), GSE, cached);
+	toGsm(makeDateTime(2004, 3, 20, 22, 0, 30), middle);
+	ok &= check("cached GSE to GSM 2004-03-20T22:00:10", cached, middle);
+	return ok ? 0 : 1;
+}
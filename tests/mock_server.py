@@ -0,0 +1,441 @@
+#!/usr/bin/env python3
+"""Local stand-in for the CSA archive interface and the OMNI file directory.
+
+Serves synthetic data chunks, dataset metadata, asynchronous requests and
+OMNI files over HTTP, and can inject latency, bandwidth limits, error
+responses and truncated transfers. Point cdownload to it with
+
+    cdownload --csa-url http://127.0.0.1:8700/csa/aio \
+              --omni-url http://127.0.0.1:8700/omni/ ...
+
+The CSA cookie is accepted but not checked, so any ~/.csacookie works.
+
+Datasets are described by a JSON file (--datasets), an object mapping
+dataset names to objects with the keys "title", "start", "end"
+("YYYY-MM-DD hh:mm:ss.f"), "parameters" (list of parameter names),
+"bytes_per_hour" (size of a synthetic chunk per hour of data) and
+optionally "cdf" (a CDF file, relative to the JSON file, served instead of
+synthetic bytes for every chunk of the dataset). Without --datasets a
+single synthetic dataset is served.
+
+The chunk payload is incompressible and depends only on --seed, so runs
+with the same options transfer the same amount of data.
+"""
+
+import argparse
+import collections
+import datetime
+import hashlib
+import io
+import itertools
+import json
+import os
+import random
+import re
+import sys
+import tarfile
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+TIME_FORMAT = '%Y-%m-%dT%H:%M:%S.%fZ'
+METADATA_TIME_FORMAT = '%Y-%m-%d %H:%M:%S.%f'
+
+DEFAULT_DATASETS = {
+    'C4_CP_FGM_SPIN': {
+        'title': 'Synthetic spin resolution magnetic field',
+        'start': '2001-01-01 00:00:00.0',
+        'end': '2020-12-31 23:59:59.0',
+        'parameters': [
+            'time_tags__C4_CP_FGM_SPIN',
+            'half_interval__C4_CP_FGM_SPIN',
+            'B_vec_xyz_gse__C4_CP_FGM_SPIN',
+            'B_mag__C4_CP_FGM_SPIN',
+            'sc_pos_xyz_gse__C4_CP_FGM_SPIN',
+        ],
+        'bytes_per_hour': 100 * 1024,
+    },
+}
+
+# number of columns in the high resolution OMNI files (see omni/omnidb.cxx)
+OMNI_COLUMNS = 46
+OMNI_FILE_RX = re.compile(r'omni_(5?)min(\d{4})\.asc')
+
+CHUNK_BLOCK_SIZE = 1 << 20
+TRANSFER_PIECE_SIZE = 64 * 1024
+ARCHIVE_CACHE_SIZE = 8
+
+
+class Faults:
+    """Randomised fault injection, reproducible for a given seed"""
+
+    def __init__(self, args):
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.lock = threading.Lock()
+        self.active = 0
+        self.truncated = set()
+        self.validators = itertools.count(1)
+
+    def enter(self):
+        """Registers a transfer and returns the error to reply with, or None"""
+        with self.lock:
+            self.active += 1
+            if self.args.max_concurrent and self.active > self.args.max_concurrent:
+                return 503
+            if self.random.random() < self.args.error_rate:
+                return self.random.choice(self.args.error_codes)
+            return None
+
+    def leave(self):
+        with self.lock:
+            self.active -= 1
+
+    def latency(self):
+        with self.lock:
+            return self.args.latency + self.random.uniform(0., self.args.latency_jitter)
+
+    def truncate(self):
+        with self.lock:
+            return self.random.random() < self.args.truncate_rate
+
+    def truncate_first(self, resource):
+        """Whether this is the first transfer of the resource, which --truncate-first cuts"""
+        with self.lock:
+            if not self.args.truncate_first or resource in self.truncated:
+                return False
+            self.truncated.add(resource)
+            return True
+
+
+class Archive:
+    """Builds and caches tar.gz chunks, as the CSA product action returns them"""
+
+    def __init__(self, args, datasets):
+        self.args = args
+        self.datasets = datasets
+        self.block = random.Random(args.seed).getrandbits(8 * CHUNK_BLOCK_SIZE).to_bytes(CHUNK_BLOCK_SIZE, 'little')
+        self.cache = collections.OrderedDict()
+        self.lock = threading.Lock()
+
+    def payload_size(self, dataset, start, end):
+        hours = max((end - start).total_seconds(), 0.) / 3600.
+        return max(int(self.datasets[dataset]['bytes_per_hour'] * hours), 1)
+
+    def payload(self, dataset, size):
+        cdf = self.datasets[dataset].get('cdf')
+        if cdf:
+            with open(cdf, 'rb') as f:
+                return f.read()
+        whole, rest = divmod(size, CHUNK_BLOCK_SIZE)
+        return self.block * whole + self.block[:rest]
+
+    def get(self, dataset, start, end):
+        key = (dataset, start, end)
+        with self.lock:
+            if key in self.cache:
+                self.cache.move_to_end(key)
+                return self.cache[key]
+
+        stamp = '%Y%m%d_%H%M%S'
+        name = '{0}__{1}_{2}_V00.cdf'.format(dataset, start.strftime(stamp), end.strftime(stamp))
+        data = self.payload(dataset, self.payload_size(dataset, start, end))
+        buf = io.BytesIO()
+        with tarfile.open(fileobj=buf, mode='w:gz', compresslevel=1) as tar:
+            info = tarfile.TarInfo('CSA_Download_mock/{0}/{1}'.format(dataset, name))
+            info.size = len(data)
+            info.mtime = int(time.time())
+            tar.addfile(info, io.BytesIO(data))
+        archive = buf.getvalue()
+
+        with self.lock:
+            self.cache[key] = archive
+            while len(self.cache) > ARCHIVE_CACHE_SIZE:
+                self.cache.popitem(last=False)
+        return archive
+
+
+class Omni:
+    """Synthetic high resolution OMNI files and their directory listing"""
+
+    def __init__(self, args):
+        self.first_year, self.last_year = args.omni_years
+        self.step = args.omni_step
+        self.files = {}
+        self.lock = threading.Lock()
+
+    def listing(self):
+        lines = []
+        for year in range(self.first_year, self.last_year + 1):
+            for prefix in ('', '5'):
+                # clients take only the name, the size is an estimate to keep the listing cheap
+                size = 366 * 24 * 60 // max(self.step, 5 if prefix else 1) * OMNI_COLUMNS * 3
+                lines.append('-rw-r--r--   1 ftp      ftp      {0:>10} Jan 01  {1} omni_{2}min{1}.asc'.format(
+                    size, year, prefix))
+        return ('\r\n'.join(lines) + '\r\n').encode()
+
+    def file(self, year, five_minutes):
+        key = (year, five_minutes)
+        with self.lock:
+            if key not in self.files:
+                step = max(self.step, 5 if five_minutes else 1)
+                days = 366 if datetime.date(year, 12, 31).timetuple().tm_yday == 366 else 365
+                rows = []
+                for minute in range(0, days * 24 * 60, step):
+                    day, rest = divmod(minute, 24 * 60)
+                    values = [str(year), str(day + 1), str(rest // 60), str(rest % 60)]
+                    values += [str((minute // step + i) % 100) for i in range(OMNI_COLUMNS - len(values))]
+                    rows.append(' '.join(values))
+                self.files[key] = ('\n'.join(rows) + '\n').encode()
+            return self.files[key]
+
+    def has(self, year):
+        return self.first_year <= year <= self.last_year
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    server_version = 'cdownload-mock/1'
+
+    def log_message(self, fmt, *args):
+        if not self.server.args.quiet:
+            sys.stderr.write('{0} {1}\n'.format(self.log_date_time_string(), fmt % args))
+
+    def do_GET(self):
+        url = urllib.parse.urlsplit(self.path)
+        query = urllib.parse.parse_qs(url.query, keep_blank_values=True)
+        args = self.server.args
+
+        error = self.server.faults.enter()
+        try:
+            time.sleep(self.server.faults.latency())
+            if error:
+                self.reply(error, b'Injected error\n', headers={'Retry-After': '1'} if error == 503 else {})
+                return
+            if url.path == args.csa_prefix + '/product-action':
+                self.product(query)
+            elif url.path == args.csa_prefix + '/async-product-action':
+                self.async_product(query)
+            elif url.path == args.csa_prefix + '/metadata-action':
+                self.metadata(query)
+            elif url.path.startswith('/deliver/'):
+                self.deliver(url.path[len('/deliver/'):])
+            elif url.path == args.omni_prefix:
+                self.reply(200, self.server.omni.listing())
+            elif url.path.startswith(args.omni_prefix):
+                self.omni_file(url.path[len(args.omni_prefix):])
+            else:
+                self.reply(404, b'Not found\n')
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+        finally:
+            self.server.faults.leave()
+
+    def chunk_request(self, query):
+        dataset = query.get('DATASET_ID', [''])[0]
+        if dataset not in self.server.datasets:
+            self.reply(404, 'Unknown dataset {0}\n'.format(dataset).encode())
+            return None
+        try:
+            start = datetime.datetime.strptime(query['START_DATE'][0], TIME_FORMAT)
+            end = datetime.datetime.strptime(query['END_DATE'][0], TIME_FORMAT)
+        except (KeyError, ValueError):
+            self.reply(400, b'Invalid time range\n')
+            return None
+        size = self.server.archive.payload_size(dataset, start, end)
+        if self.server.args.max_chunk_size and size > self.server.args.max_chunk_size:
+            self.reply(413, b'Request Entity Too Large\n')
+            return None
+        return dataset, start, end
+
+    def product(self, query):
+        request = self.chunk_request(query)
+        if request:
+            self.send_data(self.server.archive.get(*request), 'application/x-gzip')
+
+    def async_product(self, query):
+        request = self.chunk_request(query)
+        if request:
+            with self.server.lock:
+                job = 'job{0}'.format(next(self.server.jobs))
+                self.server.async_jobs[job] = (time.time() + self.server.args.async_delay, request)
+            host = self.headers.get('Host', '{0}:{1}'.format(*self.server.server_address))
+            self.reply(200, 'Your request has been queued. The data will be available at '
+                            'http://{0}/deliver/{1}.tar.gz\n'.format(host, job).encode())
+
+    def deliver(self, name):
+        job = name[:-len('.tar.gz')] if name.endswith('.tar.gz') else name
+        with self.server.lock:
+            ready, request = self.server.async_jobs.get(job, (None, None))
+        if request is None:
+            self.reply(404, b'Unknown request\n')
+        elif time.time() < ready:
+            self.reply(404, b'Not ready yet\n')
+        else:
+            self.send_data(self.server.archive.get(*request), 'application/x-gzip')
+
+    def metadata(self, query):
+        datasets = self.server.datasets
+        fields = query.get('SELECTED_FIELDS', [''])[0].split(',')
+        names = re.findall(r"DATASET_ID == '([^']+)'", query.get('QUERY', [''])[0])
+        if not query.get('QUERY'):
+            names = sorted(datasets)
+        names = [name for name in names if name in datasets]
+
+        rows = []
+        if 'PARAMETER.PARAMETER_ID' in fields:
+            for name in names:
+                rows += [{'PARAMETER.PARAMETER_ID': p} for p in datasets[name].get('parameters', [])]
+        else:
+            for name in names:
+                ds = datasets[name]
+                rows.append({
+                    'DATASET.DATASET_ID': name,
+                    'DATASET.TITLE': ds.get('title', name),
+                    'DATASET.DESCRIPTION': ds.get('title', name),
+                    'DATASET.TIME_RESOLUTION': '4',
+                    'DATASET.MIN_TIME_RESOLUTION': '4',
+                    'DATASET.MAX_TIME_RESOLUTION': '4',
+                    'DATASET.START_DATE': ds['start'],
+                    'DATASET.END_DATE': ds['end'],
+                })
+        self.reply(200, json.dumps({'data': rows}).encode(), 'application/json')
+
+    def omni_file(self, name):
+        match = OMNI_FILE_RX.fullmatch(name)
+        if not match or not self.server.omni.has(int(match.group(2))):
+            self.reply(404, b'Not found\n')
+            return
+        self.send_data(self.server.omni.file(int(match.group(2)), match.group(1) == '5'))
+
+    def reply(self, code, body, content_type='text/plain', headers={}):
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        for key, value in headers.items():
+            self.send_header(key, value)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def send_data(self, data, content_type='application/octet-stream'):
+        """Sends data honouring Range requests and the bandwidth and truncation faults"""
+        etag = '"{0}"'.format(hashlib.md5(data).hexdigest())
+        if self.server.args.change_validator:
+            # as if the resource changed since the previous request
+            etag = '"{0}-{1}"'.format(hashlib.md5(data).hexdigest(), next(self.server.faults.validators))
+        first = 0
+        match = re.fullmatch(r'bytes=(\d+)-', self.headers.get('Range', ''))
+        if match and self.headers.get('If-Range', etag) == etag:
+            first = int(match.group(1))
+            if first >= len(data):
+                self.reply(416, b'', headers={'Content-Range': 'bytes */{0}'.format(len(data))})
+                return
+
+        self.send_response(206 if first else 200)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(data) - first))
+        self.send_header('ETag', etag)
+        self.send_header('Accept-Ranges', 'bytes')
+        if first:
+            self.send_header('Content-Range', 'bytes {0}-{1}/{2}'.format(first, len(data) - 1, len(data)))
+        self.end_headers()
+
+        last = len(data)
+        if not first and self.server.faults.truncate_first(self.path):
+            last = min(last, self.server.args.truncate_first)
+            self.close_connection = True
+        elif self.server.faults.truncate():
+            last = first + (last - first) // 2
+            self.close_connection = True
+
+        bandwidth = self.server.args.bandwidth
+        started = time.time()
+        for offset in range(first, last, TRANSFER_PIECE_SIZE):
+            piece = data[offset:min(offset + TRANSFER_PIECE_SIZE, last)]
+            self.wfile.write(piece)
+            if bandwidth:
+                ahead = (offset + len(piece) - first) / bandwidth - (time.time() - started)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, args, datasets):
+        super().__init__((args.bind, args.port), Handler)
+        self.args = args
+        self.datasets = datasets
+        self.faults = Faults(args)
+        self.archive = Archive(args, datasets)
+        self.omni = Omni(args)
+        self.lock = threading.Lock()
+        self.jobs = itertools.count(1)
+        self.async_jobs = {}
+
+
+def load_datasets(file_name):
+    if not file_name:
+        return DEFAULT_DATASETS
+    with open(file_name) as f:
+        datasets = json.load(f)
+    base = os.path.dirname(os.path.abspath(file_name))
+    for name, ds in datasets.items():
+        for key in ('start', 'end'):
+            datetime.datetime.strptime(ds[key], METADATA_TIME_FORMAT)
+        ds.setdefault('bytes_per_hour', DEFAULT_DATASETS['C4_CP_FGM_SPIN']['bytes_per_hour'])
+        if ds.get('cdf'):
+            ds['cdf'] = os.path.join(base, ds['cdf'])
+    return datasets
+
+
+def year_range(s):
+    first, _, last = s.partition('-')
+    return int(first), int(last or first)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--bind', default='127.0.0.1', help='address to listen on')
+    parser.add_argument('--port', type=int, default=8700, help='port to listen on')
+    parser.add_argument('--csa-prefix', default='/csa/aio', help='path of the CSA interface')
+    parser.add_argument('--omni-prefix', default='/omni/', help='path of the OMNI directory')
+    parser.add_argument('--datasets', help='JSON file describing the served datasets')
+    parser.add_argument('--omni-years', type=year_range, default=(1995, 2017),
+                        help='range of years with OMNI files, e.g. 1995-2017')
+    parser.add_argument('--omni-step', type=int, default=60, help='minutes between OMNI records')
+    parser.add_argument('--async-delay', type=float, default=5., help='seconds until an asynchronous request is ready')
+    parser.add_argument('--latency', type=float, default=0., help='seconds before every response')
+    parser.add_argument('--latency-jitter', type=float, default=0., help='random extra latency, seconds')
+    parser.add_argument('--bandwidth', type=float, default=0., help='bytes per second per transfer, 0 for unlimited')
+    parser.add_argument('--max-chunk-size', type=int, default=0,
+                        help='reply 413 to chunk requests larger than this many bytes, 0 for no limit')
+    parser.add_argument('--max-concurrent', type=int, default=0,
+                        help='reply 503 when more requests are active, 0 for no limit')
+    parser.add_argument('--error-rate', type=float, default=0., help='probability of an injected error response')
+    parser.add_argument('--error-codes', type=lambda s: [int(c) for c in s.split(',')], default=[503, 504],
+                        help='comma-separated status codes for injected errors')
+    parser.add_argument('--truncate-rate', type=float, default=0.,
+                        help='probability that a data transfer is cut in the middle')
+    parser.add_argument('--truncate-first', type=int, default=0,
+                        help='cut the first transfer of every resource after this many bytes, 0 for never')
+    parser.add_argument('--change-validator', action='store_true',
+                        help='send a new ETag with every response, thus transfers can not be resumed')
+    parser.add_argument('--seed', type=int, default=0, help='seed for the payload and the fault injection')
+    parser.add_argument('--quiet', action='store_true', help='do not log requests')
+    args = parser.parse_args()
+    args.csa_prefix = args.csa_prefix.rstrip('/')
+    args.omni_prefix = args.omni_prefix.rstrip('/') + '/'
+
+    server = Server(args, load_datasets(args.datasets))
+    sys.stderr.write('Serving CSA at http://{0}:{1}{2} and OMNI at http://{0}:{1}{3}\n'.format(
+        args.bind, server.server_address[1], args.csa_prefix, args.omni_prefix))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
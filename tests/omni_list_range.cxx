@@ -1,4 +1,5 @@
 #include "../omni/downloader.hxx"
+#include "../omni/omnidb.hxx"
 
 #include <iostream>
 #include <fstream>
@@ -12,13 +13,17 @@
 using namespace cdownload;
 namespace logging = boost::log;
 
-int main(int /*argc*/, char** /*argv*/)
+int main(int argc, char** argv)
 {
 	logging::core::get()->set_filter
 	(
 		logging::trivial::severity >= logging::trivial::debug
 	);
 
+	if (argc > 1) {
+		omni::OmniTableDesc::setHroDirectoryUrl(argv[1]);
+	}
+
 	omni::Downloader downloader;
 	const auto yearRange = downloader.availableYearRange();
 	std::cout << "Available year range: [" << yearRange.first << ':' << yearRange.second << ']' << std::endl;
@@ -0,0 +1,84 @@
+#include "../downloader.hxx"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+using namespace cdownload;
+namespace logging = boost::log;
+
+namespace {
+	//! Downloads the URL into a string, returns the status code of the last response
+	int download(const std::string& url, std::string& body)
+	{
+		curl::DownloadManager manager;
+		std::ostringstream output;
+		int statusCode = 0;
+		manager.beginDownloading(url, output, [&statusCode](const curl::RunningRequest& request) {
+			statusCode = request.statusCode();
+		});
+		manager.waitForFinished();
+		body = output.str();
+		return statusCode;
+	}
+}
+
+// Checks that an interrupted transfer is continued from the interruption point and the output
+// gets exactly the same bytes as from an uninterrupted one. Meant to be run against
+// tests/mock_server.py, which cuts the first transfer of every resource:
+// mock_server.py --truncate-first 100000 &
+// resume-test http://127.0.0.1:8700/omni/omni_min2000.asc
+// When the resource changes between the transfers, it has to be downloaded from scratch:
+// mock_server.py --truncate-first 100000 --change-validator &
+// resume-test --refused http://127.0.0.1:8700/omni/omni_min2000.asc
+int main(int argc, char** argv)
+{
+	const bool refused = argc > 2 && std::strcmp(argv[1], "--refused") == 0;
+	if (argc < 2 || (argc > 2 && !refused)) {
+		std::cerr << "Usage: " << argv[0] << " [--refused] <url>" << std::endl;
+		return 2;
+	}
+	const std::string url = argv[argc - 1];
+
+	logging::core::get()->set_filter
+	(
+		logging::trivial::severity >= logging::trivial::info
+	);
+
+	std::string resumed;
+	int resumedStatus = 0;
+	try {
+		resumedStatus = download(url, resumed);
+	} catch (curl::DownloadManager::ResumeError& ex) {
+		if (refused) {
+			std::cout << "Resumption refused: " << ex.what() << std::endl;
+			return 0;
+		}
+		std::cerr << "Unexpected: " << ex.what() << std::endl;
+		return 1;
+	}
+	if (refused) {
+		std::cerr << "The changed resource was resumed, status " << resumedStatus << std::endl;
+		return 1;
+	}
+
+	// the server does not interrupt the resource any more
+	std::string whole;
+	const int wholeStatus = download(url, whole);
+
+	std::cout << "Resumed: status " << resumedStatus << ", " << resumed.size() << " bytes" << std::endl
+	          << "Uninterrupted: status " << wholeStatus << ", " << whole.size() << " bytes" << std::endl;
+	if (resumedStatus != 206 || wholeStatus != 200) {
+		std::cerr << "Expected statuses 206 and 200" << std::endl;
+		return 1;
+	}
+	if (resumed != whole) {
+		std::cerr << "Bodies differ" << std::endl;
+		return 1;
+	}
+	std::cout << "Bodies are identical" << std::endl;
+	return 0;
+}
@@ -1,7 +1,7 @@
+#include "../csa/downloader.hxx"
 #include "../csa/metadata.hxx"
 #include "../util.hxx"
 #include <iostream>
-#include <sstream>
 
 #ifdef __GNUG__
 #include <cstdlib>
@@ -39,14 +39,8 @@ int main(int argc, char** argv) {
 			cdownload::DatasetName ds(argv[i]);
 			auto dsMeta = meta.dataset(ds);
 
-			std::ostringstream os;
-
-			os << "https://csa.esac.esa.int/csa/aio/async-product-action?"
-				<< "DATASET_ID=" << ds
-				<< "&START_DATE=" << dsMeta.minTime()
-				<< "&END_DATE=" << dsMeta.maxTime()
-				<< "&DELIVERY_FORMAT=CDF&DELIVERY_INTERVAL=All";
-			std::cout << os.str() << std::endl;
+			std::cout << cdownload::csa::DataDownloader::asyncRequestUrl(ds, dsMeta.minTime(), dsMeta.maxTime())
+				<< std::endl;
 		}
 	} catch (std::exception& ex) {
 		std::cerr << "Execution was terminated due to '" << demangle(typeid(ex).name()) << "' exception." << std::endl
@@ -259,3 +259,8 @@ void cdownload::DownloadedChunkFile::release()
 {
 	impl_->released = true;
 }
+
+bool cdownload::DownloadedChunkFile::transient() const
+{
+	return !impl_->released && !impl_->unpackedFileName.empty();
+}
@@ -217,6 +217,9 @@ namespace cdownload {
 
 		// release the guarded file, which will not be deleted by the last destructor then
 		void release();
+
+		//! @returns true if the file is deleted by the last destructor
+		bool transient() const;
 	private:
 		class Impl;
 		std::shared_ptr<Impl> impl_;
@@ -0,0 +1,183 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "workspace.hxx"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	const char* const DIRECTORY_NAME_PATTERN = "cdownload-%%%%-%%%%-%%%%";
+	constexpr const std::size_t COPY_BUFFER_SIZE = 1 << 20;
+
+	//! Copies the file contents, returns false if reading or writing fails or the copy is shorter
+	bool copyFile(const cdownload::path& source, const cdownload::path& target)
+	{
+		std::ifstream input(source.c_str(), std::ios::binary);
+		std::ofstream output(target.c_str(), std::ios::binary | std::ios::trunc);
+		if (!input || !output) {
+			return false;
+		}
+		std::vector<char> buffer(COPY_BUFFER_SIZE);
+		std::uintmax_t copied = 0;
+		while (input.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || input.gcount()) {
+			if (!output.write(buffer.data(), input.gcount())) {
+				return false;
+			}
+			copied += static_cast<std::uintmax_t>(input.gcount());
+		}
+		output.close();
+		if (input.bad() || !input.eof() || !output) {
+			return false;
+		}
+		boost::system::error_code ec;
+		const std::uintmax_t size = boost::filesystem::file_size(source, ec);
+		return !ec && size == copied && boost::filesystem::file_size(target, ec) == copied && !ec;
+	}
+}
+
+cdownload::Workspace& cdownload::Workspace::instance()
+{
+	static Workspace workspace;
+	return workspace;
+}
+
+cdownload::Workspace::Workspace()
+	: memoryBudget_{0}
+{
+}
+
+cdownload::Workspace::~Workspace()
+{
+	removeDirectories();
+}
+
+void cdownload::Workspace::setDirectories(const path& workDir, const path& memoryDir, std::uint64_t memoryBudget)
+{
+	namespace fs = boost::filesystem;
+	std::unique_lock<std::mutex> lock(mutex_);
+	removeDirectories();
+
+	diskDir_ = workDir / fs::unique_path(DIRECTORY_NAME_PATTERN);
+	fs::create_directories(diskDir_);
+	memoryBudget_ = memoryBudget;
+	if (!memoryDir.empty() && memoryBudget_) {
+		memoryDir_ = memoryDir / fs::unique_path(DIRECTORY_NAME_PATTERN);
+		fs::create_directories(memoryDir_);
+	}
+}
+
+cdownload::path cdownload::Workspace::reserve(const path& fileName, std::uint64_t expectedSize)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (!memoryDir_.empty() && memoryUsageUnlocked() + expectedSize <= memoryBudget_) {
+		const path res = memoryDir_ / fileName;
+		reservations_[res] = expectedSize;
+		return res;
+	}
+	return diskDir_ / fileName;
+}
+
+void cdownload::Workspace::release(const path& fileName)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	reservations_.erase(fileName);
+}
+
+cdownload::path cdownload::Workspace::settle(const path& fileName)
+{
+	namespace fs = boost::filesystem;
+	std::unique_lock<std::mutex> lock(mutex_);
+	reservations_.erase(fileName);
+	if (memoryDir_.empty() || fileName.parent_path() != memoryDir_ || memoryUsageUnlocked() <= memoryBudget_) {
+		return fileName;
+	}
+	const path target = diskDir_ / fileName.filename();
+	BOOST_LOG_TRIVIAL(debug) << "RAM workspace is over budget, moving " << fileName << " to disk";
+	boost::system::error_code ec;
+	// usually these are different file systems, where rename fails, and fs::copy_file() fails
+	// for them with some kernels
+	fs::rename(fileName, target, ec);
+	if (!ec) {
+		return target;
+	}
+	if (!copyFile(fileName, target)) {
+		// the file in RAM is intact, it is just over budget
+		BOOST_LOG_TRIVIAL(warning) << "Could not move " << fileName << " to " << target << ", keeping it in RAM";
+		fs::remove(target, ec);
+		return fileName;
+	}
+	fs::remove(fileName, ec);
+	if (ec) {
+		BOOST_LOG_TRIVIAL(warning) << "Could not remove " << fileName << ": " << ec.message();
+	}
+	return target;
+}
+
+std::uint64_t cdownload::Workspace::memoryUsage() const
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return memoryUsageUnlocked();
+}
+
+std::uint64_t cdownload::Workspace::memoryUsageUnlocked() const
+{
+	namespace fs = boost::filesystem;
+	std::uint64_t res = 0;
+	if (memoryDir_.empty()) {
+		return res;
+	}
+	// files being written count with their expected sizes, unless they are larger already
+	for (const auto& r: reservations_) {
+		res += r.second;
+	}
+	// files may be removed concurrently by their owners
+	boost::system::error_code ec;
+	for (fs::directory_iterator it(memoryDir_, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+		const std::uintmax_t size = fs::file_size(it->path(), ec);
+		if (!ec) {
+			const auto r = reservations_.find(it->path());
+			res += r == reservations_.end() ? size : std::max<std::uint64_t>(size, r->second) - r->second;
+		}
+		ec.clear();
+	}
+	return res;
+}
+
+void cdownload::Workspace::removeDirectories()
+{
+	boost::system::error_code ec;
+	for (const path& dir: {memoryDir_, diskDir_}) {
+		if (!dir.empty()) {
+			boost::filesystem::remove_all(dir, ec);
+		}
+	}
+	memoryDir_.clear();
+	diskDir_.clear();
+	reservations_.clear();
+}
@@ -0,0 +1,104 @@
+/*
+ * cdownload lib: downloads, unpacks, and reads data from the Cluster CSA arhive
+ * Copyright (C) 2016  Eugene Shalygin <eugene.shalygin@gmail.com>
+ *
+ * The development was partially supported by the Volkswagen Foundation
+ * (VolkswagenStiftung).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef CDOWNLOAD_WORKSPACE_HXX
+#define CDOWNLOAD_WORKSPACE_HXX
+
+#include "commonDefinitions.hxx"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace cdownload {
+
+	/**
+	 * @brief Place for transient files: downloaded chunks, which are not kept in a cache
+	 *
+	 * Files are placed into a directory in RAM-backed file system (tmpfs, e.g. /dev/shm) while
+	 * the files there, together with the expected sizes of those being written, fit into the
+	 * memory budget, and into the work directory on disk otherwise. The CDF library opens files
+	 * by name, therefore these are tmpfs files rather than anonymous memory. The workspace
+	 * directories are removed together with their content when the workspace is reconfigured
+	 * and at exit.
+	 *
+	 * Until the workspace is configured, files are placed into the current directory.
+	 */
+	class Workspace {
+	public:
+		static Workspace& instance();
+
+		/**
+		 * @brief Creates unique subdirectories for the files
+		 *
+		 * @param workDir Directory on disk
+		 * @param memoryDir Directory in tmpfs, empty path or zero @p memoryBudget disable using RAM
+		 * @param memoryBudget Bytes
+		 */
+		void setDirectories(const path& workDir, const path& memoryDir, std::uint64_t memoryBudget);
+
+		const path& diskDirectory() const {
+			return diskDir_;
+		}
+
+		/**
+		 * @brief Places a file of about @p expectedSize bytes
+		 *
+		 * The file goes to RAM if it fits into the budget, and the room stays reserved there until
+		 * the file is settled or released.
+		 * @return Path of the file
+		 */
+		path reserve(const path& fileName, std::uint64_t expectedSize);
+
+		//! Cancels the reservation of a file, which was not written completely
+		void release(const path& fileName);
+
+		/**
+		 * @brief Ends the reservation of the complete file and moves it from RAM to disk, if files
+		 * in RAM exceed the budget
+		 *
+		 * A file may turn out larger than expected, thus the budget is checked again when the file
+		 * is complete. If the move fails, the file stays in RAM.
+		 * @return File name after the move
+		 */
+		path settle(const path& fileName);
+
+		//! Bytes occupied by the files in RAM and reserved for those being written
+		std::uint64_t memoryUsage() const;
+
+	private:
+		Workspace();
+		~Workspace();
+
+		void removeDirectories();
+		std::uint64_t memoryUsageUnlocked() const;
+
+		mutable std::mutex mutex_;
+		path diskDir_;
+		path memoryDir_;
+		std::uint64_t memoryBudget_;
+		std::map<path, std::uint64_t> reservations_; //!< expected sizes of the files in RAM being written
+	};
+}
+
+#endif // CDOWNLOAD_WORKSPACE_HXX
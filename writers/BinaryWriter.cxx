@@ -26,6 +26,7 @@
 #include "../field.hxx"
 
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <numeric>
 #include <type_traits>
@@ -50,6 +51,8 @@ extern const std::string NATIVE_REAL;
 }
 
 namespace {
+const std::size_t OUTPUT_STREAM_BUFFER_SIZE = 1 << 20;
+
 std::size_t fieldsStride(const std::vector<cdownload::Field>& fields, bool averagedFields)
 {
 	std::size_t stride = 0;
@@ -86,6 +89,16 @@ std::size_t fieldsStride(const std::vector<cdownload::Field>& fields, bool avera
 // 	return stride(averagedFields, writeEpochColumn, true) + fieldsStride(rawFields, false);
 // }
 
+//! size of the CellNo and MidTime columns, which start every row
+std::size_t rowPrefixSize(bool writeEpochColumn)
+{
+	std::size_t size = sizeof(std::size_t) + sizeof(decltype(cdownload::datetime().seconds()));
+	if (writeEpochColumn) {
+		size += sizeof(decltype(cdownload::timeduration().milliseconds()));
+	}
+	return size;
+}
+
 std::size_t stride(const cdownload::DirectBinaryWriter::Types::Fields& fields, bool writeEpochColumn, bool averagedFields)
 {
 	std::size_t stride = std::accumulate(fields.begin(), fields.end(), std::size_t(0),
@@ -135,16 +148,29 @@ cdownload::BinaryWriter::BinaryWriter(bool writeEpochColumn, std::size_t stride)
 
 cdownload::BinaryWriter::~BinaryWriter() = default;
 
+void cdownload::BinaryWriter::reopen(const char* mode)
+{
+	output_.reset(std::fopen(outputFileName_.c_str(), mode));
+	if (!output_) {
+		throw std::runtime_error("Can not open output file '" + outputFileName_.string() + '\'');
+	}
+	// rows are small, let them be collected into large writes
+	if (!streamBuffer_) {
+		streamBuffer_.reset(new char[OUTPUT_STREAM_BUFFER_SIZE]);
+	}
+	std::setvbuf(output_.get(), streamBuffer_.get(), _IOFBF, OUTPUT_STREAM_BUFFER_SIZE);
+}
+
 void cdownload::BinaryWriter::open(const path& fileName)
 {
-	output_.reset(std::fopen(fileName.c_str(), "a+"));
-	std::fseek(output_.get(), 0, SEEK_END);
 	outputFileName_ = fileName;
+	reopen("a+");
+	std::fseek(output_.get(), 0, SEEK_END);
 }
 
 void cdownload::BinaryWriter::truncate()
 {
-	output_.reset(std::fopen(outputFileName_.c_str(), "w+"));
+	reopen("w+");
 }
 
 bool cdownload::BinaryWriter::canAppend(std::size_t& lastWrittenCellNumber)
@@ -163,8 +189,19 @@ bool cdownload::BinaryWriter::canAppend(std::size_t& lastWrittenCellNumber)
 cdownload::DirectBinaryWriter::DirectBinaryWriter(const Types::Fields& fields, bool writeEpochColumn)
 	: Writer(writeEpochColumn)
 	, DirectDataWriter(fields, writeEpochColumn)
-	, BinaryWriter(writeEpochColumn, stride(fields, writeEpochColumn, false))
+	, BinaryWriter(writeEpochColumn, rowPrefixSize(writeEpochColumn) + stride(fields, false, false))
+	, rowLayout_{}
+	, row_{}
 {
+	std::size_t rowOffset = rowPrefixSize(writeEpochColumn);
+	for (std::size_t i = 0; i < fields.size(); ++i) {
+		for (const Field& f: fields[i]) {
+			const std::size_t size = f.dataSize() * f.elementCount();
+			rowLayout_.push_back({i, f.offset(), rowOffset, size});
+			rowOffset += size;
+		}
+	}
+	row_.resize(rowOffset);
 }
 
 void cdownload::AveragedDataBinaryWriter::write(std::size_t cellNumber, const datetime& dt,
@@ -253,6 +290,36 @@ namespace {
 	}
 }
 
+namespace {
+	const std::string& nativeTypeName(cdownload::FieldDesc::DataType dt)
+	{
+		using DataType = cdownload::FieldDesc::DataType;
+		switch (dt) {
+		case DataType::Real:
+			return datatypenaming::NATIVE_REAL;
+		case DataType::UnsignedInt:
+			return datatypenaming::NATIVE_UNSIGNED_INT;
+		case DataType::SignedInt:
+		case DataType::Char:
+			return datatypenaming::NATIVE_INT;
+		}
+		throw std::logic_error("Unexpected DataType value");
+	}
+
+	void printTypedFieldHeader(std::ostream& os, const cdownload::FieldDesc& f)
+	{
+		const std::string& typeName = nativeTypeName(f.dataType());
+		const std::size_t bits = f.dataSize() * CHAR_BIT;
+		if (f.elementCount() == 1) {
+			os << '\t' << f.name().name() << " <" << typeName << "[" << bits << "]>";
+		} else {
+			for (std::size_t elem = 0; elem < f.elementCount(); ++elem) {
+				os << '\t' << f.name().name() << "___" << elem + 1 << " <" << typeName << "[" << bits << "]>";
+			}
+		}
+	}
+}
+
 void cdownload::AveragedDataBinaryWriter::writeHeader()
 {
 	string headerFileName = outputFileName().string() + ".hdr";
@@ -300,7 +367,7 @@ void cdownload::DirectBinaryWriter::writeHeader()
 	}
 	for (const auto& fieldArray: fields()) {
 		for (const FieldDesc& f: fieldArray) {
-			printRawFieldHeader(headerFile, f.name().name(), f.elementCount());
+			printTypedFieldHeader(headerFile, f);
 		}
 	}
 	headerFile << std::endl;
@@ -327,23 +394,23 @@ cdownload::AveragedDataBinaryWriter::AveragedDataBinaryWriter(const AveragedType
 void cdownload::DirectBinaryWriter::write(std::size_t cellNumber, const datetime& dt, const Types::Data& lines)
 {
 	assert(lines.size() == fields().size());
-	std::fwrite(&cellNumber, sizeof(std::size_t), 1, outputStream());
 
-	const auto dtSeconds = dt.seconds();
+	char* row = row_.data();
+	std::memcpy(row, &cellNumber, sizeof(cellNumber));
+	row += sizeof(cellNumber);
 
-	std::fwrite(&dtSeconds, sizeof(dtSeconds), 1, outputStream());
+	const auto dtSeconds = dt.seconds();
+	std::memcpy(row, &dtSeconds, sizeof(dtSeconds));
+	row += sizeof(dtSeconds);
 
 	if (writeEpochColumn()) {
 		const auto epoch = dt.milliseconds();
-		std::fwrite(&epoch, sizeof(epoch), 1, outputStream());
+		std::memcpy(row, &epoch, sizeof(epoch));
 	}
 
-	for (std::size_t i = 0; i < lines.size(); ++i) {
-		const auto& fieldsArray = fields()[i];
-		const auto& line = lines[i];
-		for (const Field& f: fieldsArray) {
-			const double* data = f.data<double>(line);
-			std::fwrite(data, sizeof(double), f.elementCount(), outputStream());
-		}
+	for (const RowColumn& column: rowLayout_) {
+		std::memcpy(row_.data() + column.rowOffset, lines[column.fieldArray][column.lineOffset], column.size);
 	}
+
+	std::fwrite(row_.data(), row_.size(), 1, outputStream());
 }
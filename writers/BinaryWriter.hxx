@@ -26,6 +26,9 @@
 
 #include "../writer.hxx"
 
+#include <cstdio>
+#include <memory>
+
 namespace cdownload {
 
 
@@ -59,17 +62,36 @@ namespace cdownload {
 		struct FileClose {
 			void operator()(::FILE*) const;
 		};
+		void reopen(const char* mode);
+
+		std::unique_ptr<char[]> streamBuffer_; // has to outlive output_
 		std::unique_ptr<::FILE, FileClose> output_;
 		path outputFileName_;
 		std::size_t stride_;
 	};
 
+	/**
+	 * @brief Writes raw records, copying field values as they are stored in CDF files
+	 *
+	 * The row layout is computed once at construction, each record is assembled in a row buffer
+	 * and written with a single call.
+	 */
 	class DirectBinaryWriter: public DirectDataWriter, public BinaryWriter {
 	public:
 		DirectBinaryWriter(const Types::Fields& fields, bool writeEpochColumn);
 	private:
+		struct RowColumn {
+			std::size_t fieldArray; //!< index in the lines array
+			std::size_t lineOffset; //!< index in the line of the field array
+			std::size_t rowOffset;  //!< in bytes
+			std::size_t size;       //!< in bytes
+		};
+
 		void writeHeader() override;
 		void write(std::size_t cellNumber, const datetime& dt, const Types::Data& lines) override;
+
+		std::vector<RowColumn> rowLayout_;
+		std::vector<char> row_;
 	};
 
 	class AveragedDataBinaryWriter: public AveragedDataWriter, public BinaryWriter {